@@ -151,6 +151,8 @@
 /// -# SD_Stop: Stop the SDcard by sending Cmd12
 /// -# SD_ReadBlock : Read blocks of data
 /// -# SD_WriteBlock : Write blocks of data
+/// -# SD_ReadMultipleBlocks : Read a run of blocks with closed multiple block transfers
+/// -# SD_WriteMultipleBlocks : Write a run of blocks with closed, pre-erased multiple block transfers
 //------------------------------------------------------------------------------
 
 #ifndef SDCARD_H
@@ -173,6 +175,8 @@
 #define SD_BLOCK_SIZE           512
 /// SD card block size binary shift value
 #define SD_BLOCK_SIZE_BIT     9
+/// Max blocks per multiple block transfer (the PDC counter is 16 bit wide in words)
+#define SD_MULTIPLE_BLOCKS_MAX  127
 
 //------------------------------------------------------------------------------
 //         Macros
@@ -333,6 +337,18 @@ extern unsigned char SD_WriteBlock(
     unsigned short nbBlocks,
     const unsigned char *pData);
 
+extern unsigned char SD_ReadMultipleBlocks(
+    SdCard *pSd,
+    unsigned int address,
+    unsigned int nbBlocks,
+    unsigned char *pData);
+
+extern unsigned char SD_WriteMultipleBlocks(
+    SdCard *pSd,
+    unsigned int address,
+    unsigned int nbBlocks,
+    const unsigned char *pData);
+
 extern unsigned char SD_Stop(SdCard *pSd, SdDriver *pSdDriver);
 
 #endif //#ifndef SDCARD_H
@@ -238,7 +238,7 @@
 // ACMD22
 //#define AT91C_SDCARD_SEND_NUM_WR_BLOCKS_CMD     (22 | AT91C_MCI_SPCMD_NONE  | AT91C_MCI_RSPTYP_48   | AT91C_MCI_TRCMD_NO    | AT91C_MCI_MAXLAT)
 // ACMD23
-//#define AT91C_SDCARD_SET_WR_BLK_ERASE_COUNT_CMD (23 | AT91C_MCI_SPCMD_NONE  | AT91C_MCI_RSPTYP_48   | AT91C_MCI_TRCMD_NO    | AT91C_MCI_MAXLAT)
+#define   AT91C_SDCARD_SET_WR_BLK_ERASE_COUNT_CMD (23 | AT91C_MCI_SPCMD_NONE  | AT91C_MCI_RSPTYP_48   | AT91C_MCI_TRCMD_NO    | AT91C_MCI_MAXLAT)
 // ACMD41
 #define AT91C_SDCARD_APP_OP_COND_CMD            (41 | AT91C_MCI_SPCMD_NONE  | AT91C_MCI_RSPTYP_48   | AT91C_MCI_TRCMD_NO )
 // ACMD42
@@ -888,6 +888,40 @@ static unsigned char Acmd6(SdCard *pSd, unsigned char busWidth)
     return SendCommand(pSd);
 }
 
+//------------------------------------------------------------------------------
+/// Sets the number of write blocks to be pre-erased before writing, to speed
+/// up the following multiple block write (SD cards only, cleared by the card
+/// at the end of the write).
+/// Returns the command transfer result (see SendCommand).
+/// \param pSd  Pointer to a SD card driver instance.
+/// \param nbBlocks  Number of blocks of the following write.
+//------------------------------------------------------------------------------
+static unsigned char Acmd23(SdCard *pSd, unsigned int nbBlocks)
+{
+    SdCmd *pCommand = &(pSd->command);
+    unsigned char error;
+    unsigned int response;
+
+    SDMMC_TRACE_DEBUG("Acmd23()\n\r");
+    error = Cmd55(pSd);
+    if (error) {
+        return error;
+    }
+
+    memset(pCommand, 0, sizeof(SdCmd));
+    // Fill command information
+    pCommand->cmd = AT91C_SDCARD_SET_WR_BLK_ERASE_COUNT_CMD;
+    pCommand->arg = nbBlocks & 0x7FFFFF;
+    pCommand->resType = 1;
+    pCommand->pResp = &response;
+
+    // Set SD command state
+    pSd->state = SD_STATE_STBY;
+
+    // Send command
+    return SendCommand(pSd);
+}
+
 //------------------------------------------------------------------------------
 /// Asks to all cards to send their operations conditions.
 /// Returns the command transfer result (see SendCommand).
@@ -1081,6 +1115,43 @@ static unsigned char MoveToTransferState(SdCard *pSd,
     return error;
 }
 
+//------------------------------------------------------------------------------
+/// Ends a pending open ended transfer and waits for the card to be in transfer
+/// state and ready for data.
+/// Returns 0 if successful; otherwise returns an code describing the error.
+/// \param pSd  Pointer to a SD card driver instance.
+//------------------------------------------------------------------------------
+static unsigned char WaitTransferState(SdCard *pSd)
+{
+    unsigned int status;
+    unsigned char error;
+
+    if((pSd->state == SD_STATE_DATA)
+    || (pSd->state == SD_STATE_RCV)) {
+
+        error = Cmd12(pSd);
+        if (error) {
+            return error;
+        }
+    }
+
+    do {
+        error = Cmd13(pSd, &status);
+        if (error) {
+            return error;
+        }
+        if( ((status & STATUS_STATE) == STATUS_IDLE)
+          ||((status & STATUS_STATE) == STATUS_READY)
+          ||((status & STATUS_STATE) == STATUS_IDENT)) {
+            return SD_ERROR_NOT_INITIALIZED;
+        }
+    }
+    while (((status & STATUS_READY_FOR_DATA) == 0) ||
+          ((status & STATUS_STATE) != STATUS_TRAN));
+
+    return 0;
+}
+
 //------------------------------------------------------------------------------
 //         Global functions
 //------------------------------------------------------------------------------
@@ -1161,6 +1232,111 @@ unsigned char SD_WriteBlock(SdCard *pSd,
     return error;
 }
 
+//------------------------------------------------------------------------------
+/// Read a run of consecutive blocks with closed CMD18 transfers of up to
+/// SD_MULTIPLE_BLOCKS_MAX blocks, each ended by CMD12, so that the card is
+/// back in transfer state when the function returns and the next access does
+/// not depend on where this one ended.
+/// Returns 0 if successful; otherwise returns an code describing the error.
+/// \param pSd  Pointer to a SD card driver instance.
+/// \param address  Address of the first block to read.
+/// \param nbBlocks Number of blocks to be read.
+/// \param pData  Data buffer whose size is at least nbBlocks * SD_BLOCK_SIZE.
+//------------------------------------------------------------------------------
+unsigned char SD_ReadMultipleBlocks(SdCard *pSd,
+                                    unsigned int address,
+                                    unsigned int nbBlocks,
+                                    unsigned char *pData)
+{
+    unsigned char error;
+    unsigned short nb;
+
+    SANITY_CHECK(pSd);
+    SANITY_CHECK(pData);
+    SANITY_CHECK(nbBlocks);
+
+    while (nbBlocks) {
+        nb = (nbBlocks > SD_MULTIPLE_BLOCKS_MAX) ? SD_MULTIPLE_BLOCKS_MAX : nbBlocks;
+
+        error = WaitTransferState(pSd);
+        if (error) {
+            return error;
+        }
+        error = Cmd18(pSd, nb, pData, SD_ADDRESS(pSd,address));
+        if (error) {
+            Cmd12(pSd);
+            return error;
+        }
+        error = Cmd12(pSd);
+        if (error) {
+            return error;
+        }
+
+        address += nb;
+        pData += nb * SD_BLOCK_SIZE;
+        nbBlocks -= nb;
+    }
+    pSd->preBlock = address - 1;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Write a run of consecutive blocks with closed CMD25 transfers of up to
+/// SD_MULTIPLE_BLOCKS_MAX blocks. SD cards are told the length of each
+/// transfer beforehand with ACMD23, so that they can pre-erase the blocks, and
+/// each transfer is ended by CMD12 which waits until the card is done
+/// programming.
+/// Returns 0 if successful; otherwise returns an SD_ERROR code.
+/// \param pSd  Pointer to a SD card driver instance.
+/// \param address  Address of the first block to write.
+/// \param nbBlocks Number of blocks to be written.
+/// \param pData  Pointer to nbBlocks * SD_BLOCK_SIZE bytes to be transfered.
+//------------------------------------------------------------------------------
+unsigned char SD_WriteMultipleBlocks(SdCard *pSd,
+                                     unsigned int address,
+                                     unsigned int nbBlocks,
+                                     const unsigned char *pData)
+{
+    unsigned char error;
+    unsigned short nb;
+
+    SANITY_CHECK(pSd);
+    SANITY_CHECK(pData);
+    SANITY_CHECK(nbBlocks);
+
+    while (nbBlocks) {
+        nb = (nbBlocks > SD_MULTIPLE_BLOCKS_MAX) ? SD_MULTIPLE_BLOCKS_MAX : nbBlocks;
+
+        error = WaitTransferState(pSd);
+        if (error) {
+            return error;
+        }
+        if ((nb > 1)
+         && ((pSd->cardType == CARD_SD) || (pSd->cardType == CARD_SDHC))) {
+
+            error = Acmd23(pSd, nb);
+            if (error) {
+                return error;
+            }
+        }
+        error = Cmd25(pSd, nb, (unsigned char *)pData, SD_ADDRESS(pSd,address));
+        if (error) {
+            Cmd12(pSd);
+            return error;
+        }
+        error = Cmd12(pSd);
+        if (error) {
+            return error;
+        }
+
+        address += nb;
+        pData += nb * SD_BLOCK_SIZE;
+        nbBlocks -= nb;
+    }
+    pSd->preBlock = address - 1;
+    return 0;
+}
+
 //------------------------------------------------------------------------------
 /// Run the SDcard SD Mode initialization sequence. This function runs the
 /// initialisation procedure and the identification process, then it sets the
@@ -27,6 +27,12 @@
  * ----------------------------------------------------------------------------
  */
 
+//------------------------------------------------------------------------------
+/// The LabSat firmware links the prebuilt libAt91(D).a, which holds the vendor
+/// bit-by-bit version of this file. This one runs in hamming-bench on the
+/// development machine until the library is rebuilt and checked on the OBC.
+//------------------------------------------------------------------------------
+
 //------------------------------------------------------------------------------
 //         Headers
 //------------------------------------------------------------------------------
@@ -35,6 +41,22 @@
 #include "at91/utility/trace.h"
 #include "at91/utility/assert.h"
 
+//------------------------------------------------------------------------------
+//         Local constants
+//------------------------------------------------------------------------------
+
+/// Number of bits set to '1' in each 4-bit value.
+static const unsigned char bitsInNibble[16] = {
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+};
+
+/// Bits of each 4-bit value spread to the even bit positions (abcd -> 0a0b0c0d),
+/// to interleave the odd and even parity values of the code.
+static const unsigned char spreadNibble[16] = {
+    0x00, 0x01, 0x04, 0x05, 0x10, 0x11, 0x14, 0x15,
+    0x40, 0x41, 0x44, 0x45, 0x50, 0x51, 0x54, 0x55
+};
+
 //------------------------------------------------------------------------------
 //         Internal function
 //------------------------------------------------------------------------------
@@ -43,19 +65,23 @@
 /// Counts and return the number of bits set to '1' in the given byte.
 /// \param byte  Byte to count.
 //------------------------------------------------------------------------------
-static unsigned char CountBitsInByte(unsigned char byte)
+static inline unsigned char CountBitsInByte(unsigned char byte)
 {
-    unsigned char count = 0;
-    while (byte > 0) {
-
-        if (byte & 1) {
+    return bitsInNibble[byte & 0x0F] + bitsInNibble[byte >> 4];
+}
 
-            count++;
-        }
-        byte >>= 1;
-    }
+//------------------------------------------------------------------------------
+/// Returns 1 if an odd number of bits is set in the given word, 0 otherwise.
+/// \param value  Word to check.
+//------------------------------------------------------------------------------
+static inline unsigned int Parity(unsigned int value)
+{
+    value ^= value >> 16;
+    value ^= value >> 8;
+    value ^= value >> 4;
 
-    return count;
+    // 0x6996 holds the parity of each 4-bit value
+    return (0x6996 >> (value & 0x0F)) & 1;
 }
 
 //------------------------------------------------------------------------------
@@ -77,123 +103,126 @@ static unsigned char CountBitsInCode256(unsigned char *code)
 static void Compute256(const unsigned char *data, unsigned char *code)
 {
     unsigned int i;
-    unsigned char columnSum = 0;
-    unsigned char evenLineCode = 0;
+    unsigned char columnSum;
+    unsigned char evenLineCode;
     unsigned char oddLineCode = 0;
-    unsigned char evenColumnCode = 0;
-    unsigned char oddColumnCode = 0;
-
-    // Xor all bytes together to get the column sum;
-    // At the same time, calculate the even and odd line codes
-    for (i=0; i < 256; i++) {
-
-        columnSum ^= data[i];
-
-        // If the xor sum of the byte is 0, then this byte has no incidence on
-        // the computed code; so check if the sum is 1.
-        if ((CountBitsInByte(data[i]) & 1) == 1) {
-
-            // Parity groups are formed by forcing a particular index bit to 0
-            // (even) or 1 (odd).
-            // Example on one byte:
-            // 
-            // bits (dec)  7   6   5   4   3   2   1   0    
-            //      (bin) 111 110 101 100 011 010 001 000    
-            //                            '---'---'---'----------.
-            //                                                   |
-            // groups P4' ooooooooooooooo eeeeeeeeeeeeeee P4     |
-            //        P2' ooooooo eeeeeee ooooooo eeeeeee P2     |
-            //        P1' ooo eee ooo eee ooo eee ooo eee P1     |
-            //                                                   |
-            // We can see that:                                  |
-            //  - P4  -> bit 2 of index is 0 --------------------'
-            //  - P4' -> bit 2 of index is 1.
-            //  - P2  -> bit 1 of index if 0.
-            //  - etc...
-            // We deduce that a bit position has an impact on all even Px if
-            // the log2(x)nth bit of its index is 0
-            //     ex: log2(4) = 2, bit2 of the index must be 0 (-> 0 1 2 3)
-            // and on all odd Px' if the log2(x)nth bit of its index is 1
-            //     ex: log2(2) = 1, bit1 of the index must be 1 (-> 0 1 4 5)
-            // 
-            // As such, we calculate all the possible Px and Px' values at the
-            // same time in two variables, evenLineCode and oddLineCode, such as
-            //     evenLineCode bits: P128  P64  P32  P16  P8  P4  P2  P1
-            //     oddLineCode  bits: P128' P64' P32' P16' P8' P4' P2' P1'
-            // 
-            evenLineCode ^= (255 - i);
-            oddLineCode ^= i;
+    unsigned char evenColumnCode;
+    unsigned char oddColumnCode;
+    unsigned char invert;
+
+    // Parity groups are formed by forcing a particular index bit to 0
+    // (even) or 1 (odd).
+    // Example on one byte:
+    //
+    // bits (dec)  7   6   5   4   3   2   1   0
+    //      (bin) 111 110 101 100 011 010 001 000
+    //                            '---'---'---'----------.
+    //                                                   |
+    // groups P4' ooooooooooooooo eeeeeeeeeeeeeee P4     |
+    //        P2' ooooooo eeeeeee ooooooo eeeeeee P2     |
+    //        P1' ooo eee ooo eee ooo eee ooo eee P1     |
+    //                                                   |
+    // We can see that:                                  |
+    //  - P4  -> bit 2 of index is 0 --------------------'
+    //  - P4' -> bit 2 of index is 1.
+    //  - P2  -> bit 1 of index if 0.
+    //  - etc...
+    // The same groups are formed on the byte indexes of the block for the
+    // line codes, and on the bit indexes of the column sum (xor of all bytes)
+    // for the column codes:
+    //     evenLineCode bits: P128  P64  P32  P16  P8  P4  P2  P1
+    //     oddLineCode  bits: P128' P64' P32' P16' P8' P4' P2' P1'
+    //
+    // Bit x of oddLineCode is the parity of all bytes whose index has bit x
+    // set, so it is computed on whole words: the xor of those words has the
+    // same parity. Every bit is in either Px or Px', so the even codes are the
+    // odd codes inverted when the whole block has an odd number of bits set.
+    if (((unsigned int) data & 0x3) == 0) {
+
+        const unsigned int *pWord = (const unsigned int *) data;
+        unsigned int w0, w1, w2, w3, group;
+        unsigned int total = 0;
+        unsigned int sum1 = 0, sum2 = 0, sum4 = 0, sum8 = 0, sum16 = 0, sum32 = 0;
+        const unsigned char *pTotal = (const unsigned char *) &total;
+
+        // 16 groups of 4 words, sumN is the xor of the words whose index
+        // (0..63) has the bit of value N set
+        for (i=0; i < 16; i++) {
+
+            w0 = pWord[0];
+            w1 = pWord[1];
+            w2 = pWord[2];
+            w3 = pWord[3];
+            pWord += 4;
+
+            sum1 ^= w1 ^ w3;
+            sum2 ^= w2 ^ w3;
+            group = w0 ^ w1 ^ w2 ^ w3;
+            total ^= group;
+            if (i & 1) {
+
+                sum4 ^= group;
+            }
+            if (i & 2) {
+
+                sum8 ^= group;
+            }
+            if (i & 4) {
+
+                sum16 ^= group;
+            }
+            if (i & 8) {
+
+                sum32 ^= group;
+            }
         }
+
+        // Byte index = word index * 4 + byte position in the word, whose two
+        // bits come from the bytes of the total as they are in memory
+        columnSum = pTotal[0] ^ pTotal[1] ^ pTotal[2] ^ pTotal[3];
+        oddLineCode = Parity(pTotal[1] ^ pTotal[3])
+                      | (Parity(pTotal[2] ^ pTotal[3]) << 1)
+                      | (Parity(sum1) << 2)
+                      | (Parity(sum2) << 3)
+                      | (Parity(sum4) << 4)
+                      | (Parity(sum8) << 5)
+                      | (Parity(sum16) << 6)
+                      | (Parity(sum32) << 7);
     }
+    // Unaligned data: one byte at a time
+    else {
 
-    // At this point, we have the line parities, and the column sum. First, We
-    // must caculate the parity group values on the column sum.
-    for (i=0; i < 8; i++) {
+        columnSum = 0;
+        for (i=0; i < 256; i++) {
 
-        if (columnSum & 1) {
+            columnSum ^= data[i];
+            if (Parity(data[i])) {
 
-            evenColumnCode ^= (7 - i);
-            oddColumnCode ^= i;
+                oddLineCode ^= i;
+            }
         }
-        columnSum >>= 1;
     }
 
+    oddColumnCode = Parity(columnSum & 0xAA)
+                    | (Parity(columnSum & 0xCC) << 1)
+                    | (Parity(columnSum & 0xF0) << 2);
+    invert = Parity(columnSum) ? 0xFF : 0;
+    evenLineCode = oddLineCode ^ invert;
+    evenColumnCode = oddColumnCode ^ (invert & 0x07);
+
     // Now, we must interleave the parity values, to obtain the following layout:
     // Code[0] = Line1
     // Code[1] = Line2
     // Code[2] = Column
     // Line = Px' Px P(x-1)- P(x-1) ...
-    // Column = P4' P4 P2' P2 P1' P1 PadBit PadBit 
-    code[0] = 0;
-    code[1] = 0;
-    code[2] = 0;
-
-    for (i=0; i < 4; i++) {
-
-        code[0] <<= 2;
-        code[1] <<= 2;
-        code[2] <<= 2;
-
-        // Line 1
-        if ((oddLineCode & 0x80) != 0) {
-
-            code[0] |= 2;
-        }
-        if ((evenLineCode & 0x80) != 0) {
-
-            code[0] |= 1;
-        }
-
-        // Line 2
-        if ((oddLineCode & 0x08) != 0) {
-
-            code[1] |= 2;
-        }
-        if ((evenLineCode & 0x08) != 0) {
-
-            code[1] |= 1;
-        }
-
-        // Column
-        if ((oddColumnCode & 0x04) != 0) {
-
-            code[2] |= 2;
-        }
-        if ((evenColumnCode & 0x04) != 0) {
-
-            code[2] |= 1;
-        }
-
-        oddLineCode <<= 1;
-        evenLineCode <<= 1;
-        oddColumnCode <<= 1;
-        evenColumnCode <<= 1;
-    }
-
-    // Invert codes (linux compatibility)
-    code[0] = ~code[0];
-    code[1] = ~code[1];
-    code[2] = ~code[2];
+    // Column = P4' P4 P2' P2 P1' P1 PadBit PadBit
+    // and invert codes (linux compatibility)
+    code[0] = ~((spreadNibble[oddLineCode >> 4] << 1)
+                | spreadNibble[evenLineCode >> 4]);
+    code[1] = ~((spreadNibble[oddLineCode & 0x0F] << 1)
+                | spreadNibble[evenLineCode & 0x0F]);
+    code[2] = ~(((spreadNibble[oddColumnCode] << 1)
+                 | spreadNibble[evenColumnCode]) << 2);
 
     TRACE_DEBUG("Computed code = %02X %02X %02X\n\r",
               code[0], code[1], code[2]);
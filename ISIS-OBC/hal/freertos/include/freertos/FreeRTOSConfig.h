@@ -110,6 +110,14 @@
 #define configTIMER_QUEUE_LENGTH		10
 #define configTIMER_TASK_STACK_DEPTH	4096
 
+/* Run time stats: per task CPU time, counted by TC3 (RunTimeStats.c in the
+application provides the counter). */
+#define configGENERATE_RUN_TIME_STATS	1
+extern void vConfigureTimerForRunTimeStats( void );
+extern unsigned long ulGetRunTimeCounterValue( void );
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()	vConfigureTimerForRunTimeStats()
+#define portGET_RUN_TIME_COUNTER_VALUE()			ulGetRunTimeCounterValue()
+
 /* Co-routine definitions. */
 #define configUSE_CO_ROUTINES 		0
 #define configMAX_CO_ROUTINE_PRIORITIES ( 2 )
@@ -139,4 +147,20 @@ to exclude the API function. */
 #define INCLUDE_eTaskGetState               1
 #define INCLUDE_xTaskGetSchedulerState		1
 
+/* Run slice monitor of the cooperative scheduler: defines traceTASK_SWITCHED_OUT
+(SliceMonitor.h in the application include directory). Off by default: set to 1 to
+build the kernel with the hook (a few us on every task switch). */
+#define configUSE_SLICE_MONITOR			0
+#if ( configUSE_SLICE_MONITOR == 1 )
+	#include "SliceMonitor.h"
+#endif
+
+/* Kernel event trace recorder: defines the trace macros (TraceRecorder.h in the
+application include directory). Off by default: set to 1 to build the kernel with
+them and the recorder with its RAM ring. */
+#define configUSE_TRACE_RECORDER		0
+#if ( configUSE_TRACE_RECORDER == 1 )
+	#include "TraceRecorder.h"
+#endif
+
 #endif /* FREERTOS_CONFIG_H */
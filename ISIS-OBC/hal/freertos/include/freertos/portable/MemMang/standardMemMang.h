@@ -8,9 +8,71 @@
 #ifndef STANDARDMEMMANG_H_
 #define STANDARDMEMMANG_H_
 
+/*
+ * pvPortMalloc serves requests up to heapMAX_CLASS_SIZE bytes (with its 8 byte
+ * header) from segregated size classes: 16, 24, 32, 48, 64 ... 1536, 2048. Each
+ * class has a free list and takes new blocks from a chunk of heap it carves, so
+ * allocating and freeing are O(1); freed blocks are only reused by their class.
+ * Bigger requests (task stacks, queue storage) go to newlib malloc.
+ *
+ * What a class carved is never given back to newlib or the heap end, even when
+ * all its blocks are free. So the classes carve heapCLASS_MAX_BYTES at most in
+ * all: past that (or at the heap end) small requests go to newlib malloc too,
+ * counted in ulClassOverflows.
+ */
+#define heapNUM_CLASSES			15
+#define heapMAX_CLASS_SIZE		2048
+#define heapCHUNK_SIZE			4096	/* carved from the heap at a time by a class */
+#define heapCLASS_MAX_BYTES		( 64 * heapCHUNK_SIZE )
+
+/* Blocks and bytes in use per task (the task that allocated them). */
+#ifndef configHEAP_TASK_STATS
+	#define configHEAP_TASK_STATS	1
+#endif
+#define heapTASK_SLOTS			32		/* same count as RTS_MAX_TASKS of the application */
+
+typedef struct
+{
+	size_t xBlockSize;					/* including the header */
+	unsigned long ulBlocks;				/* carved so far */
+	unsigned long ulInUse, ulMaxInUse;
+	unsigned long ulAllocs;
+} xHeapClassStatsType;
+
+typedef struct
+{
+	void *xTask;						/* xTaskHandle, NULL for the allocations before the scheduler started */
+	unsigned long ulBlocks, ulBytes;	/* in use (block sizes) */
+} xHeapTaskStatsType;
+
+typedef struct
+{
+	xHeapClassStatsType xClass[ heapNUM_CLASSES ];
+	unsigned long ulLargeInUse, ulLargeAllocs;
+	size_t xLargeBytes;					/* in use by large blocks */
+	size_t xRequestedBytes;				/* in use as asked, the rest of the block sizes is internal fragmentation */
+	size_t xClassBytes;					/* carved for the classes */
+	size_t xClassFreeBytes;				/* in the class free lists */
+	size_t xUncarvedBytes;				/* left in the chunks of the classes */
+	size_t xHeapRemaining;				/* never given to newlib or a class */
+	size_t xNewlibFreeBytes;			/* in the newlib free lists */
+	size_t xMinimumEverFree;			/* low-water mark of the free bytes but xNewlibFreeBytes */
+	size_t xLargestFreeBlock;
+	unsigned long ulFailures, ulBadFrees;
+	unsigned long ulClassOverflows;		/* small requests served by newlib */
+	#if ( configHEAP_TASK_STATS == 1 )
+		xHeapTaskStatsType xTask[ heapTASK_SLOTS ];
+	#endif
+} xHeapStatsType;
+
 void *pvPortMalloc( size_t xSize );
 void vPortFree( void *pv );
 void vPortInitialiseBlocks( void );
 size_t xPortGetFreeHeapSize( void );
 
+/* Largest request that can be served now without failing. */
+size_t xPortGetLargestFreeBlockSize( void );
+size_t xPortGetMinimumEverFreeHeapSize( void );
+void vPortGetHeapStats( xHeapStatsType *pxStats );
+
 #endif /* STANDARDMEMMANG_H_ */
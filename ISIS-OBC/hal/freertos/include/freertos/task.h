@@ -150,6 +150,7 @@ typedef struct xTASK_STATUS
 	unsigned portBASE_TYPE uxBasePriority;		/* The priority to which the task will return if the task's current priority has been inherited to avoid unbounded priority inversion when obtaining a mutex.  Only valid if configUSE_MUTEXES is defined as 1 in FreeRTOSConfig.h. */
 	unsigned long ulRunTimeCounter;				/* The total run time allocated to the task so far, as defined by the run time stats clock.  See http://www.freertos.org/rtos-run-time-stats.html.  Only valid when configGENERATE_RUN_TIME_STATS is defined as 1 in FreeRTOSConfig.h. */
 	unsigned short usStackHighWaterMark;		/* The minimum amount of stack space that has remained for the task since the task was created.  The closer this value is to zero the closer the task has come to overflowing its stack. */
+	unsigned short usStackDepth;				/* The stack size the task was created with, in words like usStackHighWaterMark. */
 } xTaskStatusType;
 
 /* Possible return values for eTaskConfirmSleepModeStatus(). */
@@ -1511,6 +1512,17 @@ void vTaskStepTick( portTickType xTicksToJump );
  */
 eSleepModeStatus eTaskConfirmSleepModeStatus( void );
 
+/*
+ * Provided for use within vApplicationIdleHook() to decide whether the idle
+ * task can put the processor to sleep until the next interrupt.  Returns pdTRUE
+ * if no task other than the idle task is ready to run.
+ *
+ * Must be called with interrupts disabled, and the sleep entered before they
+ * are enabled again, so a task readied by an interrupt is not left waiting
+ * for the next one.
+ */
+portBASE_TYPE xTaskIdleCanSleep( void );
+
 #ifdef __cplusplus
 }
 #endif
@@ -9,44 +9,439 @@
 #include "freertos/task.h"
 #include <errno.h>
 
+#include <malloc.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+/* Heap bounds from the linker script (a host build of this file defines its own). */
+#ifndef heapSTART
+	extern char _sheap_, _eheap_;
+	#define heapSTART	( &_sheap_ )
+	#define heapEND		( &_eheap_ )
+#endif
+
+#define heapHEADER_SIZE		8
+#define heapLARGE			0xFF	/* ucClass of the blocks from newlib malloc */
+#define heapMAGIC_USED		0xA5
+#define heapMAGIC_FREE		0x5A
+#define heapNO_TASK			0xFF
+
+/* In front of every block returned by pvPortMalloc. */
+typedef struct
+{
+	unsigned char ucMagic;
+	unsigned char ucClass;
+	unsigned char ucTask;			/* slot of the allocating task */
+	unsigned char ucPad;
+	unsigned int uxRequested;
+} xBlockHeader;
+
+typedef struct xFREE_BLOCK
+{
+	xBlockHeader xHeader;
+	struct xFREE_BLOCK *pxNext;
+} xFreeBlock;
+
+typedef struct
+{
+	xFreeBlock *pxFree;
+	char *pcNext, *pcEnd;			/* uncarved part of the current chunk */
+	unsigned long ulBlocks, ulInUse, ulMaxInUse, ulAllocs;
+} xSizeClass;
+
+static const size_t xClassSize[ heapNUM_CLASSES ] = { 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048 };
+static xSizeClass xClasses[ heapNUM_CLASSES ];
+
 //Used for heap size estimate
 static int heapBytesRemaining=0;
+static char *cur_heap_pos = 0;
+
+static unsigned long ulLargeInUse = 0, ulLargeAllocs = 0, ulFailures = 0, ulBadFrees = 0, ulClassOverflows = 0;
+static size_t xLargeBytes = 0, xRequestedBytes = 0, xClassBytes = 0;
+static size_t xClassFreeBytes = 0, xUncarvedBytes = 0, xMinimumEverFreeBytes = ( size_t ) -1;
+#if ( configHEAP_TASK_STATS == 1 )
+	static xHeapTaskStatsType xTaskSlots[ heapTASK_SLOTS ];
+#endif
+
+/* Class of a block of xBytes (header included, 17..heapMAX_CLASS_SIZE): classes
+go 2^b, 3*2^(b-1), 2^(b+1), so the two bits under the highest one of xBytes-1
+give it. */
+static inline unsigned int prvClassIndex( size_t xBytes )
+{
+	unsigned int y = ( unsigned int ) xBytes - 1;
+	unsigned int b = 31 - __builtin_clz( y );
+	return ( ( y >> ( b - 1 ) ) & 1 ) ? 2 * ( b - 3 ) : 2 * ( b - 3 ) - 1;
+}
+
+/* The sbrk of the heap between _sheap_ and _eheap_ (scheduler suspended). */
+static void *prvHeapExtend( ptrdiff_t increment )
+{
+	void *old_heap_pos;
+
+	if(cur_heap_pos == 0) {
+		cur_heap_pos = heapSTART;
+		heapBytesRemaining = (int)(heapEND - heapSTART);
+	}
+
+	if((cur_heap_pos + increment) > heapEND) {
+		return (void *) -1;
+	}
+
+	old_heap_pos = cur_heap_pos;
+	cur_heap_pos += increment;
+	heapBytesRemaining -= increment;
+	return old_heap_pos;
+}
+
+/* Next new block of a class: from its chunk, or a new chunk from the heap (the
+rest of the old chunk stays unused). NULL when the classes have carved
+heapCLASS_MAX_BYTES or the heap end is used up. Scheduler suspended. */
+static xBlockHeader *prvCarve( xSizeClass *pxClass, size_t xBlockSize )
+{
+	char *pcChunk;
+	size_t xPad, xChunk = heapCHUNK_SIZE;
+
+	if( pxClass->pcNext + xBlockSize > pxClass->pcEnd )
+	{
+		if( xClassBytes + xChunk > heapCLASS_MAX_BYTES )
+		{
+			return NULL;
+		}
+		/* newlib moves the heap by any amount: align the chunk to 8 */
+		prvHeapExtend( 0 );
+		xPad = ( 0 - ( size_t ) cur_heap_pos ) & ( portBYTE_ALIGNMENT - 1 );
+		pcChunk = prvHeapExtend( xPad + xChunk );
+		if( pcChunk == ( void * ) -1 )
+		{
+			/* near the end of the heap, one block at a time */
+			xChunk = xBlockSize;
+			pcChunk = prvHeapExtend( xPad + xChunk );
+			if( pcChunk == ( void * ) -1 )
+			{
+				return NULL;
+			}
+		}
+		xUncarvedBytes -= pxClass->pcEnd - pxClass->pcNext;
+		xUncarvedBytes += xChunk;
+		pxClass->pcNext = pcChunk + xPad;
+		pxClass->pcEnd = pxClass->pcNext + xChunk;
+		xClassBytes += xChunk;
+	}
+
+	pcChunk = pxClass->pcNext;
+	pxClass->pcNext += xBlockSize;
+	xUncarvedBytes -= xBlockSize;
+	pxClass->ulBlocks++;
+	return ( xBlockHeader * ) pcChunk;
+}
+
+#if ( configHEAP_TASK_STATS == 1 )
+/* Slot of a task: its own, or a free one. Scheduler suspended. */
+static unsigned char prvTaskSlot( void *xTask )
+{
+	unsigned int i, uxFree = heapNO_TASK;
+
+	for( i = 0; i < heapTASK_SLOTS; i++ )
+	{
+		if( xTaskSlots[ i ].xTask == xTask )
+		{
+			return i;
+		}
+		if( xTaskSlots[ i ].ulBlocks == 0 && uxFree == heapNO_TASK )
+		{
+			uxFree = i;
+		}
+	}
+	if( uxFree != heapNO_TASK )
+	{
+		xTaskSlots[ uxFree ].xTask = xTask;
+	}
+	return uxFree;
+}
+#endif
+
+/* Low-water mark of the free bytes but those in the newlib free lists (scheduler
+suspended). */
+static inline void prvUpdateMinimum( void )
+{
+	size_t xFree = heapBytesRemaining + xClassFreeBytes + xUncarvedBytes;
+
+	if( xFree < xMinimumEverFreeBytes )
+	{
+		xMinimumEverFreeBytes = xFree;
+	}
+}
+
+/* Scheduler suspended */
+static void prvAccount( xBlockHeader *pxHeader, unsigned int uxClass, size_t xSize, size_t xBlockSize, void *xTask )
+{
+	pxHeader->ucMagic = heapMAGIC_USED;
+	pxHeader->ucClass = uxClass;
+	pxHeader->ucTask = heapNO_TASK;
+	pxHeader->uxRequested = xSize;
+	xRequestedBytes += xSize;
+
+	if( uxClass == heapLARGE )
+	{
+		ulLargeInUse++;
+		ulLargeAllocs++;
+		xLargeBytes += xBlockSize;
+	}
+	else
+	{
+		xSizeClass *pxClass = &xClasses[ uxClass ];
+		pxClass->ulAllocs++;
+		if( ++pxClass->ulInUse > pxClass->ulMaxInUse )
+		{
+			pxClass->ulMaxInUse = pxClass->ulInUse;
+		}
+	}
+
+	#if ( configHEAP_TASK_STATS == 1 )
+	{
+		pxHeader->ucTask = prvTaskSlot( xTask );
+		if( pxHeader->ucTask != heapNO_TASK )
+		{
+			xTaskSlots[ pxHeader->ucTask ].ulBlocks++;
+			xTaskSlots[ pxHeader->ucTask ].ulBytes += xBlockSize;
+		}
+	}
+	#else
+		( void ) xTask;
+	#endif
+}
 
 void *pvPortMalloc( size_t xSize ) {
-	return malloc(xSize);
+	xBlockHeader *pxHeader = NULL;
+	xSizeClass *pxClass;
+	size_t xBytes = xSize + heapHEADER_SIZE;
+	unsigned int uxClass;
+	void *xTask = NULL;
+
+	#if ( configHEAP_TASK_STATS == 1 )
+		if( xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED )
+		{
+			xTask = xTaskGetCurrentTaskHandle();
+		}
+	#endif
+
+	if( xSize <= heapMAX_CLASS_SIZE - heapHEADER_SIZE )
+	{
+		uxClass = xBytes <= xClassSize[ 0 ] ? 0 : prvClassIndex( xBytes );
+		pxClass = &xClasses[ uxClass ];
+		vTaskSuspendAll();
+		{
+			if( pxClass->pxFree != NULL )
+			{
+				pxHeader = &pxClass->pxFree->xHeader;
+				pxClass->pxFree = pxClass->pxFree->pxNext;
+				xClassFreeBytes -= xClassSize[ uxClass ];
+			}
+			else
+			{
+				pxHeader = prvCarve( pxClass, xClassSize[ uxClass ] );
+			}
+			if( pxHeader != NULL )
+			{
+				prvAccount( pxHeader, uxClass, xSize, xClassSize[ uxClass ], xTask );
+				prvUpdateMinimum();
+			}
+			else
+			{
+				ulClassOverflows++;
+			}
+		}
+		xTaskResumeAll();
+	}
+
+	if( pxHeader == NULL && xBytes > xSize )
+	{
+		/* large, or no class block left: newlib takes its lock, and calls the
+		hook if the heap is exhausted */
+		pxHeader = malloc( xBytes );
+		vTaskSuspendAll();
+		{
+			if( pxHeader != NULL )
+			{
+				prvAccount( pxHeader, heapLARGE, xSize, xBytes, xTask );
+				prvUpdateMinimum();
+			}
+			else
+			{
+				ulFailures++;
+			}
+		}
+		xTaskResumeAll();
+	}
+
+	return pxHeader != NULL ? ( char * ) pxHeader + heapHEADER_SIZE : NULL;
 }
 
 void vPortFree( void *pv ) {
-	free(pv);
+	xBlockHeader *pxHeader;
+	xSizeClass *pxClass;
+	size_t xBlockSize;
+	portBASE_TYPE xLarge;
+
+	if( pv == NULL )
+	{
+		return;
+	}
+	pxHeader = ( xBlockHeader * ) ( ( char * ) pv - heapHEADER_SIZE );
+
+	vTaskSuspendAll();
+	{
+		/* not from pvPortMalloc, or freed already */
+		if( pxHeader->ucMagic != heapMAGIC_USED || ( pxHeader->ucClass >= heapNUM_CLASSES && pxHeader->ucClass != heapLARGE ) )
+		{
+			ulBadFrees++;
+			xTaskResumeAll();
+			return;
+		}
+		pxHeader->ucMagic = heapMAGIC_FREE;
+		xRequestedBytes -= pxHeader->uxRequested;
+
+		xLarge = pxHeader->ucClass == heapLARGE;
+		if( xLarge )
+		{
+			xBlockSize = pxHeader->uxRequested + heapHEADER_SIZE;
+			ulLargeInUse--;
+			xLargeBytes -= xBlockSize;
+		}
+		else
+		{
+			pxClass = &xClasses[ pxHeader->ucClass ];
+			xBlockSize = xClassSize[ pxHeader->ucClass ];
+			pxClass->ulInUse--;
+			xClassFreeBytes += xBlockSize;
+			( ( xFreeBlock * ) pxHeader )->pxNext = pxClass->pxFree;
+			pxClass->pxFree = ( xFreeBlock * ) pxHeader;
+		}
+
+		#if ( configHEAP_TASK_STATS == 1 )
+			if( pxHeader->ucTask < heapTASK_SLOTS )
+			{
+				xTaskSlots[ pxHeader->ucTask ].ulBlocks--;
+				xTaskSlots[ pxHeader->ucTask ].ulBytes -= xBlockSize;
+			}
+		#endif
+	}
+	xTaskResumeAll();
+
+	if( xLarge )
+	{
+		free( pxHeader );
+	}
 }
 
 void vPortInitialiseBlocks( void ) {
 
 }
 
+/* Largest block a class can give without taking a new chunk (scheduler suspended). */
+static size_t prvLargestClassBlock( void )
+{
+	unsigned int i;
+	size_t xLargest = 0;
+
+	for( i = 0; i < heapNUM_CLASSES; i++ )
+	{
+		if( xClasses[ i ].pxFree != NULL || xClasses[ i ].pcNext + xClassSize[ i ] <= xClasses[ i ].pcEnd )
+		{
+			xLargest = xClassSize[ i ] - heapHEADER_SIZE;
+		}
+	}
+	return xLargest;
+}
+
 size_t xPortGetFreeHeapSize( void ) {
-	//This gives a rough estimate of how much heap space is used
-	return heapBytesRemaining;
+	size_t xFree;
+	struct mallinfo xInfo = mallinfo();
+
+	vTaskSuspendAll();
+	{
+		xFree = heapBytesRemaining + xClassFreeBytes + xUncarvedBytes;
+	}
+	xTaskResumeAll();
+	return xFree + xInfo.fordblks;
 }
 
-void *_sbrk(ptrdiff_t increment) {
+size_t xPortGetMinimumEverFreeHeapSize( void ) {
+	size_t xMinimum;
 
-	extern char _sheap_, _eheap_;
-	static void *cur_heap_pos = 0;
+	vTaskSuspendAll();
+	{
+		prvUpdateMinimum();
+		xMinimum = xMinimumEverFreeBytes;
+	}
+	xTaskResumeAll();
+	return xMinimum;
+}
+
+size_t xPortGetLargestFreeBlockSize( void ) {
+	size_t xLargest;
 
-	//Making it reentrant in case someone has crazy thoughts and actually calls
-	// this function despite malloc being readily available
 	vTaskSuspendAll();
+	{
+		xLargest = prvLargestClassBlock();
+		/* a new chunk, or newlib growing its heap (alignment and its header) */
+		if( heapBytesRemaining > 2 * heapHEADER_SIZE + portBYTE_ALIGNMENT + ( int ) xLargest )
+		{
+			xLargest = heapBytesRemaining - 2 * heapHEADER_SIZE - portBYTE_ALIGNMENT;
+		}
+	}
+	xTaskResumeAll();
+	return xLargest;
+}
 
-	if(cur_heap_pos == 0) {
-		cur_heap_pos = &_sheap_;
-		heapBytesRemaining = (int)&_eheap_ - (int)&_sheap_;
+void vPortGetHeapStats( xHeapStatsType *pxStats ) {
+	unsigned int i;
+	struct mallinfo xInfo = mallinfo();
+
+	vTaskSuspendAll();
+	{
+		for( i = 0; i < heapNUM_CLASSES; i++ )
+		{
+			pxStats->xClass[ i ].xBlockSize = xClassSize[ i ];
+			pxStats->xClass[ i ].ulBlocks = xClasses[ i ].ulBlocks;
+			pxStats->xClass[ i ].ulInUse = xClasses[ i ].ulInUse;
+			pxStats->xClass[ i ].ulMaxInUse = xClasses[ i ].ulMaxInUse;
+			pxStats->xClass[ i ].ulAllocs = xClasses[ i ].ulAllocs;
+		}
+		pxStats->ulLargeInUse = ulLargeInUse;
+		pxStats->ulLargeAllocs = ulLargeAllocs;
+		pxStats->xLargeBytes = xLargeBytes;
+		pxStats->xRequestedBytes = xRequestedBytes;
+		pxStats->xClassBytes = xClassBytes;
+		pxStats->xClassFreeBytes = xClassFreeBytes;
+		pxStats->xUncarvedBytes = xUncarvedBytes;
+		pxStats->xHeapRemaining = heapBytesRemaining;
+		prvUpdateMinimum();
+		pxStats->xMinimumEverFree = xMinimumEverFreeBytes;
+		pxStats->ulFailures = ulFailures;
+		pxStats->ulBadFrees = ulBadFrees;
+		pxStats->ulClassOverflows = ulClassOverflows;
+		#if ( configHEAP_TASK_STATS == 1 )
+			for( i = 0; i < heapTASK_SLOTS; i++ )
+			{
+				pxStats->xTask[ i ] = xTaskSlots[ i ];
+			}
+		#endif
 	}
+	xTaskResumeAll();
+	pxStats->xNewlibFreeBytes = xInfo.fordblks;
+	pxStats->xLargestFreeBlock = xPortGetLargestFreeBlockSize();
+}
+
+void *_sbrk(ptrdiff_t increment) {
+	void *old_heap_pos;
+
+	//Making it reentrant in case someone has crazy thoughts and actually calls
+	// this function despite malloc being readily available
+	vTaskSuspendAll();
 
-	if((cur_heap_pos + increment) > (void *) &_eheap_) {
+	old_heap_pos = prvHeapExtend(increment);
+	if(old_heap_pos == (void *) -1) {
 #if( configUSE_MALLOC_FAILED_HOOK == 1 )
 		extern void vApplicationMallocFailedHook( void );
 		vApplicationMallocFailedHook();
@@ -55,16 +450,13 @@ void *_sbrk(ptrdiff_t increment) {
 		write(1, "\n\r _sbrk: Out of heap-space! \n\r", 32);
 		errno = ENOMEM;
 #endif
-		xTaskResumeAll();
-		return (void *) -1;
+	} else {
+		prvUpdateMinimum();
 	}
 
 	//We could do stack collision detection here,
 	// except that FreeRTOS use heap for that...
 
-	void * old_heap_pos = cur_heap_pos;
-	cur_heap_pos += increment;
-	heapBytesRemaining -= increment;
 	xTaskResumeAll();
 	return old_heap_pos;
 }
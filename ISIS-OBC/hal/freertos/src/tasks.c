@@ -134,6 +134,7 @@ typedef struct tskTaskControlBlock
 	#if ( configUSE_TRACE_FACILITY == 1 )
 		unsigned portBASE_TYPE	uxTCBNumber;	/*< Stores a number that increments each time a TCB is created.  It allows debuggers to determine when a task has been deleted and then recreated. */
 		unsigned portBASE_TYPE  uxTaskNumber;	/*< Stores a number specifically for use by third party trace code. */
+		unsigned short			usStackDepth;	/*< The stack size given to xTaskGenericCreate(), reported by uxTaskGetSystemState(). */
 	#endif
 
 	#if ( configUSE_MUTEXES == 1 )
@@ -2256,6 +2257,39 @@ static portTASK_FUNCTION( prvIdleTask, pvParameters )
 #endif /* configUSE_TICKLESS_IDLE */
 /*-----------------------------------------------------------*/
 
+#if ( configUSE_IDLE_HOOK == 1 )
+
+	portBASE_TYPE xTaskIdleCanSleep( void )
+	{
+	unsigned portBASE_TYPE uxPriority;
+
+		if( ( listCURRENT_LIST_LENGTH( &xPendingReadyList ) != 0 ) || ( xYieldPending != pdFALSE ) )
+		{
+			return pdFALSE;
+		}
+
+		/* uxTopReadyPriority can be above the highest ready priority until the
+		next task selection lowers it, so look at the lists themselves. */
+		for( uxPriority = uxTopReadyPriority; uxPriority > tskIDLE_PRIORITY; --uxPriority )
+		{
+			if( listLIST_IS_EMPTY( &( pxReadyTasksLists[ uxPriority ] ) ) == pdFALSE )
+			{
+				return pdFALSE;
+			}
+		}
+
+		/* The idle task itself is in the idle priority list. */
+		if( listCURRENT_LIST_LENGTH( &( pxReadyTasksLists[ tskIDLE_PRIORITY ] ) ) > ( unsigned portBASE_TYPE ) 1 )
+		{
+			return pdFALSE;
+		}
+
+		return pdTRUE;
+	}
+
+#endif /* configUSE_IDLE_HOOK */
+/*-----------------------------------------------------------*/
+
 static void prvInitialiseTCBVariables( tskTCB *pxTCB, const signed char * const pcName, unsigned portBASE_TYPE uxPriority, const xMemoryRegion * const xRegions, unsigned short usStackDepth )
 {
 unsigned portBASE_TYPE x;
@@ -2321,6 +2355,12 @@ unsigned portBASE_TYPE x;
 	}
 	#endif /* configGENERATE_RUN_TIME_STATS */
 
+	#if ( configUSE_TRACE_FACILITY == 1 )
+	{
+		pxTCB->usStackDepth = usStackDepth;
+	}
+	#endif /* configUSE_TRACE_FACILITY */
+
 	#if ( portUSING_MPU_WRAPPERS == 1 )
 	{
 		vPortStoreTaskMPUSettings( &( pxTCB->xMPUSettings ), xRegions, pxTCB->pxStack, usStackDepth );
@@ -2536,6 +2576,8 @@ tskTCB *pxNewTCB;
 				}
 				#endif
 
+				pxTaskStatusArray[ uxTask ].usStackDepth = pxNextTCB->usStackDepth;
+
 				uxTask++;
 
 			} while( pxNextTCB != pxFirstTCB );
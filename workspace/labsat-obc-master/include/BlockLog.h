@@ -0,0 +1,85 @@
+// Block log for high rate telemetry.
+//
+// Like the mission-support Log (Log.h) each added entry gets a time stamp and an entryNumber,
+// but entries are packed in blocks of BLOCKLOG_BLOCK_SIZE (one SD sector) and only whole
+// blocks go to the log file, so there is one SD write per block instead of per entry.
+// Inside a block the time is stored as the difference to the previous entry (a 1 byte varint
+// for samples less than a minute apart) and entryNumbers are not stored at all: the entries
+// of a block are consecutive, so only the first entryNumber is in the block header.
+//
+// The open block is kept in FRAM: every add writes the encoded entry and then a small commit
+// record (two alternating slots), so after a reset the log goes on with the open block. A full
+// block is written to the file and synced to the card (SDManagerSync) before the next one takes
+// its place in FRAM. Entries are never lost, at most the last one if the reset comes in the
+// middle of its add (or a block the card did not take, which is logged).
+//
+// blocklog-bench.c cuts the power at every FRAM and file write of a run on the development
+// machine and checks that every added entry can be read after the restart.
+//
+// A second file (log file path + ".idx") has the first entryNumber and time of each block, so
+// reading an entry is a binary search on the index and one block read.
+//
+// The calling tasks must be registered to the file system (f_enterFS).
+
+#ifndef BLOCKLOG_H
+#define BLOCKLOG_H
+
+#include <hal/boolean.h>
+#include <hcc/api_fat.h>
+
+#define BLOCKLOG_MAX_LOGS 8
+#define BLOCKLOG_BLOCK_SIZE 512 // one SD sector
+#define BLOCKLOG_HDR_SIZE 16 // block header: magic(2) crc16(2) count(2) used(2) firstEntry(4) firstTime(4)
+#define BLOCKLOG_MAX_DATA (BLOCKLOG_BLOCK_SIZE-BLOCKLOG_HDR_SIZE-5) // entry data size
+#define BLOCKLOG_SLOT_SIZE 20 // FRAM commit record
+#define BLOCKLOG_FRAM_SIZE (BLOCKLOG_BLOCK_SIZE+2*BLOCKLOG_SLOT_SIZE) // FRAM used by each log
+
+// Error codes
+#define BL_ERR_FS -1 // file system error
+#define BL_ERR_FRAM -2 // FRAM driver error
+#define BL_ERR_MALLOC -3
+#define BL_ERR_INVALID -4 // invalid parameters or logid
+#define BL_ERR_MAXLOGS -5
+#define BL_ERR_NOTFOUND -6 // entry not in the log (or its block is damaged)
+
+typedef struct {
+	unsigned int entryDataSize; // bytes of data of each entry, 1..BLOCKLOG_MAX_DATA
+	char logFilePath[F_MAXPATHNAME-4]; // the index file is this path + ".idx"
+	unsigned int FRAMbaseAddress; // BLOCKLOG_FRAM_SIZE bytes for the open block
+} BlockLogInit;
+
+typedef struct {
+	unsigned int time; // unix epoch
+	unsigned int entryNumber;
+	unsigned char data[]; // entryDataSize bytes
+} BlockLogEntry;
+
+typedef struct {
+	unsigned int nextEntryNumber;
+	unsigned int blocksInFile; // full blocks written, the open one is the next
+	unsigned int entriesInBlock, bytesInBlock; // of the open block
+	unsigned int adds, blocksWritten, bytesWritten; // file bytes, blocks and index
+	unsigned int blockReads, fileErrors, framErrors;
+} BlockLogStats;
+
+// Start a log. With firstInit the file, its index and the FRAM block are started empty,
+// otherwise the log goes on from the open block in FRAM (or from the file if the FRAM block
+// is not valid). Returns 0 or a BL_ERR code.
+int BlockLog_start(BlockLogInit* init, Boolean firstInit, int* logid);
+
+// Write the open block to the file (rewritten later as it fills) and close the log
+int BlockLog_stop(int logid);
+
+// Add an entry (entryDataSize bytes of data). Returns 0 or a BL_ERR code.
+int BlockLog_add(int logid, const void* data);
+
+// Write the open block to the file as it is now (it will be rewritten when it fills)
+int BlockLog_flush(int logid);
+
+// Read an entry. The last block read is cached, so reading consecutive entries costs one
+// block read per block. entry must have room for entryDataSize data bytes.
+int BlockLog_readOnce(int logid, unsigned int entryNumber, BlockLogEntry* entry);
+
+int BlockLog_getStats(int logid, BlockLogStats* st);
+
+#endif
@@ -22,6 +22,8 @@
 #define CSP_STACK_DEPTH  configMINIMAL_STACK_SIZE   /* check if 1024 is ok */
 #define CSP_RX_RINGBUF_COUNT 2 /* number of buffers in RX ring buffer */
 #define CSP_BUF_SIZE 288 /* libcsp supports 256 UART pkts (see libcsp/doc/mtu.md) */
+#define CSP_KISS_TX_POOL 6 /* escaped frames queued to the uart at the same time */
+#define CSP_KISS_TX_SIZE (CSP_BUF_SIZE*2+12) /* UARTtransferStatus and the escaped frame with its 3 KISS bytes */
 
 int CSPManagerInit(const char* ifname);
 void CSPShowStatus();
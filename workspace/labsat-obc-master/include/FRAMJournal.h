@@ -0,0 +1,81 @@
+// Journaled key-value store in FRAM, for small state that changes often (stack high-water
+// marks, ...).
+//
+// Values live in RAM (FRAMJournalGet does not touch the FRAM). Each FRAMJournalPut appends
+// one record (header, value and CRC16) to the active bank of the journal with a single
+// sequential FRAM_write, without read back: a torn or corrupted record is detected by its CRC
+// when the journal is replayed.
+// The journal region is split in two banks. When the active one fills up (or goes over
+// FRAMJOURNAL_COMPACT_PCT when FRAMJournalCompact runs in the background) the live values are
+// written to the other bank and then its header, with a higher generation, commits the switch.
+// At boot FRAMJournalInit replays the bank with the highest valid generation up to the first
+// bad record, so replay time is bounded by the bank size.
+//
+// The mission-support modules (ParamsDB, PersistentList, Log) place themselves in FRAM through
+// the FRAMRegistry: FRAMJournalInit registers the journal region there as well, and fails with
+// FJ_ERR_OVERLAP if any of it is already taken. The layout of the region itself is checked at
+// compile time below.
+
+#ifndef FRAMJOURNAL_H
+#define FRAMJOURNAL_H
+
+#define FRAMJOURNAL_FRAM_SIZE 0x40000 // FRAM of the OBC (FRAM_getMaxAddress()+1, checked again at FRAMJournalInit)
+#define FRAMJOURNAL_ADDR 0x30000 // journal region in FRAM, registered in the FRAMRegistry
+#define FRAMJOURNAL_SIZE 0x8000 // two banks of half this size
+#define FRAMJOURNAL_MAX_KEYS 64
+#define FRAMJOURNAL_MAX_VALUE 64 // bytes
+#define FRAMJOURNAL_COMPACT_PCT 75 // background compaction when the active bank is this full
+#define FRAMJOURNAL_COMPACT_INTERVAL 5 // secs between FRAMJournalCompact calls from the TimerManager
+#define FRAMJOURNAL_REG_ID 0x464A // FRAMRegistry id of the journal region
+
+// Region layout (the banks are checked against the record format in FRAMJournal.c)
+#if FRAMJOURNAL_ADDR+FRAMJOURNAL_SIZE>FRAMJOURNAL_FRAM_SIZE
+	#error "FRAMJOURNAL_ADDR/FRAMJOURNAL_SIZE: the journal region ends past the FRAM"
+#endif
+#if FRAMJOURNAL_SIZE%4
+	#error "FRAMJOURNAL_SIZE: two banks of whole words"
+#endif
+
+// Keys in use (unsigned short, 0xFFFF is not valid)
+#define FJ_KEY_STACK_MONITOR 0x0400 // StackMonitor, one key per slot up to +SM_MAX_TASKS
+
+// Error codes
+#define FJ_ERR_FRAM -1 // FRAM driver error
+#define FJ_ERR_SIZE -2 // value too long (FRAMJOURNAL_MAX_VALUE) or key not valid
+#define FJ_ERR_FULL -3 // no room for more keys, or the live values do not fit in a bank
+#define FJ_ERR_NOTFOUND -4
+#define FJ_ERR_NOTINIT -5
+#define FJ_ERR_OVERLAP -6 // the journal region is registered by another FRAM user
+
+typedef struct {
+	unsigned int generation; // of the active bank
+	unsigned int keys, liveBytes; // live values and the bytes their records take
+	unsigned int used, bankSize; // bytes used in the active bank
+	unsigned int puts, unchanged; // puts, and puts skipped because the value did not change
+	unsigned int deletes;
+	unsigned int bytesWritten, compactions, errors;
+	unsigned int replayRecords, replayMs; // at the last FRAMJournalInit
+	char replayTorn; // replay stopped at a damaged record (not at erased/old space)
+} FRAMJournalStats;
+
+// Start the FRAM driver, register the journal region in the FRAMRegistry, and replay the
+// journal (or create it if there is none). Returns 0 or an FJ_ERR code.
+int FRAMJournalInit();
+
+// Store a value (len 0..FRAMJOURNAL_MAX_VALUE). Returns 0 or an FJ_ERR code.
+int FRAMJournalPut(unsigned short key, const void* value, unsigned int len);
+
+// Copy up to maxLen bytes of a value. Returns the length of the value or an FJ_ERR code.
+int FRAMJournalGet(unsigned short key, void* value, unsigned int maxLen);
+
+// Remove a value. Returns 0 or an FJ_ERR code (FJ_ERR_NOTFOUND if there was none).
+int FRAMJournalDelete(unsigned short key);
+
+// Compact the active bank if it is over FRAMJOURNAL_COMPACT_PCT. Has the TimerManager callback
+// signature to be scheduled every FRAMJOURNAL_COMPACT_INTERVAL (returns 0).
+int FRAMJournalCompact(unsigned int when, void* privData);
+
+void FRAMJournalGetStats(FRAMJournalStats* st);
+void FRAMJournalShowStatus();
+
+#endif
@@ -0,0 +1,94 @@
+// S-band downlink: streams a file or a telemetry source to the ISIS HSTXS over its SPI data
+// interface, one CCSDS frame (6 byte header + HSTXS_FRAME_DATA bytes) per sendframe.
+//
+// The streaming task keeps two frame buffers. It fills one from the source while the other is
+// sent with isis_hstxs_spi__sendframe(...,FALSE): the SPI driver transfers it by DMA while the
+// task goes on reading the source, and the buffer is filled again only after the driver went idle.
+// A frame is sent only when the TX ready pin says the transmitter has room for it. When it has
+// none the task sleeps until the pin interrupt, so a full transmitter does not block the
+// sendframe of the caller (or the task) for the time of a frame on air.
+//
+// The transmitter sends idle frames (virtual channel 0) when it has nothing else: the idle frames
+// it sent while a stream was running are its underruns, read over I2C by the streaming task before
+// the first frame, every HSTXS_UNDERRUNS_MS and at the end (one more at most: the slot on air
+// during the first SPI transfer).
+// Sustained bytes/s counts the source bytes sent, from the first frame to the last.
+//
+// hstxs-bench.c runs this file on the development machine against a simulated HSTXS SPI slave
+// with a finite TX FIFO and drain rate.
+
+#ifndef HSTXSMANAGER_H
+#define HSTXSMANAGER_H
+
+#include <freertos/FreeRTOS.h>
+#include "ObcGlobals.h"
+
+// The wiring below is not confirmed on the board (the pin, chip select and addresses are taken
+// from the HSTXS and OBC manuals, not from the harness): HstxsManagerInit returns -1 until
+// HSTXS_ENABLED is set.
+#define HSTXS_ENABLED 0
+#define HSTXS_INDEX 0 // I2C driver index
+#define HSTXS_MSS_ADDR 0x45
+#define HSTXS_SUP_ADDR 0x46
+#define HSTXS_SPI_SLAVE slave3_spi // SPI bus 1, chip select on GPIO00
+#define HSTXS_TXREADY_PIN {1 << 21, AT91C_BASE_PIOB, AT91C_ID_PIOB, PIO_INPUT, PIO_PULLUP} // GPIO05
+#define HSTXS_FRAME_DATA 217 // source bytes per frame; the last frame of a stream is zero padded
+#define HSTXS_VC 1 // virtual channel of the stream (0 is the idle frames of the transmitter)
+#define HSTXS_PRIO (tskIDLE_PRIORITY+1) // background: below the SPI driver task, see HstxsManager.c
+#define HSTXS_STACK_SIZE basic_STACK_DEPTH
+#define HSTXS_SPI_SPIN_US 500 // a frame takes ~0.2ms on the SPI bus: yield until it ends rather than sleep a tick
+#define HSTXS_READY_TIMEOUT_TICKS pdMS_TO_TICKS(100) // check the TX ready pin without an interrupt
+#define HSTXS_ERROR_BACKOFF_MS 10 // after a failed sendframe, doubled on each failure in a row
+#define HSTXS_ERROR_BACKOFF_MAX_MS 1000
+#define HSTXS_UNDERRUNS_MS 1000 // idle frame counter reads while streaming
+#define HSTXS_PATH_MAX 64
+
+// Source of the stream: put up to max bytes in data and return how many, 0 at the end,
+// <0 on error. Called from the streaming task, once more with data 0 when the stream ends
+// (or is stopped) to release what it holds.
+typedef int (*HstxsSource)(unsigned char* data, unsigned int max, void* privData);
+
+typedef enum {
+	HSTXS_WAIT_NONE, // run again
+	HSTXS_WAIT_READY, // a frame is waiting for the TX ready pin
+	HSTXS_WAIT_SPI, // both buffers are in use until the SPI transfer ends
+	HSTXS_WAIT_ERROR, // sendframe failed: wait HstxsErrorBackoffMs before sending the frame again
+	HSTXS_WAIT_START // no stream
+} HstxsWait;
+
+typedef struct {
+	char active;
+	unsigned int frames, bytes; // sent, bytes from the source
+	unsigned int ms; // from the first frame sent to the last
+	unsigned int bytesPerSec; // sustained
+	unsigned int maxGapMs; // longest time between two frames sent
+	unsigned int underruns; // idle frames sent by the transmitter during the stream
+	unsigned int readyWaits; // a full frame had to wait for the TX ready pin
+	unsigned int spiWaits; // both buffers were in use
+	unsigned int sendErrors, sourceErrors, i2cErrors;
+	unsigned int streams; // ended since HstxsManagerInit
+} HstxsManagerReport;
+
+// Start the SPI bus 1, the HSTXS drivers and the streaming task. -1 without HSTXS_ENABLED.
+int HstxsManagerInit();
+
+// Stream from a source. -1 if a stream is running. The transmitter has to be on (set_tx_mode).
+int HstxsManagerStart(HstxsSource source, void* privData);
+
+// Stream a file from the SD card
+int HstxsManagerSendFile(const char* path);
+
+// End the stream after the frame being sent
+void HstxsManagerStop();
+
+// One pass of the streaming task (the benchmark calls it directly)
+HstxsWait HstxsPump();
+
+// Wait after HSTXS_WAIT_ERROR
+unsigned int HstxsErrorBackoffMs();
+
+int HstxsManagerGet(HstxsManagerReport* rep);
+
+void HstxsManagerShowStatus();
+
+#endif
@@ -0,0 +1,49 @@
+// Processor sleep in the idle task, and how much of the time the OBC spends asleep.
+//
+// vApplicationIdleHook (replacing the empty one of hooks.c) runs every time the idle task gets
+// the CPU back. With interrupts disabled it asks the kernel whether any other task is ready
+// (xTaskIdleCanSleep); if none is, it disables the processor clock in the PMC. The ARM926 stops
+// until an interrupt is asserted (the tick at the latest, 1ms), the PMC restarts the clock, and
+// the interrupt is taken when the hook enables interrupts again.
+//
+// The time asleep is measured with the run time counter (RunTimeStats.h, ~1us), which keeps
+// counting with the processor clock stopped. IdleSleepSample runs from the TimerManager every
+// IDLE_SAMPLE_INTERVAL secs and takes the residency (per mille of the time asleep) and the
+// wakeups per second over that interval.
+//
+// A JTAG debugger loses the core while its clock is stopped: DEBUG builds start with the sleep
+// disabled (IdleSleepEnable).
+
+#ifndef IDLESLEEP_H
+#define IDLESLEEP_H
+
+#define IDLE_SAMPLE_INTERVAL 1 // secs between IdleSleepSample calls from the TimerManager
+#ifdef DEBUG
+	#define IDLE_SLEEP_DEFAULT 0
+#else
+	#define IDLE_SLEEP_DEFAULT 1
+#endif
+
+typedef struct {
+	char enabled;
+	unsigned int samples;
+	unsigned short residency, minResidency, maxResidency; // per mille asleep: last sample, min and max
+	unsigned int wakeups, maxWakeups; // per second: last sample and max
+	unsigned long long sleepUs; // total asleep since IdleSleepInit
+	unsigned int sleeps; // total
+	unsigned int busy; // idle hook calls that found a task ready
+} IdleSleepReport;
+
+int IdleSleepInit();
+
+// TimerManager callback
+int IdleSleepSample(unsigned int when, void* privData);
+
+// Turn the sleep on (1) or off (0); the statistics keep counting
+void IdleSleepEnable(char on);
+
+int IdleSleepGet(IdleSleepReport* rep);
+
+void IdleSleepShowStatus();
+
+#endif
@@ -24,14 +24,15 @@ typedef void* xTaskHandle; // same as in freertos/task.h
 #define MAXLOGLINE 192
 
 // Queue logs and return at once? or wait till written to file?
-// (if log queue is full UPLOG calls will still block until there is space in queue)
+// (if all the LOG_MAXQUEUE lines are queued UPLOG calls will still block until one is written)
 #define LOG_NONBLOCKING 1
 // Nonblocking logs require the following definitions
 // LOG Task definitions (only for non-blocking logs)
 #define LOG_STACK_SIZE basic_STACK_DEPTH	// check if 4096 is enough
 #define LOG_PRIORITY (configMAX_PRIORITIES-3)
-#define LOGQUEUE_WAIT_TICKS (10*configTICK_RATE_HZ) // ticks
-#define LOG_MAXQUEUE 32
+#define LOGQUEUE_WAIT_TICKS (10*configTICK_RATE_HZ) // ticks between log rotation retries
+#define LOG_MAXQUEUE 32 // log lines in the pool and the channel to the log task (MsgChannel.h)
+#define LOG_BATCH 8 // log lines written per wakeup of the log task
 
 
 // Enable logging to file in SD card
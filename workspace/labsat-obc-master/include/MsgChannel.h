@@ -0,0 +1,86 @@
+// Message passing between tasks by pointer: pools of fixed size message buffers, and channels
+// (FreeRTOS queues of pointers) that move a buffer from the sending task to the receiving one.
+//
+// A message is taken from its pool with MsgAlloc, filled, and given away with MsgSend: from then
+// on it belongs to the receiver, which calls MsgFree when done with it (any task, or an
+// interrupt with MsgFreeFromISR). Only the pointer is copied. If MsgSend fails the sender still
+// owns the message.
+// MsgReceive takes up to max messages per wakeup: it waits for the first one and takes the ones
+// already queued behind it.
+// A channel created with an urgent depth has a second queue for urgent messages: MsgReceive
+// returns them before the others, in the order they were sent. An urgent send also puts a token
+// in the normal queue to wake the receiver; tokens are skipped.
+// Each channel counts the messages sent to it and not freed yet (queued or held by the receiver).
+// A null message can be sent as a signal (e.g. to stop the receiver); it is not counted.
+//
+// MsgFree finds the pool of a message from its address, so a pointer that is not from a pool,
+// or a message freed twice, is detected, counted and ignored.
+
+#ifndef MSGCHANNEL_H
+#define MSGCHANNEL_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#define MSG_MAX_POOLS 8
+#define MSG_MAX_CHANNELS 8
+#define MSG_MAX_BATCH 16 // max of MsgReceive
+
+typedef struct _MsgChannel MsgChannel;
+
+typedef struct {
+	const char* name;
+	unsigned char* base; // count buffers of size bytes
+	unsigned int size, count;
+	xQueueHandle freeQ; // free buffers
+	MsgChannel** owner; // of each buffer: channel it was last sent to, 0 if not sent
+	unsigned char* state; // of each buffer
+	char ownStorage;
+	unsigned int inUse, maxInUse, allocs, exhausted, badFrees; // exhausted: MsgAlloc timed out
+} MsgPool;
+
+struct _MsgChannel {
+	const char* name;
+	xQueueHandle q, urgentQ; // urgentQ: 0 without urgent depth
+	unsigned int depth, urgentDepth;
+	unsigned int tokens; // urgent wakeups queued in q
+	unsigned int sent, received, full; // full: MsgSend timed out
+	unsigned int inFlight, maxInFlight; // sent and not freed yet
+	unsigned int batches, maxBatch; // MsgReceive calls that got messages, and the most in one
+};
+
+// Create a pool of count buffers of size bytes. storage holds count*size bytes (aligned for the
+// messages), or is 0 to take it from the heap. Returns 0 if out of memory or MSG_MAX_POOLS.
+MsgPool* MsgPoolCreate(const char* name, unsigned int count, unsigned int size, void* storage);
+
+// Returns a buffer, or 0 if none was freed within wait ticks
+void* MsgAlloc(MsgPool* pool, portTickType wait);
+
+void MsgFree(void* msg);
+void MsgFreeFromISR(void* msg, portBASE_TYPE* higherPriorityTaskWoken);
+
+// Create a channel that holds up to depth messages, and up to urgentDepth urgent ones (0: no
+// urgent messages); it is added to the queue registry under name. Returns 0 if out of memory or
+// MSG_MAX_CHANNELS.
+MsgChannel* MsgChannelCreate(const char* name, unsigned int depth, unsigned int urgentDepth);
+
+// Delete an empty channel (free what MsgReceive still returns first)
+void MsgChannelDelete(MsgChannel* ch);
+
+// Give msg to the receiver of ch. An urgent msg goes after the urgent ones queued and ahead of
+// the others. Returns 0, or -1 if the channel stayed full for wait ticks or has no urgent queue
+// (the caller keeps msg).
+int MsgSend(MsgChannel* ch, void* msg, char urgent, portTickType wait);
+int MsgSendFromISR(MsgChannel* ch, void* msg, portBASE_TYPE* higherPriorityTaskWoken);
+
+// Wait up to wait ticks for a message, and take up to max (MSG_MAX_BATCH at most) into msgs,
+// the urgent ones first. Returns the number of messages taken.
+unsigned int MsgReceive(MsgChannel* ch, void** msgs, unsigned int max, portTickType wait);
+
+// Messages queued in ch
+unsigned int MsgWaiting(MsgChannel* ch);
+
+// Log the counters of every pool and channel
+void MsgShowStatus();
+
+#endif
@@ -0,0 +1,88 @@
+// Log-structured record store in the NOR flash sectors reserved by hal/Storage/NORflash.h.
+//
+// NOR flash can only be written from erased (1) to 0 and is erased a whole 8KB sector at a
+// time, so rewriting mode or parameters in place costs a sector erase (~0.5 s, and erase
+// cycles are limited). Here records are appended into erased space instead:
+//
+// - Values (mode, parameters): MODE_STORAGE_SECTOR and PARAMETER_STORAGE_SECTOR form one store.
+//   Each NORStorePut appends a record (key, length, CRC16, data) to the active sector; the
+//   newest record of a key is its value. When the active sector is full the live values are
+//   copied to the other sector (erased first), whose header then commits the switch. So a
+//   sector is erased every ~8KB of updates, not every update.
+// - Error log: ERROR_LOG_FIRST_SECTOR and ERROR_LOG_SECOND_SECTOR are a ring of two sectors.
+//   When the active one is full the other (the oldest entries) is erased and used next.
+//
+// Each sector header has a sequence number and the erase count of the sector (wear).
+// NORStoreInit scans the active sectors once to rebuild the key index and find where the
+// free space starts. Records and headers are programmed with their magic last, so one torn by
+// a reset has no magic and is ignored (a 16 bit CRC alone lets one torn write in 65536 through),
+// and the rest of that sector is not used (the next write moves to the other sector).
+//
+// Sectors are only taken for the store when they are erased. Sectors holding anything else
+// (no valid header, as on a board whose NOR was written before) are left alone: the mode and
+// parameter store or the error log then return NS_ERR_NOSTORE until the ground sends
+// NORStoreFormat. Nothing in this tree wrote these sectors before, so there is no older layout
+// to migrate from.
+//
+// norstore-bench.c runs this file on the development machine against a simulated flash with
+// power losses, and reports the erases and the time taken by each update.
+
+#ifndef NORSTORE_H
+#define NORSTORE_H
+
+#define NORSTORE_MAX_KEYS 32
+#define NORSTORE_MAX_VALUE 128 // bytes (all keys at this size still fit in a sector)
+#define NORSTORE_MAX_LOG 64 // bytes of data of an error log entry
+#define NORSTORE_FORMAT_CONFIRM 0x464D5453 // "STMF": argument of NORStoreFormat
+
+// Keys (unsigned short, 0xFFFF is not valid)
+#define NS_KEY_MODE 0x0001 // satellite mode
+#define NS_KEY_PARAM_BASE 0x1000 // parameters from here on
+
+// Error codes
+#define NS_ERR_FLASH -1 // erase or program failed (or did not verify)
+#define NS_ERR_SIZE -2 // value too long, key or argument not valid
+#define NS_ERR_FULL -3 // no room for more keys, or the live values do not fit in a sector
+#define NS_ERR_NOTFOUND -4
+#define NS_ERR_NOTINIT -5
+#define NS_ERR_NOSTORE -6 // the sectors hold other data: NORStoreFormat
+
+typedef struct {
+	unsigned int keys, liveBytes; // values and the bytes their records take
+	unsigned int kvUsed, logUsed, sectorSize; // bytes used in the active sectors
+	unsigned int kvSeq, logSeq; // sequence number of the active sectors
+	unsigned int erases[4]; // erase count of the mode, parameter and error log sectors
+	unsigned int puts, unchanged, logAdds;
+	unsigned int bytesWritten, sectorSwitches, errors;
+	unsigned int scanMs; // at NORStoreInit
+} NORStoreStats;
+
+// Start the NOR flash driver and scan the store (starting one in erased sectors). Returns 0 or
+// an NS_ERR code: NS_ERR_NOSTORE if some sectors hold other data (the rest is usable).
+int NORStoreInit();
+
+// Erase the mode, parameter and error log sectors and start an empty store in them. Whatever
+// they held is lost: ground command only, confirm must be NORSTORE_FORMAT_CONFIRM.
+// Returns 0 or an NS_ERR code.
+int NORStoreFormat(unsigned int confirm);
+
+// Store a value (len 1..NORSTORE_MAX_VALUE). Does not write if the value did not change.
+// Returns 0 or an NS_ERR code.
+int NORStorePut(unsigned short key, const void* value, unsigned int len);
+
+// Copy up to maxLen bytes of a value. Returns the length of the value or an NS_ERR code.
+int NORStoreGet(unsigned short key, void* value, unsigned int maxLen);
+
+// Add an entry to the error log (time stamped). Returns 0 or an NS_ERR code.
+int NORStoreLogAdd(unsigned short code, const void* data, unsigned int len);
+
+// Call cb for every error log entry, oldest first, until it returns nonzero (cb runs with the
+// store locked, it must not call NORStore functions).
+// Returns the number of entries passed to cb.
+typedef int (*NORStoreLogCallback)(unsigned short code, unsigned int time, const void* data, unsigned int len, void* priv);
+int NORStoreLogRead(NORStoreLogCallback cb, void* priv);
+
+void NORStoreGetStats(NORStoreStats* st);
+void NORStoreShowStatus();
+
+#endif
@@ -5,6 +5,8 @@
 
 #define basic_STACK_DEPTH (configMINIMAL_STACK_SIZE*4) // the miminum is 1024
 #define basic_TASK_PRIORITY (configMAX_PRIORITIES-3) // (configMAX_PRIORITIES is 5 so the maximum would be 4)
+#define I2C_BUS_SPEED 200000 // Hz, EPS and TRXVU
+#define I2C_TRANSFER_TIMEOUT 10 // 1/10 ticks per byte
 
 #ifndef pdMS_TO_TICKS
  #define pdMS_TO_TICKS(xTimeInMs) ( ( ((portTickType)xTimeInMs) * ((portTickType)configTICK_RATE_HZ) ) / ((portTickType)1000) )
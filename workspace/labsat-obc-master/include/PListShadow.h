@@ -0,0 +1,40 @@
+// RAM shadow of mission-support persistent lists (PersistentList.h).
+//
+// PersistentList keeps its nodes linked in FRAM, so getting the node at position N follows N
+// links over SPI. A shadowed list also keeps the data of every node in a RAM array in list
+// order, loaded with one iterator pass at PListShadowStart and kept up to date by the
+// PListShadow functions that change the list. Reads by position (and so iterating by
+// position) cost no FRAM access. Changes still go to FRAM through PersistentList first.
+//
+// Use the PListShadow functions for every change of a shadowed list. The listid is the
+// PersistentList one, so PersistentList functions that only read can still be used.
+
+#ifndef PLISTSHADOW_H
+#define PLISTSHADOW_H
+
+#include <hal/boolean.h>
+#include <mission-support/PersistentList.h>
+
+#define E_PLIST_SHADOW_NONE -200 // the list is not shadowed
+
+// Start a persistent list (see PersistentListStart) and load its shadow. max_iterators is
+// raised to 1 if needed (the load uses an iterator). Returns 0 or a negative error code (the
+// list is then stopped and not shadowed).
+int PListShadowStart(unsigned int FRAMbaseaddress, unsigned int item_size, unsigned int max_no_items,
+							unsigned int max_iterators, Boolean force_empty, int* listid);
+
+// Drop the shadow and stop the list
+int PListShadowStop(int listid);
+
+// Same as the PersistentListNode functions, reads served from RAM
+int PListShadowAdd(int listid, int position, void* data);
+int PListShadowGetdata(int listid, int position, void* data);
+int PListShadowUpdatedata(int listid, int position, void* data);
+int PListShadowRemove(int listid, int position);
+int PListShadowRemoveAll(int listid);
+int PListShadowGetcount(int listid);
+
+// Load the shadow again from FRAM (done automatically after a failed change)
+int PListShadowReload(int listid);
+
+#endif
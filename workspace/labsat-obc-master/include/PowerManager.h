@@ -20,6 +20,10 @@
 #define PM_WDG_TIMEOUT 300 //secs
 #define PM_TTC_TIMEOUT (PM_WDG_TIMEOUT*65/100) //secs
 #define PM_QUEUE_WAIT_TICKS ( PM_WDG_TIMEOUT/8*configTICK_RATE_HZ) // ticks
+#define PM_POOL_SIZE 24 // max requests pending or scheduled at the same time (no heap allocation per request)
+#define PM_MAX_CALLBACKS 4 // max callers sharing one coalesced read-only command
+#define PM_HK_PERIOD 10 // secs between housekeeping samples (0 disables periodic sampling)
+#define PM_HK_POLL_TICKS pdMS_TO_TICKS(10) // PowerManagerGetSnapshot poll interval while waiting for a sample
 
 
 // type definitions (using isismepsv2_ivid7_piu.h, isismepsv2_ivid7_piu_types.h common_types.h)
@@ -57,14 +61,31 @@ isismepsv2_ivid7_piu__replyheader_t											replyHdrOut;
 typedef void (*PowerManagerCmdCallback)(driver_error_t cmderr,unsigned int when,commandRespData* response);
 
 
+// Requests live in a fixed pool inside the power manager. Identical read-only commands
+// pending at the same time are coalesced into one request with several callbacks.
 typedef struct __attribute__((__packed__)) _PowerManagerRequest {
 	unsigned int when; // 4 bytes
-	PowerManagerCmdCallback callback; // sizeof(functionPointer): 4 bytes in 32bits arch, 8 bytes in 64 bits arch.
+	PowerManagerCmdCallback callback[PM_MAX_CALLBACKS]; // sizeof(functionPointer)*PM_MAX_CALLBACKS: 16 bytes in 32bits arch.
 	commandReqData cdata; // 10 bytes
 	unsigned char commandCode; // 1 byte. See below command code definitions
-} PowerManagerRequest; // 19 bytes
+	unsigned char callbackCount; // 1 byte. Used entries in callback[]
+	unsigned char state; // 1 byte. Pool slot state (private to power manager)
+} PowerManagerRequest; // 33 bytes
+
+// Last EPS housekeeping sample. Published by the power manager task, any task can read it
+// with PowerManagerGetSnapshot without taking a lock or sending commands to the EPS.
+typedef struct _PowerManagerSnapshot {
+	unsigned int version; // number of samples published so far (0 = no sample yet)
+	portTickType tstamp; // xTaskGetTickCount() when sampled
+	unsigned int unixTime; // OBC unix time when sampled
+	driver_error_t errSysStatus, errHKeng, errHKavg; // last read result of each part. Failed parts keep the previous data
+	isismepsv2_ivid7_piu__getsystemstatus__from_t sysStatus;
+	isismepsv2_ivid7_piu__gethousekeepingeng__from_t hkEng;
+	isismepsv2_ivid7_piu__gethousekeepingrunningavg__from_t hkAvg;
+} PowerManagerSnapshot;
 
 // Command codes
+#define PM_CC_SAMPLEHK 0xF0 // not an EPS command: refresh the housekeeping snapshot (callback response is 0, read the snapshot)
 #define PM_CC_NOP 0x02
 #define PM_CC_CANCEL 0x04
 #define PM_CC_RESETWATCHDOG 0x06
@@ -127,8 +148,25 @@ char PowerManagerInit();
 // Send command to power manager / EPS
 // When response from the command is available, it will execute the callback
 // (will be xecuted from power manager own task)
+// Bus on/off and mode switch commands are queued ahead of housekeeping reads.
+// A read-only command identical to one already pending is not sent again to the EPS,
+// its callback is executed with the response of the pending one.
+// Returns 0 on success, -1 if the request pool is exhausted (never blocks).
 char PowerManagerAddRequest(unsigned int commandCode, unsigned int when,PowerManagerCmdCallback callback, commandReqData* cdata);
 
+// Log request pool usage, coalescing and housekeeping sampler counters
+void PowerManagerShowStatus();
+
+// Change the periodic housekeeping sample interval (secs, 0 disables periodic sampling)
+void PowerManagerSetSamplePeriod(unsigned int secs);
+
+// Copy the last housekeeping snapshot to *snap (lock free).
+// If it is older than maxAgeMs a new sample is requested, and the caller waits up to
+// waitTicks for it (waitTicks=0 returns at once with the stale copy).
+// Do not wait from a power manager callback: the sample runs in the same task.
+// Returns 0 if the copy is fresh, 1 if it is stale, -1 if there is no sample yet.
+char PowerManagerGetSnapshot(PowerManagerSnapshot* snap, unsigned int maxAgeMs, portTickType waitTicks);
+
 // Print resonse header, or system status.
 // If strPtr==0 then it prints to regular log
 // If strPtr!=0 and *strPtr!=0 it prints to the memory pointed by *strPtr
@@ -0,0 +1,49 @@
+// Resource headroom for the ground: heap, CSP buffers, task stacks and queue depths, served by
+// the CSP memfree and ps services.
+//
+// - memfree (csp_memfree_hook): free heap bytes.
+// - ps (csp_ps_hook): the csp_ps client sends 0x55 and prints the reply as text: a line with
+//   heap free/low-water/largest block, CSP buffers in use/count and CPU load min/avg/max, then
+//   one line per task (load avg per mille, stack words never used) and one per queue of the
+//   kernel registry (waiting/length). Lines that do not fit in the packet are left out.
+//   A request starting with RM_PS_BINARY gets the same values in binary, big endian:
+//   version, tasks, queues, bufInUse, bufCount (1 byte each), heapFree, heapLow, heapLargest
+//   (4), cpuMin, cpuAvg, cpuMax (2), then per task number (1), load (2), stackFree (2), and per
+//   queue waiting (2), length (2), in the order of the text reply.
+//
+// The heap low-water mark leaves out the newlib free lists (xPortGetMinimumEverFreeHeapSize).
+
+#ifndef RESOURCEMONITOR_H
+#define RESOURCEMONITOR_H
+
+#include "RunTimeStats.h"
+
+#define RM_MAX_TASKS RTS_MAX_TASKS
+#define RM_MAX_QUEUES 8
+#define RM_NAME_LEN 16
+#define RM_PS_BINARY 'T'
+#define RM_REPLY_VERSION 1
+
+typedef struct {
+	unsigned int heapFree, heapLow, heapLargest; // bytes
+	unsigned short bufInUse, bufCount; // CSP buffers
+	unsigned short cpuMin, cpuAvg, cpuMax; // per mille, last complete RunTimeStats window
+	unsigned int tasks, queues;
+	struct {
+		char name[RM_NAME_LEN];
+		unsigned int number;
+		unsigned short load; // per mille, avg of the last complete window
+		unsigned short stackFree; // words never used
+	} task[RM_MAX_TASKS];
+	struct {
+		char name[RM_NAME_LEN];
+		unsigned short waiting, length;
+	} queue[RM_MAX_QUEUES];
+} ResourceMonitorReport;
+
+// Returns the number of tasks or -1
+int ResourceMonitorGet(ResourceMonitorReport* rep);
+
+void ResourceMonitorShowStatus();
+
+#endif
@@ -0,0 +1,54 @@
+// Per-task CPU load from the FreeRTOS run time stats.
+//
+// With configGENERATE_RUN_TIME_STATS (FreeRTOSConfig.h) the kernel adds the time a task ran
+// to its ulRunTimeCounter every time it is switched out. The time base is TC3 counting at
+// MCK/128 (~1us; TC0-2 belong to the PWM driver and TC4-5 to the ADC driver), extended to 32
+// bits by its overflow interrupt, so the counters wrap after ~70 minutes.
+//
+// RunTimeStatsSample runs from the TimerManager every RTS_SAMPLE_INTERVAL secs and takes the
+// load of each task over that interval (per mille of the CPU). The samples are folded into
+// min/avg/max over windows of RTS_WINDOW samples; the last complete window is what
+// RunTimeStatsGet, RunTimeStatsShowStatus and the CSP ps service (ResourceMonitor.h) report.
+
+#ifndef RUNTIMESTATS_H
+#define RUNTIMESTATS_H
+
+#define RTS_SAMPLE_INTERVAL 1 // secs between RunTimeStatsSample calls from the TimerManager
+#define RTS_WINDOW 300 // samples per window
+#define RTS_MAX_TASKS 32 // the application tasks, the HAL driver tasks (I2C, SPI, UART), IDLE and Tmr Svc
+#define RTS_NAME_LEN 16
+#define RTS_LOG_WINDOWS 1 // log the load of every task at the end of each window
+#define RTS_COUNTER_HZ (BOARD_MCK/128) // TIMER_DIV4_CLOCK (board.h)
+
+typedef struct {
+	char name[RTS_NAME_LEN];
+	unsigned int taskNumber;
+	unsigned short min, avg, max; // per mille of the CPU, last complete window
+	unsigned short last; // per mille, last sample
+} RunTimeStatsTask;
+
+typedef struct {
+	unsigned int windows; // complete windows
+	unsigned int samples; // in the window being filled
+	unsigned int windowSecs; // length of the last complete window
+	unsigned short cpuMin, cpuAvg, cpuMax; // per mille not in the IDLE task, last complete window
+	unsigned int tasks;
+	RunTimeStatsTask task[RTS_MAX_TASKS];
+} RunTimeStatsReport;
+
+// Start the module (the run time counter is started by the scheduler)
+int RunTimeStatsInit();
+
+// TimerManager callback
+int RunTimeStatsSample(unsigned int when, void* privData);
+
+// Load of each task over the last complete window. Returns the number of tasks.
+int RunTimeStatsGet(RunTimeStatsReport* rep);
+
+void RunTimeStatsShowStatus();
+
+// Called by the kernel (FreeRTOSConfig.h)
+void vConfigureTimerForRunTimeStats(void);
+unsigned long ulGetRunTimeCounterValue(void);
+
+#endif
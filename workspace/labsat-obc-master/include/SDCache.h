@@ -0,0 +1,54 @@
+// Write-back sector cache for the SD cards, stacked as an hcc driver on top of the
+// SD card driver (atmel_mcipdc). Mount a volume through it with
+//   f_initvolume(drivenum,SDCacheInitFunc,F_AUTO_ASSIGN)
+//
+// - Single sector reads and writes from hcc are served from an LRU cache.
+// - Dirty sectors are written back in runs of consecutive sectors with one multi-sector
+//   command, when the cache needs room, when too many are dirty, when the oldest dirty
+//   sector gets too old (checked on each access), and on SDCacheFlush or volume release.
+// - A miss right after the previous sector was read, reads SDCACHE_READAHEAD sectors at once.
+// - Multi-sector reads and writes from hcc go straight to the card (keeping the cache coherent).
+//
+// f_flush only pushes file data down to this driver: call SDManagerSync when data must be
+// on the card (SDManager flushes periodically and on shutdown).
+
+#ifndef SDCACHE_H
+#define SDCACHE_H
+
+#include <hcc/api_mdriver.h>
+
+#define SDCACHE_VOLUMES 2 // volumes that can be cached at the same time (more are mounted uncached)
+#define SDCACHE_SECTORS 64 // cached sectors per volume
+#define SDCACHE_SECTOR_SIZE 512 // volumes with other sector sizes are not cached
+#define SDCACHE_MAX_RUN 16 // max sectors per multi-sector write back or read ahead
+#define SDCACHE_READAHEAD 8 // sectors read at once on a sequential miss (<=SDCACHE_MAX_RUN, 1 disables it)
+#define SDCACHE_MAX_DIRTY (SDCACHE_SECTORS/2) // write back when this many sectors are dirty
+#define SDCACHE_MAX_DIRTY_MS 5000 // write back when the oldest dirty sector is this old
+
+typedef struct {
+	unsigned int reads, writes; // sectors requested by hcc
+	unsigned int hits, misses; // single sector reads served from / not found in cache
+	unsigned int readAheads; // read ahead commands
+	unsigned int sdReadCmds, sdWriteCmds; // commands sent to the SD card driver
+	unsigned int sdSectorsRead, sdSectorsWritten;
+	unsigned int flushes; // write backs
+	unsigned int errors; // SD card driver errors
+} SDCacheStats;
+
+// Driver wrapped by the cache. atmel_mcipdc_initfunc by default.
+extern F_DRIVERINIT SDCacheLowerInit;
+
+// hcc driver init function (pass it to f_initvolume)
+F_DRIVER* SDCacheInitFunc(unsigned long driver_param);
+
+// Write all dirty sectors of all cached volumes. Returns 0 or the first driver error.
+int SDCacheFlush();
+
+// Get the counters of a cached volume (0..SDCACHE_VOLUMES-1 in mount order).
+// Returns -1 if it is not in use.
+int SDCacheGetStats(int vol, SDCacheStats* st, char reset);
+
+// Log counters and hit rate of every cached volume
+void SDCacheShowStatus();
+
+#endif
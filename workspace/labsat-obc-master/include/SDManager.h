@@ -6,11 +6,29 @@
 #include <hcc/api_mdriver_atmel_mcipdc.h>
 #include <hcc/api_fs_err.h> // error codes
 
+#define SD_FLUSH_INTERVAL 2 // secs between write backs of the SD sector cache (see SDCache.h)
+// Mount both SD cards as one mirrored volume (see SDMirror.h). Off: card 1 is volume 2, as before.
+// The first mount with it on copies card 0 over card 1 (their file systems differ), and what was
+// on card 1 is lost: turn it on only after card 1 has been emptied or copied to the ground.
+#define SD_MIRROR 0
+// SD card driver: 0 the prebuilt hcc atmel_mcipdc, 1 SDMmc.h (at91 sdmmc_mci.c multi-block commands).
+// SDMmc has not run on the board yet: its card select polarity is taken from a disassembly of
+// atmel_mcipdc. Turn it on only to validate it (testSDMirror logs its MB/s).
+#define SD_DRIVER_SDMMC 0
+
 
 // Initialize driver and volumes.
 // Innitialized volumes are 0 ramdisk, 1 first SD card, 2 second SD card
 // (this hcc distributioon does not support ramdisk)
+// With SD_MIRROR volume 1 is both SD cards mirrored, and there is no volume 2.
+// SD card volumes are mounted through the write-back sector cache in SDCache.h
 int SDManagerInit();
+// Write back the SD sector cache and wake the mirror tasks, without waiting for the cards. Has the
+// TimerManager callback signature so it can be scheduled every SD_FLUSH_INTERVAL (returns 0).
+int SDManagerFlush(unsigned int when, void* privData);
+// Write back the SD sector cache and wait (up to SDMIRROR_FLUSH_MS) until the mirror wrote it on
+// both cards. Call it after f_flush when data must be on the card. Returns 0 or an error.
+int SDManagerSync();
 // Shutdown and initialize again. Warning: close all files in all tasks, and unregister all tasks from driver.
 int SDManagerReInit();
 // Close driver and release resources. Warning: close all files in all tasks, and unregister all tasks from driver.
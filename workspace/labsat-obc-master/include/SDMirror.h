@@ -0,0 +1,94 @@
+// Mirroring of the two SD cards, as an hcc driver below the sector cache (SDCache.h):
+//   hcc -> SDCache -> SDMirror -> atmel_mcipdc card 0 + atmel_mcipdc card 1
+// Mounted by SDManager as volume 1 when SD_MIRROR is set.
+//
+// - Writes are copied once to a queue and the caller returns. One task per card applies the
+//   queue to its card in order, so each card works at its own pace (one can be transferring
+//   while the other is busy programming) and a slow or failed card does not stall the other.
+// - Reads go to an available card that is not busy with the queue (if possible), and pending
+//   queue writes are overlaid on what was read, so readers always see the latest data.
+// - A card that fails is taken out of service. Writes it misses are recorded per region
+//   (1MB or more) and when the card answers again (probed every SDMIRROR_RETRY_MS) those
+//   regions are copied from the other card in the background before it serves reads again.
+//   A card that was missing at mount or was changed is copied whole.
+// - At mount the boot sectors and first FAT sector of both cards are compared, and if they
+//   differ (new card, or cards used separately before) card 1 is copied whole from card 0
+//   (from card 1 to card 0 if only card 1 has a partition table). The files of the overwritten
+//   card are lost, which is why SD_MIRROR is off by default.
+//
+// Writes are only on the cards after SDMirrorFlush (SDManagerSync does it after the cache).
+//
+// sdmirror-bench.c runs this file on the development machine against two fake cards that fail,
+// come back and are changed.
+
+#ifndef SDMIRROR_H
+#define SDMIRROR_H
+
+#include <freertos/FreeRTOS.h>
+#include <hcc/api_mdriver.h>
+#include "ObcGlobals.h"
+
+#define SDMIRROR_CARDS 2
+#define SDMIRROR_SECTOR_SIZE 512
+#define SDMIRROR_QUEUE 16 // queued writes
+#define SDMIRROR_MAX_RUN 16 // max sectors per queued write (longer writes take several)
+#define SDMIRROR_REGIONS 32768 // missed writes are tracked in up to this many regions per card
+#define SDMIRROR_MIN_REGION_SHIFT 11 // regions are at least 2048 sectors (1MB)
+#define SDMIRROR_RETRY_MS 2000 // probe period of a failed card
+#define SDMIRROR_FLUSH_MS 10000 // max wait of SDManagerSync and of the volume release
+#define SDMIRROR_STACK_SIZE basic_STACK_DEPTH
+#define SDMIRROR_PRIORITY (configMAX_PRIORITIES-2)
+
+// card states
+#define SDMIRROR_CARD_OK 0
+#define SDMIRROR_CARD_FAILED 1 // not used, missed writes are recorded
+#define SDMIRROR_CARD_RESYNC 2 // getting missed regions from the other card, writes are applied
+
+typedef struct {
+	unsigned char state;
+	unsigned int writeCmds, sectorsWritten, writeMs; // queue writes applied (and time spent)
+	unsigned int readCmds, sectorsRead, readMs;
+	unsigned int errors; // driver errors
+	unsigned int failures; // times taken out of service
+	unsigned int dirtyRegions; // regions waiting for resync
+	unsigned int pending; // queued writes not applied yet
+} SDMirrorCardStats;
+
+typedef struct {
+	unsigned int writes, sectorsWritten; // accepted from the upper layer
+	unsigned int reads, sectorsRead;
+	unsigned int queueOverlays; // sectors read that came from the queue
+	unsigned int queueFull; // writes that had to wait for room in the queue
+	unsigned int maxPending;
+	unsigned int lostWrites; // queued writes that no card could take
+	unsigned int regionSectors;
+	SDMirrorCardStats card[SDMIRROR_CARDS];
+} SDMirrorStats;
+
+// Driver of each card, atmel_mcipdc_initfunc by default (called with the card number 0 or 1)
+extern F_DRIVERINIT SDMirrorLowerInit;
+
+// hcc driver init function (pass it to f_initvolume, or set it as SDCacheLowerInit).
+// driver_param is not used: it always mirrors cards 0 and 1. Only one mirror can be mounted.
+F_DRIVER* SDMirrorInitFunc(unsigned long driver_param);
+
+// Wait until every queued write is on every available card.
+// Returns 0, or -1 if the queue could not be emptied in waitTicks.
+// With waitTicks 0 it only wakes the card tasks and returns (-1 if writes are queued).
+int SDMirrorFlush(portTickType waitTicks);
+
+// Copy a card whole from the other one (after replacing it, or if it is known to differ).
+// Returns -1 if the mirror is not mounted or the card number is wrong.
+int SDMirrorResync(int card);
+
+// Get the counters. Returns -1 if the mirror is not mounted.
+int SDMirrorGetStats(SDMirrorStats* st, char reset);
+
+// Log state, counters and write throughput of each card
+void SDMirrorShowStatus();
+
+// One pass of the task of a card (sdmirror-bench.c calls it directly): 0 to run again,
+// else the ticks to wait for more work
+portTickType SDMirrorPump(int card);
+
+#endif
@@ -0,0 +1,43 @@
+// hcc media driver for the two SD cards of the OBC over the at91 SD card code (sdmmc_mci.c),
+// used by SDManager in place of the prebuilt atmel_mcipdc driver when SD_DRIVER_SDMMC is set
+// (off until it has been validated on the board).
+//
+// - A multi-sector read or write from the layers above (SDCache write-back and read-ahead,
+//   SDMirror) is one closed CMD18 or CMD25 transfer (SD_ReadMultipleBlocks,
+//   SD_WriteMultipleBlocks), announced to the card with ACMD23 so it can pre-erase.
+// - Both cards are on MCI slot A; PIN_SDSEL connects one of them to the bus. atmel_mcipdc powers
+//   only the card it was started for, so a second instance switches the first one off. This
+//   driver keeps both cards powered and initialized and only moves PIN_SDSEL between transfers.
+// - A card that fails a command is initialized again on its next access.
+// - Transfers wait for the MCI interrupt by polling (as the at91 code does) while holding
+//   the bus: call it from tasks that may hold the CPU for a transfer (SDMirror card tasks).
+// - The data cache is off (board_lowlevel.c), so the PDC transfers straight to and from the
+//   buffers of the callers. Buffers that are not word aligned go through a bounce sector.
+
+#ifndef SDMMC_H
+#define SDMMC_H
+
+#include <hcc/api_mdriver.h>
+
+#define SDMMC_CARDS 2
+#define SDMMC_SPEED_HZ 25000000 // MCI clock after initialization (default speed SD)
+#define SDMMC_POWER_MS 10 // power ramp up before the first command
+
+typedef struct {
+	unsigned int readCmds, sectorsRead, readMs;
+	unsigned int writeCmds, sectorsWritten, writeMs;
+	unsigned int errors, starts; // failed commands, card initializations
+	unsigned int sectors; // card size, 0 if not initialized
+} SDMmcStats;
+
+// hcc driver init function: driver_param is the card (0 or 1), or F_AUTO_ASSIGN for the first
+// one not mounted
+F_DRIVER* SDMmcInitFunc(unsigned long driver_param);
+
+// Get the counters of a card. Returns -1 if the card number is wrong.
+int SDMmcGetStats(int card, SDMmcStats* st, char reset);
+
+// Log the counters and the read and write rates of each card
+void SDMmcShowStatus();
+
+#endif
@@ -0,0 +1,87 @@
+// Run slices of the tasks under the cooperative scheduler (configUSE_PREEMPTION 0).
+//
+// A task keeps the CPU from the moment it is switched in until it blocks or yields, so one long
+// TimerManager callback or EPS transaction delays every other task, csp_router_task included.
+// FreeRTOSConfig.h includes this file when configUSE_SLICE_MONITOR is 1: traceTASK_SWITCHED_OUT times each slice with the run time
+// counter (RunTimeStats.h, ~1us) and keeps per task the number of slices, a histogram of their
+// lengths (power of 2 buckets) and the longest one.
+//
+// Code marks what it is about to run with SliceMonitorMark (the TimerManager marks every callback,
+// the power manager every command). A slice is split at the marks, and its longest part is
+// the call site reported for it.
+// A slice longer than the budget (SLICE_BUDGET_US, SliceMonitorSetBudget) is queued as an event.
+// SliceMonitorCheck logs it from the TimerManager with the task, the length and the call site.
+//
+// SLICE_YIELD() in a long loop calls taskYIELD when the current slice is longer than
+// SLICE_YIELD_US (with SLICE_YIELD_POINTS). That lets the ready tasks of the same or higher
+// priority run. The lower priority ones wait until the task blocks.
+
+#ifndef SLICEMONITOR_H
+#define SLICEMONITOR_H
+
+#define SLICE_MAX_TASKS 32 // same count as RTS_MAX_TASKS
+#define SLICE_NAME_LEN 16
+#define SLICE_SITE_LEN 16
+#define SLICE_BUCKETS 12 // lengths below 128, 256, ... 131072 counts (~us), and the rest
+#define SLICE_BUDGET_US 20000
+#define SLICE_EVENTS 8 // slices over budget waiting for SliceMonitorCheck
+#define SLICE_CHECK_INTERVAL 1 // secs between SliceMonitorCheck calls from the TimerManager
+#define SLICE_YIELD_POINTS 1
+#define SLICE_YIELD_US 5000
+
+typedef struct {
+	char name[SLICE_NAME_LEN];
+	unsigned int slices, over, yields; // over: slices longer than the budget
+	unsigned int maxUs;
+	char maxSite[SLICE_SITE_LEN]; // call site of the longest slice
+	unsigned int hist[SLICE_BUCKETS];
+} SliceMonitorTask;
+
+typedef struct {
+	unsigned int budgetUs, yieldUs;
+	unsigned int untracked; // slices of tasks beyond SLICE_MAX_TASKS
+	unsigned int eventsLost; // over budget slices not logged (SLICE_EVENTS full)
+	unsigned int bucketUs[SLICE_BUCKETS]; // upper limit of each bucket but the last
+	unsigned int tasks;
+	SliceMonitorTask task[SLICE_MAX_TASKS];
+} SliceMonitorReport;
+
+// Start timing (the scheduler has to be running). -1 if the kernel is built without the
+// switch hook (configUSE_SLICE_MONITOR in FreeRTOSConfig.h is 0, the default): the monitor then
+// reports no slices and SLICE_YIELD never yields.
+int SliceMonitorInit();
+
+// TimerManager callback: logs the slices over budget
+int SliceMonitorCheck(unsigned int when, void* privData);
+
+void SliceMonitorSetBudget(unsigned int budgetUs, unsigned int yieldUs);
+
+// What the calling task runs from now on (copied, up to SLICE_SITE_LEN-1 characters)
+void SliceMonitorMark(const char* site);
+
+// Whether the calling task has run longer than the yield budget (SLICE_YIELD)
+int SliceMonitorYieldDue();
+
+#if SLICE_YIELD_POINTS
+	#define SLICE_YIELD() do { if( SliceMonitorYieldDue() ) taskYIELD(); } while(0)
+#else
+	#define SLICE_YIELD()
+#endif
+
+// Clear the counters and free the slots of deleted tasks
+void SliceMonitorReset();
+
+// Returns the number of tasks
+int SliceMonitorGet(SliceMonitorReport* rep);
+
+void SliceMonitorShowStatus();
+
+// Called by the kernel (traceTASK_SWITCHED_OUT, in tasks.c) with interrupts disabled
+void vSliceSwitchedOut(void* tcb, unsigned long tcbNumber, unsigned long* slot, const char* name);
+
+#if ( configUSE_SLICE_MONITOR == 1 )
+	#define traceTASK_SWITCHED_OUT() vSliceSwitchedOut(pxCurrentTCB,pxCurrentTCB->uxTCBNumber,\
+		(unsigned long*)&(pxCurrentTCB->uxTaskNumber),(const char*)pxCurrentTCB->pcTaskName)
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+// Stack high-water marks of the tasks, kept across reboots, and the stack size each one needs.
+//
+// StackMonitorSample runs from the TimerManager every SM_SAMPLE_INTERVAL secs. It takes the
+// high-water mark of every task from uxTaskGetSystemState (the kernel fills new stacks with a
+// pattern and counts the words never overwritten) and keeps, by task name, the most words a
+// task ever used in the FRAM journal (FJ_KEY_STACK_MONITOR + slot). The worst case so adds up
+// over all the boots and modes the OBC goes through, not only the current one.
+//
+// The recommended size is the most used plus SM_MARGIN_PCT and SM_MARGIN_WORDS, rounded up to
+// SM_ROUND_WORDS and not under configMINIMAL_STACK_SIZE. StackMonitorShowStatus logs it next
+// to the size the task was created with, and the heap bytes that resizing would give back.
+// Tasks that end quickly (InitTask) may be gone before they are sampled.
+// The stack sizes in the module headers (basic_STACK_DEPTH, TM_STACK_SIZE, ...) are the
+// guesses this report is meant to replace: change them from it, after a long enough run.
+
+#ifndef STACKMONITOR_H
+#define STACKMONITOR_H
+
+#define SM_SAMPLE_INTERVAL 60 // secs between StackMonitorSample calls from the TimerManager
+#define SM_MAX_TASKS 32 // FRAM journal slots, one per task (same count as RTS_MAX_TASKS)
+#define SM_NAME_LEN 16
+#define SM_MARGIN_PCT 25
+#define SM_MARGIN_WORDS 128
+#define SM_ROUND_WORDS 64
+#define SM_LOW_WORDS 128 // log an error when a task has less free stack than this
+
+typedef struct {
+	char name[SM_NAME_LEN];
+	char running; // seen at the last sample
+	unsigned short depth; // words the task was created with (the last time it was seen)
+	unsigned short maxUsed; // most words ever used, all boots
+	unsigned short minFree; // words never used since the task started, 0 if not running
+	unsigned short recommended; // words
+} StackMonitorTask;
+
+typedef struct {
+	unsigned int samples, fjErrors; // since boot
+	unsigned int reclaimBytes; // running tasks whose stack is bigger than recommended
+	unsigned int tasks;
+	StackMonitorTask task[SM_MAX_TASKS];
+} StackMonitorReport;
+
+// Load the high-water marks of the previous boots (after FRAMJournalInit)
+int StackMonitorInit();
+
+// TimerManager callback
+int StackMonitorSample(unsigned int when, void* privData);
+
+// Forget the marks of the previous boots, in RAM and in FRAM (after the code of tasks changed)
+void StackMonitorReset();
+
+// Returns the number of tasks
+int StackMonitorGet(StackMonitorReport* rep);
+
+void StackMonitorShowStatus();
+
+#endif
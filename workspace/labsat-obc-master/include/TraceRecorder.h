@@ -0,0 +1,130 @@
+// Binary trace recorder for FreeRTOS kernel events.
+//
+// FreeRTOSConfig.h includes this file when configUSE_TRACE_RECORDER is 1 (off by default), so
+// the kernel trace macros below call the recorder (the FreeRTOS library has to be built with it).
+// Without it the ring is not allocated and TraceRecorderStart returns -1. While the recorder is off each macro costs
+// one flag test. While on, every event is an 8 byte record (run time counter time stamp, event,
+// current task, object) written with interrupts disabled into a RAM ring of TRACE_RECORDS:
+//
+// - TRACE_SNAPSHOT: the ring keeps the newest records; TraceRecorderDump writes them to a file.
+// - TRACE_STREAM: a task writes the ring to a file every TRACE_STREAM_MS. If it falls behind,
+//   new records are dropped (and counted) instead of overwriting unwritten ones.
+//
+// Recorded: task switches, creation, deletion and delays; queue, semaphore and mutex sends,
+// receives, failures and blocking (also the ...FromISR calls of the drivers); and optionally the
+// tick interrupt. Task and queue names go in TRC_NAME records. trace2json.c converts a trace
+// file into Chrome trace JSON (chrome://tracing or ui.perfetto.dev).
+//
+// File: TraceRecorderFileHeader, then records. A TRC_NAME record is followed by
+// TRACE_NAME_RECORDS TRC_NAME_DATA records holding the name: 7 characters each, all the bytes but
+// the event one (so that a snapshot whose oldest records are the end of a name can be read).
+
+#ifndef TRACERECORDER_H
+#define TRACERECORDER_H
+
+#define TRACE_RECORDS 8192 // ring size (power of 2), 64KB
+#define TRACE_STREAM_MS 500 // between writes of the stream task
+#define TRACE_NAME_LEN 16
+#define TRACE_NAME_RECORDS ((TRACE_NAME_LEN+6)/7)
+#define TRACE_MAGIC 0x52545246 // "FRTR"
+#define TRACE_VERSION 1
+
+// Modes
+#define TRACE_SNAPSHOT 0
+#define TRACE_STREAM 1
+
+// Events
+#define TRC_NAME 1 // task: TRC_OBJ_TASK or TRC_OBJ_QUEUE, obj: number; the name records follow
+#define TRC_TASK_SWITCH 2 // task: the task switched in
+#define TRC_TASK_CREATE 3 // obj: task number
+#define TRC_TASK_DELETE 4 // obj: task number
+#define TRC_TASK_DELAY 5
+#define TRC_QUEUE_CREATE 6 // obj (also for the queue events below): queue number | type<<8
+#define TRC_QUEUE_SEND 7
+#define TRC_QUEUE_SEND_FAILED 8
+#define TRC_QUEUE_RECEIVE 9
+#define TRC_QUEUE_RECEIVE_FAILED 10
+#define TRC_QUEUE_PEEK 11
+#define TRC_BLOCKING_ON_SEND 12
+#define TRC_BLOCKING_ON_RECEIVE 13
+#define TRC_QUEUE_SEND_FROM_ISR 14
+#define TRC_QUEUE_RECEIVE_FROM_ISR 15
+#define TRC_TICK 16 // obj: low 16 bits of the tick count
+#define TRC_DROPPED 17 // obj: records dropped (stream mode) before this one
+#define TRC_NAME_DATA 18
+#define TRC_EVENTS 19
+
+// Object kinds of TRC_NAME
+#define TRC_OBJ_TASK 0
+#define TRC_OBJ_QUEUE 1
+
+typedef struct {
+	unsigned int time; // run time counter (RunTimeStats.h)
+	unsigned char event;
+	unsigned char task; // number of the running task (low 8 bits)
+	unsigned short obj;
+} TraceRecord;
+
+typedef struct {
+	unsigned int magic, version;
+	unsigned int counterHz; // of the time stamps
+	unsigned int records; // 0 for a stream (read to the end of the file)
+	unsigned int dropped;
+	unsigned int reserved[3];
+} TraceRecorderFileHeader;
+
+typedef struct {
+	unsigned char on, mode, ticks;
+	unsigned int events, dropped; // since TraceRecorderStart
+	unsigned int buffered; // records in the ring
+	unsigned int bytesWritten, writeErrors;
+} TraceRecorderStats;
+
+// Start recording (a stream goes to path). With ticks, the tick interrupt is recorded too
+// (1000 records per second). Returns 0 or -1 (also without configUSE_TRACE_RECORDER).
+int TraceRecorderStart(unsigned char mode, unsigned char ticks, const char* path);
+
+// Stop recording (a stream is written to the end and closed)
+void TraceRecorderStop();
+
+// Stop recording and write the ring to a file, oldest record first. Returns the number of
+// records written or -1. The caller must be registered to the file system (f_enterFS).
+int TraceRecorderDump(const char* path);
+
+void TraceRecorderGetStats(TraceRecorderStats* st);
+void TraceRecorderShowStatus();
+
+#if ( configUSE_TRACE_RECORDER == 1 )
+
+// Used by the kernel trace macros
+extern volatile unsigned char ucTraceRecorderOn, ucTraceRecorderTicks;
+void vTraceRecord(unsigned char event, unsigned short obj);
+void vTraceTaskSwitchedIn(unsigned int taskNumber);
+void vTraceTaskCreate(unsigned int taskNumber, const char* name);
+unsigned char ucTraceQueueCreate(unsigned char type);
+
+#define TRACE_EVENT(ev,obj) do { if( ucTraceRecorderOn ) vTraceRecord((ev),(obj)); } while(0)
+#define TRACE_QUEUE_OBJ(q) ((q)->ucQueueNumber | ((q)->ucQueueType<<8))
+
+// Kernel trace macros (FreeRTOS.h). Queue macros are expanded in queue.c, task ones in tasks.c.
+#define traceTASK_SWITCHED_IN() do { if( ucTraceRecorderOn ) vTraceTaskSwitchedIn(pxCurrentTCB->uxTCBNumber); } while(0)
+#define traceTASK_CREATE(pxNewTCB) vTraceTaskCreate((pxNewTCB)->uxTCBNumber,(const char*)(pxNewTCB)->pcTaskName)
+#define traceTASK_DELETE(pxTCB) TRACE_EVENT(TRC_TASK_DELETE,(pxTCB)->uxTCBNumber)
+#define traceTASK_DELAY() TRACE_EVENT(TRC_TASK_DELAY,0)
+#define traceTASK_DELAY_UNTIL() TRACE_EVENT(TRC_TASK_DELAY,0)
+#define traceTASK_INCREMENT_TICK(xTickCount) do { if( ucTraceRecorderTicks ) vTraceRecord(TRC_TICK,(xTickCount)); } while(0)
+#define traceQUEUE_CREATE(pxNewQueue) ((pxNewQueue)->ucQueueNumber = ucTraceQueueCreate((pxNewQueue)->ucQueueType))
+#define traceCREATE_MUTEX(pxNewQueue) ((pxNewQueue)->ucQueueNumber = ucTraceQueueCreate((pxNewQueue)->ucQueueType))
+#define traceQUEUE_SEND(pxQueue) TRACE_EVENT(TRC_QUEUE_SEND,TRACE_QUEUE_OBJ(pxQueue))
+#define traceQUEUE_SEND_FAILED(pxQueue) TRACE_EVENT(TRC_QUEUE_SEND_FAILED,TRACE_QUEUE_OBJ(pxQueue))
+#define traceQUEUE_RECEIVE(pxQueue) TRACE_EVENT(TRC_QUEUE_RECEIVE,TRACE_QUEUE_OBJ(pxQueue))
+#define traceQUEUE_RECEIVE_FAILED(pxQueue) TRACE_EVENT(TRC_QUEUE_RECEIVE_FAILED,TRACE_QUEUE_OBJ(pxQueue))
+#define traceQUEUE_PEEK(pxQueue) TRACE_EVENT(TRC_QUEUE_PEEK,TRACE_QUEUE_OBJ(pxQueue))
+#define traceBLOCKING_ON_QUEUE_SEND(pxQueue) TRACE_EVENT(TRC_BLOCKING_ON_SEND,TRACE_QUEUE_OBJ(pxQueue))
+#define traceBLOCKING_ON_QUEUE_RECEIVE(pxQueue) TRACE_EVENT(TRC_BLOCKING_ON_RECEIVE,TRACE_QUEUE_OBJ(pxQueue))
+#define traceQUEUE_SEND_FROM_ISR(pxQueue) TRACE_EVENT(TRC_QUEUE_SEND_FROM_ISR,TRACE_QUEUE_OBJ(pxQueue))
+#define traceQUEUE_RECEIVE_FROM_ISR(pxQueue) TRACE_EVENT(TRC_QUEUE_RECEIVE_FROM_ISR,TRACE_QUEUE_OBJ(pxQueue))
+
+#endif
+
+#endif
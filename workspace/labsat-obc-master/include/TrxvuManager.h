@@ -0,0 +1,72 @@
+// TRXVU (ISIS VU-E) uplink: frames received by the transceiver are handed to CSP as packets
+// of the "TRXVU" interface. Packets routed to that interface are sent as AX.25 frames.
+//
+// The receiver holds its frame-ready line (PA19) high while frames are waiting. Its PIO
+// interrupt wakes the rx task, which drains the receive buffer in bursts: one
+// get_frame_count_length returns the number of frames and the lengths of the first
+// TRXVU_RX_BURST, then each frame is read with get_full_frame_variable sized to its length
+// (plus the AX.25 header) and removed. Three I2C commands for a lone frame, two per frame in
+// bursts, and no reads of the whole 200 byte frame buffer. A drain ends with the frames that were
+// waiting when it started.
+// The task also drains every TRXVU_RX_IDLE_TICKS without an interrupt, in case an edge was missed.
+//
+// TrxvuManagerSetPolling(1) switches to the polling loop of the isis_vu_e demos
+// (get_frame_count every TRXVU_RX_POLL_TICKS, get_frame and remove_frame per frame) to compare
+// both with the same counters: frames/s, I2C commands and bytes per frame, and the latency from
+// the frame-ready line to the packet queued to CSP.
+//
+// trxvu-bench.c runs this file on the development machine against a simulated VU-E receiver
+// (frames arriving at a fixed rate, frame-ready line, I2C command times at I2C_BUS_SPEED) in both
+// modes. src/fsw-vue-sim simulates the receiver on the qemu TWI socket for the firmware itself.
+
+#ifndef TRXVUMANAGER_H
+#define TRXVUMANAGER_H
+
+#include <freertos/FreeRTOS.h>
+#include "ObcGlobals.h"
+
+#define TRXVU_INDEX 0 // driver index
+#define TRXVU_RX_ADDR 0x60
+#define TRXVU_TX_ADDR 0x61
+#define TRXVU_FRAME_MAX 200 // frame contents (get_frame)
+#define TRXVU_TX_MAX 235 // send_frame
+#define TRXVU_AX25_HDR 16 // full frames start with the AX.25 addresses, control and PID
+#define TRXVU_RX_BURST 8 // frame lengths asked per get_frame_count_length (80 at most)
+#define TRXVU_RX_PRIO (configMAX_PRIORITIES-2)
+#define TRXVU_STACK_SIZE basic_STACK_DEPTH
+#define TRXVU_RX_IDLE_TICKS (10*configTICK_RATE_HZ) // drain without the line
+#define TRXVU_RX_POLL_TICKS pdMS_TO_TICKS(100) // polling mode period
+#define TRXVU_FR_SETTLE_TICKS 2 // the line takes ~0.5ms to drop after the last remove_frame
+#define TRXVU_CSP_ADDR 1 // local address on the interface
+
+typedef struct {
+	char polling; // mode the counters were taken in
+	unsigned int secs; // since the counters were reset
+	unsigned int interrupts, drains, idleDrains; // idleDrains: drains not woken by the line
+	unsigned int frames, dropped, i2cErrors; // dropped: bad length, no CSP buffer, bad CSP header
+	unsigned int maxBurst; // most frames in one drain
+	unsigned int i2cCommands, i2cBytes; // receive side, written and read
+	unsigned int framesPerSec, commandsPerFrame100, bytesPerFrame; // commandsPerFrame100: x100
+	unsigned int latencyUs, maxLatencyUs; // frame-ready line to packet queued: avg and max
+	unsigned int txFrames, txErrors;
+} TrxvuManagerReport;
+
+// Start the transceiver driver, the CSP interface and the rx task.
+// The I2C bus and the PIO interrupts have to be started, and CSP initialized.
+int TrxvuManagerInit();
+
+// 1: polling loop, 0: frame-ready interrupt. Resets the counters.
+void TrxvuManagerSetPolling(char on);
+
+// The frame-ready line rose (its interrupt; the benchmark calls it directly). 1: wake the rx task.
+char TrxvuFrameReady();
+
+// One pass of the rx task after its wait (the benchmark calls it directly): drain, or poll in
+// polling mode. woken: by the frame-ready line. Returns the frames removed.
+unsigned int TrxvuRxPass(char polling, char woken);
+
+int TrxvuManagerGet(TrxvuManagerReport* rep);
+
+void TrxvuManagerShowStatus();
+
+#endif
@@ -32,6 +32,8 @@
 #define EPS_BUF_SIZE sizeof(commandRespData) + 32 /* a la respuesta se le agrega <rsp>, </rsp> y <CR><LF> */
 /* Timeout value for RX in baudrate ticks, so timeoutSecs=(value/EPS_UART_RATE). Timeout only starts counting after the first byte of the transfer has been received. If a timeout is specified it affects all read functions (UART_read, UART_writeRead, UART_queueTransfer). */
 #define EPS_UART_DEFAULTTIMEOUT ((EPS_BUF_SIZE*8)+(20*EPS_UART_RATE)/1000)
+#define EPS_UART_SLOTS 4 /* EPS commands submitted at the same time (only one is on the wire, the rest are written as soon as the previous response arrives) */
+#define EPS_UART_RSP_TIMEOUT pdMS_TO_TICKS(250) /* max time between writing a command and receiving its response */
 
 /////////////////////////////////////////////////////////////////////////////
 // GPS UART definitions
@@ -62,14 +64,14 @@
 #define CAM_RX_RINGBUF_COUNT 2 /* number of buffers in RX ring buffer */
 #define CAM_BUF_SIZE 650 /* max msg len is for download image line */
 /* Timeout value for RX in baudrate ticks, so timeoutSecs=(value/EPS_UART_RATE). Timeout only starts counting after the first byte of the transfer has been received. If a timeout is specified it affects all read functions (UART_read, UART_writeRead, UART_queueTransfer). */
-#define GPS_UART_DEFAULTTIMEOUT ((CAM_BUF_SIZE*8)+(10*CAM_UART_RATE)/1000)
+#define CAM_UART_DEFAULTTIMEOUT ((CAM_BUF_SIZE*8)+(10*CAM_UART_RATE)/1000)
 
 
 // Next function creates a task for continuosly reading uart, detecting start
 // and end of frame, and calling rxCallback on each incoming frame.
 // It can be called for uart0 or uart2 buses. If a uart bus is contrlled
 // by another manager (i.e. CSPManager) do not call this initializer for that bus.
-int UartManagerInit( const char* ifname,
+int UartManagerInit( UARTbus bus,
    void (*rxCallback)(char* packetBuf, unsigned int len, char complete),
    uint32_t rxBufCount,
    uint32_t rxBufSize,
@@ -85,4 +87,12 @@ int UartManagerInit( const char* ifname,
 
 void closeUart(UARTbus bus);  // bus0_uart=0, bus2_uart=1
 
+// Frame callbacks of each device. Set them before calling the device initializer.
+extern void (*epsUartRXCallback)(char* packetBuf, unsigned int len, char complete);
+extern void (*gpsUartRXCallback)(char* packetBuf, unsigned int len, char complete);
+extern void (*camUartRXCallback)(char* packetBuf, unsigned int len, char complete);
+int UartManagerInitEPS();
+int UartManagerInitCAM();
+int UartManagerInitGPS();
+
 #endif
@@ -0,0 +1,160 @@
+/**
+ * @file
+ *
+ * The property cache keeps the last value read from remote properties on the
+ * client side, so repeated reads of slowly changing values (temperatures,
+ * counters, configuration) do not each cost a CSP connection round trip.
+ *
+ * Properties are registered with a time-to-live in milliseconds. When a
+ * cached property is read after its TTL expired, all stale properties of the
+ * same node and port are packed into a single sl_prop_remote_query and
+ * refreshed in one round trip. Round trips are serialized, but the cache is
+ * not locked during them: other tasks keep reading fresh values meanwhile.
+ *
+ * @code{.cpp}
+ * int16_t temp;
+ * uint32_t gwdt;
+ *
+ * sl_prop_cache_init();
+ * sl_prop_cache_register(node, port, SL_SRS4_PROP_TM_TEMP_PSU, sizeof(temp), 5000);
+ * sl_prop_cache_register(node, port, SL_SRS4_PROP_SYS_GWDT_COUNTER, sizeof(gwdt), 1000);
+ *
+ * // Both values are fetched by the first call, the second one hits the cache
+ * sl_prop_cache_get(node, port, timeout, SL_SRS4_PROP_TM_TEMP_PSU, &temp, sizeof(temp));
+ * sl_prop_cache_get(node, port, timeout, SL_SRS4_PROP_SYS_GWDT_COUNTER, &gwdt, sizeof(gwdt));
+ * @endcode
+ */
+
+#ifndef _SL_PROP_CLIENT_CACHE_H_
+#define _SL_PROP_CLIENT_CACHE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <prop-client/prop_spec.h>
+
+/** Maximum number of cached properties (all nodes) */
+#define SL_PROP_CACHE_MAX_ENTRIES	32
+
+/** Maximum size of a cached property value in bytes */
+#define SL_PROP_CACHE_VALUE_SIZE	32
+
+/** Size of the reply buffer used for one refresh query */
+#define SL_PROP_CACHE_RXBUF_SIZE	256
+
+/** TTL value for properties that never expire once read */
+#define SL_PROP_CACHE_TTL_FOREVER	UINT32_MAX
+
+/** @brief Cache usage counters */
+struct sl_prop_cache_stats {
+	uint32_t hits;			/**< Reads served from the cache */
+	uint32_t misses;		/**< Reads that required a refresh */
+	uint32_t round_trips;		/**< Refresh queries sent */
+	uint32_t round_trips_saved;	/**< Queries avoided by hits and batching */
+	uint32_t refreshed;		/**< Property values refreshed */
+	uint32_t errors;		/**< Refresh queries that failed */
+};
+
+/**
+ * @brief Initialize property cache
+ *
+ * Removes all registered properties and clears the statistics. Must be called
+ * once before any other cache function.
+ *
+ * @returns 0 on success, negative error code otherwise.
+ */
+int sl_prop_cache_init(void);
+
+/**
+ * @brief Register property in cache
+ *
+ * Registering an already cached property only updates its TTL.
+ *
+ * @param node CSP address of the property node.
+ * @param port CSP port of the property node.
+ * @param id ID of the property to cache. Group IDs are not supported.
+ * @param size Size of the property value in bytes.
+ * @param ttl Time in milliseconds a read value is considered fresh.
+ *
+ * @returns 0 on success, negative error code otherwise.
+ */
+int sl_prop_cache_register(uint8_t node, uint8_t port, prop_id_t id, size_t size, uint32_t ttl);
+
+/**
+ * @brief Remove property from cache
+ *
+ * @param node CSP address of the property node.
+ * @param port CSP port of the property node.
+ * @param id ID of the property to remove.
+ *
+ * @returns 0 on success, negative error code otherwise.
+ */
+int sl_prop_cache_unregister(uint8_t node, uint8_t port, prop_id_t id);
+
+/**
+ * @brief Mark cached properties as stale
+ *
+ * @param node CSP address of the property node.
+ * @param port CSP port of the property node.
+ * @param id ID of the property to invalidate, or 0 for all properties of the
+ *	     node and port.
+ */
+void sl_prop_cache_invalidate(uint8_t node, uint8_t port, prop_id_t id);
+
+/**
+ * @brief Get property value through the cache
+ *
+ * If the property is fresh, the value is copied from the cache. Otherwise all
+ * stale properties of the node and port are refreshed in one query first.
+ * Properties that are not registered are read with sl_prop_remote_get.
+ *
+ * @param node CSP address of the property node.
+ * @param port CSP port of the property node.
+ * @param timeout Timeout of the command in milliseconds.
+ * @param id ID of the property to get.
+ * @param value Pointer where result should be stored.
+ * @param size Size of buffer pointed to by value.
+ *
+ * @returns 0 on success, negative error code otherwise.
+ */
+int sl_prop_cache_get(uint8_t node, uint8_t port, uint32_t timeout, prop_id_t id, void *value, size_t size);
+
+/**
+ * @brief Set remote property value and update the cache
+ *
+ * @param node CSP address of the property node.
+ * @param port CSP port of the property node.
+ * @param timeout Timeout of the command in milliseconds.
+ * @param id ID of the property to set.
+ * @param value Pointer to the new property value.
+ * @param size Size of the value pointed to by value.
+ *
+ * @returns 0 on success, negative error code otherwise.
+ */
+int sl_prop_cache_set(uint8_t node, uint8_t port, uint32_t timeout, prop_id_t id, const void *value, size_t size);
+
+/**
+ * @brief Refresh cached properties of a node
+ *
+ * @param node CSP address of the property node.
+ * @param port CSP port of the property node.
+ * @param timeout Timeout of the command in milliseconds.
+ * @param all If true, refresh all properties, otherwise only stale ones.
+ *
+ * A property that can not be added to a query is marked invalid and the
+ * others are still refreshed.
+ *
+ * @returns Number of refreshed properties, negative error code otherwise.
+ */
+int sl_prop_cache_refresh(uint8_t node, uint8_t port, uint32_t timeout, bool all);
+
+/**
+ * @brief Read cache statistics
+ *
+ * @param stats Pointer where statistics are stored.
+ * @param reset If true, counters are cleared after reading.
+ */
+void sl_prop_cache_get_stats(struct sl_prop_cache_stats *stats, bool reset);
+
+#endif /* _SL_PROP_CLIENT_CACHE_H_ */
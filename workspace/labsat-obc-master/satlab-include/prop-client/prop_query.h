@@ -47,6 +47,8 @@
 
 #include <prop-client/prop_spec.h>
 
+#include <csp/csp.h>
+
 /** Maximum number of elements in a query reply */
 #define SL_PROP_QUERY_MAX_ELEMENTS	48
 
@@ -211,4 +213,31 @@ int sl_prop_remote_query_set(struct sl_prop_query *query, prop_id_t id, const vo
  */
 int sl_prop_remote_query_send(struct sl_prop_query *query, uint8_t node, uint8_t port, uint32_t timeout);
 
+/**
+ * @brief Transmit query request frames on an open connection
+ *
+ * Lower level half of sl_prop_remote_query_send, for clients that keep their
+ * own connection open (see prop_session.h). The reply must be fed to
+ * sl_prop_remote_query_receive.
+ *
+ * @param query Query to send.
+ * @param conn Open CSP connection to the property node.
+ *
+ * @returns 0 on success, negative error code otherwise.
+ */
+int sl_prop_remote_query_transmit(struct sl_prop_query *query, csp_conn_t *conn);
+
+/**
+ * @brief Process one reply frame of a transmitted query
+ *
+ * The packet is always freed by this function.
+ *
+ * @param query Query the reply belongs to.
+ * @param packet Reply frame read from the connection.
+ *
+ * @returns 1 if the reply is complete, 0 if more frames are expected, and a
+ * negative error code otherwise.
+ */
+int sl_prop_remote_query_receive(struct sl_prop_query *query, csp_packet_t *packet);
+
 #endif /* _SL_PROP_CLIENT_QUERY_H_ */
@@ -0,0 +1,189 @@
+/**
+ * @file
+ *
+ * A property session lets any task submit requests to a remote node without
+ * blocking. Requests are transmitted back to back by the session task, up to
+ * SL_PROP_SESSION_MAX_INFLIGHT at a time. The protocol has no request tag, so
+ * each request in flight has its own CSP connection: its replies arrive on it,
+ * and a lost or late reply only fails the request it belongs to (on timeout).
+ * Each request also carries the reply type it expects, so stray replies on its
+ * connection are discarded.
+ *
+ * Two kinds of requests are supported:
+ *  - property queries built with the prop_query.h API (GET or SET), and
+ *  - raw single frame request/reply transactions, e.g. the BTP control
+ *    messages from btp/types.h on a session opened to the BTP server port.
+ *
+ * Completed requests are reported through a callback, executed from the
+ * session task, and/or posted to a FreeRTOS queue of request pointers.
+ *
+ * @code{.cpp}
+ * static struct sl_prop_session radio;
+ * static struct sl_prop_request req;
+ * static struct sl_prop_query query;
+ * static uint8_t txbuf[64], rxbuf[128];
+ * struct sl_prop_request *done;
+ * xQueueHandle q = xQueueCreate(4, sizeof(struct sl_prop_request *));
+ *
+ * sl_prop_session_open(&radio, node, SL_PROP_DEFAULT_PORT, 1000, CSP_O_NONE);
+ * sl_prop_remote_query_create_static(&query, txbuf, sizeof(txbuf), rxbuf, sizeof(rxbuf));
+ * sl_prop_remote_query_get(&query, SL_SRS4_PROP_TM_TEMP_PSU);
+ * sl_prop_session_query(&radio, &req, &query, NULL, NULL, q);
+ *
+ * // ... do other work, then collect the reply
+ * xQueueReceive(q, &done, portMAX_DELAY);
+ * if (done->result == 0)
+ *	sl_prop_remote_query_get_reply(&query, SL_SRS4_PROP_TM_TEMP_PSU, &temp, sizeof(temp));
+ * @endcode
+ */
+
+#ifndef _SL_PROP_CLIENT_SESSION_H_
+#define _SL_PROP_CLIENT_SESSION_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <csp/csp.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#include <prop-client/prop_query.h>
+
+/** Maximum number of requests transmitted and waiting for a reply */
+#define SL_PROP_SESSION_MAX_INFLIGHT	4
+
+/** Number of submitted requests waiting for transmission */
+#define SL_PROP_SESSION_QUEUE_LEN	8
+
+/** Interval in milliseconds the session task polls for replies */
+#define SL_PROP_SESSION_POLL_MS		10
+
+/** Session task stack depth and priority */
+#define SL_PROP_SESSION_STACK_SIZE	(configMINIMAL_STACK_SIZE * 2)
+#define SL_PROP_SESSION_PRIORITY	(configMAX_PRIORITIES - 3)
+
+/** @brief Request types */
+enum sl_prop_request_type {
+	SL_PROP_REQUEST_QUERY = 1,	/**< Property get/set query */
+	SL_PROP_REQUEST_RAW = 2,	/**< Single frame request and reply */
+};
+
+struct sl_prop_request;
+
+/**
+ * @brief Request completion callback
+ *
+ * Executed from the session task. Do not block in this function.
+ *
+ * @param req Completed request. req->result holds the outcome.
+ * @param arg Pointer value passed when the request was submitted.
+ */
+typedef void (*sl_prop_request_cb)(struct sl_prop_request *req, void *arg);
+
+/** @brief Request state - owned by the caller, must stay valid until completed */
+struct sl_prop_request {
+	enum sl_prop_request_type type;
+	int result;			/**< 0 (query) or reply length (raw) on success, negative error code otherwise */
+	bool complete;			/**< Set when result is valid */
+	struct sl_prop_query *query;	/**< Query of SL_PROP_REQUEST_QUERY requests */
+	const void *outbuf;		/**< Request frame of SL_PROP_REQUEST_RAW requests */
+	size_t outlen;
+	void *inbuf;			/**< Reply buffer of SL_PROP_REQUEST_RAW requests */
+	size_t inlen;
+	uint8_t reply_type;		/**< Expected first byte of the reply, 0 to accept any */
+	uint32_t sent;			/**< csp_get_ms() at transmission */
+	sl_prop_request_cb callback;
+	void *arg;
+	xQueueHandle done;
+};
+
+/** @brief Session state - should not be directly modified */
+struct sl_prop_session {
+	uint8_t node;
+	uint8_t port;
+	uint32_t timeout;
+	uint32_t opts;
+	xQueueHandle requests;
+	xTaskHandle task;
+	struct sl_prop_request *inflight[SL_PROP_SESSION_MAX_INFLIGHT];	/**< NULL if the slot is free */
+	csp_conn_t *conns[SL_PROP_SESSION_MAX_INFLIGHT];		/**< Connection of each request in flight */
+	unsigned int count;
+	volatile bool running;
+	uint32_t completed;		/**< Requests completed successfully */
+	uint32_t failed;		/**< Requests completed with an error */
+	uint32_t timeouts;		/**< Reply timeouts */
+	uint32_t dropped;		/**< Unexpected reply frames discarded */
+};
+
+/**
+ * @brief Open session to a remote node
+ *
+ * Starts the session task. Connections are opened per request.
+ *
+ * @param session Session to initialize.
+ * @param node CSP address of the remote node.
+ * @param port CSP port of the remote service.
+ * @param timeout Reply timeout of each request in milliseconds.
+ * @param opts CSP connection options of the requests.
+ *
+ * @returns 0 on success, negative error code otherwise.
+ */
+int sl_prop_session_open(struct sl_prop_session *session, uint8_t node, uint8_t port, uint32_t timeout, uint32_t opts);
+
+/**
+ * @brief Close session
+ *
+ * Pending requests are completed with -ECANCELED. Blocks until the session
+ * task has finished.
+ *
+ * @param session Session to close.
+ *
+ * @returns 0 on success, negative error code otherwise.
+ */
+int sl_prop_session_close(struct sl_prop_session *session);
+
+/**
+ * @brief Submit property query
+ *
+ * The query must have been prepared with sl_prop_remote_query_get or
+ * sl_prop_remote_query_set. Replies can be read from the query with
+ * sl_prop_remote_query_get_reply once the request is complete.
+ *
+ * @param session Open session.
+ * @param req Request state.
+ * @param query Query to send.
+ * @param cb Completion callback, or NULL.
+ * @param arg Pointer passed to cb.
+ * @param done Queue where req is posted on completion, or NULL.
+ *
+ * @returns 0 if queued, -EAGAIN if the submit queue is full, or another
+ * negative error code.
+ */
+int sl_prop_session_query(struct sl_prop_session *session, struct sl_prop_request *req, struct sl_prop_query *query,
+			  sl_prop_request_cb cb, void *arg, xQueueHandle done);
+
+/**
+ * @brief Submit raw single frame transaction
+ *
+ * @param session Open session.
+ * @param req Request state.
+ * @param outbuf Request frame.
+ * @param outlen Size of request frame.
+ * @param inbuf Buffer for the reply frame.
+ * @param inlen Size of inbuf.
+ * @param reply_type Expected first byte of the reply (e.g. BTP_STAT_PUSH_REPLY), 0 to accept any.
+ * @param cb Completion callback, or NULL.
+ * @param arg Pointer passed to cb.
+ * @param done Queue where req is posted on completion, or NULL.
+ *
+ * @returns 0 if queued, -EAGAIN if the submit queue is full, or another
+ * negative error code.
+ */
+int sl_prop_session_raw(struct sl_prop_session *session, struct sl_prop_request *req,
+			const void *outbuf, size_t outlen, void *inbuf, size_t inlen, uint8_t reply_type,
+			sl_prop_request_cb cb, void *arg, xQueueHandle done);
+
+#endif /* _SL_PROP_CLIENT_SESSION_H_ */
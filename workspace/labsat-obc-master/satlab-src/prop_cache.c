@@ -0,0 +1,353 @@
+#include <prop-client/prop_cache.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <csp/csp.h>
+#include <csp/arch/csp_time.h>
+
+#include <prop-client/prop_client.h>
+#include <prop-client/prop_query.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+/** @brief Cached property */
+struct sl_prop_cache_entry {
+	prop_id_t id;			/**< Property ID, 0 for unused entries */
+	uint8_t node;
+	uint8_t port;
+	bool valid;			/**< Value has been read at least once */
+	uint8_t size;			/**< Size of value in bytes */
+	uint32_t ttl;			/**< Time to live in milliseconds */
+	uint32_t stamp;			/**< csp_get_ms() of last refresh */
+	uint8_t value[SL_PROP_CACHE_VALUE_SIZE];
+};
+
+static struct sl_prop_cache_entry cache[SL_PROP_CACHE_MAX_ENTRIES];
+static struct sl_prop_cache_stats stats;
+static xSemaphoreHandle cache_lock = NULL;
+
+/* Refresh queries are serialized by query_lock, which also owns the query
+ * buffers (kept off the caller task stack). cache_lock only guards the entries
+ * and is never held during a round trip, so reads that hit the cache do not
+ * wait for a slow node. Lock order: query_lock, then cache_lock. */
+static xSemaphoreHandle query_lock = NULL;
+static uint8_t cache_txbuf[2 * SL_PROP_QUERY_MAX_ELEMENTS];
+static uint8_t cache_rxbuf[SL_PROP_CACHE_RXBUF_SIZE];
+
+static struct sl_prop_cache_entry *sl_prop_cache_find(uint8_t node, uint8_t port, prop_id_t id)
+{
+	size_t i;
+
+	for (i = 0; i < SL_PROP_CACHE_MAX_ENTRIES; i++) {
+		if (cache[i].id == id && cache[i].node == node && cache[i].port == port)
+			return &cache[i];
+	}
+
+	return NULL;
+}
+
+static bool sl_prop_cache_stale(const struct sl_prop_cache_entry *e, uint32_t now)
+{
+	if (!e->valid)
+		return true;
+
+	if (e->ttl == SL_PROP_CACHE_TTL_FOREVER)
+		return false;
+
+	/* Unsigned subtraction handles csp_get_ms() wrap-around */
+	return (now - e->stamp) >= e->ttl;
+}
+
+/* Size of the packed reply for a cached property: ID, optional length field
+ * for variable size types, and the value itself */
+static size_t sl_prop_cache_reply_size(prop_id_t id, size_t size)
+{
+	prop_type_t type = PROP_TYPE(id);
+
+	if (type == PROP_TYPE_STRING || type == PROP_TYPE_BINARY)
+		return sizeof(uint16_t) + sizeof(uint16_t) + size;
+
+	return sizeof(uint16_t) + size;
+}
+
+/* Mark a property that could not be refreshed. Must be called with cache_lock
+ * held. */
+static void sl_prop_cache_fail(uint8_t node, uint8_t port, prop_id_t id)
+{
+	struct sl_prop_cache_entry *e = sl_prop_cache_find(node, port, id);
+
+	if (e)
+		e->valid = false;
+}
+
+/* Must be called without cache_lock held. The properties to refresh are
+ * copied first; entries unregistered or resized during a round trip are
+ * skipped when the reply is stored. */
+static int sl_prop_cache_refresh_node(uint8_t node, uint8_t port, uint32_t timeout, bool all)
+{
+	int ret = 0, refreshed = 0;
+	size_t i, n = 0, first = 0, rxsize, count;
+	uint32_t now;
+	struct sl_prop_query query;
+	struct sl_prop_cache_entry *e;
+	prop_id_t ids[SL_PROP_CACHE_MAX_ENTRIES];
+	uint8_t sizes[SL_PROP_CACHE_MAX_ENTRIES];
+
+	xSemaphoreTake(query_lock, portMAX_DELAY);
+
+	xSemaphoreTake(cache_lock, portMAX_DELAY);
+	now = csp_get_ms();
+	for (i = 0; i < SL_PROP_CACHE_MAX_ENTRIES; i++) {
+		e = &cache[i];
+		if (e->id && e->node == node && e->port == port &&
+		    (all || sl_prop_cache_stale(e, now))) {
+			ids[n] = e->id;
+			sizes[n] = e->size;
+			n++;
+		}
+	}
+	xSemaphoreGive(cache_lock);
+
+	/* Refresh in as few queries as the reply buffer allows */
+	while (first < n) {
+		ret = sl_prop_remote_query_create_static(&query, cache_txbuf, sizeof(cache_txbuf),
+							 cache_rxbuf, sizeof(cache_rxbuf));
+		if (ret < 0)
+			break;
+
+		rxsize = 0;
+		count = 0;
+		for (i = first; i < n; i++) {
+			if (rxsize + sl_prop_cache_reply_size(ids[i], sizes[i]) > sizeof(cache_rxbuf) ||
+			    count == SL_PROP_QUERY_MAX_ELEMENTS)
+				break;
+			if (sl_prop_remote_query_get(&query, ids[i]) < 0)
+				break;
+			rxsize += sl_prop_cache_reply_size(ids[i], sizes[i]);
+			count++;
+		}
+
+		if (count == 0) {
+			/* This property can not be queried at all: skip it and
+			 * go on with the others */
+			sl_prop_remote_query_destroy(&query);
+			xSemaphoreTake(cache_lock, portMAX_DELAY);
+			sl_prop_cache_fail(node, port, ids[first]);
+			stats.errors++;
+			xSemaphoreGive(cache_lock);
+			first++;
+			continue;
+		}
+
+		ret = sl_prop_remote_query_send(&query, node, port, timeout);
+
+		xSemaphoreTake(cache_lock, portMAX_DELAY);
+		stats.round_trips++;
+		if (ret < 0) {
+			stats.errors++;
+			xSemaphoreGive(cache_lock);
+			sl_prop_remote_query_destroy(&query);
+			break;
+		}
+		stats.round_trips_saved += count - 1;
+
+		now = csp_get_ms();
+		for (; first < i; first++) {
+			e = sl_prop_cache_find(node, port, ids[first]);
+			if (!e || e->size != sizes[first])
+				continue;
+			if (sl_prop_remote_query_get_reply(&query, e->id, e->value, e->size) < 0) {
+				e->valid = false;
+				continue;
+			}
+			e->valid = true;
+			e->stamp = now;
+			refreshed++;
+			stats.refreshed++;
+		}
+		xSemaphoreGive(cache_lock);
+
+		sl_prop_remote_query_destroy(&query);
+	}
+
+	xSemaphoreGive(query_lock);
+
+	return ret < 0 ? ret : refreshed;
+}
+
+int sl_prop_cache_init(void)
+{
+	if (!cache_lock) {
+		cache_lock = xSemaphoreCreateMutex();
+		if (!cache_lock)
+			return -ENOMEM;
+	}
+	if (!query_lock) {
+		query_lock = xSemaphoreCreateMutex();
+		if (!query_lock)
+			return -ENOMEM;
+	}
+
+	xSemaphoreTake(cache_lock, portMAX_DELAY);
+	memset(cache, 0, sizeof(cache));
+	memset(&stats, 0, sizeof(stats));
+	xSemaphoreGive(cache_lock);
+
+	return 0;
+}
+
+int sl_prop_cache_register(uint8_t node, uint8_t port, prop_id_t id, size_t size, uint32_t ttl)
+{
+	struct sl_prop_cache_entry *e;
+
+	if (!cache_lock || !id || !size || size > SL_PROP_CACHE_VALUE_SIZE)
+		return -EINVAL;
+
+	xSemaphoreTake(cache_lock, portMAX_DELAY);
+	e = sl_prop_cache_find(node, port, id);
+	if (!e) {
+		e = sl_prop_cache_find(0, 0, 0);
+		if (!e) {
+			xSemaphoreGive(cache_lock);
+			return -ENOSPC;
+		}
+		e->id = id;
+		e->node = node;
+		e->port = port;
+		e->valid = false;
+	}
+	if (e->size != size)
+		e->valid = false;
+	e->size = size;
+	e->ttl = ttl;
+	xSemaphoreGive(cache_lock);
+
+	return 0;
+}
+
+int sl_prop_cache_unregister(uint8_t node, uint8_t port, prop_id_t id)
+{
+	struct sl_prop_cache_entry *e;
+
+	if (!cache_lock || !id)
+		return -EINVAL;
+
+	xSemaphoreTake(cache_lock, portMAX_DELAY);
+	e = sl_prop_cache_find(node, port, id);
+	if (e)
+		memset(e, 0, sizeof(*e));
+	xSemaphoreGive(cache_lock);
+
+	return e ? 0 : -ENOENT;
+}
+
+void sl_prop_cache_invalidate(uint8_t node, uint8_t port, prop_id_t id)
+{
+	size_t i;
+
+	if (!cache_lock)
+		return;
+
+	xSemaphoreTake(cache_lock, portMAX_DELAY);
+	for (i = 0; i < SL_PROP_CACHE_MAX_ENTRIES; i++) {
+		if (cache[i].id && cache[i].node == node && cache[i].port == port &&
+		    (!id || cache[i].id == id))
+			cache[i].valid = false;
+	}
+	xSemaphoreGive(cache_lock);
+}
+
+int sl_prop_cache_get(uint8_t node, uint8_t port, uint32_t timeout, prop_id_t id, void *value, size_t size)
+{
+	int ret = 0;
+	struct sl_prop_cache_entry *e;
+
+	if (!cache_lock || !query_lock)
+		return sl_prop_remote_get(node, port, timeout, id, value, size);
+
+	xSemaphoreTake(cache_lock, portMAX_DELAY);
+	e = sl_prop_cache_find(node, port, id);
+	if (!e || !id) {
+		xSemaphoreGive(cache_lock);
+		return sl_prop_remote_get(node, port, timeout, id, value, size);
+	}
+
+	if (e->size != size) {
+		xSemaphoreGive(cache_lock);
+		return -ENOSPC;
+	}
+
+	if (sl_prop_cache_stale(e, csp_get_ms())) {
+		stats.misses++;
+		xSemaphoreGive(cache_lock);
+		ret = sl_prop_cache_refresh_node(node, port, timeout, false);
+		xSemaphoreTake(cache_lock, portMAX_DELAY);
+		/* The entry may have changed while the lock was released */
+		e = sl_prop_cache_find(node, port, id);
+		if (ret >= 0 && (!e || e->size != size || !e->valid))
+			ret = -EIO;
+	} else {
+		stats.hits++;
+		stats.round_trips_saved++;
+	}
+
+	if (ret >= 0) {
+		memcpy(value, e->value, size);
+		ret = 0;
+	}
+	xSemaphoreGive(cache_lock);
+
+	return ret;
+}
+
+int sl_prop_cache_set(uint8_t node, uint8_t port, uint32_t timeout, prop_id_t id, const void *value, size_t size)
+{
+	int ret;
+	struct sl_prop_cache_entry *e;
+
+	ret = sl_prop_remote_set(node, port, timeout, id, value, size);
+
+	if (!cache_lock)
+		return ret;
+
+	xSemaphoreTake(cache_lock, portMAX_DELAY);
+	e = sl_prop_cache_find(node, port, id);
+	if (e && id) {
+		/* On failure the remote value is unknown, so force a re-read */
+		if (ret == 0 && e->size == size) {
+			memcpy(e->value, value, size);
+			e->valid = true;
+			e->stamp = csp_get_ms();
+		} else {
+			e->valid = false;
+		}
+	}
+	xSemaphoreGive(cache_lock);
+
+	return ret;
+}
+
+int sl_prop_cache_refresh(uint8_t node, uint8_t port, uint32_t timeout, bool all)
+{
+	if (!cache_lock || !query_lock)
+		return -EINVAL;
+
+	return sl_prop_cache_refresh_node(node, port, timeout, all);
+}
+
+void sl_prop_cache_get_stats(struct sl_prop_cache_stats *s, bool reset)
+{
+	if (!cache_lock) {
+		memset(s, 0, sizeof(*s));
+		return;
+	}
+
+	xSemaphoreTake(cache_lock, portMAX_DELAY);
+	memcpy(s, &stats, sizeof(*s));
+	if (reset)
+		memset(&stats, 0, sizeof(stats));
+	xSemaphoreGive(cache_lock);
+}
@@ -351,17 +351,23 @@ int sl_prop_remote_query_destroy(struct sl_prop_query *query)
 	return 0;
 }
 
-static int sl_prop_remote_query_send_get(struct sl_prop_query *query, uint8_t node, uint8_t port, uint32_t timeout)
+int sl_prop_remote_query_transmit(struct sl_prop_query *query, csp_conn_t *conn)
 {
-	sl_prop_get_req_t *request;
-	sl_prop_get_rep_t *reply;
-	csp_conn_t *conn;
+	sl_prop_get_req_t *getreq;
+	sl_prop_set_req_t *setreq;
 	csp_packet_t *packet;
-	size_t sent = 0, received = 0, datasize, remain;
+	size_t sent = 0, hdrsize, datasize, remain;
+	uint8_t *data;
 
-	conn = csp_connect(CSP_PRIO_NORM, node, port, timeout, CSP_O_NONE);
-	if (!conn)
-		return -ECONNREFUSED;
+	if (!query || !conn)
+		return -EINVAL;
+
+	if (query->type == SL_PROP_QUERY_GET)
+		hdrsize = sizeof(*getreq);
+	else if (query->type == SL_PROP_QUERY_SET)
+		hdrsize = sizeof(*setreq);
+	else
+		return -EINVAL;
 
 	remain = (query->txsize + query->chunksize - 1) / query->chunksize;
 
@@ -370,135 +376,132 @@ static int sl_prop_remote_query_send_get(struct sl_prop_query *query, uint8_t no
 			datasize = query->chunksize;
 		else
 			datasize = query->txsize - sent;
-		packet = csp_buffer_get(sizeof(*request) + datasize);
-		if (!packet) {
-			csp_close(conn);
+		packet = csp_buffer_get(hdrsize + datasize);
+		if (!packet)
 			return -ENOMEM;
-		}
 
-		request = (sl_prop_get_req_t *)packet->data;
-		request->type = SL_PROP_GET_REQUEST;
-		request->flags = (!sent ? SL_PROP_FLAG_BEGIN : 0) | query->flags;
-		request->chunksize = query->chunksize;
-		request->remain = --remain;
+		if (query->type == SL_PROP_QUERY_GET) {
+			getreq = (sl_prop_get_req_t *)packet->data;
+			getreq->type = SL_PROP_GET_REQUEST;
+			getreq->flags = (!sent ? SL_PROP_FLAG_BEGIN : 0) | query->flags;
+			getreq->chunksize = query->chunksize;
+			getreq->remain = --remain;
+			data = getreq->data;
+		} else {
+			setreq = (sl_prop_set_req_t *)packet->data;
+			setreq->type = SL_PROP_SET_REQUEST;
+			setreq->flags = (!sent ? SL_PROP_FLAG_BEGIN : 0) | query->flags;
+			setreq->remain = --remain;
+			data = setreq->data;
+		}
 
-		memcpy(request->data, &query->txbuf[sent], datasize);
-		packet->length = sizeof(*request) + datasize;
+		memcpy(data, &query->txbuf[sent], datasize);
+		packet->length = hdrsize + datasize;
 
 		csp_send(conn, packet);
-		
+
 		sent += datasize;
 	}
 
-	query->rxsize = query->rxbufsize;
-	while (received < query->rxsize) {
-		packet = csp_read(conn, timeout);
-		if (!packet) {
-			csp_close(conn);
-			return -ETIMEDOUT;
-		}
+	/* Reply data is accumulated from the start of the receive buffer */
+	query->rxsize = 0;
+	query->elements = 0;
 
-		reply = (sl_prop_get_rep_t *)packet->data;
-		if (reply->type != SL_PROP_GET_REPLY) {
-			csp_buffer_free(packet);
-			csp_close(conn);
-			return -EINVAL;
-		}
+	return 0;
+}
 
-		if (reply->error != SL_PROP_ERR_NONE) {
-			csp_buffer_free(packet);
-			csp_close(conn);
-			return -reply->error;
-		}
+int sl_prop_remote_query_receive(struct sl_prop_query *query, csp_packet_t *packet)
+{
+	sl_prop_get_rep_t *getrep;
+	sl_prop_set_rep_t *setrep;
+	size_t datasize;
+	int ret;
 
-		remain = reply->remain;
+	if (!query || !packet)
+		return -EINVAL;
 
-		datasize = packet->length - sizeof(*reply);
-		if (received + datasize > query->rxsize) {
-			csp_buffer_free(packet);
-			csp_close(conn);
-			return -ENOSPC;
-		}
+	if (query->type == SL_PROP_QUERY_SET) {
+		setrep = (sl_prop_set_rep_t *)packet->data;
+		if (setrep->type != SL_PROP_SET_REPLY)
+			ret = -EINVAL;
+		else if (setrep->error != SL_PROP_ERR_NONE)
+			ret = -setrep->error;
+		else
+			ret = 1;
+		csp_buffer_free(packet);
+		return ret;
+	}
 
-		memcpy(&query->rxbuf[received], reply->data, datasize);
+	if (query->type != SL_PROP_QUERY_GET) {
+		csp_buffer_free(packet);
+		return -EINVAL;
+	}
 
+	getrep = (sl_prop_get_rep_t *)packet->data;
+	if (getrep->type != SL_PROP_GET_REPLY) {
 		csp_buffer_free(packet);
+		return -EINVAL;
+	}
 
-		received += datasize;
+	if (getrep->error != SL_PROP_ERR_NONE) {
+		ret = -getrep->error;
+		csp_buffer_free(packet);
+		return ret;
+	}
 
-		if (remain == 0)
-			break;
+	datasize = packet->length - sizeof(*getrep);
+	if (query->rxsize + datasize > query->rxbufsize) {
+		csp_buffer_free(packet);
+		return -ENOSPC;
 	}
 
-	csp_close(conn);
+	memcpy(&query->rxbuf[query->rxsize], getrep->data, datasize);
+	query->rxsize += datasize;
+
+	/* Wait for more frames unless this was the last one or the buffer is full */
+	if (getrep->remain != 0 && query->rxsize < query->rxbufsize) {
+		csp_buffer_free(packet);
+		return 0;
+	}
+
+	csp_buffer_free(packet);
 
 	/* Unpack buffer */
-	query->rxsize = received;
-	return sl_prop_remote_query_unpack_buffer(query, query->rxbuf, query->rxsize);
+	ret = sl_prop_remote_query_unpack_buffer(query, query->rxbuf, query->rxsize);
+	if (ret < 0)
+		return ret;
+
+	return 1;
 }
 
-static int sl_prop_remote_query_send_set(struct sl_prop_query *query, uint8_t node, uint8_t port, uint32_t timeout)
+static int sl_prop_remote_query_send_receive(struct sl_prop_query *query, uint8_t node, uint8_t port, uint32_t timeout)
 {
-	sl_prop_set_req_t *request;
-	sl_prop_set_rep_t *reply;
 	csp_conn_t *conn;
 	csp_packet_t *packet;
-	size_t sent = 0, datasize, remain;
+	int ret;
 
 	conn = csp_connect(CSP_PRIO_NORM, node, port, timeout, CSP_O_NONE);
 	if (!conn)
 		return -ECONNREFUSED;
 
-	remain = (query->txsize + query->chunksize - 1) / query->chunksize;
+	ret = sl_prop_remote_query_transmit(query, conn);
+	if (ret < 0) {
+		csp_close(conn);
+		return ret;
+	}
 
-	while (sent < query->txsize) {
-		if (query->txsize - sent > query->chunksize)
-			datasize = query->chunksize;
-		else
-			datasize = query->txsize - sent;
-		packet = csp_buffer_get(sizeof(*request) + datasize);
+	do {
+		packet = csp_read(conn, timeout);
 		if (!packet) {
 			csp_close(conn);
-			return -ENOMEM;
+			return -ETIMEDOUT;
 		}
-
-		request = (sl_prop_set_req_t *)packet->data;
-		request->type = SL_PROP_SET_REQUEST;
-		request->flags = (!sent ? SL_PROP_FLAG_BEGIN : 0) | query->flags;
-		request->remain = --remain;
-
-		memcpy(request->data, &query->txbuf[sent], datasize);
-		packet->length = sizeof(*request) + datasize;
-
-		csp_send(conn, packet);
-
-		sent += datasize;
-	}
-
-	packet = csp_read(conn, timeout);
-	if (!packet) {
-		csp_close(conn);
-		return -ETIMEDOUT;
-	}
-
-	reply = (sl_prop_set_rep_t *)packet->data;
-	if (reply->type != SL_PROP_SET_REPLY) {
-		csp_buffer_free(packet);
-		csp_close(conn);
-		return -EINVAL;
-	}
-
-	if (reply->error != SL_PROP_ERR_NONE) {
-		csp_buffer_free(packet);
-		csp_close(conn);
-		return -reply->error;
-	}
-
-	csp_buffer_free(packet);
+		ret = sl_prop_remote_query_receive(query, packet);
+	} while (ret == 0);
 
 	csp_close(conn);
 
-	return 0;
+	return ret < 0 ? ret : 0;
 }
 
 int sl_prop_remote_query_send(struct sl_prop_query *query, uint8_t node, uint8_t port, uint32_t timeout)
@@ -506,12 +509,10 @@ int sl_prop_remote_query_send(struct sl_prop_query *query, uint8_t node, uint8_t
 	if (!query)
 		return -EINVAL;
 
-	if (query->type == SL_PROP_QUERY_GET)
-		return sl_prop_remote_query_send_get(query, node, port, timeout);
-	else if (query->type == SL_PROP_QUERY_SET)
-		return sl_prop_remote_query_send_set(query, node, port, timeout);
-	else
+	if (query->type != SL_PROP_QUERY_GET && query->type != SL_PROP_QUERY_SET)
 		return -EINVAL;
+
+	return sl_prop_remote_query_send_receive(query, node, port, timeout);
 }
 
 int sl_prop_remote_query_get(struct sl_prop_query *query, prop_id_t id)
@@ -0,0 +1,273 @@
+#include <prop-client/prop_session.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <csp/csp.h>
+#include <csp/arch/csp_time.h>
+
+#include <prop-client/prop_proto.h>
+
+static void sl_prop_session_complete(struct sl_prop_session *s, struct sl_prop_request *req, int result)
+{
+	req->result = result;
+	req->complete = true;
+
+	if (result < 0)
+		s->failed++;
+	else
+		s->completed++;
+
+	if (req->callback)
+		req->callback(req, req->arg);
+	if (req->done)
+		xQueueSend(req->done, &req, 0);
+}
+
+/* Complete the request in a window slot. Its connection is closed, so late
+ * replies to it are discarded by CSP */
+static void sl_prop_session_finish(struct sl_prop_session *s, unsigned int slot, int result)
+{
+	struct sl_prop_request *req = s->inflight[slot];
+
+	csp_close(s->conns[slot]);
+	s->conns[slot] = NULL;
+	s->inflight[slot] = NULL;
+	s->count--;
+
+	sl_prop_session_complete(s, req, result);
+}
+
+/* Each request has its own connection, so a lost or late reply only affects
+ * the request it belongs to */
+static int sl_prop_session_transmit(struct sl_prop_session *s, struct sl_prop_request *req, csp_conn_t **connp)
+{
+	csp_packet_t *packet;
+	csp_conn_t *conn;
+	int ret = 0;
+
+	conn = csp_connect(CSP_PRIO_NORM, s->node, s->port, s->timeout, s->opts);
+	if (!conn)
+		return -ECONNREFUSED;
+
+	if (req->type == SL_PROP_REQUEST_QUERY) {
+		ret = sl_prop_remote_query_transmit(req->query, conn);
+	} else if ((packet = csp_buffer_get(req->outlen))) {
+		memcpy(packet->data, req->outbuf, req->outlen);
+		packet->length = req->outlen;
+		csp_send(conn, packet);
+	} else {
+		ret = -ENOMEM;
+	}
+
+	if (ret < 0) {
+		csp_close(conn);
+		return ret;
+	}
+
+	*connp = conn;
+	return 0;
+}
+
+/* Returns true if the request in the slot was completed */
+static bool sl_prop_session_receive(struct sl_prop_session *s, unsigned int slot, csp_packet_t *packet)
+{
+	struct sl_prop_request *req = s->inflight[slot];
+	int ret;
+
+	if (packet->length < 1 || (req->reply_type && packet->data[0] != req->reply_type)) {
+		s->dropped++;
+		csp_buffer_free(packet);
+		return false;
+	}
+
+	if (req->type == SL_PROP_REQUEST_QUERY) {
+		/* Multi-frame replies keep the request in the window */
+		ret = sl_prop_remote_query_receive(req->query, packet);
+		if (ret == 0)
+			return false;
+		sl_prop_session_finish(s, slot, ret < 0 ? ret : 0);
+		return true;
+	}
+
+	if (packet->length > req->inlen) {
+		ret = -EMSGSIZE;
+	} else {
+		memcpy(req->inbuf, packet->data, packet->length);
+		ret = packet->length;
+	}
+	csp_buffer_free(packet);
+	sl_prop_session_finish(s, slot, ret);
+	return true;
+}
+
+static void sl_prop_session_task(void *param)
+{
+	struct sl_prop_session *s = param;
+	struct sl_prop_request *req;
+	csp_packet_t *packet;
+	portTickType wait;
+	unsigned int slot;
+	bool received;
+	int ret;
+
+	for (;;) {
+		/* Fill the window. Block only when nothing is waiting for a reply */
+		while (s->count < SL_PROP_SESSION_MAX_INFLIGHT) {
+			wait = s->count ? 0 : portMAX_DELAY;
+			if (xQueueReceive(s->requests, &req, wait) != pdTRUE)
+				break;
+			if (!req)
+				goto out;
+
+			for (slot = 0; s->inflight[slot]; slot++)
+				;
+			ret = sl_prop_session_transmit(s, req, &s->conns[slot]);
+			if (ret < 0) {
+				sl_prop_session_complete(s, req, ret);
+				continue;
+			}
+
+			req->sent = csp_get_ms();
+			s->inflight[slot] = req;
+			s->count++;
+		}
+
+		if (!s->count)
+			continue;
+
+		received = false;
+		for (slot = 0; slot < SL_PROP_SESSION_MAX_INFLIGHT; slot++) {
+			if (!s->inflight[slot])
+				continue;
+			while ((packet = csp_read(s->conns[slot], 0))) {
+				received = true;
+				if (sl_prop_session_receive(s, slot, packet))
+					break;
+			}
+			if (s->inflight[slot] && csp_get_ms() - s->inflight[slot]->sent >= s->timeout) {
+				s->timeouts++;
+				sl_prop_session_finish(s, slot, -ETIMEDOUT);
+			}
+		}
+
+		/* Poll again after SL_PROP_SESSION_POLL_MS, or as soon as a
+		 * request is submitted while the window has room */
+		if (!received && s->count) {
+			if (s->count < SL_PROP_SESSION_MAX_INFLIGHT)
+				xQueuePeek(s->requests, &req, SL_PROP_SESSION_POLL_MS / portTICK_RATE_MS);
+			else
+				vTaskDelay(SL_PROP_SESSION_POLL_MS / portTICK_RATE_MS);
+		}
+	}
+
+out:
+	for (slot = 0; slot < SL_PROP_SESSION_MAX_INFLIGHT; slot++)
+		if (s->inflight[slot])
+			sl_prop_session_finish(s, slot, -ECANCELED);
+	while (xQueueReceive(s->requests, &req, 0) == pdTRUE)
+		if (req)
+			sl_prop_session_complete(s, req, -ECANCELED);
+
+	s->running = false;
+	vTaskDelete(NULL);
+}
+
+static int sl_prop_session_submit(struct sl_prop_session *s, struct sl_prop_request *req,
+				  sl_prop_request_cb cb, void *arg, xQueueHandle done)
+{
+	if (!s->running)
+		return -ENOTCONN;
+
+	req->callback = cb;
+	req->arg = arg;
+	req->done = done;
+	req->result = 0;
+	req->complete = false;
+
+	if (xQueueSend(s->requests, &req, 0) != pdTRUE)
+		return -EAGAIN;
+
+	return 0;
+}
+
+int sl_prop_session_open(struct sl_prop_session *s, uint8_t node, uint8_t port, uint32_t timeout, uint32_t opts)
+{
+	if (!s)
+		return -EINVAL;
+
+	memset(s, 0, sizeof(*s));
+	s->node = node;
+	s->port = port;
+	s->timeout = timeout;
+	s->opts = opts;
+
+	s->requests = xQueueCreate(SL_PROP_SESSION_QUEUE_LEN, sizeof(struct sl_prop_request *));
+	if (!s->requests)
+		return -ENOMEM;
+
+	s->running = true;
+	if (xTaskCreate(sl_prop_session_task, "sl_prop_session", SL_PROP_SESSION_STACK_SIZE,
+			s, SL_PROP_SESSION_PRIORITY, &s->task) != pdPASS) {
+		s->running = false;
+		vQueueDelete(s->requests);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+int sl_prop_session_close(struct sl_prop_session *s)
+{
+	struct sl_prop_request *stop = NULL;
+
+	if (!s || !s->running)
+		return -EINVAL;
+
+	xQueueSend(s->requests, &stop, portMAX_DELAY);
+	while (s->running)
+		vTaskDelay(1);
+
+	vQueueDelete(s->requests);
+	s->requests = NULL;
+	s->task = NULL;
+
+	return 0;
+}
+
+int sl_prop_session_query(struct sl_prop_session *s, struct sl_prop_request *req, struct sl_prop_query *query,
+			  sl_prop_request_cb cb, void *arg, xQueueHandle done)
+{
+	if (!s || !req || !query)
+		return -EINVAL;
+
+	req->type = SL_PROP_REQUEST_QUERY;
+	req->query = query;
+	if (query->type == SL_PROP_QUERY_GET)
+		req->reply_type = SL_PROP_GET_REPLY;
+	else if (query->type == SL_PROP_QUERY_SET)
+		req->reply_type = SL_PROP_SET_REPLY;
+	else
+		return -EINVAL;
+
+	return sl_prop_session_submit(s, req, cb, arg, done);
+}
+
+int sl_prop_session_raw(struct sl_prop_session *s, struct sl_prop_request *req,
+			const void *outbuf, size_t outlen, void *inbuf, size_t inlen, uint8_t reply_type,
+			sl_prop_request_cb cb, void *arg, xQueueHandle done)
+{
+	if (!s || !req || !outbuf || !outlen || !inbuf)
+		return -EINVAL;
+
+	req->type = SL_PROP_REQUEST_RAW;
+	req->query = NULL;
+	req->outbuf = outbuf;
+	req->outlen = outlen;
+	req->inbuf = inbuf;
+	req->inlen = inlen;
+	req->reply_type = reply_type;
+
+	return sl_prop_session_submit(s, req, cb, arg, done);
+}
@@ -0,0 +1,411 @@
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <hal/errors.h>
+#include <hal/checksum.h>
+#include <hal/Storage/FRAM.h>
+#include <hal/Timing/Time.h>
+#include "BlockLog.h"
+#include "SDManager.h"
+
+#ifdef BLOCKLOG_HOST
+	// power-loss harness build (blocklog-bench.c): one task, and FRAM, files, clock and
+	// SDManagerSync are the harness fakes
+	#include <stdio.h>
+	#define blLockCreate(l) 1
+	#define blLockDelete(l)
+	#define blLock(l)
+	#define blUnlock(l)
+	#define UPLOG_ERR(fmt,...) fprintf(stderr,fmt "\n",__VA_ARGS__)
+	#define UPLOG_CRIT UPLOG_ERR
+	#define UPLOG_INFO(fmt,...)
+#else
+	#include <freertos/semphr.h>
+	#include "LogManager.h"
+	#define blLockCreate(l) ( (l)->lock = xSemaphoreCreateMutex() )
+	#define blLockDelete(l) do { if( (l)->lock ) vQueueDelete((l)->lock); } while(0)
+	#define blLock(l) xSemaphoreTake((l)->lock,portMAX_DELAY)
+	#define blUnlock(l) xSemaphoreGive((l)->lock)
+#endif
+
+#define BL_MAGIC 0x4C42 // "BL"
+#define BL_CRC_POLY 0x1021
+#define BL_IDX_SIZE 8 // index entry: firstEntry(4) firstTime(4)
+#define BL_MAX_VARINT 5
+#define BL_RECOVER_BLOCKS 16 // damaged blocks skipped at the end of the file when recovering from it
+
+typedef struct {
+	BlockLogInit cfg;
+	F_FILE *fh, *idx;
+#ifndef BLOCKLOG_HOST
+	xSemaphoreHandle lock;
+#endif
+	// open block
+	unsigned int blockNo, firstEntry, firstTime, count, used;
+	unsigned int lastTime, nextEntry;
+	unsigned int slot; // FRAM commit slot written next
+	unsigned char blk[BLOCKLOG_BLOCK_SIZE];
+	// last block read from the file
+	int rblkNo;
+	unsigned char rblk[BLOCKLOG_BLOCK_SIZE];
+	BlockLogStats st;
+} BlockLog;
+
+static BlockLog* blLog[BLOCKLOG_MAX_LOGS];
+static unsigned short blLUT[256];
+static char blLUTReady = 0;
+
+#define BL_CHECK(logid) if( logid<0 || logid>=BLOCKLOG_MAX_LOGS || ! blLog[logid] ) return BL_ERR_INVALID
+// no room for one more entry
+#define BL_BLOCK_FULL(l) (BLOCKLOG_HDR_SIZE+(l)->used+BL_MAX_VARINT+(l)->cfg.entryDataSize>BLOCKLOG_BLOCK_SIZE)
+#define BL_SLOT_ADDR(l,k) ((l)->cfg.FRAMbaseAddress+BLOCKLOG_BLOCK_SIZE+(k)*BLOCKLOG_SLOT_SIZE)
+
+static void put16(unsigned char* p, unsigned int v) { p[0] = v & 0xFF; p[1] = (v>>8) & 0xFF; }
+static void put32(unsigned char* p, unsigned int v) { put16(p,v); put16(p+2,v>>16); }
+static unsigned int get16(const unsigned char* p) { return p[0] | p[1]<<8; }
+static unsigned int get32(const unsigned char* p) { return get16(p) | get16(p+2)<<16; }
+
+static unsigned short BLCrc(const unsigned char* data, unsigned int len) {
+	return checksum_calculateCRC16LUT(data,len,blLUT,0xFFFF,TRUE);
+}
+
+// Time delta as a zigzag varint (the clock may be set backwards). Returns the bytes used.
+static unsigned int BLPutVarint(unsigned char* p, int d) {
+	unsigned int z = (unsigned int)d<<1 ^ (unsigned int)(d>>31), n = 0;
+	while( z>=0x80 ) { p[n++] = z | 0x80; z >>= 7; }
+	p[n++] = z;
+	return n;
+}
+
+static int BLGetVarint(const unsigned char* p, const unsigned char* end, int* d) {
+	unsigned int z = 0, s = 0, n = 0;
+	do {
+		if( p+n>=end || s>28 ) return -1;
+		z |= (p[n] & 0x7F)<<s;
+		s += 7;
+	} while( p[n++] & 0x80 );
+	*d = (int)(z>>1) ^ -(int)(z & 1);
+	return n;
+}
+
+// Entry k of a block (p: its entries, used: their bytes). Returns its data and time, 0 if not there.
+static const unsigned char* BLEntry(BlockLog* l, const unsigned char* p, unsigned int used, unsigned int time,
+												unsigned int k, unsigned int* t) {
+	const unsigned char* end = p+used;
+	int d, n;
+	for(;;) {
+		if( (n=BLGetVarint(p,end,&d))<0 || p+n+l->cfg.entryDataSize>end ) return 0;
+		time += d;
+		p += n;
+		if( ! k-- ) { *t = time; return p; }
+		p += l->cfg.entryDataSize;
+	}
+}
+
+static int BLBlockValid(const unsigned char* b) {
+	unsigned int used = get16(b+6);
+	return get16(b)==BL_MAGIC && used<=BLOCKLOG_BLOCK_SIZE-BLOCKLOG_HDR_SIZE
+			&& BLCrc(b+4,BLOCKLOG_HDR_SIZE-4+used)==get16(b+2);
+}
+
+// Commit the open block state to FRAM (its entries are already there)
+static int BLCommit(BlockLog* l) {
+	unsigned char s[BLOCKLOG_SLOT_SIZE];
+	put32(s,l->blockNo);
+	put32(s+4,l->firstEntry);
+	put32(s+8,l->firstTime);
+	put16(s+12,l->count);
+	put16(s+14,l->used);
+	put16(s+16,BL_MAGIC);
+	put16(s+18,BLCrc(s,BLOCKLOG_SLOT_SIZE-2));
+	// slots alternate, so a torn write leaves the previous state
+	if( FRAM_write(s,BL_SLOT_ADDR(l,l->slot),BLOCKLOG_SLOT_SIZE) ) {
+		++l->st.framErrors;
+		return BL_ERR_FRAM;
+	}
+	l->slot ^= 1;
+	return 0;
+}
+
+// Write the open block (and its index entry) to its place in the file
+static int BLWriteBlock(BlockLog* l) {
+	unsigned char* b = l->blk, ie[BL_IDX_SIZE];
+	put16(b,BL_MAGIC);
+	put16(b+4,l->count);
+	put16(b+6,l->used);
+	put32(b+8,l->firstEntry);
+	put32(b+12,l->firstTime);
+	memset(b+BLOCKLOG_HDR_SIZE+l->used,0,BLOCKLOG_BLOCK_SIZE-BLOCKLOG_HDR_SIZE-l->used);
+	put16(b+2,BLCrc(b+4,BLOCKLOG_HDR_SIZE-4+l->used));
+	put32(ie,l->firstEntry);
+	put32(ie+4,l->firstTime);
+	if( f_seek(l->fh,l->blockNo*BLOCKLOG_BLOCK_SIZE,F_SEEK_SET) || f_write(b,1,BLOCKLOG_BLOCK_SIZE,l->fh)!=BLOCKLOG_BLOCK_SIZE
+		 || f_seek(l->idx,l->blockNo*BL_IDX_SIZE,F_SEEK_SET) || f_write(ie,1,BL_IDX_SIZE,l->idx)!=BL_IDX_SIZE ) {
+		++l->st.fileErrors;
+		UPLOG_ERR("%s %s block %u: error %d",__FUNCTION__,l->cfg.logFilePath,l->blockNo,f_getlasterror());
+		return BL_ERR_FS;
+	}
+	++l->st.blocksWritten;
+	l->st.bytesWritten += BLOCKLOG_BLOCK_SIZE+BL_IDX_SIZE;
+	if( l->rblkNo==(int)l->blockNo ) l->rblkNo = -1;
+	return 0;
+}
+
+// Write the open block to the file and start the next one. The next block takes its place in
+// FRAM, so it has to be on the card first: through the hcc buffers, the cache and the mirror.
+// A block that could not be written is dropped (its place in the file is kept).
+static int BLNextBlock(BlockLog* l) {
+	int err = BLWriteBlock(l), e;
+	if( ! err && (f_flush(l->fh) || f_flush(l->idx) || SDManagerSync()) ) {
+		++l->st.fileErrors;
+		UPLOG_ERR("%s %s block %u not synced to the card",__FUNCTION__,l->cfg.logFilePath,l->blockNo);
+		err = BL_ERR_FS;
+	}
+	++l->blockNo;
+	l->count = l->used = 0;
+	l->firstEntry = l->nextEntry;
+	l->firstTime = l->lastTime;
+	e = BLCommit(l);
+	return err ? err : e;
+}
+
+static int BLReadBlock(BlockLog* l, unsigned int b) {
+	if( l->rblkNo==(int)b ) return 0;
+	l->rblkNo = -1;
+	if( f_seek(l->fh,b*BLOCKLOG_BLOCK_SIZE,F_SEEK_SET) || f_read(l->rblk,1,BLOCKLOG_BLOCK_SIZE,l->fh)!=BLOCKLOG_BLOCK_SIZE ) {
+		++l->st.fileErrors;
+		return BL_ERR_FS;
+	}
+	++l->st.blockReads;
+	if( ! BLBlockValid(l->rblk) ) return BL_ERR_NOTFOUND;
+	l->rblkNo = b;
+	return 0;
+}
+
+// Binary search in the index for the last full block starting at or before entryNumber
+static int BLFindBlock(BlockLog* l, unsigned int entryNumber) {
+	unsigned char ie[BL_IDX_SIZE];
+	int lo = 0, hi = l->blockNo-1, mid, b = -1;
+	while( lo<=hi ) {
+		mid = (lo+hi)/2;
+		if( f_seek(l->idx,mid*BL_IDX_SIZE,F_SEEK_SET) || f_read(ie,1,BL_IDX_SIZE,l->idx)!=BL_IDX_SIZE ) {
+			++l->st.fileErrors;
+			return -1;
+		}
+		if( get32(ie)<=entryNumber ) { b = mid; lo = mid+1; }
+		else hi = mid-1;
+	}
+	return b;
+}
+
+// Go on with the open block in FRAM. Returns nonzero if there is no valid one.
+static int BLRecoverFRAM(BlockLog* l) {
+	unsigned char s[2][BLOCKLOG_SLOT_SIZE];
+	int i, k = -1;
+	if( FRAM_read(s[0],BL_SLOT_ADDR(l,0),2*BLOCKLOG_SLOT_SIZE) ) { ++l->st.framErrors; return -1; }
+	for(i=0; i<2; ++i) {
+		if( get16(s[i]+16)!=BL_MAGIC || BLCrc(s[i],BLOCKLOG_SLOT_SIZE-2)!=get16(s[i]+18) ) continue;
+		if( k<0 || get32(s[i])>get32(s[k]) || (get32(s[i])==get32(s[k]) && get16(s[i]+12)>get16(s[k]+12)) ) k = i;
+	}
+	if( k<0 ) return -1;
+	l->slot = k^1;
+	l->blockNo = get32(s[k]);
+	l->firstEntry = get32(s[k]+4);
+	l->firstTime = l->lastTime = get32(s[k]+8);
+	l->count = get16(s[k]+12);
+	l->used = get16(s[k]+14);
+	l->nextEntry = l->firstEntry+l->count;
+	if( l->used>BLOCKLOG_BLOCK_SIZE-BLOCKLOG_HDR_SIZE ) return -1;
+	if( FRAM_read(l->blk+BLOCKLOG_HDR_SIZE,l->cfg.FRAMbaseAddress+BLOCKLOG_HDR_SIZE,l->used) ) { ++l->st.framErrors; return -1; }
+	if( l->count && ! BLEntry(l,l->blk+BLOCKLOG_HDR_SIZE,l->used,l->firstTime,l->count-1,&l->lastTime) ) return -1;
+	return 0;
+}
+
+// Start a new block after the last one in the file
+static void BLRecoverFile(BlockLog* l) {
+	unsigned int b, n = 0;
+	l->blockNo = l->count = l->used = l->nextEntry = 0;
+	l->firstTime = l->lastTime = 0;
+	if( f_seek(l->fh,0,F_SEEK_END)==F_NO_ERROR ) n = f_tell(l->fh)/BLOCKLOG_BLOCK_SIZE;
+	for(b=n; b>0 && b+BL_RECOVER_BLOCKS>n; --b) {
+		if( BLReadBlock(l,b-1) ) continue;
+		l->nextEntry = get32(l->rblk+8)+get16(l->rblk+4);
+		l->lastTime = get32(l->rblk+12);
+		if( get16(l->rblk+4) )
+			BLEntry(l,l->rblk+BLOCKLOG_HDR_SIZE,get16(l->rblk+6),get32(l->rblk+12),get16(l->rblk+4)-1,&l->lastTime);
+		break;
+	}
+	l->blockNo = n;
+	l->firstEntry = l->nextEntry;
+	l->firstTime = l->lastTime;
+}
+
+static F_FILE* BLOpen(const char* path, Boolean firstInit) {
+	F_FILE* f = firstInit ? 0 : f_open(path,"r+");
+	return f ? f : f_open(path,"w+");
+}
+
+static void BLFree(BlockLog* l) {
+	if( l->fh ) f_close(l->fh);
+	if( l->idx ) f_close(l->idx);
+	blLockDelete(l);
+	vPortFree(l);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Public functions
+
+int BlockLog_start(BlockLogInit* init, Boolean firstInit, int* logid) {
+	char path[F_MAXPATHNAME];
+	BlockLog* l;
+	int i, j, err;
+	*logid = -1;
+	if( ! init || init->entryDataSize==0 || init->entryDataSize>BLOCKLOG_MAX_DATA ) return BL_ERR_INVALID;
+	for(i=-1, j=0; j<BLOCKLOG_MAX_LOGS; ++j) {
+		if( ! blLog[j] ) { if( i<0 ) i = j; continue; }
+		if( init->FRAMbaseAddress<blLog[j]->cfg.FRAMbaseAddress+BLOCKLOG_FRAM_SIZE
+			 && blLog[j]->cfg.FRAMbaseAddress<init->FRAMbaseAddress+BLOCKLOG_FRAM_SIZE ) return BL_ERR_INVALID;
+	}
+	if( i<0 ) return BL_ERR_MAXLOGS;
+	if( (err=FRAM_start()) && err!=E_IS_INITIALIZED ) {
+		UPLOG_CRIT("%s error starting FRAM: %d",__FUNCTION__,err);
+		return BL_ERR_FRAM;
+	}
+	if( ! blLUTReady ) { checksum_prepareLUTCRC16(BL_CRC_POLY,blLUT); blLUTReady = 1; }
+	if( !(l=(BlockLog*)pvPortMalloc(sizeof(BlockLog))) ) return BL_ERR_MALLOC;
+	memset(l,0,sizeof(*l));
+	l->cfg = *init;
+	l->cfg.logFilePath[sizeof(l->cfg.logFilePath)-1] = 0;
+	l->rblkNo = -1;
+	if( ! blLockCreate(l) ) { BLFree(l); return BL_ERR_MALLOC; }
+	strcpy(path,l->cfg.logFilePath);
+	strcat(path,".idx");
+	if( !(l->fh=BLOpen(l->cfg.logFilePath,firstInit)) || !(l->idx=BLOpen(path,firstInit)) ) {
+		UPLOG_ERR("%s error opening %s: %d",__FUNCTION__,l->cfg.logFilePath,f_getlasterror());
+		BLFree(l);
+		return BL_ERR_FS;
+	}
+	err = 0;
+	if( firstInit || BLRecoverFRAM(l) ) {
+		BLRecoverFile(l);
+		// both slots, so that no state of an earlier log is left
+		if( !(err=BLCommit(l)) ) err = BLCommit(l);
+	}
+	UPLOG_INFO("%s %s: block %u, %u entries in it, next entry %u",__FUNCTION__,l->cfg.logFilePath,l->blockNo,l->count,l->nextEntry);
+	blLog[i] = l;
+	*logid = i;
+	return err;
+}
+
+int BlockLog_stop(int logid) {
+	BlockLog* l;
+	int err = 0;
+	BL_CHECK(logid);
+	l = blLog[logid];
+	blLock(l);
+		blLog[logid] = 0;
+		if( l->count ) err = BLWriteBlock(l);
+	blUnlock(l);
+	BLFree(l);
+	return err;
+}
+
+int BlockLog_add(int logid, const void* data) {
+	BlockLog* l;
+	unsigned char* p;
+	unsigned int t, n;
+	int err = 0, e;
+	BL_CHECK(logid);
+	l = blLog[logid];
+	blLock(l);
+		if( Time_getUnixEpoch(&t) ) t = l->lastTime; // keep the delta small without a clock
+		// full blocks are written at once, but a reset may come before
+		if( BL_BLOCK_FULL(l) ) err = BLNextBlock(l);
+		if( l->count==0 ) l->firstTime = l->lastTime = t;
+		p = l->blk+BLOCKLOG_HDR_SIZE+l->used;
+		n = BLPutVarint(p,(int)(t-l->lastTime));
+		memcpy(p+n,data,l->cfg.entryDataSize);
+		n += l->cfg.entryDataSize;
+		if( FRAM_write(p,l->cfg.FRAMbaseAddress+BLOCKLOG_HDR_SIZE+l->used,n) ) {
+			++l->st.framErrors;
+			if( ! err ) err = BL_ERR_FRAM;
+		}
+		// entry added anyway, it will still reach the file
+		++l->count;
+		l->used += n;
+		l->lastTime = t;
+		++l->nextEntry;
+		++l->st.adds;
+		if( (e=BLCommit(l)) && ! err ) err = e;
+		if( BL_BLOCK_FULL(l) && (e=BLNextBlock(l)) && ! err ) err = e;
+	blUnlock(l);
+	return err;
+}
+
+int BlockLog_flush(int logid) {
+	BlockLog* l;
+	int err = 0;
+	BL_CHECK(logid);
+	l = blLog[logid];
+	blLock(l);
+		if( l->count && !(err=BLWriteBlock(l)) ) {
+			f_flush(l->fh);
+			f_flush(l->idx);
+		}
+	blUnlock(l);
+	return err;
+}
+
+int BlockLog_readOnce(int logid, unsigned int entryNumber, BlockLogEntry* entry) {
+	BlockLog* l;
+	const unsigned char* d = 0;
+	unsigned int t, k;
+	int b, err = 0;
+	BL_CHECK(logid);
+	l = blLog[logid];
+	blLock(l);
+		if( entryNumber>=l->nextEntry ) {
+			err = BL_ERR_NOTFOUND;
+		} else if( l->count && entryNumber>=l->firstEntry ) {
+			d = BLEntry(l,l->blk+BLOCKLOG_HDR_SIZE,l->used,l->firstTime,entryNumber-l->firstEntry,&t);
+		} else {
+			k = entryNumber-get32(l->rblk+8);
+			if( l->rblkNo<0 || k>=get16(l->rblk+4) ) {
+				if( (b=BLFindBlock(l,entryNumber))<0 ) err = BL_ERR_NOTFOUND;
+				else err = BLReadBlock(l,b);
+				k = entryNumber-get32(l->rblk+8);
+			}
+			if( ! err && k<get16(l->rblk+4) )
+				d = BLEntry(l,l->rblk+BLOCKLOG_HDR_SIZE,get16(l->rblk+6),get32(l->rblk+12),k,&t);
+		}
+		if( d ) {
+			entry->time = t;
+			entry->entryNumber = entryNumber;
+			memcpy(entry->data,d,l->cfg.entryDataSize);
+		} else if( ! err ) {
+			err = BL_ERR_NOTFOUND;
+		}
+	blUnlock(l);
+	return err;
+}
+
+int BlockLog_getStats(int logid, BlockLogStats* st) {
+	BlockLog* l;
+	BL_CHECK(logid);
+	l = blLog[logid];
+	blLock(l);
+		*st = l->st;
+		st->nextEntryNumber = l->nextEntry;
+		st->blocksInFile = l->blockNo;
+		st->entriesInBlock = l->count;
+		st->bytesInBlock = BLOCKLOG_HDR_SIZE+l->used;
+	blUnlock(l);
+	return 0;
+}
+
+#ifdef BLOCKLOG_HOST
+// The power went (blocklog-bench.c): forget the open logs without writing anything
+void BlockLogPowerLoss() {
+	memset(blLog,0,sizeof(blLog));
+}
+#endif
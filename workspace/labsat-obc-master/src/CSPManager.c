@@ -16,6 +16,7 @@
 #include <hal/Drivers/UART.h>
 
 #include "misc.h"
+#include "MsgChannel.h"
 
 
 /*-------------------------------------------------------------------------------------------*/
@@ -46,7 +47,8 @@ usart_context_t usart_ctx;
 
 // these are only one instance even if we later open more interfaces (i2c-csp, spi-csp, etc)
 xTaskHandle cspRouterTaskHandle = 0;
-xQueueHandle txDelQueue = 0;
+// escaped frames: taken by csp_palermo_kiss_tx() and given back by the uart when sent
+static MsgPool* kissTxPool = 0;
 
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
@@ -113,11 +115,10 @@ static void csp_uart_rx_task(void* param) {
 
 static void uart_tx_end_callback(SystemContext ctx,void* u) {
 	if( ctx==task_context ) {
-		vPortFree(u);
+		MsgFree(u);
 	} else { // isr_context
 		portBASE_TYPE ptw = pdFALSE;
-		// do not call vPortFree() from ISR, but ensure deletion from csp_palermo_kiss_tx()
-		xQueueSendFromISR(txDelQueue,&u,&ptw);
+		MsgFreeFromISR(u,&ptw);
 		if( ptw==pdTRUE ) portYIELD_FROM_ISR();
 	}
 }
@@ -139,7 +140,6 @@ static int csp_palermo_kiss_tx(csp_iface_t * iface, uint16_t via, csp_packet_t *
 	usart_context_t* uctx = iface->driver_data;
 	int ret = CSP_ERR_NONE;
   	void* v; 
-	while( pdTRUE==xQueueReceive(txDelQueue,&v,0) ) vPortFree(v); // delete old escaped and transmitted packets
 
 	/* TODO: Check if UART_queueTransfer() and UART_write() and csp_buffer_free() actually need us to protect them */
  	if( xSemaphoreTake( uctx->sem,pdMS_TO_TICKS(45))!=pdTRUE ) return CSP_ERR_TX;
@@ -150,7 +150,10 @@ static int csp_palermo_kiss_tx(csp_iface_t * iface, uint16_t via, csp_packet_t *
 
 	/* Transmit data */
 	// start[]={FEND, TNC_DATA}, esc_end[]={FESC, TFEND}, esc_esc[]={FESC, TFESC}, stop[]={FEND};
-	v = pvPortMalloc( (packet->frame_length)*2 + 12 );
+	if( (packet->frame_length)*2 + 12 > CSP_KISS_TX_SIZE || !(v=MsgAlloc(kissTxPool,pdMS_TO_TICKS(45))) ) {
+		xSemaphoreGive( uctx->sem );
+		return CSP_ERR_NOMEM;
+	}
 	UARTtransferStatus    *uts = v;
 	const unsigned char *begin = packet->frame_begin;
 	const unsigned char     *p = begin;
@@ -182,7 +185,7 @@ static int csp_palermo_kiss_tx(csp_iface_t * iface, uint16_t via, csp_packet_t *
 	if( (n=UART_queueTransfer(&tr))!=0 ) {
 		UPLOG_WARNING("%s error queuing tx, retrying in blocking call: %d\n",__FUNCTION__,n);
 		n=UART_write(tr.bus,tr.writeData,tr.writeSize);
-		vPortFree(v); // already sent or failed, but escaped packet can be deleted now
+		MsgFree(v); // already sent or failed, but escaped packet can be deleted now
 		if( n!=0 ) {
 			UPLOG_ERR("%s error writing to csp uart: %s",__FUNCTION__,n);
 			ret=CSP_ERR_TX;
@@ -268,7 +271,7 @@ int CSPManagerInit(const char* ifname) {
 		return CSP_ERR_NOMEM;
 	}
 	uctx->sem = xSemaphoreCreateMutex();
-	if( txDelQueue==0 ) txDelQueue = xQueueCreate(128,sizeof(void*));
+	if( ! kissTxPool ) kissTxPool = MsgPoolCreate("KissTx",CSP_KISS_TX_POOL,CSP_KISS_TX_SIZE,0);
 
 	// add default route (0/0) through this iface
 	csp_rtable_set(0 /* destAddr */, 0 /* netmask */, ictx, CSP_NO_VIA_ADDRESS);
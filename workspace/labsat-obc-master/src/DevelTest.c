@@ -6,10 +6,40 @@
 #include "PowerManager.h"
 #include "CSPManager.h"
 #include "SDManager.h"
+#include "SDMirror.h"
+#include "SDMmc.h"
+#include "PListShadow.h"
+#include "MsgChannel.h"
+#include "ResourceMonitor.h"
+#include "RunTimeStats.h"
+#include "StackMonitor.h"
+#include "SliceMonitor.h"
+#include "IdleSleep.h"
+#include "TrxvuManager.h"
+#include "HstxsManager.h"
+#include "TraceRecorder.h"
 #include <freertos/task.h>
 #include <csp/csp.h>
+#include <at91/utility/hamming.h>
+#include <at91/boards/ISIS_OBC_G20/board.h>
+#include <stdlib.h>
 
 
+// Tests and benchmarks run once by DevelTestTask, all off: set one to 1 to build and run it.
+// The host benchmarks of the same modules are the *-bench targets of src/Makefile.
+#define TEST_SD_MIRROR 0 // writes and deletes TEST_MIRROR_KB on the flight card
+#define TEST_PLIST_BENCH 0 // builds lists in FRAM over whatever is at TEST_PLIST_FRAMADDR
+#define TEST_HAMMING_BENCH 0
+#define TEST_TRACE_BENCH 0
+#define TEST_HEAP_BENCH 0
+
+#if TEST_SD_MIRROR && ! SD_MIRROR
+ #error TEST_SD_MIRROR needs SD_MIRROR (SDManager.h)
+#endif
+#if TEST_TRACE_BENCH && ( configUSE_TRACE_RECORDER != 1 )
+ #error TEST_TRACE_BENCH needs the kernel built with configUSE_TRACE_RECORDER (FreeRTOSConfig.h)
+#endif
+
 #define TEST_TIMER_INTERVAL 15
 #define TEST_TIMER_COUNT 10
 int testTimerCallback(unsigned int when, void* _privData) {
@@ -79,6 +109,170 @@ void testPowerManagerCallback(driver_error_t cmderr,unsigned int when,commandRes
 }
 
 
+#if TEST_SD_MIRROR
+// Write a file to the mirrored volume and compare the rate seen by the writer with the rate
+// of each card alone (time the card tasks spent writing the same data), then read it back.
+// With SD_DRIVER_SDMMC the SD card driver logs the MB/s of its multi-block commands.
+#define TEST_MIRROR_KB 512
+void testSDMirror() {
+	static unsigned char buf[4096];
+	SDMirrorStats st;
+	SDMmcStats mst;
+	F_FILE* f;
+	portTickType t;
+	unsigned int i, ms;
+	if( f_enterFS() ) return;
+	memset(buf,0x5A,sizeof(buf));
+	SDManagerSync();
+	SDMirrorGetStats(&st,1);
+	for(i=0; i<SDMMC_CARDS; ++i) SDMmcGetStats(i,&mst,1);
+	t = xTaskGetTickCount();
+	if( (f=f_open("B:/mirror.tst","w")) ) {
+		for(i=0; i<TEST_MIRROR_KB/4; ++i) f_write(buf,1,sizeof(buf),f);
+		f_close(f);
+		SDManagerSync();
+		ms = (xTaskGetTickCount()-t)*portTICK_RATE_MS;
+		UPLOG_NOTICE("%s %uKB in %ums: mirrored %uKB/s",__FUNCTION__,TEST_MIRROR_KB,ms,ms ? TEST_MIRROR_KB*1000/ms : 0);
+		SDMirrorShowStatus(); // writeKBs of each card is its single card rate
+		// more than the sector cache holds: read from the cards
+		t = xTaskGetTickCount();
+		if( (f=f_open("B:/mirror.tst","r")) ) {
+			for(i=0; i<TEST_MIRROR_KB/4; ++i) f_read(buf,1,sizeof(buf),f);
+			f_close(f);
+			ms = (xTaskGetTickCount()-t)*portTICK_RATE_MS;
+			UPLOG_NOTICE("%s %uKB in %ums: read %uKB/s",__FUNCTION__,TEST_MIRROR_KB,ms,ms ? TEST_MIRROR_KB*1000/ms : 0);
+		}
+		if( SD_DRIVER_SDMMC ) SDMmcShowStatus();
+		f_delete("B:/mirror.tst");
+	}
+	f_releaseFS();
+}
+#endif
+
+#if TEST_PLIST_BENCH
+// Time reading every node of a list by position, with PersistentList (walks the links in
+// FRAM), with an iterator pass, and from the RAM shadow
+#define TEST_PLIST_FRAMADDR 0x1000
+#define TEST_PLIST_SAMPLES 50 // positional reads of PersistentList sampled for long lists
+void testPListShadow() {
+	static const unsigned int sizes[] = {50,500,5000};
+	unsigned int i, n, step, item[2];
+	unsigned int msPos, msIter, msShadow;
+	portTickType t;
+	int listid, it, j;
+	for(j=0; j<sizeof(sizes)/sizeof(sizes[0]); ++j) {
+		n = sizes[j];
+		if( PListShadowStart(TEST_PLIST_FRAMADDR,sizeof(item),n,1,TRUE,&listid)<0 ) return;
+		for(i=0; i<n; ++i) {
+			item[0] = i; item[1] = ~i;
+			if( PListShadowAdd(listid,PLIST_END,item)<0 ) break;
+		}
+		step = n>TEST_PLIST_SAMPLES ? n/TEST_PLIST_SAMPLES : 1;
+		t = xTaskGetTickCount();
+		for(i=0; i<n; i+=step) PersistentListNodeGetdata(listid,i,item);
+		msPos = (xTaskGetTickCount()-t)*portTICK_RATE_MS*step; // scaled to n reads
+		t = xTaskGetTickCount();
+		if( PersistentListIteratorNew(listid,PLIST_START,&it)>=0 ) {
+			PersistentListIteratorGetNodeData(listid,it,item);
+			while( PersistentListIteratorNextNodeData(listid,it,iterator_forward,item)>=0 ) ;
+			PersistentListIteratorStop(listid,it);
+		}
+		msIter = (xTaskGetTickCount()-t)*portTICK_RATE_MS;
+		t = xTaskGetTickCount();
+		for(i=0; i<n; ++i) PListShadowGetdata(listid,i,item);
+		msShadow = (xTaskGetTickCount()-t)*portTICK_RATE_MS;
+		UPLOG_NOTICE("%s %u nodes: by position %ums, iterator %ums, shadow %ums",
+						__FUNCTION__,PListShadowGetcount(listid),msPos,msIter,msShadow);
+		PListShadowRemoveAll(listid);
+		PListShadowStop(listid);
+	}
+}
+#endif
+
+#if TEST_HAMMING_BENCH
+// Hamming ECC throughput over 2KB pages (the vendor code of the prebuilt libAt91)
+#define TEST_HAMMING_PAGES 200
+void testHammingBench() {
+	static unsigned char page[2048], code[3*2048/256];
+	unsigned int i, compute, verify;
+	portTickType t = xTaskGetTickCount();
+	for(i=0; i<TEST_HAMMING_PAGES; ++i) Hamming_Compute256x(page,sizeof(page),code);
+	compute = (xTaskGetTickCount()-t)*portTICK_RATE_MS;
+	t = xTaskGetTickCount();
+	for(i=0; i<TEST_HAMMING_PAGES; ++i) Hamming_Verify256x(page,sizeof(page),code);
+	verify = (xTaskGetTickCount()-t)*portTICK_RATE_MS;
+	UPLOG_NOTICE("%s %u pages: compute %ums, verify %ums",__FUNCTION__,TEST_HAMMING_PAGES,compute,verify);
+}
+#endif
+
+#if TEST_TRACE_BENCH
+// Cost of a trace record, then a snapshot of the normal load (with the ticks) dumped to
+// TEST_TRACE_FILE: the records per second times the cost is the overhead of the recorder.
+#define TEST_TRACE_RECORDS 10000
+#define TEST_TRACE_SECS 10
+#define TEST_TRACE_FILE "trace.bin"
+void testTraceBench() {
+	unsigned int i, ns, events, rate;
+	unsigned long t;
+	TraceRecorderStats st;
+	if( f_enterFS() ) return;
+	TraceRecorderStart(TRACE_SNAPSHOT,0,0);
+	t = ulGetRunTimeCounterValue();
+	for(i=0; i<TEST_TRACE_RECORDS; ++i) vTraceRecord(TRC_QUEUE_PEEK,i);
+	ns = (unsigned long long)(ulGetRunTimeCounterValue()-t)*1000000000/RTS_COUNTER_HZ/TEST_TRACE_RECORDS;
+	TraceRecorderStart(TRACE_SNAPSHOT,1,0);
+	vTaskDelay(pdMS_TO_TICKS(TEST_TRACE_SECS*1000));
+	TraceRecorderGetStats(&st);
+	events = st.events;
+	TraceRecorderDump(TEST_TRACE_FILE);
+	f_releaseFS();
+	rate = events/TEST_TRACE_SECS;
+	UPLOG_NOTICE("%s %uns per record, %u records/s: overhead %u permille",__FUNCTION__,ns,rate,
+					 (unsigned int)((unsigned long long)rate*ns/1000000));
+}
+#endif
+
+#if TEST_HEAP_BENCH
+// Time of pvPortMalloc/vPortFree and of newlib malloc/free over log line, KISS frame and
+// power manager sized blocks
+#define TEST_HEAP_OPS 20000
+#define TEST_HEAP_LIVE 16
+typedef void* (*testAllocFunc)(size_t);
+static void testHeapRun(const char* name, testAllocFunc af, void (*ff)(void*)) {
+	static const unsigned short sizes[] = {196,40,300,196,524,64,196,12*36};
+	void* live[TEST_HEAP_LIVE] = {0};
+	unsigned long t, dt, sum = 0, worst = 0;
+	unsigned int i;
+	for(i=0; i<TEST_HEAP_OPS; ++i) {
+		t = ulGetRunTimeCounterValue();
+		if( live[i%TEST_HEAP_LIVE] ) ff(live[i%TEST_HEAP_LIVE]);
+		live[i%TEST_HEAP_LIVE] = af(sizes[i%(sizeof(sizes)/sizeof(sizes[0]))]);
+		dt = ulGetRunTimeCounterValue()-t;
+		sum += dt;
+		if( dt>worst ) worst = dt;
+	}
+	for(i=0; i<TEST_HEAP_LIVE; ++i) ff(live[i]);
+	UPLOG_NOTICE("%s %s free+alloc: mean %uns worst %uns",__FUNCTION__,name,
+					 (unsigned int)((unsigned long long)sum*1000000000/RTS_COUNTER_HZ/TEST_HEAP_OPS),
+					 (unsigned int)((unsigned long long)worst*1000000000/RTS_COUNTER_HZ));
+}
+
+void testHeapBench() {
+	static xHeapStatsType st;
+	unsigned int i;
+	testHeapRun("pvPortMalloc",pvPortMalloc,vPortFree);
+	testHeapRun("malloc",malloc,free);
+	vPortGetHeapStats(&st);
+	for(i=0; i<heapNUM_CLASSES; ++i)
+		if( st.xClass[i].ulAllocs )
+			UPLOG_NOTICE("%s class %u: blocks=%lu inUse=%lu maxInUse=%lu allocs=%lu",__FUNCTION__,st.xClass[i].xBlockSize,
+							 st.xClass[i].ulBlocks,st.xClass[i].ulInUse,st.xClass[i].ulMaxInUse,st.xClass[i].ulAllocs);
+	UPLOG_NOTICE("%s large=%lu/%uB requested=%uB classes=%uB classFree=%uB remaining=%uB newlibFree=%uB largest=%uB failures=%lu classOverflows=%lu",
+					 __FUNCTION__,st.ulLargeInUse,st.xLargeBytes,st.xRequestedBytes,st.xClassBytes,st.xClassFreeBytes,
+					 st.xHeapRemaining,st.xNewlibFreeBytes,st.xLargestFreeBlock,st.ulFailures,st.ulClassOverflows);
+}
+#endif
+
 void DevelTestTask(void* param) {
 	// test TimerManager
 	TimerManagerAdd(0,testTimerCallback,TEST_TIMER_INTERVAL,TEST_TIMER_COUNT,
@@ -88,13 +282,40 @@ void DevelTestTask(void* param) {
 
 	// test PowerManager
 	PowerManagerAddRequest(PM_CC_GETSYSTEMSTATUS,0,testPowerManagerCallback,0);
+	// same data from the housekeeping snapshot (accept up to 5 secs old, wait 1 sec for a new one)
+	static PowerManagerSnapshot snap;
+	if( PowerManagerGetSnapshot(&snap,5000,pdMS_TO_TICKS(1000))>=0 )
+		PowerManagerPrintSysStatus(0,(commandRespData*)&snap.sysStatus);
+	PowerManagerShowStatus();
+	MsgShowStatus();
 
 	// test SDManager
 	SDManagerShowStatus(1 /*drivenum*/,1 /*doLog*/,0);
+#if TEST_SD_MIRROR
+	testSDMirror();
+#endif
+#if TEST_PLIST_BENCH
+	testPListShadow();
+#endif
+#if TEST_HAMMING_BENCH
+	testHammingBench();
+#endif
+#if TEST_TRACE_BENCH
+	testTraceBench();
+#endif
+#if TEST_HEAP_BENCH
+	testHeapBench();
+#endif
 	
 	// test LogManager
 	vTaskDelay(pdMS_TO_TICKS(7000/*msecs*/)); 
 	logRotate();
+	ResourceMonitorShowStatus();
+	StackMonitorShowStatus();
+	SliceMonitorShowStatus();
+	IdleSleepShowStatus();
+	TrxvuManagerShowStatus();
+	HstxsManagerShowStatus();
 #if (configUSE_TRACE_FACILITY==1)
 	UPLOG_TasksStatus();
 #endif
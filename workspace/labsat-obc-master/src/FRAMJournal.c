@@ -0,0 +1,322 @@
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <hal/boolean.h>
+#include <hal/errors.h>
+#include <hal/checksum.h>
+#include <hal/Storage/FRAM.h>
+#include <mission-support/FRAMRegistry.h>
+#include "FRAMJournal.h"
+#include "LogManager.h"
+
+#define FJ_BANK_SIZE (FRAMJOURNAL_SIZE/2)
+#define FJ_BANK_ADDR(b) (FRAMJOURNAL_ADDR+(b)*FJ_BANK_SIZE)
+#define FJ_HDR_SIZE 16 // bank header: magic(4) generation(4) reserved(6) crc16(2)
+#define FJ_REC_MAGIC 0xA5
+#define FJ_REC_DELETE 0x01
+#define FJ_REC_HDR 8 // record: magic flags generation(2) key(2) len reserved, then value and crc16(2)
+#define FJ_REC_SIZE(len) (FJ_REC_HDR+(len)+2)
+#define FJ_CRC_POLY 0x1021
+
+// a bank holds its header, every key at FRAMJOURNAL_MAX_VALUE and the end mark, so compaction always fits
+#if FRAMJOURNAL_MAX_VALUE>255
+	#error "FRAMJOURNAL_MAX_VALUE: the record length is one byte"
+#endif
+#if FJ_BANK_SIZE<FJ_HDR_SIZE+FRAMJOURNAL_MAX_KEYS*FJ_REC_SIZE(FRAMJOURNAL_MAX_VALUE)+1
+	#error "FRAMJOURNAL_SIZE: a bank does not hold FRAMJOURNAL_MAX_KEYS values of FRAMJOURNAL_MAX_VALUE"
+#endif
+
+typedef struct {
+	unsigned short key;
+	unsigned char len;
+	unsigned char data[FRAMJOURNAL_MAX_VALUE];
+} FJValue;
+
+static FJValue fjVal[FRAMJOURNAL_MAX_KEYS];
+static unsigned int fjCount = 0;
+static unsigned int fjGen = 0; // generation of the active bank
+static unsigned int fjBank = 0; // active bank
+static unsigned int fjPos = 0; // where the next record goes in the active bank
+static unsigned short fjLUT[256];
+static xSemaphoreHandle fjLock = 0;
+static char fjRegistered = 0; // the region is ours in the FRAMRegistry
+static FRAMJournalStats fjSt;
+// records are staged here before writing, and the journal is read through it when replaying
+static unsigned char fjBuf[512];
+
+
+static unsigned short FJCrc(const unsigned char* data, unsigned int len) {
+	return checksum_calculateCRC16LUT(data,len,fjLUT,0xFFFF,TRUE);
+}
+
+static int FJFind(unsigned short key) {
+	unsigned int i;
+	for(i=0; i<fjCount; ++i)
+		if( fjVal[i].key==key ) return i;
+	return -1;
+}
+
+// Build a record in buf. Returns its size.
+static unsigned int FJRecord(unsigned char* buf, unsigned char flags, unsigned short key, const void* value, unsigned int len) {
+	unsigned short crc;
+	buf[0] = FJ_REC_MAGIC;
+	buf[1] = flags;
+	buf[2] = fjGen & 0xFF; buf[3] = (fjGen>>8) & 0xFF;
+	buf[4] = key & 0xFF; buf[5] = key>>8;
+	buf[6] = len;
+	buf[7] = 0;
+	memcpy(buf+FJ_REC_HDR,value,len);
+	crc = FJCrc(buf,FJ_REC_HDR+len);
+	buf[FJ_REC_HDR+len] = crc & 0xFF;
+	buf[FJ_REC_HDR+len+1] = crc>>8;
+	return FJ_REC_SIZE(len);
+}
+
+static int FJWriteHeader(unsigned int bank, unsigned int gen) {
+	unsigned char h[FJ_HDR_SIZE];
+	unsigned short crc;
+	memset(h,0,sizeof(h));
+	memcpy(h,"FJN1",4); // magic
+	h[4] = gen & 0xFF; h[5] = (gen>>8) & 0xFF; h[6] = (gen>>16) & 0xFF; h[7] = gen>>24;
+	crc = FJCrc(h,FJ_HDR_SIZE-2);
+	h[FJ_HDR_SIZE-2] = crc & 0xFF;
+	h[FJ_HDR_SIZE-1] = crc>>8;
+	return FRAM_write(h,FJ_BANK_ADDR(bank),FJ_HDR_SIZE);
+}
+
+// Generation of a bank, 0 if its header is not valid
+static unsigned int FJReadHeader(unsigned int bank) {
+	unsigned char h[FJ_HDR_SIZE];
+	if( FRAM_read(h,FJ_BANK_ADDR(bank),FJ_HDR_SIZE) ) return 0;
+	if( memcmp(h,"FJN1",4) || FJCrc(h,FJ_HDR_SIZE-2)!=(h[FJ_HDR_SIZE-2] | h[FJ_HDR_SIZE-1]<<8) ) return 0;
+	return h[4] | h[5]<<8 | h[6]<<16 | (unsigned int)h[7]<<24;
+}
+
+// Write the live values to the other bank, then its header. Must hold the lock.
+static int FJCompactLocked() {
+	unsigned int bank = !fjBank, gen = fjGen+1, pos = FJ_HDR_SIZE, n = 0, i, oldGen = fjGen;
+	int err = 0;
+	fjGen = gen; // records carry the generation of their bank
+	for(i=0; i<fjCount && !err; ++i) {
+		if( n+FJ_REC_SIZE(fjVal[i].len)>sizeof(fjBuf) ) {
+			err = FRAM_write(fjBuf,FJ_BANK_ADDR(bank)+pos,n);
+			pos += n; n = 0;
+		}
+		n += FJRecord(fjBuf+n,0,fjVal[i].key,fjVal[i].data,fjVal[i].len);
+	}
+	if( !err && n ) { err = FRAM_write(fjBuf,FJ_BANK_ADDR(bank)+pos,n); pos += n; }
+	// end mark, so that a replay does not run into records of two generations ago
+	// (they would be rejected by their generation anyway, this stops it earlier)
+	if( !err && pos<FJ_BANK_SIZE ) { fjBuf[0] = 0; err = FRAM_write(fjBuf,FJ_BANK_ADDR(bank)+pos,1); }
+	if( !err ) err = FJWriteHeader(bank,gen);
+	if( err ) {
+		fjGen = oldGen;
+		++fjSt.errors;
+		return FJ_ERR_FRAM;
+	}
+	fjSt.bytesWritten += pos+FJ_HDR_SIZE;
+	++fjSt.compactions;
+	fjBank = bank;
+	fjPos = pos;
+	return 0;
+}
+
+// Append a record to the active bank (compacting first if it does not fit). Must hold the lock.
+static int FJAppendLocked(unsigned char flags, unsigned short key, const void* value, unsigned int len) {
+	unsigned int size = FJ_REC_SIZE(len);
+	int err;
+	if( fjPos+size>FJ_BANK_SIZE ) {
+		if( (err=FJCompactLocked()) ) return err;
+		if( fjPos+size>FJ_BANK_SIZE ) return FJ_ERR_FULL;
+	}
+	FJRecord(fjBuf,flags,key,value,len);
+	// the byte after the record is left as it is: a replay stops there because it is not a
+	// record of this generation (or is the end mark written by the compaction)
+	if( FRAM_write(fjBuf,FJ_BANK_ADDR(fjBank)+fjPos,size) ) {
+		++fjSt.errors;
+		return FJ_ERR_FRAM;
+	}
+	fjPos += size;
+	fjSt.bytesWritten += size;
+	return 0;
+}
+
+// Apply the records of the active bank to the RAM values, reading the bank in fjBuf sized
+// chunks. Sets fjPos after the last good record.
+static void FJReplay() {
+	unsigned int pos = FJ_HDR_SIZE, winStart = 0, winLen = 0, len, size;
+	unsigned short key;
+	int i;
+	unsigned char* r;
+	fjSt.replayTorn = 0;
+	while( pos+FJ_REC_SIZE(0)<=FJ_BANK_SIZE ) {
+		// record header, then the whole record, in the window
+		for(size=FJ_REC_HDR; ; size=FJ_REC_SIZE(len)) {
+			if( pos<winStart || pos+size>winStart+winLen ) {
+				winStart = pos;
+				winLen = FJ_BANK_SIZE-pos<sizeof(fjBuf) ? FJ_BANK_SIZE-pos : sizeof(fjBuf);
+				if( FRAM_read(fjBuf,FJ_BANK_ADDR(fjBank)+winStart,winLen) ) { ++fjSt.errors; winLen = 0; goto end; }
+			}
+			r = fjBuf+pos-winStart;
+			if( size>FJ_REC_HDR ) break;
+			if( r[0]!=FJ_REC_MAGIC || (r[2] | r[3]<<8)!=(fjGen & 0xFFFF) ) goto end; // end of this generation
+			len = r[6];
+			if( len>FRAMJOURNAL_MAX_VALUE || pos+FJ_REC_SIZE(len)>FJ_BANK_SIZE ) { fjSt.replayTorn = 1; goto end; }
+		}
+		if( FJCrc(r,FJ_REC_HDR+len)!=(r[FJ_REC_HDR+len] | r[FJ_REC_HDR+len+1]<<8) ) { fjSt.replayTorn = 1; goto end; }
+		key = r[4] | r[5]<<8;
+		i = FJFind(key);
+		if( r[1] & FJ_REC_DELETE ) {
+			if( i>=0 ) fjVal[i] = fjVal[--fjCount];
+		} else if( i>=0 || fjCount<FRAMJOURNAL_MAX_KEYS ) {
+			if( i<0 ) i = fjCount++;
+			fjVal[i].key = key;
+			fjVal[i].len = len;
+			memcpy(fjVal[i].data,r+FJ_REC_HDR,len);
+		}
+		++fjSt.replayRecords;
+		pos += FJ_REC_SIZE(len);
+	}
+	end:
+	fjPos = pos;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Public functions
+
+int FRAMJournalInit() {
+	static const char* ownStr = __FUNCTION__;
+	unsigned int g0, g1;
+	portTickType t;
+	int err;
+	if( ! fjLock && !(fjLock=xSemaphoreCreateMutex()) ) return FJ_ERR_NOTINIT;
+	if( (err=FRAM_start()) && err!=E_IS_INITIALIZED ) {
+		UPLOG_CRIT("%s error starting FRAM: %d",ownStr,err);
+		return FJ_ERR_FRAM;
+	}
+	if( FRAMJOURNAL_ADDR+FRAMJOURNAL_SIZE-1>FRAM_getMaxAddress() ) {
+		UPLOG_CRIT("%s journal region does not fit in FRAM",ownStr);
+		return FJ_ERR_FULL;
+	}
+	if( ! fjRegistered ) {
+		if( FRAMReg_IsOccupied(FRAMJOURNAL_ADDR,FRAMJOURNAL_ADDR+FRAMJOURNAL_SIZE-1)
+		 || ! FRAMReg_SetOccupied(FRAMJOURNAL_ADDR,FRAMJOURNAL_ADDR+FRAMJOURNAL_SIZE-1,(unsigned char*)"FRAMJournal",FRAMJOURNAL_REG_ID) ) {
+			UPLOG_CRIT("%s journal region 0x%X..0x%X overlaps another FRAM user",ownStr,FRAMJOURNAL_ADDR,FRAMJOURNAL_ADDR+FRAMJOURNAL_SIZE-1);
+			FRAMReg_PrintMapping();
+			return FJ_ERR_OVERLAP;
+		}
+		fjRegistered = 1;
+	}
+	xSemaphoreTake(fjLock,portMAX_DELAY);
+		checksum_prepareLUTCRC16(FJ_CRC_POLY,fjLUT);
+		memset(&fjSt,0,sizeof(fjSt));
+		fjCount = 0;
+		t = xTaskGetTickCount();
+		g0 = FJReadHeader(0);
+		g1 = FJReadHeader(1);
+		if( g0 || g1 ) {
+			// the newest valid bank (generations only grow)
+			fjBank = g1 && (!g0 || (int)(g1-g0)>0) ? 1 : 0;
+			fjGen = fjBank ? g1 : g0;
+			FJReplay();
+			err = 0;
+		} else {
+			fjBank = 0;
+			fjGen = 1;
+			fjPos = FJ_HDR_SIZE;
+			fjBuf[0] = 0;
+			err = FRAM_write(fjBuf,FJ_BANK_ADDR(0)+fjPos,1) || FJWriteHeader(0,fjGen) ? FJ_ERR_FRAM : 0;
+		}
+		fjSt.replayMs = (xTaskGetTickCount()-t)*portTICK_RATE_MS;
+	xSemaphoreGive(fjLock);
+	if( err ) {
+		UPLOG_CRIT("%s error creating the journal",ownStr);
+	} else if( fjSt.replayTorn ) {
+		UPLOG_ERR("%s replay stopped at a damaged record (bank %u offset %u)",ownStr,fjBank,fjPos);
+	}
+	FRAMJournalShowStatus();
+	return err;
+}
+
+int FRAMJournalPut(unsigned short key, const void* value, unsigned int len) {
+	int i, err;
+	if( len>FRAMJOURNAL_MAX_VALUE || key==0xFFFF ) return FJ_ERR_SIZE;
+	if( ! fjLock ) return FJ_ERR_NOTINIT;
+	xSemaphoreTake(fjLock,portMAX_DELAY);
+		++fjSt.puts;
+		i = FJFind(key);
+		if( i>=0 && fjVal[i].len==len && 0==memcmp(fjVal[i].data,value,len) ) {
+			++fjSt.unchanged;
+			err = 0;
+		} else if( i<0 && fjCount>=FRAMJOURNAL_MAX_KEYS ) {
+			err = FJ_ERR_FULL;
+		} else if( 0==(err=FJAppendLocked(0,key,value,len)) ) {
+			if( i<0 ) i = fjCount++;
+			fjVal[i].key = key;
+			fjVal[i].len = len;
+			memcpy(fjVal[i].data,value,len);
+		}
+	xSemaphoreGive(fjLock);
+	return err;
+}
+
+int FRAMJournalGet(unsigned short key, void* value, unsigned int maxLen) {
+	int i, len;
+	if( ! fjLock ) return FJ_ERR_NOTINIT;
+	xSemaphoreTake(fjLock,portMAX_DELAY);
+		if( (i=FJFind(key))<0 ) {
+			len = FJ_ERR_NOTFOUND;
+		} else {
+			len = fjVal[i].len;
+			memcpy(value,fjVal[i].data,(unsigned int)len<maxLen ? (unsigned int)len : maxLen);
+		}
+	xSemaphoreGive(fjLock);
+	return len;
+}
+
+int FRAMJournalDelete(unsigned short key) {
+	int i, err;
+	if( ! fjLock ) return FJ_ERR_NOTINIT;
+	xSemaphoreTake(fjLock,portMAX_DELAY);
+		if( (i=FJFind(key))<0 ) {
+			err = FJ_ERR_NOTFOUND;
+		} else if( 0==(err=FJAppendLocked(FJ_REC_DELETE,key,0,0)) ) {
+			fjVal[i] = fjVal[--fjCount];
+			++fjSt.deletes;
+		}
+	xSemaphoreGive(fjLock);
+	return err;
+}
+
+int FRAMJournalCompact(unsigned int when, void* privData) {
+	if( ! fjLock ) return 0;
+	xSemaphoreTake(fjLock,portMAX_DELAY);
+		if( fjPos*100>=FJ_BANK_SIZE*FRAMJOURNAL_COMPACT_PCT && FJCompactLocked() )
+			UPLOG_ERR("%s error compacting the journal",__FUNCTION__);
+	xSemaphoreGive(fjLock);
+	return 0;
+}
+
+void FRAMJournalGetStats(FRAMJournalStats* st) {
+	unsigned int i;
+	if( ! fjLock ) { memset(st,0,sizeof(*st)); return; }
+	xSemaphoreTake(fjLock,portMAX_DELAY);
+		fjSt.generation = fjGen;
+		fjSt.keys = fjCount;
+		fjSt.liveBytes = 0;
+		for(i=0; i<fjCount; ++i) fjSt.liveBytes += FJ_REC_SIZE(fjVal[i].len);
+		fjSt.used = fjPos;
+		fjSt.bankSize = FJ_BANK_SIZE;
+		memcpy(st,&fjSt,sizeof(*st));
+	xSemaphoreGive(fjLock);
+}
+
+void FRAMJournalShowStatus() {
+	FRAMJournalStats st;
+	FRAMJournalGetStats(&st);
+	UPLOG_INFO("%s generation=%u keys=%u liveBytes=%u used=%u/%u puts=%u unchanged=%u deletes=%u bytesWritten=%u compactions=%u errors=%u replayRecords=%u replayMs=%u replayTorn=%d",
+				  __FUNCTION__,st.generation,st.keys,st.liveBytes,st.used,st.bankSize,st.puts,st.unchanged,st.deletes,
+				  st.bytesWritten,st.compactions,st.errors,st.replayRecords,st.replayMs,st.replayTorn);
+}
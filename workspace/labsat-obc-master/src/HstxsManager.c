@@ -0,0 +1,314 @@
+#include <string.h>
+#include <satellite-subsystems/isis_hstxs_v2.h>
+#include <satellite-subsystems/isis_hstxs_v2_spi.h>
+#include "HstxsManager.h"
+
+#ifdef HSTXS_HOST
+	// host benchmark build (hstxs-bench.c): no task, the benchmark calls HstxsPump and drives the time
+	#include <stdio.h>
+	extern portTickType hstxsBenchTicks;
+	int hstxsBenchSpiIdle(void);
+	#define hstxsTicks() hstxsBenchTicks
+	#define hstxsSpiIdle() hstxsBenchSpiIdle()
+	#define hstxsWake()
+	#define HSLOG_ERR(fmt,...) fprintf(stderr,fmt "\n",__VA_ARGS__)
+	#define HSLOG_INFO(fmt,...) printf(fmt "\n",__VA_ARGS__)
+#else
+	#include <freertos/task.h>
+	#include <freertos/semphr.h>
+	#include <hcc/api_fat.h>
+	#include <at91/boards/ISIS_OBC_G20/board.h>
+	#include <at91/peripherals/pio/pio_it.h>
+	#include "LogManager.h"
+	#include "RunTimeStats.h"
+	#define hstxsTicks() xTaskGetTickCount()
+	// sendframe(...,FALSE) queues the transfer to the SPI driver task, which has a higher priority
+	// than HSTXS_PRIO: it has started the transfer when sendframe returns, and the driver is idle
+	// again when it ended. Nothing else uses SPI bus 1.
+	#define hstxsSpiIdle() (SPI_getDriverState(bus1_spi)!=transfer_spiState)
+	#define hstxsWake() do { if( hstxsWakeSem ) xSemaphoreGive(hstxsWakeSem); } while(0)
+	#define HSLOG_ERR UPLOG_ERR
+	#define HSLOG_INFO UPLOG_INFO
+	static xSemaphoreHandle hstxsWakeSem = 0; // TX ready pin, HstxsManagerStart/Stop
+#endif
+
+#define HSTXS_MS(ticks) ((unsigned int)((unsigned long long)(ticks)*1000/configTICK_RATE_HZ))
+
+enum { HSTXS_BUF_FREE, HSTXS_BUF_FULL, HSTXS_BUF_SENDING };
+
+typedef struct {
+	isis_hstxs_spi__sendframe__to_t frame; // read by the DMA until the transfer ends
+	unsigned short len; // source bytes in the frame
+	char state, waited; // waited: counted in readyWaits
+} HstxsBuffer;
+
+// Set by HstxsManagerStart/Stop, the rest only by the streaming task. The other tasks run while
+// HstxsPump blocks (I2C, SPI, source read), but the scheduler is cooperative and the task never
+// blocks halfway through an update of these: HstxsManagerGet copies a consistent report.
+static HstxsSource hstxsSource = 0;
+static void* hstxsPriv = 0;
+static volatile char hstxsBegin = 0, hstxsStopReq = 0;
+static char hstxsEnded = 0; // no more frames from the source
+static HstxsBuffer hstxsBuf[2];
+static unsigned char hstxsFill = 0, hstxsSend = 0; // next buffer to fill, to send
+static signed char hstxsInFlight = -1; // buffer in the SPI transfer
+static unsigned char hstxsVcCount = 0;
+static portTickType hstxsFirst = 0, hstxsLast = 0; // first and last frame sent
+static uint32_t hstxsIdleStart = 0; // idle frame counter of the transmitter at the start
+static char hstxsIdleKnown = 0;
+static portTickType hstxsIdleRead = 0; // last read of the idle frame counter
+static unsigned char hstxsSendFails = 0; // sendframe failures in a row
+static HstxsManagerReport hstxsStat;
+
+
+// Idle frames sent by the transmitter since the stream started
+static void HstxsUnderruns() {
+	uint32_t idle;
+	if( ! hstxsIdleKnown ) return;
+	hstxsIdleRead = hstxsTicks();
+	if( driver_error_none!=isis_hstxs_v2__get_virtual_channel_counter_0(HSTXS_INDEX,&idle) ) { ++hstxsStat.i2cErrors; return; }
+	hstxsStat.underruns = idle-hstxsIdleStart;
+}
+
+static void HstxsStreamBegin() {
+	unsigned int streams = hstxsStat.streams;
+	memset(&hstxsStat,0,sizeof(hstxsStat));
+	hstxsStat.streams = streams;
+	hstxsStat.active = 1;
+	memset(hstxsBuf,0,sizeof(hstxsBuf));
+	hstxsFill = hstxsSend = 0;
+	hstxsInFlight = -1;
+	hstxsEnded = 0;
+	hstxsBegin = 0;
+	hstxsIdleKnown = 0;
+	hstxsSendFails = 0;
+}
+
+static void HstxsStreamEnd() {
+	hstxsSource(0,0,hstxsPriv);
+	HstxsUnderruns();
+	hstxsStat.active = 0;
+	++hstxsStat.streams;
+	hstxsSource = 0;
+	hstxsStopReq = 0;
+	HSLOG_INFO("%s %u frames %u bytes in %ums underruns=%u",__FUNCTION__,
+				  hstxsStat.frames,hstxsStat.bytes,HSTXS_MS(hstxsLast-hstxsFirst),hstxsStat.underruns);
+}
+
+static void HstxsFillBuffer(HstxsBuffer* b) {
+	isis_hstxs_v2__ccsds_frameheader_t* h = &b->frame.fields.header;
+	int n = hstxsSource(b->frame.fields.data,HSTXS_FRAME_DATA,hstxsPriv);
+	if( n<=0 ) {
+		if( n<0 ) ++hstxsStat.sourceErrors;
+		hstxsEnded = 1;
+		return;
+	}
+	if( n>HSTXS_FRAME_DATA ) n = HSTXS_FRAME_DATA;
+	if( n<HSTXS_FRAME_DATA ) memset(b->frame.fields.data+n,0,HSTXS_FRAME_DATA-n);
+	// spacecraft id, version and master channel count are set by the transmitter
+	memset(h,0,sizeof(*h));
+	h->fields.virtual_channel = HSTXS_VC;
+	h->fields.framecount_vc = hstxsVcCount++;
+	h->fields.firstheader_ptr_high = 0x7; // 0x7FF: no packet starts in the frame, the data is a byte stream
+	h->fields.firstheader_ptr_low = 0xFF;
+	b->len = n;
+	b->waited = 0;
+	b->state = HSTXS_BUF_FULL;
+	hstxsFill ^= 1;
+}
+
+static void HstxsSendBuffer(HstxsBuffer* b) {
+	portTickType now;
+	// the transmitter has been sending idle frames until now
+	if( hstxsStat.frames==0 && ! hstxsIdleKnown ) {
+		hstxsIdleKnown = driver_error_none==isis_hstxs_v2__get_virtual_channel_counter_0(HSTXS_INDEX,&hstxsIdleStart);
+		if( ! hstxsIdleKnown ) ++hstxsStat.i2cErrors;
+		hstxsIdleRead = hstxsTicks();
+	}
+	if( driver_error_none!=isis_hstxs_spi__sendframe(&b->frame,FALSE) ) {
+		++hstxsStat.sendErrors;
+		if( hstxsSendFails<255 ) ++hstxsSendFails;
+		return;
+	}
+	hstxsSendFails = 0;
+	now = hstxsTicks();
+	if( hstxsStat.frames==0 ) hstxsFirst = now;
+	else if( HSTXS_MS(now-hstxsLast)>hstxsStat.maxGapMs ) hstxsStat.maxGapMs = HSTXS_MS(now-hstxsLast);
+	hstxsLast = now;
+	++hstxsStat.frames;
+	hstxsStat.bytes += b->len;
+	b->state = HSTXS_BUF_SENDING;
+	hstxsInFlight = hstxsSend;
+	hstxsSend ^= 1;
+}
+
+HstxsWait HstxsPump() {
+	HstxsBuffer* b;
+	uint8_t ready = 0;
+	if( ! hstxsSource ) return HSTXS_WAIT_START;
+	if( hstxsBegin ) HstxsStreamBegin();
+	// the counter is read here, by the streaming task: HstxsManagerGet only copies the report
+	if( hstxsIdleKnown && HSTXS_MS(hstxsTicks()-hstxsIdleRead)>=HSTXS_UNDERRUNS_MS ) HstxsUnderruns();
+	// one transfer at a time: the driver idle means it ended
+	if( hstxsInFlight>=0 && hstxsSpiIdle() ) {
+		hstxsBuf[(int)hstxsInFlight].state = HSTXS_BUF_FREE;
+		hstxsInFlight = -1;
+	}
+	if( hstxsStopReq && ! hstxsEnded ) {
+		hstxsEnded = 1;
+		if( hstxsBuf[0].state==HSTXS_BUF_FULL ) hstxsBuf[0].state = HSTXS_BUF_FREE;
+		if( hstxsBuf[1].state==HSTXS_BUF_FULL ) hstxsBuf[1].state = HSTXS_BUF_FREE;
+	}
+
+	b = &hstxsBuf[hstxsSend];
+	if( b->state==HSTXS_BUF_FULL && hstxsInFlight<0 ) {
+		if( driver_error_none!=isis_hstxs_spi__gettxready(&ready) ) ++hstxsStat.sendErrors;
+		if( ready ) {
+			HstxsSendBuffer(b);
+			if( b->state!=HSTXS_BUF_SENDING ) return HSTXS_WAIT_ERROR; // the SPI is idle: waiting for it would spin
+		} else if( ! b->waited ) {
+			b->waited = 1;
+			++hstxsStat.readyWaits;
+		}
+	}
+
+	// the other buffer is filled while one is sent or waits for the pin
+	b = &hstxsBuf[hstxsFill];
+	if( b->state==HSTXS_BUF_FREE && ! hstxsEnded ) {
+		HstxsFillBuffer(b);
+		return HSTXS_WAIT_NONE;
+	}
+
+	if( hstxsEnded && hstxsInFlight<0 && hstxsBuf[hstxsSend].state!=HSTXS_BUF_FULL ) {
+		HstxsStreamEnd();
+		return HSTXS_WAIT_START;
+	}
+	if( hstxsBuf[hstxsSend].state==HSTXS_BUF_FULL && hstxsInFlight<0 ) return HSTXS_WAIT_READY;
+	++hstxsStat.spiWaits;
+	return HSTXS_WAIT_SPI;
+}
+
+unsigned int HstxsErrorBackoffMs() {
+	unsigned int ms = HSTXS_ERROR_BACKOFF_MS, i;
+	for(i=1; i<hstxsSendFails && ms<HSTXS_ERROR_BACKOFF_MAX_MS; ++i) ms *= 2;
+	return ms<HSTXS_ERROR_BACKOFF_MAX_MS ? ms : HSTXS_ERROR_BACKOFF_MAX_MS;
+}
+
+int HstxsManagerStart(HstxsSource source, void* privData) {
+	if( hstxsSource || ! source ) return -1;
+	hstxsPriv = privData;
+	hstxsStopReq = 0;
+	hstxsBegin = 1;
+	hstxsSource = source;
+	hstxsWake();
+	return 0;
+}
+
+void HstxsManagerStop() {
+	if( hstxsSource ) hstxsStopReq = 1;
+	hstxsWake();
+}
+
+int HstxsManagerGet(HstxsManagerReport* rep) {
+	memcpy(rep,&hstxsStat,sizeof(*rep));
+	if( rep->frames>1 ) {
+		rep->ms = HSTXS_MS(hstxsLast-hstxsFirst);
+		if( rep->ms ) rep->bytesPerSec = (unsigned int)((unsigned long long)rep->bytes*1000/rep->ms);
+	}
+	return 0;
+}
+
+void HstxsManagerShowStatus() {
+	HstxsManagerReport rep;
+	HstxsManagerGet(&rep);
+	HSLOG_INFO("%s active=%u streams=%u frames=%u bytes=%u ms=%u bytes/s=%u underruns=%u maxGap=%ums",
+				  __FUNCTION__,rep.active,rep.streams,rep.frames,rep.bytes,rep.ms,rep.bytesPerSec,rep.underruns,rep.maxGapMs);
+	HSLOG_INFO("%s readyWaits=%u spiWaits=%u sendErrors=%u sourceErrors=%u i2cErrors=%u",
+				  __FUNCTION__,rep.readyWaits,rep.spiWaits,rep.sendErrors,rep.sourceErrors,rep.i2cErrors);
+}
+
+#ifndef HSTXS_HOST
+
+static const Pin hstxsReadyPin = HSTXS_TXREADY_PIN;
+static xTaskHandle hstxsTaskHandle = 0;
+static F_FILE* hstxsFile = 0;
+static char hstxsPath[HSTXS_PATH_MAX];
+
+// The transmitter has room for a frame
+static void HstxsReadyISR(const Pin* pin) {
+	portBASE_TYPE woken = pdFALSE;
+	if( PIO_Get(pin)!=1 ) return;
+	xSemaphoreGiveFromISR(hstxsWakeSem,&woken);
+	if( woken==pdTRUE ) portYIELD_FROM_ISR();
+}
+
+static int HstxsFileSource(unsigned char* data, unsigned int max, void* privData) {
+	if( ! data ) {
+		if( hstxsFile ) { f_close(hstxsFile); hstxsFile = 0; }
+		return 0;
+	}
+	if( ! hstxsFile && !(hstxsFile=f_open(hstxsPath,"r")) ) {
+		UPLOG_ERR("%s f_open %s err=%d",__FUNCTION__,hstxsPath,f_getlasterror());
+		return -1;
+	}
+	return (int)f_read(data,1,max,hstxsFile);
+}
+
+// Both buffers are in use until the transfer ends
+static void HstxsWaitSpi() {
+	unsigned long start = ulGetRunTimeCounterValue(), spin = (unsigned long)((unsigned long long)HSTXS_SPI_SPIN_US*RTS_COUNTER_HZ/1000000);
+	while( ! hstxsSpiIdle() && ulGetRunTimeCounterValue()-start<spin ) taskYIELD();
+	if( ! hstxsSpiIdle() ) vTaskDelay(1);
+}
+
+static void HstxsTask(void* args) {
+	UPLOG_NOTICE("%s starting",__FUNCTION__);
+	if( f_enterFS()!=F_NO_ERROR ) UPLOG_ERR("%s enter FS error, no file streams",__FUNCTION__);
+	for(;;) {
+		switch( HstxsPump() ) {
+			case HSTXS_WAIT_NONE: break;
+			case HSTXS_WAIT_READY: xSemaphoreTake(hstxsWakeSem,HSTXS_READY_TIMEOUT_TICKS); break;
+			case HSTXS_WAIT_SPI: HstxsWaitSpi(); break;
+			case HSTXS_WAIT_ERROR: vTaskDelay(pdMS_TO_TICKS(HstxsErrorBackoffMs())); break;
+			case HSTXS_WAIT_START: xSemaphoreTake(hstxsWakeSem,portMAX_DELAY); break;
+		}
+	}
+}
+
+int HstxsManagerInit() {
+	ISIS_HSTXS_V2_t hs;
+	driver_error_t err;
+	if( hstxsTaskHandle ) return 0;
+#if ! HSTXS_ENABLED
+	UPLOG_NOTICE("%s disabled (HSTXS_ENABLED)",__FUNCTION__);
+	return -1;
+#endif
+	if( SPI_start(bus1_spi,HSTXS_SPI_SLAVE) ) { UPLOG_ERR("%s SPI_start",__FUNCTION__); return -1; }
+	hs.mssAddr = HSTXS_MSS_ADDR;
+	hs.supAddr = HSTXS_SUP_ADDR;
+	err = ISIS_HSTXS_V2_Init(&hs,1);
+	if( err!=driver_error_none && err!=driver_error_reinit ) { UPLOG_ERR("%s driver init error %d",__FUNCTION__,err); return -1; }
+	// configures the pin as input with its pull-up
+	err = ISIS_HSTXS_SPI_Init(HSTXS_SPI_SLAVE,hstxsReadyPin);
+	if( err!=driver_error_none && err!=driver_error_reinit ) { UPLOG_ERR("%s SPI driver init error %d",__FUNCTION__,err); return -1; }
+	vSemaphoreCreateBinary(hstxsWakeSem);
+	if( ! hstxsWakeSem ) { UPLOG_ERR("%s semaphore",__FUNCTION__); return -1; }
+	xSemaphoreTake(hstxsWakeSem,0); // created given
+	if( pdPASS!=xTaskCreate(HstxsTask,(signed char*)"HstxsTask",HSTXS_STACK_SIZE,NULL,HSTXS_PRIO,&hstxsTaskHandle) ) {
+		UPLOG_ERR("%s task",__FUNCTION__);
+		return -1;
+	}
+	PIO_ConfigureIt(&hstxsReadyPin,HstxsReadyISR);
+	PIO_EnableIt(&hstxsReadyPin);
+	UPLOG_INFO("%s started",__FUNCTION__);
+	return 0;
+}
+
+int HstxsManagerSendFile(const char* path) {
+	if( hstxsSource ) return -1;
+	strncpy(hstxsPath,path,sizeof(hstxsPath)-1);
+	hstxsPath[sizeof(hstxsPath)-1] = 0;
+	return HstxsManagerStart(HstxsFileSource,0);
+}
+
+#endif
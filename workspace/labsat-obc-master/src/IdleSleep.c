@@ -0,0 +1,127 @@
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <at91/boards/ISIS_OBC_G20/board.h>
+#include "IdleSleep.h"
+#include "RunTimeStats.h"
+#include "LogManager.h"
+
+#define IDLE_US(counts) ((unsigned long long)(counts)*1000000/RTS_COUNTER_HZ)
+
+// Updated by the idle task with interrupts disabled; read with interrupts disabled too.
+static volatile char idleOn = 0;
+static unsigned long long idleSleepTotal = 0; // counts
+static unsigned int idleSleeps = 0, idleBusy = 0;
+// IdleSleepSample
+static unsigned long long idleLastSleep = 0;
+static unsigned long idleLastCounter = 0;
+static unsigned int idleLastSleeps = 0, idleSamples = 0;
+static unsigned short idleResidency = 0, idleMinResidency = 0, idleMaxResidency = 0;
+static unsigned int idleWakeups = 0, idleMaxWakeups = 0;
+
+
+// The interrupts stay masked from the ready check until after the sleep, so an interrupt that
+// readies a task in between wakes the core instead of running before it stops.
+static inline unsigned int IdleDisableInterrupts() {
+#if defined(__arm__) && !defined(__thumb__)
+	unsigned int cpsr, tmp;
+	__asm__ volatile("mrs %0, cpsr\n\torr %1, %0, #0xC0\n\tmsr cpsr_c, %1" : "=r"(cpsr), "=r"(tmp) : : "memory");
+	return cpsr;
+#else
+	return 0;
+#endif
+}
+
+static inline void IdleRestoreInterrupts(unsigned int cpsr) {
+#if defined(__arm__) && !defined(__thumb__)
+	__asm__ volatile("msr cpsr_c, %0" : : "r"(cpsr) : "memory");
+#else
+	(void)cpsr;
+#endif
+}
+
+// Called by the idle task every time it runs, it must not block
+void vApplicationIdleHook(void) {
+	unsigned int cpsr;
+	unsigned long start;
+	if( ! idleOn ) return;
+	cpsr = IdleDisableInterrupts();
+	if( xTaskIdleCanSleep() ) {
+		start = ulGetRunTimeCounterValue();
+		// Stops the core after this instruction. Any interrupt enabled in the AIC restarts it,
+		// masked in the CPSR or not; the wait covers the few cycles the PMC takes to stop it.
+		AT91C_BASE_PMC->PMC_SCDR = AT91C_PMC_PCK;
+		while( (AT91C_BASE_PMC->PMC_SCSR & AT91C_PMC_PCK)!=AT91C_PMC_PCK ) ;
+		idleSleepTotal += ulGetRunTimeCounterValue()-start;
+		++idleSleeps;
+	} else {
+		++idleBusy;
+	}
+	IdleRestoreInterrupts(cpsr);
+}
+
+void IdleSleepEnable(char on) {
+	idleOn = on!=0;
+	UPLOG_NOTICE("%s sleep %s",__FUNCTION__,idleOn ? "on" : "off");
+}
+
+int IdleSleepInit() {
+	unsigned int cpsr = IdleDisableInterrupts();
+		idleSleepTotal = idleLastSleep = 0;
+		idleSleeps = idleBusy = idleLastSleeps = 0;
+		idleLastCounter = ulGetRunTimeCounterValue();
+	IdleRestoreInterrupts(cpsr);
+	idleSamples = 0;
+	idleOn = IDLE_SLEEP_DEFAULT;
+	return 0;
+}
+
+int IdleSleepSample(unsigned int when, void* privData) {
+	unsigned long long asleep;
+	unsigned long counter, elapsed;
+	unsigned int sleeps, cpsr;
+	cpsr = IdleDisableInterrupts();
+		counter = ulGetRunTimeCounterValue();
+		asleep = idleSleepTotal-idleLastSleep;
+		sleeps = idleSleeps-idleLastSleeps;
+		idleLastSleep = idleSleepTotal;
+		idleLastSleeps = idleSleeps;
+	IdleRestoreInterrupts(cpsr);
+	elapsed = counter-idleLastCounter;
+	idleLastCounter = counter;
+	if( elapsed==0 ) return 0;
+	idleResidency = asleep>=elapsed ? 1000 : (unsigned short)(asleep*1000/elapsed);
+	idleWakeups = (unsigned int)((unsigned long long)sleeps*RTS_COUNTER_HZ/elapsed);
+	if( idleSamples==0 || idleResidency<idleMinResidency ) idleMinResidency = idleResidency;
+	if( idleSamples==0 || idleResidency>idleMaxResidency ) idleMaxResidency = idleResidency;
+	if( idleWakeups>idleMaxWakeups ) idleMaxWakeups = idleWakeups;
+	++idleSamples;
+	return 0;
+}
+
+int IdleSleepGet(IdleSleepReport* rep) {
+	unsigned int cpsr;
+	memset(rep,0,sizeof(*rep));
+	rep->enabled = idleOn;
+	rep->samples = idleSamples;
+	rep->residency = idleResidency;
+	rep->minResidency = idleMinResidency;
+	rep->maxResidency = idleMaxResidency;
+	rep->wakeups = idleWakeups;
+	rep->maxWakeups = idleMaxWakeups;
+	cpsr = IdleDisableInterrupts();
+		rep->sleepUs = idleSleepTotal;
+		rep->sleeps = idleSleeps;
+		rep->busy = idleBusy;
+	IdleRestoreInterrupts(cpsr);
+	rep->sleepUs = IDLE_US(rep->sleepUs);
+	return 0;
+}
+
+void IdleSleepShowStatus() {
+	IdleSleepReport rep;
+	IdleSleepGet(&rep);
+	UPLOG_INFO("%s sleep=%s samples=%u residency(permil)=%u min=%u max=%u wakeups/s=%u max=%u asleep=%us sleeps=%u busy=%u",
+				  __FUNCTION__,rep.enabled ? "on" : "off",rep.samples,rep.residency,rep.minResidency,rep.maxResidency,
+				  rep.wakeups,rep.maxWakeups,(unsigned int)(rep.sleepUs/1000000),rep.sleeps,rep.busy);
+}
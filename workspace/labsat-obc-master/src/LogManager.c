@@ -5,10 +5,11 @@
 #include <hal/Timing/RTT.h>
 #include <hal/Timing/RTC.h>
 #include "LogManager.h"
+#include "MsgChannel.h"
+#include "SliceMonitor.h"
 /* FreeRTOS includes */
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <freertos/queue.h> 
 /* DO NOT FORGET hal/at91/src/utility/stdio.c IN THE SOURCE FILES !! */
 /* (to prevent code size bloat of standard stdio lib) */
 #include <stdio.h>
@@ -24,7 +25,8 @@ static ui32 logRotateNum			 = SDLOG_ROTATENUM;
 static char			 logNonBlocking = LOG_NONBLOCKING;
 static const char* sdPath         = SDLOG_PATH;
 static xTaskHandle  logTaskHdl = 0;
-static xQueueHandle logQHandle = 0;
+static MsgPool*     logPool = 0; // log lines, passed to the log task by pointer
+static MsgChannel*  logChannel = 0;
 static F_FILE*				 logFH = 0;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -72,12 +74,16 @@ int logHdr(char* buf) {
 void UPLOG(const char* str,...) {
 	va_list args;
 	va_start(args, str);
-	logQueueItem* li = pvPortMalloc(sizeof(logQueueItem));
+	MsgChannel* ch = logChannel;
+	logQueueItem* li = ch ? MsgAlloc(logPool,portMAX_DELAY) : pvPortMalloc(sizeof(logQueueItem));
+	if( ! li ) { va_end(args); return; }
 	li->n = logHdr(li->txt);
 	li->n += vsnprintf(li->txt+li->n,MAXLOGLINE-2-li->n,str,args); 
+	va_end(args);
 	li->txt[li->n++] = '\n'; li->txt[li->n] = 0;
-	if( logQHandle )  {
-		xQueueSend(logQHandle,li,portMAX_DELAY);
+	if( ch )  {
+		// the pool has no more lines than the channel holds, so this does not block
+		if( MsgSend(ch,li,0,portMAX_DELAY) ) MsgFree(li);
 	} else {
 		// Why use heap mem for txt instead of stack mem when blocking?
 		// Because in freertos tasks we may have little stack mem. 
@@ -89,31 +95,40 @@ void UPLOG(const char* str,...) {
 
 void LogManagerTask(void* q) {
 	static const char* lmtxt = __FUNCTION__, *starting = "starting\n", *ending = "ending\n";
-	logQueueItem* li;	
-	xQueueHandle tq = logQHandle;
+	logQueueItem* li[LOG_BATCH];
+	MsgChannel* ch = logChannel;
+	unsigned int i, k, stop = 0;
 	int n = 0;
+	portTickType wait = LOGQUEUE_WAIT_TICKS;
 	if( f_enterFS()!=F_NO_ERROR ) { __DBGU_WRITE_LOG__(lmtxt); __DBGU_WRITE_LOG__(" enter FS error\n"); goto endOfLogTask; }
 	logCombined(lmtxt,strlen(lmtxt)); logCombined(starting,strlen(starting)); // need strlen instead of sizeof here
-	for(;;) {
-		if( pdPASS!=xQueueReceive(tq, &li, LOGQUEUE_WAIT_TICKS) ) {
+	while( ! stop ) {
+		#ifdef SDLOG
+		// the size only grows with a write: wake up by timeout only to retry a failed rotation
+		wait = n>=maxLogFileSize ? LOGQUEUE_WAIT_TICKS : portMAX_DELAY;
+		#endif
+		if( 0==(k=MsgReceive(ch,(void**)li,LOG_BATCH,wait)) ) {
 			#ifdef SDLOG
 			// timeout, check size
 			if( n>=maxLogFileSize ) { if( logRotateCheck() ) n = 0; }
 			#endif
 			continue;
 		}
-		if( li==0 ) break; // signaled to end task
-		logCombined(li->txt,li->n);
-		n += li->n;
+		for(i=0; i<k; ++i) {
+			if( li[i]==0 ) { stop = 1; continue; } // signaled to end task
+			if( i ) SLICE_YIELD(); // SD writes of a batch
+			logCombined(li[i]->txt,li[i]->n);
+			n += li[i]->n;
+			MsgFree(li[i]);
+		}
 		#ifdef SDLOG
 			if( n>=maxLogFileSize ) { if( logRotateCheck() ) n = 0; }
 		#endif
-		vPortFree(li);
 	}
 	endOfLogTask:
-	// flush queue and delete it
-	while( pdPASS==xQueueReceive(tq,&li,0) ) vPortFree(li);
-	vQueueDelete(tq);
+	// flush channel and delete it
+	while( (k=MsgReceive(ch,(void**)li,LOG_BATCH,0)) ) for(i=0; i<k; ++i) MsgFree(li[i]);
+	MsgChannelDelete(ch);
 	// bye message
 	logCombined(ending,sizeof(ending)); logCombined(ending,sizeof(ending));
 	f_releaseFS();
@@ -141,17 +156,19 @@ int LogManagerInit() {
 		}
 	#endif
 	if( logNonBlocking ) {
-   	logQHandle = xQueueCreate(LOG_MAXQUEUE,sizeof(void*)); // queue of pointers to logItems
-   	if( pdPASS!=xTaskCreate(LogManagerTask,"LogManagerTask",LOG_STACK_SIZE,NULL,LOG_PRIORITY,&logTaskHdl) ) {
+		// the pool is kept across LogManagerReinit
+		if( ! logPool ) logPool = MsgPoolCreate("LogPool",LOG_MAXQUEUE,sizeof(logQueueItem),0);
+		logChannel = logPool ? MsgChannelCreate("LogQueue",LOG_MAXQUEUE,0) : 0;
+   	if( ! logChannel || pdPASS!=xTaskCreate(LogManagerTask,"LogManagerTask",LOG_STACK_SIZE,NULL,LOG_PRIORITY,&logTaskHdl) ) {
 			logNonBlocking = 0;
-			if( logQHandle ) { vQueueDelete( logQHandle ); logQHandle = 0; }
+			if( logChannel ) { MsgChannelDelete(logChannel); logChannel = 0; }
 			logTaskHdl = 0;
 			ret = -2;
 			UPLOG_ALERT("%serror creating task => using blocking logs",ownStr);
 		}
 	} else {
-		// in this case, old queue is deleted by old log task
-		logQHandle = 0;
+		// in this case, old channel is deleted by old log task
+		logChannel = 0;
 		logTaskHdl = 0;
 	}
 	// Do not unregister from filesystem management. InitTask will continue logging.
@@ -164,12 +181,12 @@ int LogManagerInit() {
 int LogManagerReinit(const char* _sdPath,char _nonBlocking,
 							unsigned int _maxLogFileSize,unsigned int _logRotateNum) {
 	if( logNonBlocking && logTaskHdl ) {
-		void *li = 0;
-		if( xQueueSend(logQHandle,&li,portMAX_DELAY)!=pdTRUE ) { // signal logTask to finish and delete queue
+		MsgChannel* ch = logChannel;
+		logChannel = 0; // new lines are written directly until the new channel exists
+		if( MsgSend(ch,0,0,portMAX_DELAY) ) { // signal logTask to finish and delete channel
 			// Could not signal task to stop! Stop it by force
 			vTaskDelete(logTaskHdl);
 		}
-		logQHandle = 0;
 		logTaskHdl = 0;
 	}
 	#ifdef SDLOG
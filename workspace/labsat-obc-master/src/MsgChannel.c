@@ -0,0 +1,318 @@
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include "MsgChannel.h"
+#include "LogManager.h"
+
+#define MSG_FREE 0
+#define MSG_ALLOCATED 1
+
+// Pools are never deleted, so MsgFree can look them up from an interrupt
+static MsgPool* msgPool[MSG_MAX_POOLS];
+static MsgChannel* msgChannel[MSG_MAX_CHANNELS];
+static unsigned int msgPools = 0, msgUnknownFrees = 0;
+static xSemaphoreHandle msgLock = 0; // creation and deletion
+static char msgUrgentToken; // its address is put in the normal queue by an urgent send
+
+
+// The counters are also updated from interrupts, which the kernel critical sections do not mask
+static inline unsigned int MsgDisableInterrupts() {
+#if defined(__arm__) && !defined(__thumb__)
+	unsigned int cpsr, tmp;
+	__asm__ volatile("mrs %0, cpsr\n\torr %1, %0, #0xC0\n\tmsr cpsr_c, %1" : "=r"(cpsr), "=r"(tmp) : : "memory");
+	return cpsr;
+#else
+	return 0;
+#endif
+}
+
+static inline void MsgRestoreInterrupts(unsigned int cpsr) {
+#if defined(__arm__) && !defined(__thumb__)
+	__asm__ volatile("msr cpsr_c, %0" : : "r"(cpsr) : "memory");
+#else
+	(void)cpsr;
+#endif
+}
+
+static int MsgLock() {
+	if( ! msgLock && !(msgLock=xSemaphoreCreateMutex()) ) return -1;
+	xSemaphoreTake(msgLock,portMAX_DELAY);
+	return 0;
+}
+
+// Pool and index of a buffer. Returns 0 if msg is not the start of a buffer of a pool.
+static MsgPool* MsgFind(void* msg, unsigned int* idx) {
+	unsigned int i, off;
+	MsgPool* pool;
+	for(i=0; i<msgPools; ++i) {
+		pool = msgPool[i];
+		if( (unsigned char*)msg<pool->base || (unsigned char*)msg>=pool->base+pool->count*pool->size ) continue;
+		off = (unsigned char*)msg-pool->base;
+		if( off%pool->size ) return 0;
+		*idx = off/pool->size;
+		return pool;
+	}
+	return 0;
+}
+
+// Mark msg free, with interrupts disabled. Returns its pool, or 0 if it was not allocated.
+static MsgPool* MsgRelease(void* msg) {
+	unsigned int idx;
+	MsgPool* pool = MsgFind(msg,&idx);
+	if( ! pool ) { ++msgUnknownFrees; return 0; }
+	if( pool->state[idx]!=MSG_ALLOCATED ) { ++pool->badFrees; return 0; }
+	pool->state[idx] = MSG_FREE;
+	if( pool->owner[idx] ) --pool->owner[idx]->inFlight;
+	pool->owner[idx] = 0;
+	--pool->inUse;
+	return pool;
+}
+
+
+/*- pools -----------------------------------------------------------------------------------*/
+
+MsgPool* MsgPoolCreate(const char* name, unsigned int count, unsigned int size, void* storage) {
+	MsgPool* pool;
+	unsigned char* p;
+	unsigned int i;
+	if( ! storage ) size = (size+7) & ~7;
+	if( MsgLock() ) return 0;
+	pool = msgPools<MSG_MAX_POOLS ? pvPortMalloc(sizeof(MsgPool)) : 0;
+	if( pool ) {
+		memset(pool,0,sizeof(*pool));
+		pool->name = name;
+		pool->size = size;
+		pool->count = count;
+		pool->ownStorage = storage==0;
+		pool->base = storage ? storage : pvPortMalloc(count*size);
+		pool->owner = pvPortMalloc(count*sizeof(MsgChannel*));
+		pool->state = pvPortMalloc(count);
+		pool->freeQ = xQueueCreate(count,sizeof(void*));
+		if( pool->base && pool->owner && pool->state && pool->freeQ ) {
+			memset(pool->owner,0,count*sizeof(MsgChannel*));
+			memset(pool->state,MSG_FREE,count);
+			for(i=0; i<count; ++i) {
+				p = pool->base+i*size;
+				xQueueSend(pool->freeQ,&p,0);
+			}
+			msgPool[msgPools++] = pool;
+		} else {
+			if( pool->ownStorage && pool->base ) vPortFree(pool->base);
+			if( pool->owner ) vPortFree(pool->owner);
+			if( pool->state ) vPortFree(pool->state);
+			if( pool->freeQ ) vQueueDelete(pool->freeQ);
+			vPortFree(pool);
+			pool = 0;
+		}
+	}
+	xSemaphoreGive(msgLock);
+	if( ! pool ) UPLOG_ERR("%s '%s' %ux%u failed",__FUNCTION__,name,count,size);
+	return pool;
+}
+
+void* MsgAlloc(MsgPool* pool, portTickType wait) {
+	unsigned char* p;
+	unsigned int cpsr, idx;
+	if( ! pool ) return 0;
+	if( pdTRUE!=xQueueReceive(pool->freeQ,&p,wait) ) {
+		cpsr = MsgDisableInterrupts();
+			++pool->exhausted;
+		MsgRestoreInterrupts(cpsr);
+		return 0;
+	}
+	idx = (p-pool->base)/pool->size;
+	cpsr = MsgDisableInterrupts();
+		pool->state[idx] = MSG_ALLOCATED;
+		pool->owner[idx] = 0;
+		if( ++pool->inUse>pool->maxInUse ) pool->maxInUse = pool->inUse;
+		++pool->allocs;
+	MsgRestoreInterrupts(cpsr);
+	return p;
+}
+
+void MsgFree(void* msg) {
+	MsgPool* pool;
+	unsigned int cpsr;
+	if( ! msg ) return;
+	cpsr = MsgDisableInterrupts();
+		pool = MsgRelease(msg);
+	MsgRestoreInterrupts(cpsr);
+	// the free queue holds every buffer, it is never full
+	if( pool ) xQueueSend(pool->freeQ,&msg,0);
+}
+
+void MsgFreeFromISR(void* msg, portBASE_TYPE* higherPriorityTaskWoken) {
+	MsgPool* pool;
+	unsigned int cpsr;
+	if( ! msg ) return;
+	cpsr = MsgDisableInterrupts();
+		pool = MsgRelease(msg);
+	MsgRestoreInterrupts(cpsr);
+	if( pool ) xQueueSendFromISR(pool->freeQ,&msg,higherPriorityTaskWoken);
+}
+
+
+/*- channels --------------------------------------------------------------------------------*/
+
+MsgChannel* MsgChannelCreate(const char* name, unsigned int depth, unsigned int urgentDepth) {
+	MsgChannel* ch = 0;
+	unsigned int i;
+	if( MsgLock() ) return 0;
+	for(i=0; i<MSG_MAX_CHANNELS && msgChannel[i]; ++i) ;
+	if( i<MSG_MAX_CHANNELS && (ch=pvPortMalloc(sizeof(MsgChannel))) ) {
+		memset(ch,0,sizeof(*ch));
+		ch->name = name;
+		ch->depth = depth;
+		ch->urgentDepth = urgentDepth;
+		// room for urgentDepth tokens besides the messages
+		ch->q = xQueueCreate(depth+urgentDepth,sizeof(void*));
+		if( urgentDepth ) ch->urgentQ = xQueueCreate(urgentDepth,sizeof(void*));
+		if( ch->q && (ch->urgentQ || ! urgentDepth) ) {
+			vQueueAddToRegistry(ch->q,(signed char*)name); // depth reported by csp ps
+			msgChannel[i] = ch;
+		} else {
+			if( ch->q ) vQueueDelete(ch->q);
+			vPortFree(ch);
+			ch = 0;
+		}
+	}
+	xSemaphoreGive(msgLock);
+	if( ! ch ) UPLOG_ERR("%s '%s' failed",__FUNCTION__,name);
+	return ch;
+}
+
+void MsgChannelDelete(MsgChannel* ch) {
+	unsigned int i, j, cpsr;
+	if( ! ch || MsgLock() ) return;
+	for(i=0; i<MSG_MAX_CHANNELS; ++i) if( msgChannel[i]==ch ) msgChannel[i] = 0;
+	// messages not freed yet stop counting for it
+	if( ch->inFlight ) {
+		for(i=0; i<msgPools; ++i) {
+			cpsr = MsgDisableInterrupts();
+				for(j=0; j<msgPool[i]->count; ++j) if( msgPool[i]->owner[j]==ch ) msgPool[i]->owner[j] = 0;
+			MsgRestoreInterrupts(cpsr);
+		}
+	}
+	xSemaphoreGive(msgLock);
+	vQueueDelete(ch->q); // also takes it out of the registry
+	if( ch->urgentQ ) vQueueDelete(ch->urgentQ);
+	vPortFree(ch);
+}
+
+// Count msg in flight on ch (sent), or stop counting it (undo). Returns -1 if msg is not from a pool.
+static int MsgOwn(MsgChannel* ch, void* msg, char undo) {
+	unsigned int idx, cpsr;
+	MsgPool* pool;
+	int ret = 0;
+	if( ! msg ) return 0;
+	cpsr = MsgDisableInterrupts();
+		if( !(pool=MsgFind(msg,&idx)) || pool->state[idx]!=MSG_ALLOCATED ) {
+			ret = -1;
+		} else if( undo ) {
+			pool->owner[idx] = 0;
+			--ch->inFlight;
+			--ch->sent;
+			++ch->full;
+		} else {
+			if( pool->owner[idx] ) --pool->owner[idx]->inFlight; // forwarded from another channel
+			pool->owner[idx] = ch;
+			if( ++ch->inFlight>ch->maxInFlight ) ch->maxInFlight = ch->inFlight;
+			++ch->sent;
+		}
+	MsgRestoreInterrupts(cpsr);
+	return ret;
+}
+
+int MsgSend(MsgChannel* ch, void* msg, char urgent, portTickType wait) {
+	void* token = &msgUrgentToken;
+	unsigned int cpsr;
+	if( ! ch || (urgent && ! ch->urgentQ) || MsgOwn(ch,msg,0) ) return -1;
+	if( ! urgent ) {
+		if( pdTRUE==xQueueSend(ch->q,&msg,wait) ) return 0;
+	} else if( pdTRUE==xQueueSend(ch->urgentQ,&msg,wait) ) {
+		// with urgentDepth tokens queued the receiver wakes up anyway
+		cpsr = MsgDisableInterrupts();
+			if( ch->tokens<ch->urgentDepth ) ++ch->tokens;
+			else token = 0;
+		MsgRestoreInterrupts(cpsr);
+		if( token ) xQueueSend(ch->q,&token,0);
+		return 0;
+	}
+	if( msg ) MsgOwn(ch,msg,1);
+	return -1;
+}
+
+int MsgSendFromISR(MsgChannel* ch, void* msg, portBASE_TYPE* higherPriorityTaskWoken) {
+	if( ! ch || MsgOwn(ch,msg,0) ) return -1;
+	if( pdTRUE==xQueueSendFromISR(ch->q,&msg,higherPriorityTaskWoken) ) return 0;
+	if( msg ) MsgOwn(ch,msg,1);
+	return -1;
+}
+
+// Whether msg, taken from the normal queue of ch, is a token (then no longer counted)
+static int MsgIsToken(MsgChannel* ch, void* msg) {
+	unsigned int cpsr;
+	if( msg!=&msgUrgentToken ) return 0;
+	cpsr = MsgDisableInterrupts();
+		--ch->tokens;
+	MsgRestoreInterrupts(cpsr);
+	return 1;
+}
+
+unsigned int MsgReceive(MsgChannel* ch, void** msgs, unsigned int max, portTickType wait) {
+	unsigned int n = 0;
+	void* first;
+	portTickType start = xTaskGetTickCount(), waited;
+	if( max>MSG_MAX_BATCH ) max = MSG_MAX_BATCH;
+	if( ! ch || ! max ) return 0;
+	while( ! n ) {
+		// a token whose urgent message was taken with an earlier one wakes up for nothing
+		waited = xTaskGetTickCount()-start;
+		if( pdTRUE!=xQueueReceive(ch->q,&first,wait==portMAX_DELAY ? wait : (waited<wait ? wait-waited : 0)) ) return 0;
+		// the urgent ones, then the message that woke us up
+		if( ch->urgentQ )
+			for(; n<max && pdTRUE==xQueueReceive(ch->urgentQ,&msgs[n],0); ++n) ;
+		if( MsgIsToken(ch,first) ) continue;
+		if( n==max ) {
+			// no room for it: back to the front, where it was (or after the last urgent if an
+			// interrupt filled the queue: only tasks send urgent messages)
+			if( pdTRUE==xQueueSendToFront(ch->q,&first,0) ) break;
+			xQueueSendToFront(ch->urgentQ,&msgs[--n],0);
+		}
+		msgs[n++] = first;
+	}
+	while( n<max && pdTRUE==xQueueReceive(ch->q,&msgs[n],0) )
+		if( ! MsgIsToken(ch,msgs[n]) ) ++n;
+	// only the receiving task updates these
+	ch->received += n;
+	++ch->batches;
+	if( n>ch->maxBatch ) ch->maxBatch = n;
+	return n;
+}
+
+unsigned int MsgWaiting(MsgChannel* ch) {
+	if( ! ch ) return 0;
+	return uxQueueMessagesWaiting(ch->q)-ch->tokens+(ch->urgentQ ? uxQueueMessagesWaiting(ch->urgentQ) : 0);
+}
+
+void MsgShowStatus() {
+	unsigned int i;
+	MsgPool* pool;
+	MsgChannel* ch;
+	if( MsgLock() ) return;
+	for(i=0; i<msgPools; ++i) {
+		pool = msgPool[i];
+		UPLOG_INFO("%s pool '%s' %ux%uB inUse=%u maxInUse=%u allocs=%u exhausted=%u badFrees=%u",__FUNCTION__,pool->name,
+					  pool->count,pool->size,pool->inUse,pool->maxInUse,pool->allocs,pool->exhausted,pool->badFrees);
+	}
+	for(i=0; i<MSG_MAX_CHANNELS; ++i) {
+		if( !(ch=msgChannel[i]) ) continue;
+		UPLOG_INFO("%s channel '%s' depth=%u urgentDepth=%u queued=%u inFlight=%u maxInFlight=%u sent=%u received=%u full=%u batches=%u maxBatch=%u",
+					  __FUNCTION__,ch->name,ch->depth,ch->urgentDepth,MsgWaiting(ch),ch->inFlight,ch->maxInFlight,ch->sent,ch->received,ch->full,
+					  ch->batches,ch->maxBatch);
+	}
+	xSemaphoreGive(msgLock);
+	if( msgUnknownFrees ) UPLOG_ERR("%s %u frees of pointers not from a pool",__FUNCTION__,msgUnknownFrees);
+}
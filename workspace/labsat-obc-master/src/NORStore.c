@@ -0,0 +1,420 @@
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <hal/boolean.h>
+#include <hal/checksum.h>
+#include <hal/Storage/NORflash.h>
+#include <hal/Timing/Time.h>
+#include "NORStore.h"
+
+#ifdef NORSTORE_HOST
+	// power-loss harness build (norstore-bench.c): one task, and the flash, clock and ticks are the
+	// harness fakes
+	#include <stdio.h>
+	extern unsigned char norBenchFlash[];
+	extern portTickType norBenchTicks;
+	#define NS_PTR(addr) ((const unsigned char*)(norBenchFlash+(addr)))
+	#define nsLockCreate() 1
+	#define nsLock()
+	#define nsUnlock()
+	#define nsTicks() norBenchTicks
+	#define UPLOG_ERR(fmt,...) fprintf(stderr,fmt "\n",__VA_ARGS__)
+	#define UPLOG_CRIT UPLOG_ERR
+	#define UPLOG_INFO(fmt,...)
+#else
+	#include <freertos/task.h>
+	#include <freertos/semphr.h>
+	#include "LogManager.h"
+	// the flash is read like RAM
+	#define NS_PTR(addr) ((const unsigned char*)(NOR_FLASH_BASE_ADDRESS+(addr)))
+	#define nsLockCreate() ( nsLockHandle || (nsLockHandle=xSemaphoreCreateMutex()) )
+	#define nsLock() xSemaphoreTake(nsLockHandle,portMAX_DELAY)
+	#define nsUnlock() xSemaphoreGive(nsLockHandle)
+	#define nsTicks() xTaskGetTickCount()
+	static xSemaphoreHandle nsLockHandle = 0;
+#endif
+
+#define NS_SECTOR_SIZE NORFLASH_SMALL_SECTOR_SIZE
+#define NS_HDR_SIZE 16 // sector header: magic(4) seq(4) erases(4) reserved(2) crc16(2)
+#define NS_REC_MAGIC 0xA55A
+#define NS_REC_HDR 8 // record: magic(2) crc16(2) key(2) len(2), then data padded to 16 bits
+#define NS_REC_SIZE(len) (NS_REC_HDR+(((len)+1) & ~1))
+#define NS_CRC_POLY 0x1021
+
+typedef struct {
+	unsigned int sector[2]; // flash addresses
+	const char* magic;
+	int err; // 0: the store is open
+	unsigned int active, seq; // active sector and its sequence number
+	unsigned int pos; // where the next record goes in the active sector
+	unsigned int erases[2];
+} NSArea;
+
+typedef struct {
+	unsigned short key, len;
+	unsigned int addr; // newest record of the key
+} NSKey;
+
+typedef struct {
+	NORStoreLogCallback cb;
+	void* priv;
+	int n, stop;
+} NSLogReader;
+
+typedef int (*NSRecordCallback)(unsigned int addr, const unsigned char* rec, void* priv);
+
+static NSArea nsKV = { {MODE_STORAGE_SECTOR,PARAMETER_STORAGE_SECTOR}, "NSKV", NS_ERR_NOTINIT };
+static NSArea nsLog = { {ERROR_LOG_FIRST_SECTOR,ERROR_LOG_SECOND_SECTOR}, "NSEL", NS_ERR_NOTINIT };
+static NSKey nsKey[NORSTORE_MAX_KEYS];
+static unsigned int nsCount = 0;
+static unsigned short nsLUT[256];
+static char nsReady = 0; // flash driver started
+static NORStoreStats nsSt;
+// records are built here: the flash can not be read while it is being programmed
+static unsigned short nsBuf[(NS_REC_HDR+NORSTORE_MAX_VALUE)/2];
+
+
+static void put16(unsigned char* p, unsigned int v) { p[0] = v & 0xFF; p[1] = (v>>8) & 0xFF; }
+static void put32(unsigned char* p, unsigned int v) { put16(p,v); put16(p+2,v>>16); }
+static unsigned int get16(const unsigned char* p) { return p[0] | p[1]<<8; }
+static unsigned int get32(const unsigned char* p) { return get16(p) | get16(p+2)<<16; }
+
+static unsigned short NSCrc(const unsigned char* data, unsigned int len) {
+	return checksum_calculateCRC16LUT(data,len,nsLUT,0xFFFF,TRUE);
+}
+
+static int NSProgram(unsigned int addr, const unsigned char* data, unsigned int len) {
+	if( NORFLASH_WriteData(&NORFlash,addr,(unsigned char*)data,len) || memcmp(NS_PTR(addr),data,len) ) {
+		++nsSt.errors;
+		UPLOG_ERR("%s error at 0x%X",__FUNCTION__,addr);
+		return NS_ERR_FLASH;
+	}
+	nsSt.bytesWritten += len;
+	return 0;
+}
+
+// Program a record or header with its magic (the first mark bytes) last: a write cut before it
+// leaves the magic erased, so the torn data is never taken as valid, even when its CRC matches
+static int NSCommit(unsigned int addr, const unsigned char* data, unsigned int len, unsigned int mark) {
+	int err;
+	if( (err=NSProgram(addr+mark,data+mark,len-mark)) ) return err;
+	return NSProgram(addr,data,mark);
+}
+
+static int NSErase(NSArea* a, unsigned int k) {
+	++a->erases[k];
+	if( NORFLASH_EraseSector(&NORFlash,a->sector[k]) ) {
+		++nsSt.errors;
+		UPLOG_ERR("%s error erasing 0x%X",__FUNCTION__,a->sector[k]);
+		return NS_ERR_FLASH;
+	}
+	return 0;
+}
+
+static int NSWriteHeader(NSArea* a, unsigned int k, unsigned int seq) {
+	unsigned char h[NS_HDR_SIZE];
+	memset(h,0xFF,sizeof(h));
+	memcpy(h,a->magic,4);
+	put32(h+4,seq);
+	put32(h+8,a->erases[k]);
+	put16(h+NS_HDR_SIZE-2,NSCrc(h,NS_HDR_SIZE-2));
+	return NSCommit(a->sector[k],h,NS_HDR_SIZE,4);
+}
+
+// Sequence number of a sector (and its erase count), 0 if its header is not valid
+static unsigned int NSReadHeader(NSArea* a, unsigned int k) {
+	const unsigned char* h = NS_PTR(a->sector[k]);
+	if( memcmp(h,a->magic,4) || NSCrc(h,NS_HDR_SIZE-2)!=get16(h+NS_HDR_SIZE-2) ) return 0;
+	a->erases[k] = get32(h+8);
+	return get32(h+4);
+}
+
+// Build a record in nsBuf. Returns its size.
+static unsigned int NSRecord(unsigned short key, const void* data1, unsigned int len1, const void* data2, unsigned int len2) {
+	unsigned char* b = (unsigned char*)nsBuf;
+	unsigned int len = len1+len2;
+	put16(b,NS_REC_MAGIC);
+	put16(b+4,key);
+	put16(b+6,len);
+	memcpy(b+NS_REC_HDR,data1,len1);
+	if( len2 ) memcpy(b+NS_REC_HDR+len1,data2,len2);
+	if( len & 1 ) b[NS_REC_HDR+len] = 0xFF;
+	put16(b+2,NSCrc(b+4,NS_REC_HDR-4+len));
+	return NS_REC_SIZE(len);
+}
+
+// Walk the records of sector k calling cb (if any) for each valid one, until it returns nonzero.
+// Returns where the free space starts (NS_SECTOR_SIZE after a damaged record: the rest of the
+// sector is not used).
+static unsigned int NSScan(NSArea* a, unsigned int k, NSRecordCallback cb, void* priv) {
+	unsigned int pos = NS_HDR_SIZE, len, i;
+	const unsigned char* r;
+	while( pos+NS_REC_HDR<=NS_SECTOR_SIZE ) {
+		r = NS_PTR(a->sector[k]+pos);
+		for(i=0; i<NS_REC_HDR && r[i]==0xFF; ++i) ;
+		if( i==NS_REC_HDR ) return pos; // erased
+		len = get16(r+6);
+		if( get16(r)!=NS_REC_MAGIC || pos+NS_REC_SIZE(len)>NS_SECTOR_SIZE || NSCrc(r+4,NS_REC_HDR-4+len)!=get16(r+2) ) {
+			UPLOG_ERR("%s damaged record at 0x%X",__FUNCTION__,a->sector[k]+pos);
+			return NS_SECTOR_SIZE;
+		}
+		if( cb && cb(a->sector[k]+pos,r,priv) ) return pos;
+		pos += NS_REC_SIZE(len);
+	}
+	return NS_SECTOR_SIZE;
+}
+
+static int NSBlank(NSArea* a, unsigned int k) {
+	const unsigned char* p = NS_PTR(a->sector[k]);
+	unsigned int i;
+	for(i=0; i<NS_SECTOR_SIZE && p[i]==0xFF; ++i) ;
+	return i==NS_SECTOR_SIZE;
+}
+
+// Find the active sector of an area. With no valid header the sectors are taken only if they
+// are erased: other data in them is left alone until NORStoreFormat.
+static int NSAreaInit(NSArea* a) {
+	unsigned int s0 = NSReadHeader(a,0), s1 = NSReadHeader(a,1);
+	// sectors alternate, so an unknown erase count is about the one of the other sector
+	if( ! s0 ) a->erases[0] = a->erases[1];
+	if( ! s1 ) a->erases[1] = a->erases[0];
+	if( s0 || s1 ) {
+		a->active = s1 && (!s0 || (int)(s1-s0)>0) ? 1 : 0;
+		a->seq = a->active ? s1 : s0;
+		a->pos = NS_HDR_SIZE;
+		return 0;
+	}
+	if( ! NSBlank(a,0) || ! NSBlank(a,1) ) {
+		UPLOG_CRIT("%s sectors 0x%X,0x%X hold no store, not used until NORStoreFormat",__FUNCTION__,a->sector[0],a->sector[1]);
+		return NS_ERR_NOSTORE;
+	}
+	a->active = 0;
+	a->seq = 1;
+	a->pos = NS_HDR_SIZE;
+	return NSWriteHeader(a,0,a->seq);
+}
+
+// Erase both sectors of an area and start an empty store in the first one
+static int NSAreaFormat(NSArea* a) {
+	int err;
+	a->err = NS_ERR_NOSTORE;
+	a->active = 0;
+	a->seq = 1;
+	a->pos = NS_HDR_SIZE;
+	if( (err=NSErase(a,1)) || (err=NSErase(a,0)) || (err=NSWriteHeader(a,0,a->seq)) ) return err;
+	return a->err = 0;
+}
+
+static int NSFind(unsigned short key) {
+	unsigned int i;
+	for(i=0; i<nsCount; ++i)
+		if( nsKey[i].key==key ) return i;
+	return -1;
+}
+
+static int NSIndex(unsigned int addr, const unsigned char* r, void* priv) {
+	unsigned short key = get16(r+4);
+	int i = NSFind(key);
+	if( i<0 ) {
+		if( nsCount==NORSTORE_MAX_KEYS ) return 0;
+		i = nsCount++;
+		nsKey[i].key = key;
+	}
+	nsKey[i].len = get16(r+6);
+	nsKey[i].addr = addr;
+	return 0;
+}
+
+static void NSKVLoad() {
+	nsCount = 0;
+	nsKV.pos = NSScan(&nsKV,nsKV.active,NSIndex,0);
+}
+
+// Copy the live values to the other sector and switch to it. Must hold the lock.
+static int NSKVSwitch() {
+	unsigned int k = !nsKV.active, pos = NS_HDR_SIZE, size, i;
+	int err;
+	if( (err=NSErase(&nsKV,k)) ) return err;
+	for(i=0; i<nsCount; ++i) {
+		size = NS_REC_SIZE(nsKey[i].len);
+		if( pos+size>NS_SECTOR_SIZE ) return NS_ERR_FULL;
+		memcpy(nsBuf,NS_PTR(nsKey[i].addr),size);
+		if( (err=NSProgram(nsKV.sector[k]+pos,(unsigned char*)nsBuf,size)) ) return err;
+		pos += size;
+	}
+	// the header commits the switch, until then the old sector is the valid one
+	if( (err=NSWriteHeader(&nsKV,k,nsKV.seq+1)) ) return err;
+	nsKV.active = k;
+	++nsKV.seq;
+	++nsSt.sectorSwitches;
+	NSKVLoad();
+	return 0;
+}
+
+// Erase the oldest sector of the error log and go on there. Must hold the lock.
+static int NSLogSwitch() {
+	unsigned int k = !nsLog.active;
+	int err;
+	if( (err=NSErase(&nsLog,k)) || (err=NSWriteHeader(&nsLog,k,nsLog.seq+1)) ) return err;
+	nsLog.active = k;
+	++nsLog.seq;
+	nsLog.pos = NS_HDR_SIZE;
+	++nsSt.sectorSwitches;
+	return 0;
+}
+
+static int NSLogEntry(unsigned int addr, const unsigned char* r, void* priv) {
+	NSLogReader* rd = (NSLogReader*)priv;
+	unsigned int len = get16(r+6);
+	if( len<4 ) return 0;
+	++rd->n;
+	return rd->stop = rd->cb(get16(r+4),get32(r+NS_REC_HDR),r+NS_REC_HDR+4,len-4,rd->priv);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Public functions
+
+int NORStoreInit() {
+	static const char* ownStr = __FUNCTION__;
+	portTickType t;
+	int err;
+	if( ! nsLockCreate() ) return NS_ERR_NOTINIT;
+	if( NORflash_start() ) {
+		UPLOG_CRIT("%s error starting the NOR flash",ownStr);
+		return NS_ERR_FLASH;
+	}
+	nsLock();
+		checksum_prepareLUTCRC16(NS_CRC_POLY,nsLUT);
+		nsReady = 1;
+		memset(&nsSt,0,sizeof(nsSt));
+		nsCount = 0;
+		t = nsTicks();
+		if( !(nsKV.err=NSAreaInit(&nsKV)) ) NSKVLoad();
+		if( !(nsLog.err=NSAreaInit(&nsLog)) ) nsLog.pos = NSScan(&nsLog,nsLog.active,0,0);
+		nsSt.scanMs = (nsTicks()-t)*portTICK_RATE_MS;
+		err = nsKV.err ? nsKV.err : nsLog.err;
+	nsUnlock();
+	if( err ) UPLOG_CRIT("%s error %d opening the store",ownStr,err);
+	NORStoreShowStatus();
+	return err;
+}
+
+int NORStoreFormat(unsigned int confirm) {
+	int err, e;
+	if( confirm!=NORSTORE_FORMAT_CONFIRM ) return NS_ERR_SIZE;
+	if( ! nsReady ) return NS_ERR_NOTINIT;
+	UPLOG_CRIT("%s erasing the mode, parameter and error log sectors",__FUNCTION__);
+	nsLock();
+		if( !(err=NSAreaFormat(&nsKV)) ) NSKVLoad();
+		if( (e=NSAreaFormat(&nsLog)) && ! err ) err = e;
+	nsUnlock();
+	return err;
+}
+
+int NORStorePut(unsigned short key, const void* value, unsigned int len) {
+	unsigned int size = NS_REC_SIZE(len), addr;
+	int i, err = 0;
+	if( key==0xFFFF || len==0 || len>NORSTORE_MAX_VALUE ) return NS_ERR_SIZE;
+	if( nsKV.err ) return nsKV.err;
+	nsLock();
+		++nsSt.puts;
+		i = NSFind(key);
+		if( i>=0 && nsKey[i].len==len && ! memcmp(NS_PTR(nsKey[i].addr)+NS_REC_HDR,value,len) ) {
+			++nsSt.unchanged;
+		} else if( i<0 && nsCount==NORSTORE_MAX_KEYS ) {
+			err = NS_ERR_FULL;
+		} else {
+			if( nsKV.pos+size>NS_SECTOR_SIZE ) err = NSKVSwitch();
+			if( ! err && nsKV.pos+size>NS_SECTOR_SIZE ) err = NS_ERR_FULL;
+			if( ! err ) {
+				addr = nsKV.sector[nsKV.active]+nsKV.pos;
+				NSRecord(key,value,len,0,0);
+				if( (err=NSCommit(addr,(unsigned char*)nsBuf,size,2)) ) {
+					nsKV.pos = NS_SECTOR_SIZE; // what is there is not known, go on in the other sector
+				} else {
+					nsKV.pos += size;
+					NSIndex(addr,NS_PTR(addr),0);
+				}
+			}
+		}
+	nsUnlock();
+	return err;
+}
+
+int NORStoreGet(unsigned short key, void* value, unsigned int maxLen) {
+	int i, len;
+	if( nsKV.err ) return nsKV.err;
+	nsLock();
+		if( (i=NSFind(key))<0 ) {
+			len = NS_ERR_NOTFOUND;
+		} else {
+			len = nsKey[i].len;
+			memcpy(value,NS_PTR(nsKey[i].addr)+NS_REC_HDR,(unsigned int)len<maxLen ? (unsigned int)len : maxLen);
+		}
+	nsUnlock();
+	return len;
+}
+
+int NORStoreLogAdd(unsigned short code, const void* data, unsigned int len) {
+	unsigned char tb[4];
+	unsigned int t, size = NS_REC_SIZE(4+len), addr;
+	int err = 0;
+	if( code==0xFFFF || len>NORSTORE_MAX_LOG ) return NS_ERR_SIZE;
+	if( nsLog.err ) return nsLog.err;
+	if( Time_getUnixEpoch(&t) ) t = 0;
+	put32(tb,t);
+	nsLock();
+		++nsSt.logAdds;
+		if( nsLog.pos+size>NS_SECTOR_SIZE ) err = NSLogSwitch();
+		if( ! err ) {
+			addr = nsLog.sector[nsLog.active]+nsLog.pos;
+			NSRecord(code,tb,4,data,len);
+			if( (err=NSCommit(addr,(unsigned char*)nsBuf,size,2)) ) nsLog.pos = NS_SECTOR_SIZE;
+			else nsLog.pos += size;
+		}
+	nsUnlock();
+	return err;
+}
+
+int NORStoreLogRead(NORStoreLogCallback cb, void* priv) {
+	NSLogReader rd;
+	unsigned int k;
+	if( nsLog.err ) return nsLog.err;
+	rd.cb = cb; rd.priv = priv; rd.n = 0; rd.stop = 0;
+	nsLock();
+		k = ! nsLog.active;
+		// the other sector has the older entries, unless it was erased or never used
+		if( NSReadHeader(&nsLog,k)==nsLog.seq-1 && nsLog.seq>1 ) NSScan(&nsLog,k,NSLogEntry,&rd);
+		if( ! rd.stop ) NSScan(&nsLog,nsLog.active,NSLogEntry,&rd);
+	nsUnlock();
+	return rd.n;
+}
+
+void NORStoreGetStats(NORStoreStats* st) {
+	unsigned int i;
+	if( ! nsLockCreate() ) { memset(st,0,sizeof(*st)); return; }
+	nsLock();
+		*st = nsSt;
+		st->keys = nsCount;
+		st->liveBytes = 0;
+		for(i=0; i<nsCount; ++i) st->liveBytes += NS_REC_SIZE(nsKey[i].len);
+		st->kvUsed = nsKV.pos;
+		st->logUsed = nsLog.pos;
+		st->sectorSize = NS_SECTOR_SIZE;
+		st->kvSeq = nsKV.seq;
+		st->logSeq = nsLog.seq;
+		st->erases[0] = nsKV.erases[0];
+		st->erases[1] = nsKV.erases[1];
+		st->erases[2] = nsLog.erases[0];
+		st->erases[3] = nsLog.erases[1];
+	nsUnlock();
+}
+
+void NORStoreShowStatus() {
+	NORStoreStats st;
+	NORStoreGetStats(&st);
+	UPLOG_INFO("%s keys=%u liveBytes=%u kvUsed=%u logUsed=%u/%u kvSeq=%u logSeq=%u erases=%u,%u,%u,%u puts=%u unchanged=%u logAdds=%u bytesWritten=%u sectorSwitches=%u errors=%u scanMs=%u",
+				  __FUNCTION__,st.keys,st.liveBytes,st.kvUsed,st.logUsed,st.sectorSize,st.kvSeq,st.logSeq,
+				  st.erases[0],st.erases[1],st.erases[2],st.erases[3],st.puts,st.unchanged,st.logAdds,
+				  st.bytesWritten,st.sectorSwitches,st.errors,st.scanMs);
+}
@@ -0,0 +1,188 @@
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "PListShadow.h"
+#include "LogManager.h"
+
+typedef struct {
+	unsigned int itemSize, maxItems, count;
+	unsigned char* data; // maxItems*itemSize, in list order
+	xSemaphoreHandle lock;
+} PListShadow;
+
+static PListShadow* plShadow[PERSISTENTLST_MAX_NO_LISTS];
+
+#define PLS_ITEM(s,pos) ((s)->data+(pos)*(s)->itemSize)
+#define PLS_CHECK(listid) if( listid<0 || listid>=PERSISTENTLST_MAX_NO_LISTS || ! plShadow[listid] ) return E_PLIST_SHADOW_NONE
+
+// Position of an existing node (PLIST_END is the last one), -1 if out of range
+static int PListShadowPos(PListShadow* s, int position) {
+	if( position==PLIST_END ) position = s->count-1;
+	return position>=0 && (unsigned int)position<s->count ? position : -1;
+}
+
+// Must hold the lock
+static int PListShadowLoad(int listid, PListShadow* s) {
+	int it, err, n;
+	s->count = 0;
+	if( (n=PersistentListNodeGetcount(listid))<=0 ) return n;
+	if( (unsigned int)n>s->maxItems ) n = s->maxItems;
+	if( (err=PersistentListIteratorNew(listid,PLIST_START,&it))<0 ) return err;
+	err = PersistentListIteratorGetNodeData(listid,it,PLS_ITEM(s,0));
+	while( err>=0 && ++s->count<(unsigned int)n )
+		err = PersistentListIteratorNextNodeData(listid,it,iterator_forward,PLS_ITEM(s,s->count));
+	PersistentListIteratorStop(listid,it);
+	if( err==E_PLIST_ITERATOR_EOL ) err = 0;
+	return err<0 ? err : 0;
+}
+
+static void PListShadowFree(PListShadow* s) {
+	if( ! s ) return;
+	if( s->data ) vPortFree(s->data);
+	if( s->lock ) vQueueDelete(s->lock);
+	vPortFree(s);
+}
+
+// After a failed change the list in FRAM may or may not have changed. Must hold the lock.
+static void PListShadowResync(int listid, PListShadow* s, int err) {
+	int e = PListShadowLoad(listid,s);
+	UPLOG_ERR("%s list %d change failed (%d), shadow reloaded (%d) count=%u",__FUNCTION__,listid,err,e,s->count);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Public functions
+
+int PListShadowStart(unsigned int FRAMbaseaddress, unsigned int item_size, unsigned int max_no_items,
+							unsigned int max_iterators, Boolean force_empty, int* listid) {
+	PListShadow* s;
+	int err;
+	if( (err=PersistentListStart(FRAMbaseaddress,item_size,max_no_items,max_iterators ? max_iterators : 1,force_empty,listid))<0 )
+		return err;
+	if( *listid<0 || *listid>=PERSISTENTLST_MAX_NO_LISTS ) return E_PLIST_LISTID;
+	// a list started again gets a new shadow: the old one is unregistered before it is freed
+	if( (s=plShadow[*listid]) ) {
+		plShadow[*listid] = 0;
+		xSemaphoreTake(s->lock,portMAX_DELAY); // a call still using it
+		xSemaphoreGive(s->lock);
+		PListShadowFree(s);
+	}
+	// registered once loaded, so no other call sees it before
+	err = E_PLIST_MALLOC;
+	if( (s=(PListShadow*)pvPortMalloc(sizeof(PListShadow))) ) {
+		memset(s,0,sizeof(*s));
+		s->itemSize = item_size;
+		s->maxItems = max_no_items;
+		if( (s->lock=xSemaphoreCreateMutex()) && (s->data=(unsigned char*)pvPortMalloc(item_size*max_no_items)) )
+			err = PListShadowLoad(*listid,s);
+	}
+	if( err<0 ) {
+		PListShadowFree(s);
+		PersistentListStop(*listid);
+		return err;
+	}
+	plShadow[*listid] = s;
+	return 0;
+}
+
+int PListShadowStop(int listid) {
+	PListShadow* s;
+	PLS_CHECK(listid);
+	s = plShadow[listid];
+	plShadow[listid] = 0;
+	PListShadowFree(s);
+	return PersistentListStop(listid);
+}
+
+int PListShadowAdd(int listid, int position, void* data) {
+	PListShadow* s;
+	int err;
+	PLS_CHECK(listid);
+	s = plShadow[listid];
+	xSemaphoreTake(s->lock,portMAX_DELAY);
+		if( position<0 || (unsigned int)position>s->count ) position = s->count;
+		if( (err=PersistentListNodeAdd(listid,position,data))<0 ) {
+			if( err!=E_PLIST_MAXNODES ) PListShadowResync(listid,s,err);
+		} else {
+			memmove(PLS_ITEM(s,position+1),PLS_ITEM(s,position),(s->count-position)*s->itemSize);
+			memcpy(PLS_ITEM(s,position),data,s->itemSize);
+			++s->count;
+		}
+	xSemaphoreGive(s->lock);
+	return err;
+}
+
+int PListShadowGetdata(int listid, int position, void* data) {
+	PListShadow* s;
+	int err = 0;
+	PLS_CHECK(listid);
+	s = plShadow[listid];
+	xSemaphoreTake(s->lock,portMAX_DELAY);
+		if( (position=PListShadowPos(s,position))<0 ) err = E_PLIST_POSITION;
+		else memcpy(data,PLS_ITEM(s,position),s->itemSize);
+	xSemaphoreGive(s->lock);
+	return err;
+}
+
+int PListShadowUpdatedata(int listid, int position, void* data) {
+	PListShadow* s;
+	int err;
+	PLS_CHECK(listid);
+	s = plShadow[listid];
+	xSemaphoreTake(s->lock,portMAX_DELAY);
+		if( (position=PListShadowPos(s,position))<0 ) {
+			err = E_PLIST_POSITION;
+		} else if( (err=PersistentListNodeUpdatedata(listid,position,data))<0 ) {
+			PListShadowResync(listid,s,err);
+		} else {
+			memcpy(PLS_ITEM(s,position),data,s->itemSize);
+		}
+	xSemaphoreGive(s->lock);
+	return err;
+}
+
+int PListShadowRemove(int listid, int position) {
+	PListShadow* s;
+	int err;
+	PLS_CHECK(listid);
+	s = plShadow[listid];
+	xSemaphoreTake(s->lock,portMAX_DELAY);
+		if( (position=PListShadowPos(s,position))<0 ) {
+			err = E_PLIST_POSITION;
+		} else if( (err=PersistentListNodeRemove(listid,position))<0 ) {
+			PListShadowResync(listid,s,err);
+		} else {
+			--s->count;
+			memmove(PLS_ITEM(s,position),PLS_ITEM(s,position+1),(s->count-position)*s->itemSize);
+		}
+	xSemaphoreGive(s->lock);
+	return err;
+}
+
+int PListShadowRemoveAll(int listid) {
+	PListShadow* s;
+	int err;
+	PLS_CHECK(listid);
+	s = plShadow[listid];
+	xSemaphoreTake(s->lock,portMAX_DELAY);
+		if( (err=PersistentListNodeRemoveAll(listid))<0 ) PListShadowResync(listid,s,err);
+		else s->count = 0;
+	xSemaphoreGive(s->lock);
+	return err;
+}
+
+int PListShadowGetcount(int listid) {
+	PLS_CHECK(listid);
+	return plShadow[listid]->count;
+}
+
+int PListShadowReload(int listid) {
+	PListShadow* s;
+	int err;
+	PLS_CHECK(listid);
+	s = plShadow[listid];
+	xSemaphoreTake(s->lock,portMAX_DELAY);
+		err = PListShadowLoad(listid,s);
+	xSemaphoreGive(s->lock);
+	return err;
+}
@@ -1,14 +1,35 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <string.h>
 #include "PowerManager.h"
-#include "TimerManager.h"
+#include <hal/Timing/Time.h>
 #include "LogManager.h"
+#include "MsgChannel.h"
+#include "SliceMonitor.h"
+#include <stdio.h>
 
-static xQueueHandle pmQHandle;
 static xTaskHandle pmTaskHandle;
 static unsigned int lastEpsCmdTstamp = 0;
+// Request pool, handed to the power manager task through pmChannel. Slots are only modified
+// while holding pmPoolMutex.
+static PowerManagerRequest pmPool[PM_POOL_SIZE];
+static MsgPool* pmMsgPool = 0;
+static MsgChannel* pmChannel = 0;
+static xSemaphoreHandle pmPoolMutex = 0;
+static unsigned int pmCoalesced = 0;
+#define PM_SLOT_FREE 0
+#define PM_SLOT_QUEUED 1 // waiting in pmChannel for execution
+#define PM_SLOT_SCHEDULED 2 // waiting in pool for its 'when' time
+#define PM_SLOT_RUNNING 3
+// Housekeeping snapshot, published as a sequence lock: pmSnapSeq is odd while the
+// power manager task is writing pmSnap, readers copy it and retry if pmSnapSeq changed.
+static PowerManagerSnapshot pmSnap, pmSnapNext;
+static volatile unsigned int pmSnapSeq = 0;
+static portTickType pmHkPeriod = PM_HK_PERIOD*configTICK_RATE_HZ, pmHkLast = 0;
+static unsigned int pmHkSamples = 0, pmHkErrors = 0, pmHkFresh = 0, pmHkStale = 0;
+#define pmBarrier() __asm__ __volatile__("" ::: "memory")
 uint8_t piu_index = 0;
 const char* epsModeStr[] = { "startup","nominal","safety","emlopo",0 };
 const char* epsResetCauseStr[] = { "power-on","watchdog","commanded","crlSysReset","emlopo",0 };
@@ -16,6 +37,12 @@ const char* epsRespStat[] = { "ok","rejected","invalidCmd","paramMissing","param
 #define min(A,B) ( ( (A)<(B) ) ? (A) : (B) )
 
 // these are defined in PowerManagerUart.c
+char uart_piu__init();
+int uart_piu__submit(unsigned char cc, const void* params, unsigned int paramsLen, void* resp, unsigned int respLen);
+driver_error_t uart_piu__wait(int slot);
+void uart_piu__showStatus();
+driver_error_t uart_piu__gethousekeepingeng(isismepsv2_ivid7_piu__gethousekeepingeng__from_t* response);
+driver_error_t uart_piu__gethousekeepingrunningavg(isismepsv2_ivid7_piu__gethousekeepingrunningavg__from_t* response);
 driver_error_t uart_piu__getsystemstatus(isismepsv2_ivid7_piu__getsystemstatus__from_t* response);
 driver_error_t uart_piu__resetwatchdog(isismepsv2_ivid7_piu__replyheader_t* response);
 driver_error_t uart_piu__correcttime(int diff,isismepsv2_ivid7_piu__replyheader_t* reply);
@@ -38,13 +65,22 @@ static inline unsigned int updateLastCommandTime() {
 	return lastEpsCmdTstamp;
 }
 
+// Execute all callbacks attached to the request (more than one if coalesced)
+static void PowerManagerNotify(PowerManagerRequest* req, driver_error_t error, commandRespData* response) {
+	unsigned int i, when;
+	if( ! req ) return;
+	when = req->when ? lastEpsCmdTstamp : 0;
+	for(i=0; i<req->callbackCount; ++i)
+		if( req->callback[i] ) req->callback[i](error,when,response);
+}
+
 static void PowerManagerGetStatus(PowerManagerRequest* req) {
 	isismepsv2_ivid7_piu__getsystemstatus__from_t response;
 	updateLastCommandTime();
 	driver_error_t error = isismepsv2_ivid7_piu__getsystemstatus(piu_index,&response);
 	// see include/satellite-subsystems/common_types.h for driver error types
 	if( error!=driver_error_none ) error=uart_piu__getsystemstatus(&response);
-	if( req && req->callback ) req->callback(error,0,(commandRespData*)&response);
+	PowerManagerNotify(req,error,(commandRespData*)&response);
 	// response se libera aqui
 }
 
@@ -53,7 +89,7 @@ static void PowerManagerResetWatchdog(PowerManagerRequest* req) {
 	updateLastCommandTime();
    driver_error_t error = isismepsv2_ivid7_piu__resetwatchdog(piu_index,&response);
 	if( error!=driver_error_none ) error=uart_piu__resetwatchdog(&response);
-	if( req && req->callback ) req->callback(error,0,(commandRespData*)&response);
+	PowerManagerNotify(req,error,(commandRespData*)&response);
 }
 
 
@@ -80,7 +116,7 @@ static void PowerManagerOutputBusChannelOn(PowerManagerRequest* req) {
 	updateLastCommandTime();
 	driver_error_t error = isismepsv2_ivid7_piu__outputbuschannelon(piu_index,req->cdata.channel_idx,&response);
 	if( error!=driver_error_none ) error = uart_piu__outputbuschannelon(req->cdata.channel_idx,&response);
-	if( req->callback ) req->callback(error,0,(commandRespData*)&response);
+	PowerManagerNotify(req,error,(commandRespData*)&response);
 	// response se libera aqui
 }
 
@@ -90,7 +126,7 @@ static void PowerManagerOutputBusChannelOff(PowerManagerRequest* req) {
 	updateLastCommandTime();
 	driver_error_t error = isismepsv2_ivid7_piu__outputbuschanneloff(piu_index,req->cdata.channel_idx,&response);
 	if( error!=driver_error_none ) error = uart_piu__outputbuschanneloff(req->cdata.channel_idx,&response);
-	if( req->callback ) req->callback(error,0,(commandRespData*)&response);
+	PowerManagerNotify(req,error,(commandRespData*)&response);
 	// response se libera aqui
 }
 
@@ -100,7 +136,7 @@ static void PowerManagerOutputBusGroupOn(PowerManagerRequest* req) {
 	updateLastCommandTime();
 	driver_error_t error = isismepsv2_ivid7_piu__outputbusgroupon(piu_index,&(req->cdata.obusOn),&response);
 	if( error!=driver_error_none ) error = uart_piu__outputbusgroupon(&(req->cdata.obusOn),&response);
-	if( req->callback ) req->callback(error,0,(commandRespData*)&response);
+	PowerManagerNotify(req,error,(commandRespData*)&response);
 	// response se libera aqui
 }
 
@@ -110,7 +146,7 @@ static void PowerManagerOutputBusGroupOff(PowerManagerRequest* req) {
 	updateLastCommandTime();
 	driver_error_t error = isismepsv2_ivid7_piu__outputbusgroupoff(piu_index,&(req->cdata.obusOff),&response);
 	if( error!=driver_error_none ) error = uart_piu__outputbusgroupoff(&(req->cdata.obusOff),&response);
-	if( req->callback ) req->callback(error,0,(commandRespData*)&response);
+	PowerManagerNotify(req,error,(commandRespData*)&response);
 	// response se libera aqui
 }
 
@@ -120,7 +156,7 @@ static void PowerManagerOutputBusGroupState(PowerManagerRequest* req) {
 	updateLastCommandTime();
 	driver_error_t error = isismepsv2_ivid7_piu__outputbusgroupstate(piu_index,&(req->cdata.obusState),&response);
 	if( error!=driver_error_none ) error = uart_piu__outputbusgroupstate(&(req->cdata.obusState),&response);
-	if( req->callback ) req->callback(error,0,(commandRespData*)&response);
+	PowerManagerNotify(req,error,(commandRespData*)&response);
 	// response se libera aqui
 }
 
@@ -130,12 +166,62 @@ static void PowerManagerSetConfigParam(PowerManagerRequest* req) {
 	updateLastCommandTime();
 	driver_error_t error = isismepsv2_ivid7_piu__setconfigurationparameter(piu_index,&(req->cdata.setConfParam),&response);
 	if( error!=driver_error_none ) error = uart_piu__setconfigurationparameter(&(req->cdata.setConfParam),&response);
-	if( req->callback ) req->callback(error,0,(commandRespData*)&response);
+	PowerManagerNotify(req,error,(commandRespData*)&response);
 	// response se libera aqui
 }
 
+// Read system status and housekeeping from the EPS and publish a new snapshot.
+// The EPS is read into pmSnapNext first so readers only retry during the final copy.
+static void PowerManagerSample(PowerManagerRequest* req) {
+	driver_error_t error;
+	pmHkLast = xTaskGetTickCount();
+	pmSnapNext.unixTime = updateLastCommandTime();
+	error = isismepsv2_ivid7_piu__getsystemstatus(piu_index,&pmSnapNext.sysStatus);
+	if( error!=driver_error_none ) {
+		// EPS not answering on I2C: pipeline the three reads on the UART
+		int s1 = uart_piu__submit(PM_CC_GETSYSTEMSTATUS,0,0,&pmSnapNext.sysStatus,sizeof(pmSnapNext.sysStatus));
+		int s2 = uart_piu__submit(PM_CC_GETHOUSEKEEPINGENG,0,0,&pmSnapNext.hkEng,sizeof(pmSnapNext.hkEng));
+		int s3 = uart_piu__submit(PM_CC_GETHOUSEKEEPINGRUNNINGAVG,0,0,&pmSnapNext.hkAvg,sizeof(pmSnapNext.hkAvg));
+		error = uart_piu__wait(s1);
+		pmSnapNext.errHKeng = uart_piu__wait(s2);
+		pmSnapNext.errHKavg = uart_piu__wait(s3);
+	} else {
+		pmSnapNext.errHKeng = isismepsv2_ivid7_piu__gethousekeepingeng(piu_index,&pmSnapNext.hkEng);
+		if( pmSnapNext.errHKeng!=driver_error_none ) pmSnapNext.errHKeng = uart_piu__gethousekeepingeng(&pmSnapNext.hkEng);
+		pmSnapNext.errHKavg = isismepsv2_ivid7_piu__gethousekeepingrunningavg(piu_index,&pmSnapNext.hkAvg);
+		if( pmSnapNext.errHKavg!=driver_error_none ) pmSnapNext.errHKavg = uart_piu__gethousekeepingrunningavg(&pmSnapNext.hkAvg);
+	}
+	pmSnapNext.errSysStatus = error;
+	if( pmSnapNext.errSysStatus!=driver_error_none && pmSnapNext.errHKeng!=driver_error_none &&
+		 pmSnapNext.errHKavg!=driver_error_none ) {
+		// nothing new: keep the previous snapshot (its age tells readers it is stale)
+		++pmHkErrors;
+		memcpy(&pmSnapNext,&pmSnap,sizeof(pmSnapNext));
+		PowerManagerNotify(req,error,0);
+		return;
+	}
+	// failed parts keep the data of the previous sample
+	if( pmSnapNext.errSysStatus!=driver_error_none ) memcpy(&pmSnapNext.sysStatus,&pmSnap.sysStatus,sizeof(pmSnap.sysStatus));
+	if( pmSnapNext.errHKeng!=driver_error_none ) memcpy(&pmSnapNext.hkEng,&pmSnap.hkEng,sizeof(pmSnap.hkEng));
+	if( pmSnapNext.errHKavg!=driver_error_none ) memcpy(&pmSnapNext.hkAvg,&pmSnap.hkAvg,sizeof(pmSnap.hkAvg));
+	pmSnapNext.tstamp = xTaskGetTickCount();
+	pmSnapNext.version = ++pmHkSamples;
+	++pmSnapSeq;
+	pmBarrier();
+	memcpy(&pmSnap,&pmSnapNext,sizeof(pmSnap));
+	pmBarrier();
+	++pmSnapSeq;
+	PowerManagerNotify(req,error,0);
+}
+
 static void PowerManagerExec(PowerManagerRequest* req) {
+	char site[SLICE_SITE_LEN];
+	snprintf(site,sizeof(site),"PM cc 0x%02x",req->commandCode);
+	SliceMonitorMark(site);
 	switch(req->commandCode) {
+		case PM_CC_SAMPLEHK:
+			PowerManagerSample(req);
+			break;
 		case PM_CC_GETSYSTEMSTATUS:
 			PowerManagerGetStatus(req);
 			break;
@@ -169,34 +255,104 @@ static void PowerManagerExec(PowerManagerRequest* req) {
 }
 
 
-int PowerManagerTimerCallback(unsigned int _when, void* privData) {
-	// exec command now
-	PowerManagerExec((PowerManagerRequest*)privData);
-	vPortFree(privData);
-	return 0;
+// Read-only and idempotent commands can be answered once for all pending callers
+static char PowerManagerIsCoalescable(unsigned int commandCode) {
+	switch(commandCode) {
+		case PM_CC_SAMPLEHK:
+		case PM_CC_NOP:
+		case PM_CC_RESETWATCHDOG:
+		case PM_CC_GETSYSTEMSTATUS:
+		case PM_CC_GETOVERCURRENTFAULTSTATE:
+		case PM_CC_GETCONFIGURATIONPARAMETER:
+		case PM_CC_GETHOUSEKEEPINGRAW:
+		case PM_CC_GETHOUSEKEEPINGENG:
+		case PM_CC_GETHOUSEKEEPINGRUNNINGAVG:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// Commands changing the power state go ahead of queued housekeeping reads, in the order given
+static char PowerManagerIsUrgent(unsigned int commandCode) {
+	switch(commandCode) {
+		case PM_CC_OUTPUTBUSGROUPON:
+		case PM_CC_OUTPUTBUSGROUPOFF:
+		case PM_CC_OUTPUTBUSCHANNELON:
+		case PM_CC_OUTPUTBUSCHANNELOFF:
+		case PM_CC_SWITCHTONOMINAL:
+		case PM_CC_SWITCHTOSAFETY:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static void PowerManagerFreeSlot(PowerManagerRequest* req) {
+	xSemaphoreTake(pmPoolMutex,portMAX_DELAY);
+		req->state = PM_SLOT_FREE;
+	xSemaphoreGive(pmPoolMutex);
+	MsgFree(req);
+}
+
+static void PowerManagerRun(PowerManagerRequest* req) {
+	// from now on no more callbacks can be attached to this request
+	xSemaphoreTake(pmPoolMutex,portMAX_DELAY);
+		req->state = PM_SLOT_RUNNING;
+	xSemaphoreGive(pmPoolMutex);
+	PowerManagerExec(req);
+	PowerManagerFreeSlot(req);
+}
+
+// Execute scheduled requests whose time has come and return the ticks to wait
+// until the next one (PM_QUEUE_WAIT_TICKS at most)
+static portTickType PowerManagerRunScheduled(unsigned int now) {
+	unsigned int i, next = 0;
+	portTickType wait = PM_QUEUE_WAIT_TICKS;
+	for(i=0; i<PM_POOL_SIZE; ++i) {
+		if( pmPool[i].state!=PM_SLOT_SCHEDULED ) continue;
+		if( pmPool[i].when<=now ) { SLICE_YIELD(); PowerManagerRun(&pmPool[i]); }
+		else if( next==0 || pmPool[i].when<next ) next = pmPool[i].when;
+	}
+	if( next && (next-now)*configTICK_RATE_HZ < wait ) wait = (next-now)*configTICK_RATE_HZ;
+	return wait;
 }
 
 
 static void PowerManagerTask(void* args) {
 	PowerManagerRequest *req;
 	unsigned int now;
+	portTickType wait = PM_QUEUE_WAIT_TICKS, ticks, period;
 	for(;;) {
 		// check incoming commands queue
-		if( pdTRUE != xQueueReceive(pmQHandle,&req,PM_QUEUE_WAIT_TICKS) ) {
-			// Timeout. Kick EPS if needed
+		if( MsgReceive(pmChannel,(void**)&req,1,wait) ) {
 			Time_getUnixEpoch( &now );
-			if( now-lastEpsCmdTstamp > (PM_WDG_TIMEOUT/4) ) PowerManagerResetWatchdog(0);
-		} else if( req->when!=0 ) {
-			// Schedule command execution in the future.
-			TimerManagerAdd(req->when,PowerManagerTimerCallback,0,1,(void*)req,"PowerManagerCallback");
-			// Kick EPS if needed
-			Time_getUnixEpoch( &now );
-			if( now-lastEpsCmdTstamp > (PM_WDG_TIMEOUT/4) ) PowerManagerResetWatchdog(0);
-		} else {
-			// exec command now
-			PowerManagerExec(req);
-			vPortFree(req);
+			if( req->when>now ) {
+				// Keep it in the pool until its time comes
+				xSemaphoreTake(pmPoolMutex,portMAX_DELAY);
+					req->state = PM_SLOT_SCHEDULED;
+				xSemaphoreGive(pmPoolMutex);
+			} else {
+				// exec command now
+				PowerManagerRun(req);
+			}
+		}
+		Time_getUnixEpoch( &now );
+		wait = PowerManagerRunScheduled(now);
+		// Periodic housekeeping sample (on demand samples also restart the period)
+		period = pmHkPeriod;
+		if( period ) {
+			ticks = xTaskGetTickCount();
+			if( pmHkSamples==0 || ticks-pmHkLast >= period ) {
+				SliceMonitorMark("PM hk sample");
+				PowerManagerSample(0);
+				ticks = xTaskGetTickCount();
+			}
+			if( period-(ticks-pmHkLast) < wait ) wait = period-(ticks-pmHkLast);
 		}
+		// Kick EPS if needed
+		if( now-lastEpsCmdTstamp > (PM_WDG_TIMEOUT/4) ) { SliceMonitorMark("PM kick"); PowerManagerResetWatchdog(0); }
+		SliceMonitorMark("PowerManager");
 	}
 	vTaskDelete(NULL);
 }
@@ -210,8 +366,15 @@ inline uint32_t s2u(uint16_t s) { return (uint32_t)s; }
 // Public functions
 
 char PowerManagerInit() {
-   pmQHandle = xQueueCreate(24,sizeof(PowerManagerRequest*));
-   if( ! pmQHandle ) { UPLOG_ALERT("PowerManagerInit queue"); return 4; }
+   pmPoolMutex = xSemaphoreCreateMutex();
+   if( ! pmPoolMutex ) { UPLOG_ALERT("PowerManagerInit mutex"); return 4; }
+   memset(pmPool,0,sizeof(pmPool));
+   pmMsgPool = MsgPoolCreate("PMPool",PM_POOL_SIZE,sizeof(PowerManagerRequest),pmPool);
+   // every pool slot fits in either queue of the channel, so sending to it never blocks
+   pmChannel = MsgChannelCreate("PMQueue",PM_POOL_SIZE,PM_POOL_SIZE);
+   if( ! pmMsgPool || ! pmChannel ) { UPLOG_ALERT("PowerManagerInit queue"); return 4; }
+   // UART fallback transport. Without it commands still go through I2C
+   uart_piu__init();
 
    if( pdPASS!=xTaskCreate(PowerManagerTask,"PowerManagerTask",PM_STACK_SIZE,NULL,PM_PRIORITY,&pmTaskHandle) )
    { UPLOG_ALERT("PowerManagerInit task"); return 5; }
@@ -222,19 +385,86 @@ char PowerManagerInit() {
 
 
 char PowerManagerAddRequest(unsigned int commandCode, unsigned int when, PowerManagerCmdCallback callback, commandReqData* cdata) {
-	PowerManagerRequest *req = pvPortMalloc(sizeof(PowerManagerRequest)); // ojo habia un error aca de Luis con el tamaño
-	req->when = when;
-	req->commandCode = commandCode;
-	req->callback = callback;
-	if( cdata ) memcpy(&(req->cdata),cdata,sizeof(commandReqData));
-	else 			memset(&(req->cdata),0,sizeof(commandReqData));
-	if( pdTRUE!=xQueueSendToBack(pmQHandle,req,portMAX_DELAY) ) {
-		vPortFree(req);
+	PowerManagerRequest *req = 0;
+	commandReqData cd;
+	unsigned int i;
+	if( cdata ) memcpy(&cd,cdata,sizeof(commandReqData));
+	else 			memset(&cd,0,sizeof(commandReqData));
+	xSemaphoreTake(pmPoolMutex,portMAX_DELAY);
+		// Attach to an identical read-only command still waiting in the queue
+		if( when==0 && PowerManagerIsCoalescable(commandCode) ) {
+			for(i=0; i<PM_POOL_SIZE; ++i) {
+				req = &pmPool[i];
+				if( req->state==PM_SLOT_QUEUED && req->when==0 && req->commandCode==commandCode &&
+					 req->callbackCount<PM_MAX_CALLBACKS && 0==memcmp(&(req->cdata),&cd,sizeof(commandReqData)) ) {
+					req->callback[req->callbackCount++] = callback;
+					++pmCoalesced;
+					xSemaphoreGive(pmPoolMutex);
+					return 0;
+				}
+			}
+		}
+		if( (req=MsgAlloc(pmMsgPool,0)) ) {
+			req->when = when;
+			req->commandCode = commandCode;
+			req->callback[0] = callback;
+			req->callbackCount = 1;
+			memcpy(&(req->cdata),&cd,sizeof(commandReqData));
+			req->state = PM_SLOT_QUEUED;
+		}
+	xSemaphoreGive(pmPoolMutex);
+	if( ! req ) { UPLOG_ERR("%s request pool exhausted, command %x dropped",__FUNCTION__,commandCode); return -1; }
+	if( MsgSend(pmChannel,req,PowerManagerIsUrgent(commandCode),0) ) {
+		PowerManagerFreeSlot(req);
 		return -1;
 	}
 	return 0;
 }
 
+
+void PowerManagerShowStatus() {
+	if( ! pmMsgPool || ! pmChannel ) return;
+	UPLOG_INFO("%s pool inUse=%u maxInUse=%u size=%u exhausted=%u coalesced=%u queued=%u",__FUNCTION__,
+				  pmMsgPool->inUse,pmMsgPool->maxInUse,PM_POOL_SIZE,pmMsgPool->exhausted,pmCoalesced,MsgWaiting(pmChannel));
+	UPLOG_INFO("%s hk periodTicks=%u samples=%u errors=%u freshReads=%u staleReads=%u",__FUNCTION__,
+				  (unsigned int)pmHkPeriod,pmHkSamples,pmHkErrors,pmHkFresh,pmHkStale);
+	uart_piu__showStatus();
+}
+
+
+void PowerManagerSetSamplePeriod(unsigned int secs) {
+	pmHkPeriod = secs*configTICK_RATE_HZ;
+	// wake up the task so the new period is applied now
+	PowerManagerAddRequest(PM_CC_NOP,0,NULL,0);
+}
+
+
+char PowerManagerGetSnapshot(PowerManagerSnapshot* snap, unsigned int maxAgeMs, portTickType waitTicks) {
+	unsigned int seq;
+	portTickType start = xTaskGetTickCount();
+	char requested = 0;
+	if( ! snap ) return -1;
+	for(;;) {
+		do {
+			seq = pmSnapSeq;
+			if( seq&1 ) { taskYIELD(); continue; } // power manager task is writing
+			pmBarrier();
+			memcpy(snap,&pmSnap,sizeof(PowerManagerSnapshot));
+			pmBarrier();
+		} while( (seq&1) || seq!=pmSnapSeq );
+		if( snap->version && (xTaskGetTickCount()-snap->tstamp) <= pdMS_TO_TICKS(maxAgeMs) ) {
+			++pmHkFresh;
+			return 0;
+		}
+		// ask for a new sample once, identical pending requests are coalesced
+		if( ! requested ) { PowerManagerAddRequest(PM_CC_SAMPLEHK,0,NULL,0); requested = 1; }
+		if( xTaskGetTickCount()-start >= waitTicks ) break;
+		vTaskDelay(PM_HK_POLL_TICKS);
+	}
+	++pmHkStale;
+	return snap->version ? 1 : -1;
+}
+
 // Print resonse header
 // If strPtr==0 then it prints to regular log
 // If strPtr!=0 and *strPtr!=0 it prints to the memory pointed by *strPtr
@@ -1,31 +1,240 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <string.h>
 #include <PowerManager.h>
+#include <UartManager.h>
+#include <LogManager.h>
+
+// EPS commands over UART (fallback when the EPS does not answer on I2C).
+// Commands are framed as <cmd>STID IVID CC BID params</cmd> and the EPS answers
+// <rsp>STID IVID RC BID STAT data</rsp>, with RC=CC+1. UartManager strips the <rsp> frame.
+//
+// Submitted commands wait in a fixed set of slots. Only one command is on the wire at a
+// time: the next one is written from the UART rx task as soon as the previous response
+// frame arrives. Responses are matched to the command on the wire by command code, so
+// a late response of a timed out command is dropped instead of answering the next one.
+// Timeouts are checked by the tasks waiting for a response (the rx task blocks reading).
 
 extern uint8_t piu_index;
 
+#define EPS_STID 0x1A
+#define EPS_IVID 0x07
+#define EPS_CMD_START "<cmd>"
+#define EPS_CMD_END "</cmd>"
+#define EPS_CMD_MAXPARAMS sizeof(commandReqData)
+#define EPS_TXBUF_SIZE (sizeof(EPS_CMD_START)-1 + 4 + EPS_CMD_MAXPARAMS + sizeof(EPS_CMD_END)-1)
+#define EPS_RSP_HDR_SIZE sizeof(isismepsv2_ivid7_piu__replyheader_t)
+
+#define EPS_SLOT_FREE 0
+#define EPS_SLOT_QUEUED 1 // waiting for the wire
+#define EPS_SLOT_ONWIRE 2 // written, waiting for its response
+#define EPS_SLOT_DONE 3 // result available, waiting for uart_piu__wait
+
+typedef struct {
+	unsigned char txBuf[EPS_TXBUF_SIZE]; // framed command, built on submit
+	unsigned int txLen;
+	unsigned char *resp; // caller response buffer
+	unsigned int respLen;
+	unsigned char rc; // expected response code
+	unsigned char state;
+	driver_error_t result;
+	portTickType sent; // tick count when written
+	xSemaphoreHandle done; // given when result is available
+} epsUartSlot;
+
+static epsUartSlot epsSlot[EPS_UART_SLOTS];
+static unsigned char epsPend[EPS_UART_SLOTS]; // slots queued or on the wire, in submission order
+static unsigned int epsPendHead = 0, epsPendCount = 0;
+static xSemaphoreHandle epsMutex = 0;
+static char epsUartUp = 0;
+static unsigned int epsCmds = 0, epsTimeouts = 0, epsDropped = 0, epsWriteErr = 0;
+static portTickType epsLatencySum = 0, epsLatencyMax = 0;
+
+
+// Write the command of a slot already marked EPS_SLOT_ONWIRE. Called without epsMutex.
+static void uart_piu__write(epsUartSlot* slot) {
+	int err = UART_write(EPS_UART_BUS,slot->txBuf,slot->txLen);
+	if( err!=0 ) {
+		++epsWriteErr;
+		UPLOG_ERR("%s UART_write error %d",__FUNCTION__,err);
+		// the response will not come: let the timeout release the wire
+	}
+}
+
+// Complete the command on the wire and start the next one. Must hold epsMutex.
+// Returns the slot to write after releasing epsMutex, or 0.
+static epsUartSlot* uart_piu__complete(driver_error_t result) {
+	epsUartSlot* slot = &epsSlot[epsPend[epsPendHead]];
+	portTickType latency = xTaskGetTickCount()-slot->sent;
+	slot->result = result;
+	slot->state = EPS_SLOT_DONE;
+	if( result==driver_error_none ) {
+		epsLatencySum += latency;
+		if( latency>epsLatencyMax ) epsLatencyMax = latency;
+	}
+	xSemaphoreGive(slot->done);
+	epsPendHead = (epsPendHead+1)%EPS_UART_SLOTS;
+	if( --epsPendCount==0 ) return 0;
+	slot = &epsSlot[epsPend[epsPendHead]];
+	slot->state = EPS_SLOT_ONWIRE;
+	slot->sent = xTaskGetTickCount();
+	return slot;
+}
+
+// UartManager frame callback (executed from the UART rx task)
+static void uart_piu__rx(char* packetBuf, unsigned int len, char complete) {
+	epsUartSlot *slot, *next = 0;
+	unsigned char* rsp = (unsigned char*)packetBuf;
+	if( !complete || len<EPS_RSP_HDR_SIZE || rsp[0]!=EPS_STID ) { ++epsDropped; return; }
+	xSemaphoreTake(epsMutex,portMAX_DELAY);
+		slot = epsPendCount ? &epsSlot[epsPend[epsPendHead]] : 0;
+		if( slot && slot->state==EPS_SLOT_ONWIRE && slot->rc==rsp[2] ) {
+			if( len>slot->respLen ) len = slot->respLen;
+			memcpy(slot->resp,rsp,len);
+			// optional trailing fields not sent by the EPS read as zero
+			memset(slot->resp+len,0,slot->respLen-len);
+			next = uart_piu__complete(driver_error_none);
+		} else {
+			++epsDropped; // unexpected, or late response of a timed out command
+		}
+	xSemaphoreGive(epsMutex);
+	if( next ) uart_piu__write(next);
+}
+
+// Fail the command on the wire if its response is overdue
+static void uart_piu__checkTimeout() {
+	epsUartSlot *slot, *next = 0;
+	xSemaphoreTake(epsMutex,portMAX_DELAY);
+		slot = epsPendCount ? &epsSlot[epsPend[epsPendHead]] : 0;
+		if( slot && slot->state==EPS_SLOT_ONWIRE && xTaskGetTickCount()-slot->sent >= EPS_UART_RSP_TIMEOUT ) {
+			++epsTimeouts;
+			next = uart_piu__complete(driver_error_uart);
+		}
+	xSemaphoreGive(epsMutex);
+	if( next ) uart_piu__write(next);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Transport functions
+
+char uart_piu__init() {
+	unsigned int i;
+	epsMutex = xSemaphoreCreateMutex();
+	if( ! epsMutex ) { UPLOG_ALERT("%s mutex",__FUNCTION__); return 4; }
+	memset(epsSlot,0,sizeof(epsSlot));
+	for(i=0; i<EPS_UART_SLOTS; ++i) {
+		vSemaphoreCreateBinary(epsSlot[i].done);
+		if( ! epsSlot[i].done ) { UPLOG_ALERT("%s semaphore",__FUNCTION__); return 4; }
+		xSemaphoreTake(epsSlot[i].done,0); // created given
+	}
+	epsUartRXCallback = uart_piu__rx;
+	if( 0!=UartManagerInitEPS() ) { UPLOG_ERR("%s EPS uart not available",__FUNCTION__); return 5; }
+	epsUartUp = 1;
+	return 0;
+}
+
+// Queue a command for the EPS. Its response (reply header included) will be copied to resp.
+// Returns the slot to pass to uart_piu__wait, or -1 if all slots are in use.
+int uart_piu__submit(unsigned char cc, const void* params, unsigned int paramsLen, void* resp, unsigned int respLen) {
+	epsUartSlot *slot = 0, *write = 0;
+	unsigned char *p;
+	unsigned int i;
+	if( ! epsUartUp || paramsLen>EPS_CMD_MAXPARAMS || respLen<EPS_RSP_HDR_SIZE ) return -1;
+	xSemaphoreTake(epsMutex,portMAX_DELAY);
+		for(i=0; i<EPS_UART_SLOTS; ++i) {
+			if( epsSlot[i].state==EPS_SLOT_FREE ) { slot = &epsSlot[i]; break; }
+		}
+		if( slot ) {
+			p = slot->txBuf;
+			memcpy(p,EPS_CMD_START,sizeof(EPS_CMD_START)-1); p += sizeof(EPS_CMD_START)-1;
+			*p++ = EPS_STID; *p++ = EPS_IVID; *p++ = cc; *p++ = 0; // BID
+			if( paramsLen ) { memcpy(p,params,paramsLen); p += paramsLen; }
+			memcpy(p,EPS_CMD_END,sizeof(EPS_CMD_END)-1); p += sizeof(EPS_CMD_END)-1;
+			slot->txLen = p-slot->txBuf;
+			slot->resp = (unsigned char*)resp;
+			slot->respLen = respLen;
+			slot->rc = cc+1;
+			epsPend[(epsPendHead+epsPendCount)%EPS_UART_SLOTS] = i;
+			if( epsPendCount++==0 ) {
+				slot->state = EPS_SLOT_ONWIRE;
+				slot->sent = xTaskGetTickCount();
+				write = slot;
+			} else {
+				slot->state = EPS_SLOT_QUEUED;
+			}
+			++epsCmds;
+		}
+	xSemaphoreGive(epsMutex);
+	if( ! slot ) { UPLOG_ERR("%s no free slot, command %x dropped",__FUNCTION__,cc); return -1; }
+	if( write ) uart_piu__write(write);
+	return i;
+}
+
+// Wait for the response of a submitted command and release its slot
+driver_error_t uart_piu__wait(int s) {
+	driver_error_t result;
+	epsUartSlot* slot;
+	if( s<0 || s>=EPS_UART_SLOTS ) return driver_error_param;
+	slot = &epsSlot[s];
+	if( slot->state==EPS_SLOT_FREE ) return driver_error_param;
+	while( pdTRUE!=xSemaphoreTake(slot->done,EPS_UART_RSP_TIMEOUT) ) uart_piu__checkTimeout();
+	xSemaphoreTake(epsMutex,portMAX_DELAY);
+		result = slot->result;
+		slot->state = EPS_SLOT_FREE;
+	xSemaphoreGive(epsMutex);
+	return result;
+}
+
+static driver_error_t uart_piu__cmd(unsigned char cc, const void* params, unsigned int paramsLen, void* resp, unsigned int respLen) {
+	int s = uart_piu__submit(cc,params,paramsLen,resp,respLen);
+	if( s<0 ) return driver_error_uart;
+	return uart_piu__wait(s);
+}
+
+void uart_piu__showStatus() {
+	unsigned int ok = epsCmds-epsTimeouts;
+	UPLOG_INFO("%s cmds=%u timeouts=%u dropped=%u writeErr=%u latencyAvgTicks=%u latencyMaxTicks=%u pending=%u",
+				  __FUNCTION__,epsCmds,epsTimeouts,epsDropped,epsWriteErr,
+				  ok ? (unsigned int)(epsLatencySum/ok) : 0,(unsigned int)epsLatencyMax,epsPendCount);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// EPS commands
+
 driver_error_t uart_piu__getsystemstatus(isismepsv2_ivid7_piu__getsystemstatus__from_t* response) {
-	return driver_error_none;
+	return uart_piu__cmd(PM_CC_GETSYSTEMSTATUS,0,0,response,sizeof(*response));
+}
+driver_error_t uart_piu__gethousekeepingeng(isismepsv2_ivid7_piu__gethousekeepingeng__from_t* response) {
+	return uart_piu__cmd(PM_CC_GETHOUSEKEEPINGENG,0,0,response,sizeof(*response));
+}
+driver_error_t uart_piu__gethousekeepingrunningavg(isismepsv2_ivid7_piu__gethousekeepingrunningavg__from_t* response) {
+	return uart_piu__cmd(PM_CC_GETHOUSEKEEPINGRUNNINGAVG,0,0,response,sizeof(*response));
 }
 driver_error_t uart_piu__resetwatchdog(isismepsv2_ivid7_piu__replyheader_t* response) {
-	return driver_error_none;
+	return uart_piu__cmd(PM_CC_RESETWATCHDOG,0,0,response,sizeof(*response));
 }
 driver_error_t uart_piu__correcttime(int diff,isismepsv2_ivid7_piu__replyheader_t* reply) {
-	return driver_error_none;
+	int32_t d = diff;
+	return uart_piu__cmd(PM_CC_CORRECTTIME,&d,sizeof(d),reply,sizeof(*reply));
 }
 driver_error_t uart_piu__outputbuschannelon(isismepsv2_ivid7_piu__imeps_channel_t channel_idx,isismepsv2_ivid7_piu__replyheader_t* response) {
-	return driver_error_none;
+	return uart_piu__cmd(PM_CC_OUTPUTBUSCHANNELON,&channel_idx,sizeof(channel_idx),response,sizeof(*response));
 }
 driver_error_t uart_piu__outputbuschanneloff(isismepsv2_ivid7_piu__imeps_channel_t channel_idx,isismepsv2_ivid7_piu__replyheader_t* response) {
-	return driver_error_none;
+	return uart_piu__cmd(PM_CC_OUTPUTBUSCHANNELOFF,&channel_idx,sizeof(channel_idx),response,sizeof(*response));
 }
 driver_error_t uart_piu__outputbusgroupon(isismepsv2_ivid7_piu__outputbusgroupon__to_t* obusOn,isismepsv2_ivid7_piu__replyheader_t* response) {
-	return driver_error_none;
+	return uart_piu__cmd(PM_CC_OUTPUTBUSGROUPON,obusOn,sizeof(*obusOn),response,sizeof(*response));
 }
 driver_error_t uart_piu__outputbusgroupoff(isismepsv2_ivid7_piu__outputbusgroupoff__to_t* obusOff,isismepsv2_ivid7_piu__replyheader_t* response) {
-	return driver_error_none;
+	return uart_piu__cmd(PM_CC_OUTPUTBUSGROUPOFF,obusOff,sizeof(*obusOff),response,sizeof(*response));
 }
 driver_error_t uart_piu__outputbusgroupstate(isismepsv2_ivid7_piu__outputbusgroupstate__to_t* obusState,isismepsv2_ivid7_piu__replyheader_t* response) {
-	return driver_error_none;
+	return uart_piu__cmd(PM_CC_OUTPUTBUSGROUPSTATE,obusState,sizeof(*obusState),response,sizeof(*response));
 }
 driver_error_t uart_piu__setconfigurationparameter(isismepsv2_ivid7_piu__setconfigurationparameter__to_t* setConfParam,isismepsv2_ivid7_piu__setconfigurationparameter__from_t* response) {
-	return driver_error_none;
+	return uart_piu__cmd(PM_CC_SETCONFIGURATIONPARAMETER,setConfParam,sizeof(*setConfParam),response,sizeof(*response));
 }
@@ -0,0 +1,154 @@
+#include <string.h>
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <csp/csp.h>
+#include <csp/csp_hooks.h>
+#include <csp/csp_buffer.h>
+#include "ResourceMonitor.h"
+#include "LogManager.h"
+
+// The kernel queue registry (queue.c): names of the queues added with vQueueAddToRegistry
+typedef struct {
+	signed char* pcQueueName;
+	xQueueHandle xHandle;
+} RMQueueRegistryItem;
+extern RMQueueRegistryItem xQueueRegistry[configQUEUE_REGISTRY_SIZE];
+
+static xTaskStatusType rmStatus[RM_MAX_TASKS];
+static RunTimeStatsReport rmLoad;
+static ResourceMonitorReport rmRep; // of the CSP service
+static xSemaphoreHandle rmLock = 0; // rmStatus, rmLoad and rmRep
+
+
+static unsigned char* RMPut16(unsigned char* p, unsigned short v) {
+	*p++ = v>>8; *p++ = v;
+	return p;
+}
+
+static unsigned char* RMPut32(unsigned char* p, unsigned int v) {
+	*p++ = v>>24; *p++ = v>>16; *p++ = v>>8; *p++ = v;
+	return p;
+}
+
+static int RMGetLocked(ResourceMonitorReport* rep) {
+	unsigned int i, j, n;
+	unsigned long total;
+	memset(rep,0,sizeof(*rep));
+	rep->heapFree = xPortGetFreeHeapSize();
+	rep->heapLow = xPortGetMinimumEverFreeHeapSize();
+	rep->heapLargest = xPortGetLargestFreeBlockSize();
+	rep->bufCount = CSP_BUFFER_COUNT;
+	rep->bufInUse = CSP_BUFFER_COUNT-csp_buffer_remaining();
+	RunTimeStatsGet(&rmLoad);
+	rep->cpuMin = rmLoad.cpuMin;
+	rep->cpuAvg = rmLoad.cpuAvg;
+	rep->cpuMax = rmLoad.cpuMax;
+	// uxTaskGetSystemState measures the unused stack of every task
+	n = uxTaskGetSystemState(rmStatus,RM_MAX_TASKS,&total);
+	for(i=0; i<n; ++i) {
+		strncpy(rep->task[i].name,(const char*)rmStatus[i].pcTaskName,RM_NAME_LEN-1);
+		rep->task[i].number = rmStatus[i].xTaskNumber;
+		rep->task[i].stackFree = rmStatus[i].usStackHighWaterMark;
+		for(j=0; j<rmLoad.tasks; ++j)
+			if( rmLoad.task[j].taskNumber==rmStatus[i].xTaskNumber ) rep->task[i].load = rmLoad.task[j].avg;
+	}
+	rep->tasks = n;
+	for(i=0; i<configQUEUE_REGISTRY_SIZE && rep->queues<RM_MAX_QUEUES; ++i) {
+		if( ! xQueueRegistry[i].pcQueueName ) continue;
+		strncpy(rep->queue[rep->queues].name,(const char*)xQueueRegistry[i].pcQueueName,RM_NAME_LEN-1);
+		rep->queue[rep->queues].waiting = uxQueueMessagesWaiting(xQueueRegistry[i].xHandle);
+		rep->queue[rep->queues].length = rep->queue[rep->queues].waiting+uxQueueSpacesAvailable(xQueueRegistry[i].xHandle);
+		++rep->queues;
+	}
+	return n ? (int)n : -1; // 0: more than RM_MAX_TASKS tasks
+}
+
+static int RMLock() {
+	if( ! rmLock && !(rmLock=xSemaphoreCreateMutex()) ) return -1;
+	xSemaphoreTake(rmLock,portMAX_DELAY);
+	return 0;
+}
+
+int ResourceMonitorGet(ResourceMonitorReport* rep) {
+	int n;
+	if( RMLock() ) return -1;
+		n = RMGetLocked(rep);
+	xSemaphoreGive(rmLock);
+	return n;
+}
+
+void ResourceMonitorShowStatus() {
+	static ResourceMonitorReport rep;
+	unsigned int i;
+	ResourceMonitorGet(&rep);
+	UPLOG_INFO("%s heap(free/low/largest)=%u/%u/%u cspBuffers(inUse/count)=%u/%u cpu(min/avg/max permille)=%u/%u/%u",
+				  __FUNCTION__,rep.heapFree,rep.heapLow,rep.heapLargest,rep.bufInUse,rep.bufCount,rep.cpuMin,rep.cpuAvg,rep.cpuMax);
+	for(i=0; i<rep.tasks; ++i)
+		UPLOG_INFO("%s task '%s' num=%u load=%u stackFree=%u",__FUNCTION__,
+					  rep.task[i].name,rep.task[i].number,rep.task[i].load,rep.task[i].stackFree);
+	for(i=0; i<rep.queues; ++i)
+		UPLOG_INFO("%s queue '%s' %u/%u",__FUNCTION__,rep.queue[i].name,rep.queue[i].waiting,rep.queue[i].length);
+}
+
+
+/*- CSP services ----------------------------------------------------------------------------*/
+
+uint32_t csp_memfree_hook(void) {
+	return xPortGetFreeHeapSize();
+}
+
+static unsigned int RMBinaryReply(unsigned char* p) {
+	unsigned char* start = p;
+	unsigned int i;
+	*p++ = RM_REPLY_VERSION;
+	*p++ = rmRep.tasks;
+	*p++ = rmRep.queues;
+	*p++ = rmRep.bufInUse;
+	*p++ = rmRep.bufCount;
+	p = RMPut32(p,rmRep.heapFree);
+	p = RMPut32(p,rmRep.heapLow);
+	p = RMPut32(p,rmRep.heapLargest);
+	p = RMPut16(p,rmRep.cpuMin);
+	p = RMPut16(p,rmRep.cpuAvg);
+	p = RMPut16(p,rmRep.cpuMax);
+	for(i=0; i<rmRep.tasks; ++i) {
+		*p++ = rmRep.task[i].number;
+		p = RMPut16(p,rmRep.task[i].load);
+		p = RMPut16(p,rmRep.task[i].stackFree);
+	}
+	for(i=0; i<rmRep.queues; ++i) {
+		p = RMPut16(p,rmRep.queue[i].waiting);
+		p = RMPut16(p,rmRep.queue[i].length);
+	}
+	return p-start;
+}
+
+static unsigned int RMTextReply(char* str) {
+	unsigned int i, len;
+	int n;
+	n = snprintf(str,CSP_BUFFER_SIZE,"heap %u/%u/%u buf %u/%u cpu %u/%u/%u\n",rmRep.heapFree,rmRep.heapLow,
+					 rmRep.heapLargest,rmRep.bufInUse,rmRep.bufCount,rmRep.cpuMin,rmRep.cpuAvg,rmRep.cpuMax);
+	len = n>0 && n<CSP_BUFFER_SIZE ? n : 0;
+	for(i=0; i<rmRep.tasks+rmRep.queues; ++i) {
+		if( i<rmRep.tasks ) n = snprintf(str+len,CSP_BUFFER_SIZE-len,"%s %u %u\n",rmRep.task[i].name,rmRep.task[i].load,rmRep.task[i].stackFree);
+		else n = snprintf(str+len,CSP_BUFFER_SIZE-len,"q %s %u/%u\n",rmRep.queue[i-rmRep.tasks].name,
+								rmRep.queue[i-rmRep.tasks].waiting,rmRep.queue[i-rmRep.tasks].length);
+		if( n<0 || len+n>=CSP_BUFFER_SIZE ) break; // no room for this line
+		len += n;
+	}
+	str[len] = 0;
+	return len+1;
+}
+
+unsigned int csp_ps_hook(csp_packet_t* packet) {
+	unsigned int len;
+	int binary = packet->length>0 && packet->data[0]==RM_PS_BINARY;
+	if( RMLock() ) return 0;
+		RMGetLocked(&rmRep);
+		len = binary ? RMBinaryReply(packet->data) : RMTextReply((char*)packet->data);
+	xSemaphoreGive(rmLock);
+	return len;
+}
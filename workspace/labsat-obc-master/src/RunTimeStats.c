@@ -0,0 +1,198 @@
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <at91/boards/ISIS_OBC_G20/board.h>
+#include <at91/peripherals/aic/aic.h>
+#include <at91/peripherals/pmc/pmc.h>
+#include <at91/peripherals/tc/tc.h>
+#include "RunTimeStats.h"
+#include "LogManager.h"
+
+#define RTS_TC AT91C_BASE_TC3
+#define RTS_TC_ID AT91C_ID_TC3
+#define RTS_IDLE_NAME "IDLE" // name of the kernel idle task
+
+typedef struct {
+	char used, seen, first; // first: no load yet, the counter is the base for the next sample
+	unsigned long lastCounter;
+	unsigned int min, max, sum, count; // window being filled
+	RunTimeStatsTask rep;
+} RTSTask;
+
+static volatile unsigned int rtsHigh = 0; // TC3 overflows: upper 16 bits of the counter
+static RTSTask rtsTask[RTS_MAX_TASKS];
+static xTaskStatusType rtsStatus[RTS_MAX_TASKS];
+static unsigned long rtsLastTotal = 0, rtsWindowTime = 0;
+static unsigned int rtsSamples = 0, rtsWindows = 0, rtsWindowSecs = 0, rtsTooMany = 0;
+static unsigned int rtsCpuMin, rtsCpuMax, rtsCpuSum, rtsCpuCount;
+static unsigned short rtsCpu[3]; // min avg max of the last complete window
+static xSemaphoreHandle rtsLock = 0;
+
+
+/*- run time counter ------------------------------------------------------------------------*/
+
+static void RTSOverflowISR(void) {
+	// reading the status clears the interrupt
+	if( RTS_TC->TC_SR & AT91C_TC_COVFS ) ++rtsHigh;
+}
+
+void vConfigureTimerForRunTimeStats(void) {
+	PMC_EnablePeripheral(RTS_TC_ID);
+	TC_Configure(RTS_TC,AT91C_TC_CLKS_TIMER_DIV4_CLOCK | AT91C_TC_WAVE | AT91C_TC_WAVESEL_UP);
+	AIC_ConfigureIT(RTS_TC_ID,AT91C_AIC_PRIOR_LOWEST | AT91C_AIC_SRCTYPE_INT_HIGH_LEVEL,RTSOverflowISR);
+	RTS_TC->TC_IER = AT91C_TC_COVFS;
+	AIC_EnableIT(RTS_TC_ID);
+	TC_Start(RTS_TC);
+}
+
+// Called by the kernel at every task switch, with interrupts disabled
+unsigned long ulGetRunTimeCounterValue(void) {
+	unsigned int high, low, pending;
+	do {
+		high = rtsHigh;
+		low = RTS_TC->TC_CV & 0xFFFF;
+		pending = AT91C_BASE_AIC->AIC_IPR & (1<<RTS_TC_ID);
+	} while( high!=rtsHigh );
+	// an overflow not counted yet (the interrupt can not run until interrupts are enabled)
+	if( pending && low<0x8000 ) ++high;
+	return (high<<16) | low;
+}
+
+
+/*- per task load ---------------------------------------------------------------------------*/
+
+static RTSTask* RTSFind(xTaskStatusType* st) {
+	unsigned int i;
+	RTSTask* fr = 0;
+	for(i=0; i<RTS_MAX_TASKS; ++i) {
+		if( rtsTask[i].used && rtsTask[i].rep.taskNumber==st->xTaskNumber ) return &rtsTask[i];
+		if( ! rtsTask[i].used && ! fr ) fr = &rtsTask[i];
+	}
+	if( fr ) {
+		memset(fr,0,sizeof(*fr));
+		fr->used = fr->first = 1;
+		fr->min = 1000;
+		fr->rep.taskNumber = st->xTaskNumber;
+		strncpy(fr->rep.name,(const char*)st->pcTaskName,RTS_NAME_LEN-1);
+	}
+	return fr;
+}
+
+static unsigned short RTSAvg(unsigned int sum, unsigned int count) {
+	return count ? (sum+count/2)/count : 0;
+}
+
+// Fold the window being filled into the reported one
+static void RTSCloseWindowLocked() {
+	unsigned int i;
+	for(i=0; i<RTS_MAX_TASKS; ++i) {
+		RTSTask* t = &rtsTask[i];
+		if( ! t->used ) continue;
+		t->rep.min = t->count ? t->min : 0;
+		t->rep.avg = RTSAvg(t->sum,t->count);
+		t->rep.max = t->max;
+		t->min = 1000;
+		t->max = t->sum = t->count = 0;
+	}
+	rtsCpu[0] = rtsCpuCount ? rtsCpuMin : 0;
+	rtsCpu[1] = RTSAvg(rtsCpuSum,rtsCpuCount);
+	rtsCpu[2] = rtsCpuMax;
+	rtsCpuMin = 1000;
+	rtsCpuMax = rtsCpuSum = rtsCpuCount = 0;
+	rtsWindowSecs = (rtsWindowTime+RTS_COUNTER_HZ/2)/RTS_COUNTER_HZ;
+	rtsWindowTime = 0;
+	rtsSamples = 0;
+	++rtsWindows;
+}
+
+int RunTimeStatsSample(unsigned int when, void* privData) {
+	static const char* ownStr = __FUNCTION__;
+	unsigned long total, elapsed, delta;
+	unsigned int i, n, load, idle = 1001, closed = 0;
+	RTSTask* t;
+	if( ! rtsLock ) return 0;
+	xSemaphoreTake(rtsLock,portMAX_DELAY);
+		n = uxTaskGetSystemState(rtsStatus,RTS_MAX_TASKS,&total);
+		if( n==0 ) {
+			xSemaphoreGive(rtsLock);
+			if( rtsTooMany++==0 ) UPLOG_ERR("%s %u tasks, more than %u",ownStr,(unsigned int)uxTaskGetNumberOfTasks(),RTS_MAX_TASKS);
+			return 0;
+		}
+		elapsed = total-rtsLastTotal;
+		rtsLastTotal = total;
+		for(i=0; i<RTS_MAX_TASKS; ++i) rtsTask[i].seen = 0;
+		for(i=0; i<n; ++i) {
+			if( !(t=RTSFind(&rtsStatus[i])) ) continue;
+			t->seen = 1;
+			delta = rtsStatus[i].ulRunTimeCounter-t->lastCounter;
+			t->lastCounter = rtsStatus[i].ulRunTimeCounter;
+			if( t->first ) { t->first = 0; continue; }
+			load = elapsed ? (unsigned long long)delta*1000/elapsed : 0;
+			if( load>1000 ) load = 1000;
+			t->rep.last = load;
+			if( load<t->min ) t->min = load;
+			if( load>t->max ) t->max = load;
+			t->sum += load;
+			++t->count;
+			if( 0==strcmp(t->rep.name,RTS_IDLE_NAME) ) idle = load;
+		}
+		// deleted tasks
+		for(i=0; i<RTS_MAX_TASKS; ++i) if( ! rtsTask[i].seen ) rtsTask[i].used = 0;
+		if( idle<=1000 ) {
+			load = 1000-idle;
+			if( load<rtsCpuMin ) rtsCpuMin = load;
+			if( load>rtsCpuMax ) rtsCpuMax = load;
+			rtsCpuSum += load;
+			++rtsCpuCount;
+			rtsWindowTime += elapsed;
+			if( ++rtsSamples>=RTS_WINDOW ) { RTSCloseWindowLocked(); closed = 1; }
+		}
+	xSemaphoreGive(rtsLock);
+	if( closed && RTS_LOG_WINDOWS ) RunTimeStatsShowStatus();
+	return 0;
+}
+
+int RunTimeStatsInit() {
+	if( ! rtsLock && !(rtsLock=xSemaphoreCreateMutex()) ) return -1;
+	xSemaphoreTake(rtsLock,portMAX_DELAY);
+		memset(rtsTask,0,sizeof(rtsTask));
+		rtsSamples = rtsWindows = rtsWindowSecs = 0;
+		rtsCpuMin = 1000;
+		rtsCpuMax = rtsCpuSum = rtsCpuCount = 0;
+		memset(rtsCpu,0,sizeof(rtsCpu));
+		rtsLastTotal = ulGetRunTimeCounterValue();
+		rtsWindowTime = 0;
+	xSemaphoreGive(rtsLock);
+	return 0;
+}
+
+int RunTimeStatsGet(RunTimeStatsReport* rep) {
+	unsigned int i;
+	memset(rep,0,sizeof(*rep));
+	if( ! rtsLock ) return 0;
+	xSemaphoreTake(rtsLock,portMAX_DELAY);
+		rep->windows = rtsWindows;
+		rep->samples = rtsSamples;
+		rep->windowSecs = rtsWindowSecs;
+		rep->cpuMin = rtsCpu[0];
+		rep->cpuAvg = rtsCpu[1];
+		rep->cpuMax = rtsCpu[2];
+		for(i=0; i<RTS_MAX_TASKS; ++i)
+			if( rtsTask[i].used ) rep->task[rep->tasks++] = rtsTask[i].rep;
+	xSemaphoreGive(rtsLock);
+	return rep->tasks;
+}
+
+void RunTimeStatsShowStatus() {
+	static RunTimeStatsReport rep;
+	unsigned int i;
+	RunTimeStatsGet(&rep);
+	UPLOG_INFO("%s windows=%u windowSecs=%u samples=%u cpu(min/avg/max permille)=%u/%u/%u tasks=%u running=%u max=%u",
+				  __FUNCTION__,rep.windows,rep.windowSecs,rep.samples,rep.cpuMin,rep.cpuAvg,rep.cpuMax,rep.tasks,
+				  (unsigned int)uxTaskGetNumberOfTasks(),RTS_MAX_TASKS);
+	for(i=0; i<rep.tasks; ++i)
+		UPLOG_INFO("%s task '%s' num=%u load(min/avg/max permille)=%u/%u/%u last=%u",__FUNCTION__,
+					  rep.task[i].name,rep.task[i].taskNumber,rep.task[i].min,rep.task[i].avg,rep.task[i].max,rep.task[i].last);
+}
+
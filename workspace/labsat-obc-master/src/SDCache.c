@@ -0,0 +1,392 @@
+#include <string.h>
+#include "SDCache.h"
+
+#ifdef SDCACHE_HOST
+	// host benchmark build (sdcache-bench.c): no scheduler, the benchmark drives the time
+	#include <stdio.h>
+	typedef unsigned int portTickType;
+	extern portTickType sdcacheBenchTicks;
+	#define sdTicks() sdcacheBenchTicks
+	#define sdMsToTicks(ms) (ms)
+	#define sdLockCreate(v) 1
+	#define sdLock(v)
+	#define sdUnlock(v)
+	#define SDLOG_ERR(fmt,...) fprintf(stderr,fmt "\n",__VA_ARGS__)
+	#define SDLOG_INFO(fmt,...) printf(fmt "\n",__VA_ARGS__)
+	F_DRIVERINIT SDCacheLowerInit = 0;
+#else
+	#include <freertos/FreeRTOS.h>
+	#include <freertos/task.h>
+	#include <freertos/semphr.h>
+	#include <hcc/api_mdriver_atmel_mcipdc.h>
+	#include "LogManager.h"
+	#define sdTicks() xTaskGetTickCount()
+	#define sdMsToTicks(ms) pdMS_TO_TICKS(ms)
+	#define sdLockCreate(v) ( (v)->lock || ((v)->lock = xSemaphoreCreateMutex()) )
+	#define sdLock(v) xSemaphoreTake((v)->lock,portMAX_DELAY)
+	#define sdUnlock(v) xSemaphoreGive((v)->lock)
+	#define SDLOG_ERR UPLOG_ERR
+	#define SDLOG_INFO UPLOG_INFO
+	F_DRIVERINIT SDCacheLowerInit = atmel_mcipdc_initfunc;
+#endif
+
+typedef struct {
+	unsigned long sector;
+	unsigned int lastUse; // LRU stamp
+	char valid, dirty;
+} SDCacheEntry;
+
+typedef struct {
+	F_DRIVER drv; // handed to hcc, drv.user_ptr points back here
+	F_DRIVER *lower;
+	char inUse, bypass; // bypass: sector size not supported, forward everything
+	unsigned long nsectors; // card size (from getphy), 0 if not known yet
+	unsigned long lastRead; // last sector read, to detect sequential readers
+	unsigned int useClock;
+	unsigned int dirtyCount;
+	portTickType dirtySince; // when the oldest dirty sector was written
+	SDCacheEntry entry[SDCACHE_SECTORS];
+	unsigned char data[SDCACHE_SECTORS][SDCACHE_SECTOR_SIZE];
+	unsigned char run[SDCACHE_MAX_RUN*SDCACHE_SECTOR_SIZE]; // staging buffer for multi-sector commands
+#ifndef SDCACHE_HOST
+	xSemaphoreHandle lock;
+#endif
+	SDCacheStats st;
+} SDCacheVolume;
+
+static SDCacheVolume sdCache[SDCACHE_VOLUMES];
+
+
+static int SDCacheFind(SDCacheVolume* v, unsigned long sector) {
+	int i;
+	for(i=0; i<SDCACHE_SECTORS; ++i)
+		if( v->entry[i].valid && v->entry[i].sector==sector ) return i;
+	return -1;
+}
+
+static int SDCacheLowerWrite(SDCacheVolume* v, void* data, unsigned long sector, int cnt) {
+	int err = 0, i;
+	if( cnt==1 || ! v->lower->writemultiplesector ) {
+		for(i=0; i<cnt; ++i) {
+			++v->st.sdWriteCmds;
+			if( (err=v->lower->writesector(v->lower,(unsigned char*)data+i*SDCACHE_SECTOR_SIZE,sector+i)) ) break;
+		}
+	} else {
+		++v->st.sdWriteCmds;
+		err = v->lower->writemultiplesector(v->lower,data,sector,cnt);
+	}
+	if( err ) ++v->st.errors;
+	else v->st.sdSectorsWritten += cnt;
+	return err;
+}
+
+static int SDCacheLowerRead(SDCacheVolume* v, void* data, unsigned long sector, int cnt) {
+	int err = 0, i;
+	if( cnt==1 || ! v->lower->readmultiplesector ) {
+		for(i=0; i<cnt; ++i) {
+			++v->st.sdReadCmds;
+			if( (err=v->lower->readsector(v->lower,(unsigned char*)data+i*SDCACHE_SECTOR_SIZE,sector+i)) ) break;
+		}
+	} else {
+		++v->st.sdReadCmds;
+		err = v->lower->readmultiplesector(v->lower,data,sector,cnt);
+	}
+	if( err ) ++v->st.errors;
+	else v->st.sdSectorsRead += cnt;
+	return err;
+}
+
+// Write back all dirty sectors, consecutive ones with a single command. Must hold the lock.
+static int SDCacheFlushLocked(SDCacheVolume* v) {
+	int idx[SDCACHE_SECTORS], n = 0, i, j, k, cnt, err, ret = 0;
+	if( ! v->dirtyCount ) return 0;
+	++v->st.flushes;
+	// dirty entries sorted by sector
+	for(i=0; i<SDCACHE_SECTORS; ++i) {
+		if( !v->entry[i].valid || !v->entry[i].dirty ) continue;
+		for(j=n; j>0 && v->entry[idx[j-1]].sector>v->entry[i].sector; --j) idx[j] = idx[j-1];
+		idx[j] = i; ++n;
+	}
+	for(i=0; i<n; i+=cnt) {
+		for(cnt=1; i+cnt<n && cnt<SDCACHE_MAX_RUN &&
+				v->entry[idx[i+cnt]].sector==v->entry[idx[i]].sector+cnt; ++cnt);
+		if( cnt==1 ) {
+			err = SDCacheLowerWrite(v,v->data[idx[i]],v->entry[idx[i]].sector,1);
+		} else {
+			for(k=0; k<cnt; ++k) memcpy(v->run+k*SDCACHE_SECTOR_SIZE,v->data[idx[i+k]],SDCACHE_SECTOR_SIZE);
+			err = SDCacheLowerWrite(v,v->run,v->entry[idx[i]].sector,cnt);
+		}
+		if( err ) { if( !ret ) ret = err; continue; } // keep them dirty, retry on next flush
+		for(k=0; k<cnt; ++k) { v->entry[idx[i+k]].dirty = 0; --v->dirtyCount; }
+	}
+	if( v->dirtyCount ) v->dirtySince = sdTicks();
+	return ret;
+}
+
+// Free (or least recently used) entry. Writes back if it is dirty. Must hold the lock.
+static int SDCacheVictim(SDCacheVolume* v) {
+	int i, lru = 0;
+	for(i=0; i<SDCACHE_SECTORS; ++i) {
+		if( ! v->entry[i].valid ) return i;
+		if( v->entry[i].lastUse < v->entry[lru].lastUse ) lru = i;
+	}
+	if( v->entry[lru].dirty ) {
+		// write back everything now: it coalesces better than evicting one sector at a time
+		SDCacheFlushLocked(v);
+		if( v->entry[lru].dirty ) return -1;
+	}
+	v->entry[lru].valid = 0;
+	return lru;
+}
+
+static void SDCacheCheckAge(SDCacheVolume* v) {
+	if( v->dirtyCount && sdTicks()-v->dirtySince >= sdMsToTicks(SDCACHE_MAX_DIRTY_MS) )
+		SDCacheFlushLocked(v);
+}
+
+// Read sectors [sector,sector+cnt) to the cache, skipping those already cached. Must hold the lock.
+// The entries are taken before the card read: evicting a dirty one writes back through v->run.
+static int SDCacheReadAhead(SDCacheVolume* v, unsigned long sector, int cnt) {
+	int slot[SDCACHE_MAX_RUN], n, err, k, i;
+	if( v->nsectors && sector+cnt>v->nsectors ) cnt = v->nsectors-sector;
+	if( cnt<2 ) return -1;
+	for(n=0; n<cnt; ++n) {
+		slot[n] = -1;
+		if( SDCacheFind(v,sector+n)>=0 ) continue;
+		if( (i=SDCacheVictim(v))<0 ) break;
+		// valid and most recently used, so the next SDCacheVictim does not take it again
+		v->entry[i].sector = sector+n;
+		v->entry[i].dirty = 0;
+		v->entry[i].valid = 1;
+		v->entry[i].lastUse = ++v->useClock;
+		slot[n] = i;
+	}
+	++v->st.readAheads;
+	if( (err=SDCacheLowerRead(v,v->run,sector,cnt)) ) {
+		for(k=0; k<n; ++k) if( slot[k]>=0 ) v->entry[slot[k]].valid = 0;
+		return err;
+	}
+	for(k=0; k<n; ++k)
+		if( slot[k]>=0 ) memcpy(v->data[slot[k]],v->run+k*SDCACHE_SECTOR_SIZE,SDCACHE_SECTOR_SIZE);
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// F_DRIVER functions
+
+static int SDCacheReadSector(F_DRIVER* driver, void* data, unsigned long sector) {
+	SDCacheVolume* v = (SDCacheVolume*)driver->user_ptr;
+	int i, err = 0;
+	if( v->bypass ) return v->lower->readsector(v->lower,data,sector);
+	sdLock(v);
+		++v->st.reads;
+		SDCacheCheckAge(v);
+		if( (i=SDCacheFind(v,sector))>=0 ) {
+			++v->st.hits;
+		} else {
+			++v->st.misses;
+			if( SDCACHE_READAHEAD>1 && sector==v->lastRead+1 && 0==SDCacheReadAhead(v,sector,SDCACHE_READAHEAD) )
+				i = SDCacheFind(v,sector);
+			if( i<0 && (i=SDCacheVictim(v))>=0 ) {
+				if( (err=SDCacheLowerRead(v,v->data[i],sector,1)) ) {
+					i = -1;
+				} else {
+					v->entry[i].sector = sector;
+					v->entry[i].dirty = 0;
+					v->entry[i].valid = 1;
+				}
+			}
+		}
+		if( i>=0 ) {
+			v->entry[i].lastUse = ++v->useClock;
+			memcpy(data,v->data[i],SDCACHE_SECTOR_SIZE);
+		} else if( !err ) {
+			// no room (write back failing): read around the cache
+			err = SDCacheLowerRead(v,data,sector,1);
+		}
+		v->lastRead = sector;
+	sdUnlock(v);
+	return err;
+}
+
+static int SDCacheWriteSector(F_DRIVER* driver, void* data, unsigned long sector) {
+	SDCacheVolume* v = (SDCacheVolume*)driver->user_ptr;
+	int i, err = 0;
+	if( v->bypass ) return v->lower->writesector(v->lower,data,sector);
+	sdLock(v);
+		++v->st.writes;
+		if( (i=SDCacheFind(v,sector))<0 && (i=SDCacheVictim(v))>=0 ) {
+			v->entry[i].sector = sector;
+			v->entry[i].dirty = 0;
+			v->entry[i].valid = 1;
+		}
+		if( i>=0 ) {
+			memcpy(v->data[i],data,SDCACHE_SECTOR_SIZE);
+			v->entry[i].lastUse = ++v->useClock;
+			if( ! v->entry[i].dirty ) {
+				v->entry[i].dirty = 1;
+				if( v->dirtyCount++==0 ) v->dirtySince = sdTicks();
+			}
+			if( v->dirtyCount>=SDCACHE_MAX_DIRTY ) SDCacheFlushLocked(v);
+			else SDCacheCheckAge(v);
+		} else {
+			// no room (write back failing): write through
+			err = SDCacheLowerWrite(v,data,sector,1);
+		}
+	sdUnlock(v);
+	return err;
+}
+
+static int SDCacheReadMultipleSector(F_DRIVER* driver, void* data, unsigned long sector, int cnt) {
+	SDCacheVolume* v = (SDCacheVolume*)driver->user_ptr;
+	int i, err;
+	if( v->bypass ) return v->lower->readmultiplesector(v->lower,data,sector,cnt);
+	sdLock(v);
+		v->st.reads += cnt;
+		err = SDCacheLowerRead(v,data,sector,cnt);
+		// cached copies may be newer than the card
+		for(i=0; !err && i<SDCACHE_SECTORS; ++i) {
+			if( v->entry[i].valid && v->entry[i].sector>=sector && v->entry[i].sector<sector+cnt )
+				memcpy((unsigned char*)data+(v->entry[i].sector-sector)*SDCACHE_SECTOR_SIZE,v->data[i],SDCACHE_SECTOR_SIZE);
+		}
+		v->lastRead = sector+cnt-1;
+	sdUnlock(v);
+	return err;
+}
+
+static int SDCacheWriteMultipleSector(F_DRIVER* driver, void* data, unsigned long sector, int cnt) {
+	SDCacheVolume* v = (SDCacheVolume*)driver->user_ptr;
+	int i, err;
+	if( v->bypass ) return v->lower->writemultiplesector(v->lower,data,sector,cnt);
+	sdLock(v);
+		v->st.writes += cnt;
+		// already a multi-sector command: write through, updating cached copies
+		err = SDCacheLowerWrite(v,data,sector,cnt);
+		for(i=0; !err && i<SDCACHE_SECTORS; ++i) {
+			if( v->entry[i].valid && v->entry[i].sector>=sector && v->entry[i].sector<sector+cnt ) {
+				memcpy(v->data[i],(unsigned char*)data+(v->entry[i].sector-sector)*SDCACHE_SECTOR_SIZE,SDCACHE_SECTOR_SIZE);
+				if( v->entry[i].dirty ) { v->entry[i].dirty = 0; --v->dirtyCount; }
+			}
+		}
+	sdUnlock(v);
+	return err;
+}
+
+static int SDCacheGetPhy(F_DRIVER* driver, F_PHY* phy) {
+	SDCacheVolume* v = (SDCacheVolume*)driver->user_ptr;
+	int err = v->lower->getphy(v->lower,phy);
+	if( err ) return err;
+	sdLock(v);
+		v->nsectors = phy->number_of_sectors;
+		if( phy->bytes_per_sector!=SDCACHE_SECTOR_SIZE && !v->bypass ) {
+			SDLOG_ERR("%s sector size %u not cached",__FUNCTION__,(unsigned int)phy->bytes_per_sector);
+			SDCacheFlushLocked(v);
+			v->bypass = 1;
+		}
+	sdUnlock(v);
+	return 0;
+}
+
+static long SDCacheGetStatus(F_DRIVER* driver) {
+	SDCacheVolume* v = (SDCacheVolume*)driver->user_ptr;
+	long st = v->lower->getstatus ? v->lower->getstatus(v->lower) : 0;
+	if( st & (F_ST_MISSING|F_ST_CHANGED) ) {
+		// another card (or none): cached sectors are meaningless now
+		sdLock(v);
+			memset(v->entry,0,sizeof(v->entry));
+			v->dirtyCount = 0;
+		sdUnlock(v);
+	}
+	return st;
+}
+
+static void SDCacheRelease(F_DRIVER* driver) {
+	SDCacheVolume* v = (SDCacheVolume*)driver->user_ptr;
+	sdLock(v);
+		SDCacheFlushLocked(v);
+		if( v->lower->release ) v->lower->release(v->lower);
+		v->inUse = 0;
+	sdUnlock(v);
+}
+
+static int SDCacheIoctl(F_DRIVER* driver, unsigned long msg, void* iparam, void* oparam) {
+	SDCacheVolume* v = (SDCacheVolume*)driver->user_ptr;
+	if( ! v->lower->ioctl ) return 1; // not supported, as hcc expects from drivers without ioctl
+	return v->lower->ioctl(v->lower,msg,iparam,oparam);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Public functions
+
+F_DRIVER* SDCacheInitFunc(unsigned long driver_param) {
+	SDCacheVolume* v = 0;
+	F_DRIVER* lower;
+	int i;
+	if( ! SDCacheLowerInit ) return 0;
+	lower = SDCacheLowerInit(driver_param);
+	if( ! lower ) return 0;
+	for(i=0; i<SDCACHE_VOLUMES; ++i)
+		if( ! sdCache[i].inUse ) { v = &sdCache[i]; break; }
+	if( ! v || ! sdLockCreate(v) ) {
+		SDLOG_ERR("%s no cache available, volume mounted uncached",__FUNCTION__);
+		return lower;
+	}
+	sdLock(v);
+		memset(&v->drv,0,sizeof(v->drv));
+		memset(v->entry,0,sizeof(v->entry));
+		memset(&v->st,0,sizeof(v->st));
+		v->lower = lower;
+		v->inUse = 1;
+		v->bypass = 0;
+		v->nsectors = 0;
+		v->lastRead = (unsigned long)-2; // so that sector 0 is not taken as sequential
+		v->useClock = 0;
+		v->dirtyCount = 0;
+		v->drv.separated = lower->separated;
+		v->drv.user_ptr = v;
+		v->drv.readsector = SDCacheReadSector;
+		v->drv.writesector = SDCacheWriteSector;
+		v->drv.readmultiplesector = SDCacheReadMultipleSector;
+		v->drv.writemultiplesector = SDCacheWriteMultipleSector;
+		v->drv.getphy = SDCacheGetPhy;
+		v->drv.getstatus = SDCacheGetStatus;
+		v->drv.release = SDCacheRelease;
+		v->drv.ioctl = SDCacheIoctl;
+	sdUnlock(v);
+	return &v->drv;
+}
+
+int SDCacheFlush() {
+	int i, err, ret = 0;
+	for(i=0; i<SDCACHE_VOLUMES; ++i) {
+		if( ! sdCache[i].inUse ) continue;
+		sdLock(&sdCache[i]);
+			err = SDCacheFlushLocked(&sdCache[i]);
+		sdUnlock(&sdCache[i]);
+		if( err && !ret ) ret = err;
+	}
+	return ret;
+}
+
+int SDCacheGetStats(int vol, SDCacheStats* st, char reset) {
+	if( vol<0 || vol>=SDCACHE_VOLUMES || ! sdCache[vol].inUse ) return -1;
+	sdLock(&sdCache[vol]);
+		memcpy(st,&sdCache[vol].st,sizeof(SDCacheStats));
+		if( reset ) memset(&sdCache[vol].st,0,sizeof(SDCacheStats));
+	sdUnlock(&sdCache[vol]);
+	return 0;
+}
+
+void SDCacheShowStatus() {
+	SDCacheStats st;
+	int i;
+	for(i=0; i<SDCACHE_VOLUMES; ++i) {
+		if( SDCacheGetStats(i,&st,0) ) continue;
+		SDLOG_INFO("%s vol=%d reads=%u writes=%u hitRate=%u%% readAheads=%u sdReadCmds=%u sdWriteCmds=%u sdSectorsRead=%u sdSectorsWritten=%u flushes=%u errors=%u dirty=%u",
+					  __FUNCTION__,i,st.reads,st.writes,st.hits+st.misses ? 100*st.hits/(st.hits+st.misses) : 0,
+					  st.readAheads,st.sdReadCmds,st.sdWriteCmds,st.sdSectorsRead,st.sdSectorsWritten,
+					  st.flushes,st.errors,sdCache[i].dirtyCount);
+	}
+}
@@ -1,6 +1,15 @@
 #include "SDManager.h"
+#include "SDCache.h"
+#include "SDMirror.h"
+#include "SDMmc.h"
 #include "LogManager.h"
 
+#if SD_DRIVER_SDMMC
+	#define SD_CARD_INITFUNC SDMmcInitFunc
+#else
+	#define SD_CARD_INITFUNC atmel_mcipdc_initfunc
+#endif
+
 
 
 int SDManagerInit()
@@ -31,16 +40,28 @@ int SDManagerInit()
 	//		return err;
 	// }
 	//SDManagerShowStatus(0,1,&p);
-	if( (err=f_initvolume(1,atmel_mcipdc_initfunc,F_AUTO_ASSIGN)) ) { // safe init
+#if SD_MIRROR
+	// cache on top of the mirror of both cards
+	SDMirrorLowerInit = SD_CARD_INITFUNC;
+	SDCacheLowerInit = SDMirrorInitFunc;
+	if( (err=f_initvolume(1,SDCacheInitFunc,F_AUTO_ASSIGN)) ) { // safe init
+		UPLOG_CRIT(initErrStr,initStr,"initializing volume 1 as mirrored SD cards",err);
+		return err;
+	}
+	SDManagerShowStatus(1,1,&p);
+#else
+	SDCacheLowerInit = SD_CARD_INITFUNC;
+	if( (err=f_initvolume(1,SDCacheInitFunc,F_AUTO_ASSIGN)) ) { // safe init
 		UPLOG_CRIT(initErrStr,initStr,"initializing volume 1 as SD card",err);
 		return err;
 	}
 	SDManagerShowStatus(1,1,&p);
-	if( (err=f_initvolume(2,atmel_mcipdc_initfunc,F_AUTO_ASSIGN)) ) { // safe init
+	if( (err=f_initvolume(2,SDCacheInitFunc,F_AUTO_ASSIGN)) ) { // safe init
 		UPLOG_CRIT(initErrStr,initStr,"initializing volume 2 as SD card",err);
 		return err;
 	}
 	SDManagerShowStatus(2,1,&p);
+#endif
 	//This task is about to end or at least stop using the filesystems, so unregister now.
 	f_releaseFS();
 	
@@ -49,11 +70,15 @@ int SDManagerInit()
 
 void SDManagerShutDown() {
 	UPLOG_INFO(__FUNCTION__);
+	// write back cached sectors (also done by the cache when the volumes are released)
+	SDCacheFlush();
 	// close ramdrive
 	// f_delvolume(0);
-	// close sd cards
+	// close sd cards (the mirror writes its queue to the cards when released)
 	f_delvolume(1);
+#if ! SD_MIRROR
 	f_delvolume(2);
+#endif
 	// unregister this task from hcc
 	f_releaseFS();
 	// delete hcc driver
@@ -63,6 +88,29 @@ void SDManagerShutDown() {
 }
 
 
+int SDManagerFlush(unsigned int when, void* privData) {
+	int err = SDCacheFlush();
+	if( err ) UPLOG_ERR("%s error: %d",__FUNCTION__,err);
+#if SD_MIRROR
+	// don't hold the TimerManager task: the card tasks write the queue on their own
+	SDMirrorFlush(0);
+#endif
+	return 0;
+}
+
+int SDManagerSync() {
+	int err = SDCacheFlush();
+	if( err ) UPLOG_ERR("%s error: %d",__FUNCTION__,err);
+#if SD_MIRROR
+	if( SDMirrorFlush(pdMS_TO_TICKS(SDMIRROR_FLUSH_MS)) ) {
+		UPLOG_ERR("%s mirror queue not written",__FUNCTION__);
+		if( ! err ) err = -1;
+	}
+#endif
+	return err;
+}
+
+
 int SDManagerReInit() {
 	UPLOG_INFO(__FUNCTION__);
 	SDManagerShutDown();
@@ -0,0 +1,664 @@
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <hcc/api_mdriver_atmel_mcipdc.h>
+#include "SDMirror.h"
+
+#ifdef SDMIRROR_HOST
+	// host test build (sdmirror-bench.c): no scheduler, the test runs the card tasks with SDMirrorPump
+	// and drives the time. Nothing else runs meanwhile, so the semaphores are not needed.
+	#include <stdio.h>
+	extern portTickType sdmirrorBenchTicks;
+	#define sdmTicks() sdmirrorBenchTicks
+	static portBASE_TYPE sdmBenchTake() { return pdTRUE; }
+	#define sdmTake(s,ticks) sdmBenchTake()
+	#define sdmGive(s)
+	#define SDLOG_ERR(fmt,...) fprintf(stderr,fmt "\n",__VA_ARGS__)
+	#define SDLOG_CRIT SDLOG_ERR
+	#define SDLOG_INFO(fmt,...) printf(fmt "\n",__VA_ARGS__)
+	F_DRIVERINIT SDMirrorLowerInit = 0;
+#else
+	#include "LogManager.h"
+	#define sdmTicks() xTaskGetTickCount()
+	#define sdmTake(s,ticks) xSemaphoreTake(s,ticks)
+	#define sdmGive(s) xSemaphoreGive(s)
+	#define SDLOG_ERR UPLOG_ERR
+	#define SDLOG_CRIT UPLOG_CRIT
+	#define SDLOG_INFO UPLOG_INFO
+	F_DRIVERINIT SDMirrorLowerInit = atmel_mcipdc_initfunc;
+#endif
+
+typedef struct {
+	unsigned long sector;
+	int cnt;
+	unsigned char data[SDMIRROR_MAX_RUN*SDMIRROR_SECTOR_SIZE];
+} SDMirrorWrite;
+
+typedef struct {
+	F_DRIVER* lower; // 0 if the card was not found
+	unsigned char state;
+	unsigned int tail; // next queue write to apply (free running, like head)
+	unsigned int resyncRegion; // region being copied
+	unsigned long resyncSector; // next sector to copy in it
+	portTickType lastProbe;
+	xSemaphoreHandle io; // held while using the card driver
+	xSemaphoreHandle work; // given when there is something to do
+	xTaskHandle task;
+	unsigned char dirty[SDMIRROR_REGIONS/8]; // regions with missed writes
+	unsigned char buf[SDMIRROR_MAX_RUN*SDMIRROR_SECTOR_SIZE]; // resync staging
+} SDMirrorCard;
+
+typedef struct {
+	F_DRIVER drv; // handed to hcc
+	char inUse;
+	unsigned long nsectors;
+	unsigned int regionShift; // a region is 1<<regionShift sectors
+	unsigned int nregions;
+	unsigned int head; // queued writes (free running)
+	SDMirrorWrite q[SDMIRROR_QUEUE];
+	SDMirrorCard card[SDMIRROR_CARDS];
+	xSemaphoreHandle lock; // queue, card states and counters
+	xSemaphoreHandle room; // given when a card applied a queued write
+	SDMirrorStats st;
+} SDMirror;
+
+static SDMirror sdMirror;
+
+#define sdmLock(m) sdmTake((m)->lock,portMAX_DELAY)
+#define sdmUnlock(m) sdmGive((m)->lock)
+#define sdmMs(ticks) ((ticks)*portTICK_RATE_MS)
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Queue and region bookkeeping (hold the lock)
+
+// queued writes still needed by some card
+static unsigned int SDMirrorPending(SDMirror* m) {
+	unsigned int c, p, max = 0;
+	for(c=0; c<SDMIRROR_CARDS; ++c)
+		if( (p=m->head-m->card[c].tail)>max ) max = p;
+	return max;
+}
+
+static void SDMirrorMarkDirty(SDMirror* m, int c, unsigned long sector, int cnt) {
+	SDMirrorCard* k = &m->card[c];
+	unsigned int r, last = (sector+cnt-1)>>m->regionShift;
+	for(r=sector>>m->regionShift; r<=last && r<m->nregions; ++r) {
+		if( k->dirty[r>>3] & (1<<(r&7)) ) continue;
+		k->dirty[r>>3] |= 1<<(r&7);
+		++m->st.card[c].dirtyRegions;
+	}
+}
+
+static void SDMirrorMarkAllDirty(SDMirror* m, int c) {
+	// the card may have dirty regions already (failed, or a resync running): count them again
+	memset(m->card[c].dirty,0,sizeof(m->card[c].dirty));
+	m->st.card[c].dirtyRegions = 0;
+	SDMirrorMarkDirty(m,c,0,m->nsectors);
+	m->card[c].resyncRegion = 0;
+	m->card[c].resyncSector = 0;
+}
+
+static char SDMirrorIsDirty(SDMirror* m, int c, unsigned long sector, int cnt) {
+	unsigned int r, last = (sector+cnt-1)>>m->regionShift;
+	for(r=sector>>m->regionShift; r<=last && r<m->nregions; ++r)
+		if( m->card[c].dirty[r>>3] & (1<<(r&7)) ) return 1;
+	return 0;
+}
+
+// Can sectors be read from card c
+static char SDMirrorReadable(SDMirror* m, int c, unsigned long sector, int cnt) {
+	SDMirrorCard* k = &m->card[c];
+	if( ! k->lower || k->state==SDMIRROR_CARD_FAILED ) return 0;
+	return k->state==SDMIRROR_CARD_OK || ! SDMirrorIsDirty(m,c,sector,cnt);
+}
+
+// Take card c out of service
+static void SDMirrorFail(SDMirror* m, int c) {
+	SDMirrorCard* k = &m->card[c];
+	if( k->state==SDMIRROR_CARD_FAILED ) return;
+	k->state = SDMIRROR_CARD_FAILED;
+	k->lastProbe = sdmTicks();
+	++m->st.card[c].failures;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Card access
+
+static int SDMirrorLowerWrite(SDMirrorCard* k, void* data, unsigned long sector, int cnt) {
+	if( ! k->lower ) return MMC_ERR_NOTINITIALIZED; // released meanwhile
+	if( cnt==1 || ! k->lower->writemultiplesector ) {
+		int i, err;
+		for(i=0; i<cnt; ++i)
+			if( (err=k->lower->writesector(k->lower,(unsigned char*)data+i*SDMIRROR_SECTOR_SIZE,sector+i)) ) return err;
+		return 0;
+	}
+	return k->lower->writemultiplesector(k->lower,data,sector,cnt);
+}
+
+static int SDMirrorLowerRead(SDMirrorCard* k, void* data, unsigned long sector, int cnt) {
+	if( ! k->lower ) return MMC_ERR_NOTINITIALIZED;
+	if( cnt==1 || ! k->lower->readmultiplesector ) {
+		int i, err;
+		for(i=0; i<cnt; ++i)
+			if( (err=k->lower->readsector(k->lower,(unsigned char*)data+i*SDMIRROR_SECTOR_SIZE,sector+i)) ) return err;
+		return 0;
+	}
+	return k->lower->readmultiplesector(k->lower,data,sector,cnt);
+}
+
+// Read from card c, holding its io semaphore, and overlay the writes it has not applied yet
+// (its task can not apply any meanwhile, so none of them can be released while reading).
+static int SDMirrorReadCardIO(SDMirror* m, int c, void* data, unsigned long sector, int cnt) {
+	SDMirrorCard* k = &m->card[c];
+	SDMirrorWrite* w;
+	portTickType t = sdmTicks();
+	unsigned int i;
+	unsigned long s, e;
+	int err = SDMirrorLowerRead(k,data,sector,cnt);
+	sdmLock(m);
+		++m->st.card[c].readCmds;
+		m->st.card[c].readMs += sdmMs(sdmTicks()-t);
+		if( err ) {
+			++m->st.card[c].errors;
+		} else {
+			m->st.card[c].sectorsRead += cnt;
+			// oldest to newest, so the newest copy of a sector wins
+			for(i=k->tail; i!=m->head; ++i) {
+				w = &m->q[i%SDMIRROR_QUEUE];
+				s = w->sector>sector ? w->sector : sector;
+				e = w->sector+w->cnt<sector+cnt ? w->sector+w->cnt : sector+cnt;
+				if( s>=e ) continue;
+				memcpy((unsigned char*)data+(s-sector)*SDMIRROR_SECTOR_SIZE,
+						 w->data+(s-w->sector)*SDMIRROR_SECTOR_SIZE,(e-s)*SDMIRROR_SECTOR_SIZE);
+				m->st.queueOverlays += e-s;
+			}
+		}
+	sdmUnlock(m);
+	return err;
+}
+
+// Apply the next queued write to card c (or record it as missed if the card is out)
+static void SDMirrorApply(SDMirror* m, int c) {
+	SDMirrorCard* k = &m->card[c];
+	SDMirrorWrite* w = &m->q[k->tail%SDMIRROR_QUEUE];
+	unsigned long sector = w->sector; // for the logs, the slot can be reused once released
+	int cnt = w->cnt, err = 0;
+	portTickType t;
+	char lost = 0, failed = 0;
+	sdmTake(k->io,portMAX_DELAY);
+		t = sdmTicks();
+		if( k->state!=SDMIRROR_CARD_FAILED ) err = SDMirrorLowerWrite(k,w->data,w->sector,w->cnt);
+		sdmLock(m);
+			if( k->state!=SDMIRROR_CARD_FAILED ) {
+				++m->st.card[c].writeCmds;
+				m->st.card[c].writeMs += sdmMs(sdmTicks()-t);
+				if( err ) {
+					++m->st.card[c].errors;
+					SDMirrorFail(m,c);
+					failed = 1;
+				} else {
+					m->st.card[c].sectorsWritten += w->cnt;
+				}
+			}
+			if( k->state==SDMIRROR_CARD_FAILED ) {
+				SDMirrorMarkDirty(m,c,w->sector,w->cnt);
+				// the other card missed it too (counted by the last of both)
+				lost = m->card[!c].state==SDMIRROR_CARD_FAILED && (int)(m->card[!c].tail-k->tail)>0;
+				if( lost ) ++m->st.lostWrites;
+			}
+			++k->tail;
+		sdmUnlock(m);
+	sdmGive(k->io);
+	sdmGive(m->room);
+	if( failed ) SDLOG_ERR("%s card %d write error %d at sector %u, card out of service",__FUNCTION__,c,err,(unsigned int)sector);
+	if( lost ) SDLOG_CRIT("%s no card available, write of %d sectors at %u lost",__FUNCTION__,cnt,(unsigned int)sector);
+}
+
+// Copy the next chunk of a dirty region from the other card. Returns 0 if there was nothing
+// to do, 1 otherwise.
+static char SDMirrorResyncStep(SDMirror* m, int c) {
+	SDMirrorCard* k = &m->card[c];
+	unsigned int r;
+	unsigned long end;
+	int cnt, err, src = !c;
+	char done = 0;
+	sdmLock(m);
+		if( m->card[src].state!=SDMIRROR_CARD_OK ) { sdmUnlock(m); return 0; }
+		// next dirty region, from the one being copied on
+		for(r=k->resyncRegion; r<m->nregions && !(k->dirty[r>>3] & (1<<(r&7))); ++r);
+		if( r>=m->nregions ) {
+			if( m->st.card[c].dirtyRegions ) { // regions behind were marked meanwhile
+				k->resyncRegion = 0;
+				k->resyncSector = 0;
+				sdmUnlock(m);
+				return 1;
+			}
+			k->state = SDMIRROR_CARD_OK;
+			sdmUnlock(m);
+			SDLOG_INFO("%s card %d in sync",__FUNCTION__,c);
+			return 1;
+		}
+		if( r!=k->resyncRegion ) {
+			k->resyncRegion = r;
+			k->resyncSector = (unsigned long)r<<m->regionShift;
+		}
+		end = (unsigned long)(r+1)<<m->regionShift;
+		if( end>m->nsectors ) end = m->nsectors;
+		cnt = end-k->resyncSector>SDMIRROR_MAX_RUN ? SDMIRROR_MAX_RUN : end-k->resyncSector;
+	sdmUnlock(m);
+
+	sdmTake(m->card[src].io,portMAX_DELAY);
+		err = SDMirrorReadCardIO(m,src,k->buf,k->resyncSector,cnt);
+	sdmGive(m->card[src].io);
+	if( err ) {
+		sdmLock(m); SDMirrorFail(m,src); sdmUnlock(m);
+		SDLOG_ERR("%s card %d read error %d, card out of service",__FUNCTION__,src,err);
+	} else {
+		sdmTake(k->io,portMAX_DELAY);
+			err = SDMirrorLowerWrite(k,k->buf,k->resyncSector,cnt);
+		sdmGive(k->io);
+		sdmLock(m);
+			if( err ) {
+				++m->st.card[c].errors;
+				SDMirrorFail(m,c);
+			} else {
+				m->st.card[c].sectorsWritten += cnt;
+				k->resyncSector += cnt;
+				if( k->resyncSector>=end ) {
+					k->dirty[r>>3] &= ~(1<<(r&7));
+					--m->st.card[c].dirtyRegions;
+					done = 1;
+				}
+			}
+		sdmUnlock(m);
+		if( err ) SDLOG_ERR("%s card %d write error %d, card out of service",__FUNCTION__,c,err);
+	}
+	if( done && (r&255)==255 ) SDLOG_INFO("%s card %d %u regions left",__FUNCTION__,c,m->st.card[c].dirtyRegions);
+	return 1;
+}
+
+// Check whether a failed card answers again, and start its resync if it does
+static void SDMirrorProbe(SDMirror* m, int c) {
+	SDMirrorCard* k = &m->card[c];
+	F_PHY phy;
+	long st = 0;
+	char ok = 0, changed = 0;
+	k->lastProbe = sdmTicks();
+	sdmTake(k->io,portMAX_DELAY);
+		if( ! k->lower ) {
+			k->lower = SDMirrorLowerInit(c);
+			changed = 1;
+		}
+		if( k->lower ) {
+			if( k->lower->getstatus ) st = k->lower->getstatus(k->lower);
+			if( st & F_ST_CHANGED ) changed = 1;
+			ok = !(st & F_ST_MISSING) && 0==k->lower->getphy(k->lower,&phy) && phy.number_of_sectors>=m->nsectors &&
+				  0==SDMirrorLowerRead(k,k->buf,0,1);
+			if( ! ok && !(st & F_ST_MISSING) ) {
+				// start the driver again for the next probe
+				if( k->lower->release ) k->lower->release(k->lower);
+				k->lower = SDMirrorLowerInit(c);
+			}
+		}
+	sdmGive(k->io);
+	if( ! ok ) return;
+	sdmLock(m);
+		if( changed ) SDMirrorMarkAllDirty(m,c);
+		// from the start of the region: writes may have been missed in its copied part
+		k->resyncRegion = 0;
+		k->resyncSector = 0;
+		k->state = SDMIRROR_CARD_RESYNC;
+	sdmUnlock(m);
+	SDLOG_INFO("%s card %d back, %u regions to copy",__FUNCTION__,c,m->st.card[c].dirtyRegions);
+}
+
+portTickType SDMirrorPump(int c) {
+	SDMirror* m = &sdMirror;
+	SDMirrorCard* k = &m->card[c];
+	if( m->inUse ) {
+		if( k->tail!=m->head ) {
+			SDMirrorApply(m,c);
+			return 0;
+		}
+		if( k->state==SDMIRROR_CARD_FAILED && sdmTicks()-k->lastProbe>=pdMS_TO_TICKS(SDMIRROR_RETRY_MS) )
+			SDMirrorProbe(m,c);
+		if( k->state==SDMIRROR_CARD_RESYNC && SDMirrorResyncStep(m,c) ) return 0;
+	}
+	return m->inUse && k->state!=SDMIRROR_CARD_OK ? pdMS_TO_TICKS(SDMIRROR_RETRY_MS) : portMAX_DELAY;
+}
+
+#ifndef SDMIRROR_HOST
+static const char* sdMirrorTaskName[SDMIRROR_CARDS] = {"SDMirrorTask0","SDMirrorTask1"};
+
+static void SDMirrorTask(void* param) {
+	int c = (int)(unsigned long)param;
+	portTickType wait;
+	for(;;) {
+		if( (wait=SDMirrorPump(c)) ) sdmTake(sdMirror.card[c].work,wait);
+		else taskYIELD();
+	}
+}
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// F_DRIVER functions
+
+static int SDMirrorWriteMultipleSector(F_DRIVER* driver, void* data, unsigned long sector, int cnt) {
+	SDMirror* m = (SDMirror*)driver->user_ptr;
+	SDMirrorWrite* w;
+	unsigned int p;
+	int n, c;
+	while( cnt>0 ) {
+		n = cnt>SDMIRROR_MAX_RUN ? SDMIRROR_MAX_RUN : cnt;
+		sdmLock(m);
+			while( SDMirrorPending(m)>=SDMIRROR_QUEUE ) {
+				++m->st.queueFull;
+				sdmUnlock(m);
+				for(c=0; c<SDMIRROR_CARDS; ++c) sdmGive(m->card[c].work);
+				sdmTake(m->room,pdMS_TO_TICKS(100));
+				sdmLock(m);
+			}
+			if( m->card[0].state==SDMIRROR_CARD_FAILED && m->card[1].state==SDMIRROR_CARD_FAILED ) {
+				sdmUnlock(m);
+				return MMC_ERR_NOTPLUGGED;
+			}
+			w = &m->q[m->head%SDMIRROR_QUEUE];
+			w->sector = sector;
+			w->cnt = n;
+			memcpy(w->data,data,n*SDMIRROR_SECTOR_SIZE);
+			++m->head;
+			++m->st.writes;
+			m->st.sectorsWritten += n;
+			if( (p=SDMirrorPending(m))>m->st.maxPending ) m->st.maxPending = p;
+		sdmUnlock(m);
+		for(c=0; c<SDMIRROR_CARDS; ++c) sdmGive(m->card[c].work);
+		data = (unsigned char*)data+n*SDMIRROR_SECTOR_SIZE;
+		sector += n;
+		cnt -= n;
+	}
+	return 0;
+}
+
+static int SDMirrorWriteSector(F_DRIVER* driver, void* data, unsigned long sector) {
+	return SDMirrorWriteMultipleSector(driver,data,sector,1);
+}
+
+static int SDMirrorReadMultipleSector(F_DRIVER* driver, void* data, unsigned long sector, int cnt) {
+	SDMirror* m = (SDMirror*)driver->user_ptr;
+	int c, first, err = MMC_ERR_NOTPLUGGED, tries;
+	char ok[SDMIRROR_CARDS];
+	sdmLock(m); ++m->st.reads; sdmUnlock(m);
+	for(tries=0; tries<SDMIRROR_CARDS; ++tries) {
+		sdmLock(m);
+			for(c=0; c<SDMIRROR_CARDS; ++c) ok[c] = SDMirrorReadable(m,c,sector,cnt);
+			// prefer the card with less queued writes to apply
+			first = ok[1] && (!ok[0] || m->head-m->card[1].tail<m->head-m->card[0].tail) ? 1 : 0;
+		sdmUnlock(m);
+		if( ! ok[first] ) return err;
+		// take the idle one if the preferred is busy
+		c = first;
+		if( pdTRUE!=sdmTake(m->card[c].io,0) ) {
+			if( ok[!c] && pdTRUE==sdmTake(m->card[!c].io,0) ) c = !c;
+			else sdmTake(m->card[c].io,portMAX_DELAY);
+		}
+		err = SDMirrorReadCardIO(m,c,data,sector,cnt);
+		sdmGive(m->card[c].io);
+		if( ! err ) {
+			sdmLock(m); m->st.sectorsRead += cnt; sdmUnlock(m);
+			return 0;
+		}
+		sdmLock(m); SDMirrorFail(m,c); sdmUnlock(m);
+		SDLOG_ERR("%s card %d read error %d at sector %u, card out of service",__FUNCTION__,c,err,(unsigned int)sector);
+	}
+	return err;
+}
+
+static int SDMirrorReadSector(F_DRIVER* driver, void* data, unsigned long sector) {
+	return SDMirrorReadMultipleSector(driver,data,sector,1);
+}
+
+static int SDMirrorGetPhy(F_DRIVER* driver, F_PHY* phy) {
+	SDMirror* m = (SDMirror*)driver->user_ptr;
+	memset(phy,0,sizeof(*phy));
+	phy->number_of_sectors = m->nsectors;
+	phy->bytes_per_sector = SDMIRROR_SECTOR_SIZE;
+	phy->media_descriptor = F_MEDIADESC_REMOVABLE;
+	return 0;
+}
+
+static long SDMirrorGetStatus(F_DRIVER* driver) {
+	SDMirror* m = (SDMirror*)driver->user_ptr;
+	SDMirrorCard* k;
+	long st;
+	int c, n = 0;
+	for(c=0; c<SDMIRROR_CARDS; ++c) {
+		k = &m->card[c];
+		if( k->state!=SDMIRROR_CARD_FAILED && k->lower && k->lower->getstatus && pdTRUE==sdmTake(k->io,0) ) {
+			st = k->lower->getstatus(k->lower);
+			sdmGive(k->io);
+			if( st & (F_ST_MISSING|F_ST_CHANGED) ) {
+				sdmLock(m);
+					SDMirrorFail(m,c);
+					if( st & F_ST_CHANGED ) SDMirrorMarkAllDirty(m,c);
+				sdmUnlock(m);
+				SDLOG_ERR("%s card %d %s, card out of service",__FUNCTION__,c,(st & F_ST_MISSING) ? "missing" : "changed");
+			}
+		}
+		if( k->state==SDMIRROR_CARD_FAILED ) ++n;
+	}
+	// a card change below is handled here, hcc only has to know when there is no card at all
+	return n==SDMIRROR_CARDS ? F_ST_MISSING : 0;
+}
+
+static void SDMirrorRelease(F_DRIVER* driver) {
+	SDMirror* m = (SDMirror*)driver->user_ptr;
+	int c;
+	if( SDMirrorFlush(pdMS_TO_TICKS(SDMIRROR_FLUSH_MS)) )
+		SDLOG_ERR("%s %u writes not on every card",__FUNCTION__,SDMirrorPending(m));
+	m->inUse = 0;
+	for(c=0; c<SDMIRROR_CARDS; ++c) {
+		sdmTake(m->card[c].io,portMAX_DELAY);
+			if( m->card[c].lower && m->card[c].lower->release ) m->card[c].lower->release(m->card[c].lower);
+			m->card[c].lower = 0;
+		sdmGive(m->card[c].io);
+	}
+}
+
+static int SDMirrorIoctl(F_DRIVER* driver, unsigned long msg, void* iparam, void* oparam) {
+	return 1; // not supported (hcc erases sector by sector then)
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Public functions
+
+// Boot sectors and first FAT sector are the same on both cards (staging buffers of the cards are used)
+static char SDMirrorSameSector(SDMirror* m, unsigned long sector) {
+	if( SDMirrorLowerRead(&m->card[0],m->card[0].buf,sector,1) || SDMirrorLowerRead(&m->card[1],m->card[1].buf,sector,1) ) return 0;
+	return 0==memcmp(m->card[0].buf,m->card[1].buf,SDMIRROR_SECTOR_SIZE);
+}
+
+static char SDMirrorSameFS(SDMirror* m) {
+	unsigned char *a = m->card[0].buf;
+	unsigned long boot = 0;
+	if( ! SDMirrorSameSector(m,0) ) return 0;
+	if( a[510]!=0x55 || a[511]!=0xAA ) return 1; // neither partition table nor boot sector
+	if( a[0]!=0xEB && a[0]!=0xE9 ) { // partition table: boot sector of the first partition
+		boot = a[0x1C6] | a[0x1C7]<<8 | a[0x1C8]<<16 | (unsigned long)a[0x1C9]<<24;
+		if( ! SDMirrorSameSector(m,boot) ) return 0;
+		if( a[510]!=0x55 || a[511]!=0xAA ) return 1;
+	}
+	// first FAT sector is after the reserved sectors
+	return SDMirrorSameSector(m,boot+(a[0x0E] | a[0x0F]<<8));
+}
+
+F_DRIVER* SDMirrorInitFunc(unsigned long driver_param) {
+	static const char* ownStr = __FUNCTION__;
+	SDMirror* m = &sdMirror;
+	SDMirrorCard* k;
+	F_PHY phy;
+	int c, src;
+	if( m->inUse ) {
+		SDLOG_ERR("%s mirror already mounted",ownStr);
+		return 0;
+	}
+#ifndef SDMIRROR_HOST
+	if( ! m->lock ) {
+		if( !(m->lock=xSemaphoreCreateMutex()) ) return 0;
+		vSemaphoreCreateBinary(m->room);
+		if( ! m->room ) return 0;
+	}
+	for(c=0; c<SDMIRROR_CARDS; ++c) {
+		k = &m->card[c];
+		if( ! k->io ) {
+			k->io = xSemaphoreCreateMutex();
+			vSemaphoreCreateBinary(k->work);
+			if( ! k->io || ! k->work ) return 0;
+		}
+	}
+#endif
+	m->nsectors = 0;
+	for(c=0; c<SDMIRROR_CARDS; ++c) {
+		k = &m->card[c];
+		k->lower = SDMirrorLowerInit(c);
+		if( k->lower && k->lower->getphy(k->lower,&phy) ) {
+			if( k->lower->release ) k->lower->release(k->lower);
+			k->lower = 0;
+		}
+		if( ! k->lower ) {
+			SDLOG_ERR("%s card %d not available",ownStr,c);
+			continue;
+		}
+		if( phy.bytes_per_sector!=SDMIRROR_SECTOR_SIZE ) {
+			SDLOG_ERR("%s card %d sector size %u not supported",ownStr,c,(unsigned int)phy.bytes_per_sector);
+			if( k->lower->release ) k->lower->release(k->lower);
+			k->lower = 0;
+			continue;
+		}
+		if( ! m->nsectors || phy.number_of_sectors<m->nsectors ) m->nsectors = phy.number_of_sectors;
+	}
+	if( ! m->card[0].lower && ! m->card[1].lower ) {
+		SDLOG_CRIT("%s no card available",ownStr);
+		return 0;
+	}
+
+	memset(&m->st,0,sizeof(m->st));
+	for(m->regionShift=SDMIRROR_MIN_REGION_SHIFT; (m->nsectors>>m->regionShift)>=SDMIRROR_REGIONS; ++m->regionShift);
+	m->nregions = (m->nsectors+(1<<m->regionShift)-1)>>m->regionShift;
+	m->st.regionSectors = 1<<m->regionShift;
+	m->head = 0;
+	for(c=0; c<SDMIRROR_CARDS; ++c) {
+		k = &m->card[c];
+		k->tail = 0;
+		k->state = SDMIRROR_CARD_OK;
+		k->resyncRegion = 0;
+		k->resyncSector = 0;
+		memset(k->dirty,0,sizeof(k->dirty));
+		if( ! k->lower ) { // missed everything
+			SDMirrorFail(m,c);
+			SDMirrorMarkAllDirty(m,c);
+		}
+	}
+	if( m->card[0].lower && m->card[1].lower && ! SDMirrorSameFS(m) ) {
+		// copy the card with the partition table (card 0 if both or none have one)
+		src = m->card[0].buf[510]!=0x55 && m->card[1].buf[510]==0x55 ? 1 : 0;
+		SDMirrorMarkAllDirty(m,!src);
+		m->card[!src].state = SDMIRROR_CARD_RESYNC;
+		SDLOG_ERR("%s cards differ, copying card %d to card %d",ownStr,src,!src);
+	}
+
+	memset(&m->drv,0,sizeof(m->drv));
+	m->drv.separated = (m->card[0].lower ? m->card[0].lower : m->card[1].lower)->separated;
+	m->drv.user_ptr = m;
+	m->drv.readsector = SDMirrorReadSector;
+	m->drv.writesector = SDMirrorWriteSector;
+	m->drv.readmultiplesector = SDMirrorReadMultipleSector;
+	m->drv.writemultiplesector = SDMirrorWriteMultipleSector;
+	m->drv.getphy = SDMirrorGetPhy;
+	m->drv.getstatus = SDMirrorGetStatus;
+	m->drv.release = SDMirrorRelease;
+	m->drv.ioctl = SDMirrorIoctl;
+	m->inUse = 1;
+
+#ifndef SDMIRROR_HOST
+	for(c=0; c<SDMIRROR_CARDS; ++c) {
+		if( ! m->card[c].task &&
+			 pdPASS!=xTaskCreate(SDMirrorTask,(const signed char*)sdMirrorTaskName[c],SDMIRROR_STACK_SIZE,(void*)(unsigned long)c,SDMIRROR_PRIORITY,&m->card[c].task) ) {
+			SDLOG_CRIT("%s error creating task",ownStr);
+			SDMirrorRelease(&m->drv);
+			return 0;
+		}
+		sdmGive(m->card[c].work);
+	}
+#endif
+	SDLOG_INFO("%s sectors=%u regionSectors=%u card0=%s card1=%s",ownStr,(unsigned int)m->nsectors,m->st.regionSectors,
+				  m->card[0].lower ? "ok" : "missing",m->card[1].lower ? "ok" : "missing");
+	return &m->drv;
+}
+
+int SDMirrorFlush(portTickType waitTicks) {
+	SDMirror* m = &sdMirror;
+	portTickType start = sdmTicks();
+	unsigned int p;
+	int c;
+	if( ! m->inUse ) return 0;
+	for(;;) {
+		sdmLock(m); p = SDMirrorPending(m); sdmUnlock(m);
+		if( ! p ) return 0;
+		for(c=0; c<SDMIRROR_CARDS; ++c) sdmGive(m->card[c].work);
+		if( sdmTicks()-start>=waitTicks ) return -1;
+		sdmTake(m->room,pdMS_TO_TICKS(10));
+	}
+}
+
+int SDMirrorResync(int card) {
+	SDMirror* m = &sdMirror;
+	if( ! m->inUse || card<0 || card>=SDMIRROR_CARDS ) return -1;
+	sdmLock(m);
+		SDMirrorMarkAllDirty(m,card);
+		if( m->card[card].state==SDMIRROR_CARD_OK ) m->card[card].state = SDMIRROR_CARD_RESYNC;
+	sdmUnlock(m);
+	sdmGive(m->card[card].work);
+	return 0;
+}
+
+int SDMirrorGetStats(SDMirrorStats* st, char reset) {
+	SDMirror* m = &sdMirror;
+	int c;
+	if( ! m->inUse ) return -1;
+	sdmLock(m);
+		for(c=0; c<SDMIRROR_CARDS; ++c) {
+			m->st.card[c].state = m->card[c].state;
+			m->st.card[c].pending = m->head-m->card[c].tail;
+		}
+		memcpy(st,&m->st,sizeof(SDMirrorStats));
+		if( reset ) {
+			unsigned int regionSectors = m->st.regionSectors, dirty[SDMIRROR_CARDS];
+			for(c=0; c<SDMIRROR_CARDS; ++c) dirty[c] = m->st.card[c].dirtyRegions;
+			memset(&m->st,0,sizeof(SDMirrorStats));
+			m->st.regionSectors = regionSectors;
+			for(c=0; c<SDMIRROR_CARDS; ++c) m->st.card[c].dirtyRegions = dirty[c];
+		}
+	sdmUnlock(m);
+	return 0;
+}
+
+void SDMirrorShowStatus() {
+	static const char* stateStr[] = {"ok","failed","resync"};
+	SDMirrorStats st;
+	SDMirrorCardStats* k;
+	int c;
+	if( SDMirrorGetStats(&st,0) ) return;
+	SDLOG_INFO("%s writes=%u sectorsWritten=%u reads=%u sectorsRead=%u queueOverlays=%u queueFull=%u maxPending=%u lostWrites=%u",
+				  __FUNCTION__,st.writes,st.sectorsWritten,st.reads,st.sectorsRead,st.queueOverlays,st.queueFull,st.maxPending,st.lostWrites);
+	for(c=0; c<SDMIRROR_CARDS; ++c) {
+		k = &st.card[c];
+		SDLOG_INFO("%s card=%d state=%s pending=%u writeCmds=%u sectorsWritten=%u writeKBs=%u readCmds=%u sectorsRead=%u readKBs=%u errors=%u failures=%u dirtyRegions=%u",
+					  __FUNCTION__,c,stateStr[k->state],k->pending,k->writeCmds,k->sectorsWritten,k->writeMs ? (unsigned int)(k->sectorsWritten*500ULL/k->writeMs) : 0,
+					  k->readCmds,k->sectorsRead,k->readMs ? (unsigned int)(k->sectorsRead*500ULL/k->readMs) : 0,k->errors,k->failures,k->dirtyRegions);
+	}
+}
@@ -0,0 +1,210 @@
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <at91/boards/ISIS_OBC_G20/board.h>
+#include <at91/peripherals/aic/aic.h>
+#include <at91/peripherals/pio/pio.h>
+#include <at91/peripherals/mci/mci.h>
+#include <at91/memories/sdmmc/sdmmc_mci.h>
+#include <hcc/api_mdriver_atmel_mcipdc.h> // MMC_ERR_ codes, as the SD card driver it replaces
+#include "SDMmc.h"
+#include "LogManager.h"
+
+#define SDMMC_MS(ticks) ((ticks)*portTICK_RATE_MS)
+
+typedef struct {
+	F_DRIVER drv; // handed to hcc, drv.user_ptr points back here
+	SdCard sd;
+	char inUse, ready; // ready: initialized, in transfer state
+	SDMmcStats st;
+} SDMmcCard;
+
+static Mci sdmmcMci;
+static xSemaphoreHandle sdmmcBus = 0; // the MCI and PIN_SDSEL, shared by both cards
+static SDMmcCard sdmmcCard[SDMMC_CARDS];
+static unsigned int sdmmcBounce[SD_BLOCK_SIZE/4]; // for buffers that are not word aligned
+static const Pin sdmmcPins[] = {PINS_MCI1};
+static const Pin sdmmcSel = PIN_SDSEL;
+static const Pin sdmmcPower[SDMMC_CARDS] = {PIN_NPWR_SD0, PIN_NPWR_SD1};
+
+
+static void SDMmcISR(void) {
+	MCI_Handler(&sdmmcMci);
+}
+
+// Connect card c to the MCI (high selects card 0, read from the atmel_mcipdc object code:
+// check it on the board)
+static void SDMmcSelect(int c) {
+	if( c==0 ) PIO_Set(&sdmmcSel);
+	else PIO_Clear(&sdmmcSel);
+}
+
+// Initialize card c, holding the bus. Identification runs at 400kHz, transfers at SDMMC_SPEED_HZ.
+static int SDMmcStart(SDMmcCard* k, int c) {
+	unsigned char err;
+	SDMmcSelect(c);
+	MCI_SetSpeed(&sdmmcMci,400000);
+	err = SD_Init(&k->sd,(SdDriver*)&sdmmcMci);
+	MCI_SetSpeed(&sdmmcMci,SDMMC_SPEED_HZ);
+	++k->st.starts;
+	k->ready = !err;
+	k->st.sectors = err ? 0 : k->sd.blockNr;
+	if( err ) {
+		++k->st.errors;
+		UPLOG_ERR("%s card %d error %u",__FUNCTION__,c,err);
+	}
+	return err;
+}
+
+static int SDMmcTransfer(F_DRIVER* driver, void* data, unsigned long sector, int cnt, char write) {
+	SDMmcCard* k = (SDMmcCard*)driver->user_ptr;
+	int c = k-sdmmcCard, i;
+	unsigned char err = 0, *p = (unsigned char*)data;
+	portTickType t;
+	if( cnt<=0 ) return 0;
+	xSemaphoreTake(sdmmcBus,portMAX_DELAY);
+		if( ! k->ready ) err = SDMmcStart(k,c);
+		else SDMmcSelect(c);
+		if( ! err && sector+cnt>k->sd.blockNr ) err = SD_ERROR_DRIVER;
+		t = xTaskGetTickCount();
+		if( ! err && ((unsigned long)p & 3)==0 ) {
+			err = write ? SD_WriteMultipleBlocks(&k->sd,sector,cnt,p) : SD_ReadMultipleBlocks(&k->sd,sector,cnt,p);
+		} else for(i=0; i<cnt && ! err; ++i, p+=SD_BLOCK_SIZE) {
+			if( write ) {
+				memcpy(sdmmcBounce,p,SD_BLOCK_SIZE);
+				err = SD_WriteMultipleBlocks(&k->sd,sector+i,1,(unsigned char*)sdmmcBounce);
+			} else if( !(err=SD_ReadMultipleBlocks(&k->sd,sector+i,1,(unsigned char*)sdmmcBounce)) ) {
+				memcpy(p,sdmmcBounce,SD_BLOCK_SIZE);
+			}
+		}
+		t = xTaskGetTickCount()-t;
+		if( err ) {
+			// start the card again on the next access
+			k->ready = 0;
+			++k->st.errors;
+		} else if( write ) {
+			++k->st.writeCmds; k->st.sectorsWritten += cnt; k->st.writeMs += SDMMC_MS(t);
+		} else {
+			++k->st.readCmds; k->st.sectorsRead += cnt; k->st.readMs += SDMMC_MS(t);
+		}
+	xSemaphoreGive(sdmmcBus);
+	if( err ) UPLOG_ERR("%s card %d %s error %u at sector %u",__FUNCTION__,c,write ? "write" : "read",err,(unsigned int)sector);
+	return err ? MMC_ERR_TRANS : 0;
+}
+
+static int SDMmcReadSector(F_DRIVER* driver, void* data, unsigned long sector) {
+	return SDMmcTransfer(driver,data,sector,1,0);
+}
+
+static int SDMmcWriteSector(F_DRIVER* driver, void* data, unsigned long sector) {
+	return SDMmcTransfer(driver,data,sector,1,1);
+}
+
+static int SDMmcReadMultipleSector(F_DRIVER* driver, void* data, unsigned long sector, int cnt) {
+	return SDMmcTransfer(driver,data,sector,cnt,0);
+}
+
+static int SDMmcWriteMultipleSector(F_DRIVER* driver, void* data, unsigned long sector, int cnt) {
+	return SDMmcTransfer(driver,data,sector,cnt,1);
+}
+
+static int SDMmcGetPhy(F_DRIVER* driver, F_PHY* phy) {
+	SDMmcCard* k = (SDMmcCard*)driver->user_ptr;
+	if( ! k->ready ) return MMC_ERR_NOTINITIALIZED;
+	memset(phy,0,sizeof(*phy));
+	phy->number_of_sectors = k->sd.blockNr;
+	phy->bytes_per_sector = SD_BLOCK_SIZE;
+	phy->media_descriptor = F_MEDIADESC_REMOVABLE;
+	phy->number_of_heads = 255;
+	phy->sector_per_track = 63;
+	phy->number_of_cylinders = k->sd.blockNr/(255*63);
+	return 0;
+}
+
+// The OBC has no card detect: a card that does not start is missing
+static long SDMmcGetStatus(F_DRIVER* driver) {
+	SDMmcCard* k = (SDMmcCard*)driver->user_ptr;
+	int err = 0;
+	if( k->ready ) return 0;
+	xSemaphoreTake(sdmmcBus,portMAX_DELAY);
+		if( ! k->ready ) err = SDMmcStart(k,k-sdmmcCard);
+	xSemaphoreGive(sdmmcBus);
+	return err ? F_ST_MISSING : 0;
+}
+
+static void SDMmcRelease(F_DRIVER* driver) {
+	SDMmcCard* k = (SDMmcCard*)driver->user_ptr;
+	xSemaphoreTake(sdmmcBus,portMAX_DELAY);
+		PIO_Set(&sdmmcPower[k-sdmmcCard]);
+		k->ready = 0;
+		k->inUse = 0;
+	xSemaphoreGive(sdmmcBus);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Public functions
+
+F_DRIVER* SDMmcInitFunc(unsigned long driver_param) {
+	SDMmcCard* k;
+	int c = (int)driver_param;
+	if( driver_param==F_AUTO_ASSIGN )
+		for(c=0; c<SDMMC_CARDS && sdmmcCard[c].inUse; ++c) ;
+	if( c<0 || c>=SDMMC_CARDS || sdmmcCard[c].inUse ) return 0;
+	k = &sdmmcCard[c];
+	if( ! sdmmcBus ) {
+		if( !(sdmmcBus=xSemaphoreCreateMutex()) ) return 0;
+		// both cards off until started
+		PIO_Configure(sdmmcPower,PIO_LISTSIZE(sdmmcPower));
+		PIO_Configure(&sdmmcSel,1);
+		PIO_Configure(sdmmcPins,PIO_LISTSIZE(sdmmcPins));
+		MCI_Init(&sdmmcMci,BOARD_SD_MCI_BASE,BOARD_SD_MCI_ID,BOARD_SD_SLOT);
+		AIC_ConfigureIT(BOARD_SD_MCI_ID,AT91C_AIC_PRIOR_LOWEST,SDMmcISR);
+		AIC_EnableIT(BOARD_SD_MCI_ID);
+	}
+	xSemaphoreTake(sdmmcBus,portMAX_DELAY);
+		memset(k,0,sizeof(*k));
+		PIO_Clear(&sdmmcPower[c]);
+		vTaskDelay(pdMS_TO_TICKS(SDMMC_POWER_MS));
+		if( SDMmcStart(k,c) ) PIO_Set(&sdmmcPower[c]);
+	xSemaphoreGive(sdmmcBus);
+	if( ! k->ready ) return 0;
+	k->drv.user_ptr = k;
+	k->drv.readsector = SDMmcReadSector;
+	k->drv.writesector = SDMmcWriteSector;
+	k->drv.readmultiplesector = SDMmcReadMultipleSector;
+	k->drv.writemultiplesector = SDMmcWriteMultipleSector;
+	k->drv.getphy = SDMmcGetPhy;
+	k->drv.getstatus = SDMmcGetStatus;
+	k->drv.release = SDMmcRelease;
+	k->inUse = 1;
+	UPLOG_INFO("%s card %d: %u sectors, type %u",__FUNCTION__,c,k->st.sectors,k->sd.cardType);
+	return &k->drv;
+}
+
+int SDMmcGetStats(int card, SDMmcStats* st, char reset) {
+	SDMmcCard* k;
+	if( card<0 || card>=SDMMC_CARDS ) return -1;
+	k = &sdmmcCard[card];
+	taskENTER_CRITICAL();
+		*st = k->st;
+		if( reset ) {
+			memset(&k->st,0,sizeof(k->st));
+			k->st.sectors = st->sectors;
+		}
+	taskEXIT_CRITICAL();
+	return 0;
+}
+
+void SDMmcShowStatus() {
+	SDMmcStats st;
+	int c;
+	for(c=0; c<SDMMC_CARDS; ++c) {
+		SDMmcGetStats(c,&st,0);
+		// sectors*512/1024 KB in ms/1000 secs
+		UPLOG_INFO("%s card=%d sectors=%u starts=%u errors=%u readCmds=%u sectorsRead=%u readKBs=%u writeCmds=%u sectorsWritten=%u writeKBs=%u",
+					  __FUNCTION__,c,st.sectors,st.starts,st.errors,st.readCmds,st.sectorsRead,st.readMs ? (unsigned int)(st.sectorsRead*500ULL/st.readMs) : 0,
+					  st.writeCmds,st.sectorsWritten,st.writeMs ? (unsigned int)(st.sectorsWritten*500ULL/st.writeMs) : 0);
+	}
+}
@@ -0,0 +1,229 @@
+#include <string.h>
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <at91/boards/ISIS_OBC_G20/board.h>
+#include "SliceMonitor.h"
+#include "RunTimeStats.h"
+#include "LogManager.h"
+
+#define SLICE_HIST_SHIFT 7 // bucket 0: below 1<<SLICE_HIST_SHIFT counts
+#define SLICE_US(counts) ((unsigned int)((unsigned long long)(counts)*1000000/RTS_COUNTER_HZ))
+#define SLICE_COUNTS(us) ((unsigned int)((unsigned long long)(us)*RTS_COUNTER_HZ/1000000))
+
+typedef struct {
+	void* tcb; // 0: free slot
+	unsigned long tcbNumber;
+	SliceMonitorTask rep; // maxUs in counts here
+	char site[SLICE_SITE_LEN]; // last mark
+	unsigned int markSeq, markTime; // slice and time of the last mark
+	unsigned int segSeq, segMax; // longest part of the slice segSeq ...
+	char segSite[SLICE_SITE_LEN]; // ... and its site
+} SliceTask;
+
+typedef struct {
+	char name[SLICE_NAME_LEN], site[SLICE_SITE_LEN];
+	unsigned int len, seg; // counts
+} SliceEvent;
+
+// Written by the kernel at every task switch and by SliceMonitorMark, both with interrupts
+// disabled; read with interrupts disabled too.
+static SliceTask sliceTask[SLICE_MAX_TASKS];
+static SliceEvent sliceEv[SLICE_EVENTS];
+static unsigned int sliceEvHead = 0, sliceEvTail = 0, sliceEvLost = 0;
+static volatile unsigned char sliceOn = 0;
+static unsigned int sliceSeq = 0, sliceStart = 0; // number and start of the running slice
+static unsigned int sliceBudget = 0, sliceYield = 0, sliceUntracked = 0; // budgets in counts
+
+
+static unsigned int SliceBucket(unsigned int len) {
+	int b = 31-__builtin_clz(len|1)-(SLICE_HIST_SHIFT-1);
+	return b<0 ? 0 : b>=SLICE_BUCKETS ? SLICE_BUCKETS-1 : b;
+}
+
+// Slot of the task switched out. slot caches its index+1 in the TCB (uxTaskNumber).
+static SliceTask* SliceFind(void* tcb, unsigned long tcbNumber, unsigned long* slot, const char* name) {
+	unsigned int i;
+	SliceTask* fr = 0;
+	if( *slot>0 && *slot<=SLICE_MAX_TASKS && sliceTask[*slot-1].tcb==tcb && sliceTask[*slot-1].tcbNumber==tcbNumber )
+		return &sliceTask[*slot-1];
+	for(i=0; i<SLICE_MAX_TASKS; ++i) {
+		if( sliceTask[i].tcb==tcb && sliceTask[i].tcbNumber==tcbNumber ) { *slot = i+1; return &sliceTask[i]; }
+		if( ! sliceTask[i].tcb && ! fr ) fr = &sliceTask[i];
+	}
+	if( ! fr ) return 0;
+	memset(fr,0,sizeof(*fr));
+	fr->tcb = tcb;
+	fr->tcbNumber = tcbNumber;
+	strncpy(fr->rep.name,name,SLICE_NAME_LEN-1);
+	fr->markSeq = fr->segSeq = sliceSeq-1;
+	*slot = fr-sliceTask+1;
+	return fr;
+}
+
+// Close the part of the running slice since the last mark (or since the slice started)
+static void SliceSegment(SliceTask* t, unsigned int now) {
+	unsigned int seg = now-(t->markSeq==sliceSeq ? t->markTime : sliceStart);
+	if( t->segSeq!=sliceSeq ) {
+		t->segSeq = sliceSeq;
+		t->segMax = 0;
+	}
+	if( seg>=t->segMax ) {
+		t->segMax = seg;
+		memcpy(t->segSite,t->site,SLICE_SITE_LEN);
+	}
+}
+
+void vSliceSwitchedOut(void* tcb, unsigned long tcbNumber, unsigned long* slot, const char* name) {
+	unsigned int now, len;
+	SliceTask* t;
+	SliceEvent* ev;
+	if( ! sliceOn ) return;
+	now = ulGetRunTimeCounterValue();
+	len = now-sliceStart;
+	if( (t=SliceFind(tcb,tcbNumber,slot,name)) ) {
+		SliceSegment(t,now);
+		++t->rep.slices;
+		++t->rep.hist[SliceBucket(len)];
+		if( len>t->rep.maxUs ) {
+			t->rep.maxUs = len;
+			memcpy(t->rep.maxSite,t->segSite,SLICE_SITE_LEN);
+		}
+		if( len>sliceBudget ) {
+			++t->rep.over;
+			if( sliceEvHead-sliceEvTail<SLICE_EVENTS ) {
+				ev = &sliceEv[sliceEvHead++ % SLICE_EVENTS];
+				memcpy(ev->name,t->rep.name,SLICE_NAME_LEN);
+				memcpy(ev->site,t->segSite,SLICE_SITE_LEN);
+				ev->len = len;
+				ev->seg = t->segMax;
+			} else {
+				++sliceEvLost;
+			}
+		}
+	} else {
+		++sliceUntracked;
+	}
+	// the next slice starts now
+	++sliceSeq;
+	sliceStart = now;
+}
+
+// Slot of the calling task, 0 before its first switch out
+static SliceTask* SliceCurrent() {
+	xTaskHandle h = xTaskGetCurrentTaskHandle();
+	unsigned long slot = uxTaskGetTaskNumber(h);
+	if( slot==0 || slot>SLICE_MAX_TASKS || sliceTask[slot-1].tcb!=h ) return 0;
+	return &sliceTask[slot-1];
+}
+
+void SliceMonitorMark(const char* site) {
+	SliceTask* t;
+	unsigned int now;
+	if( ! sliceOn ) return;
+	// a task switch from an interrupt (portYIELD_FROM_ISR) would split the update
+	portENTER_CRITICAL();
+		if( (t=SliceCurrent()) ) {
+			now = ulGetRunTimeCounterValue();
+			SliceSegment(t,now);
+			t->markSeq = sliceSeq;
+			t->markTime = now;
+			strncpy(t->site,site,SLICE_SITE_LEN-1);
+		}
+	portEXIT_CRITICAL();
+}
+
+int SliceMonitorYieldDue() {
+	SliceTask* t;
+	int due = 0;
+	if( ! sliceOn ) return 0;
+	portENTER_CRITICAL();
+		if( ulGetRunTimeCounterValue()-sliceStart>sliceYield ) {
+			due = 1;
+			if( (t=SliceCurrent()) ) ++t->rep.yields;
+		}
+	portEXIT_CRITICAL();
+	return due;
+}
+
+void SliceMonitorSetBudget(unsigned int budgetUs, unsigned int yieldUs) {
+	sliceBudget = SLICE_COUNTS(budgetUs);
+	sliceYield = SLICE_COUNTS(yieldUs);
+}
+
+int SliceMonitorInit() {
+#if ( configUSE_SLICE_MONITOR != 1 )
+	return -1; // the kernel has no switch hook: nothing would be timed
+#endif
+	SliceMonitorSetBudget(SLICE_BUDGET_US,SLICE_YIELD_US);
+	portENTER_CRITICAL();
+		memset(sliceTask,0,sizeof(sliceTask));
+		sliceEvHead = sliceEvTail = sliceEvLost = sliceUntracked = 0;
+		sliceStart = ulGetRunTimeCounterValue();
+		sliceOn = 1;
+	portEXIT_CRITICAL();
+	return 0;
+}
+
+void SliceMonitorReset() {
+	portENTER_CRITICAL();
+		// the slots are taken again at the next switch of each task
+		memset(sliceTask,0,sizeof(sliceTask));
+		sliceEvTail = sliceEvHead;
+		sliceEvLost = sliceUntracked = 0;
+	portEXIT_CRITICAL();
+}
+
+int SliceMonitorCheck(unsigned int when, void* privData) {
+	static const char* ownStr = __FUNCTION__;
+	SliceEvent ev;
+	unsigned int lost;
+	for(;;) {
+		portENTER_CRITICAL();
+			if( sliceEvTail==sliceEvHead ) {
+				portEXIT_CRITICAL();
+				break;
+			}
+			ev = sliceEv[sliceEvTail++ % SLICE_EVENTS];
+		portEXIT_CRITICAL();
+		UPLOG_WARNING("%s task '%s' ran %uus (budget %uus), longest part %uus in '%s'",ownStr,ev.name,
+						  SLICE_US(ev.len),SLICE_US(sliceBudget),SLICE_US(ev.seg),ev.site[0] ? ev.site : "(no mark)");
+	}
+	portENTER_CRITICAL();
+		lost = sliceEvLost;
+		sliceEvLost = 0;
+	portEXIT_CRITICAL();
+	if( lost ) UPLOG_WARNING("%s %u more slices over budget",ownStr,lost);
+	return 0;
+}
+
+int SliceMonitorGet(SliceMonitorReport* rep) {
+	unsigned int i;
+	memset(rep,0,sizeof(*rep));
+	rep->budgetUs = SLICE_US(sliceBudget);
+	rep->yieldUs = SLICE_US(sliceYield);
+	for(i=0; i<SLICE_BUCKETS-1; ++i) rep->bucketUs[i] = SLICE_US(1u<<(SLICE_HIST_SHIFT+i));
+	portENTER_CRITICAL();
+		rep->untracked = sliceUntracked;
+		rep->eventsLost = sliceEvLost;
+		for(i=0; i<SLICE_MAX_TASKS; ++i)
+			if( sliceTask[i].tcb ) rep->task[rep->tasks++] = sliceTask[i].rep;
+	portEXIT_CRITICAL();
+	for(i=0; i<rep->tasks; ++i) rep->task[i].maxUs = SLICE_US(rep->task[i].maxUs);
+	return rep->tasks;
+}
+
+void SliceMonitorShowStatus() {
+	static SliceMonitorReport rep;
+	char hist[SLICE_BUCKETS*11+1];
+	unsigned int i, j, n;
+	SliceMonitorGet(&rep);
+	for(j=0, n=0; j<SLICE_BUCKETS-1; ++j) n += snprintf(hist+n,sizeof(hist)-n,"%s%u",j ? "," : "",rep.bucketUs[j]);
+	UPLOG_INFO("%s budget=%uus yield=%uus untracked=%u tasks=%u histogram buckets(us)=<%s,more",__FUNCTION__,
+				  rep.budgetUs,rep.yieldUs,rep.untracked,rep.tasks,hist);
+	for(i=0; i<rep.tasks; ++i) {
+		for(j=0, n=0; j<SLICE_BUCKETS; ++j) n += snprintf(hist+n,sizeof(hist)-n,"%s%u",j ? "," : "",rep.task[i].hist[j]);
+		UPLOG_INFO("%s task '%s' slices=%u over=%u yields=%u max=%uus in '%s' histogram=%s",__FUNCTION__,rep.task[i].name,
+					  rep.task[i].slices,rep.task[i].over,rep.task[i].yields,rep.task[i].maxUs,rep.task[i].maxSite,hist);
+	}
+}
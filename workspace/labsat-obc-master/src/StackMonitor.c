@@ -0,0 +1,143 @@
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "StackMonitor.h"
+#include "FRAMJournal.h"
+#include "LogManager.h"
+
+// FRAM journal value of a slot
+typedef struct {
+	char name[SM_NAME_LEN];
+	unsigned short depth, maxUsed; // words
+} SMRecord;
+
+typedef struct {
+	char used, running, low; // low: the error was logged
+	unsigned short minFree;
+	SMRecord rec;
+} SMTask;
+
+static SMTask smTask[SM_MAX_TASKS]; // index i is journal key FJ_KEY_STACK_MONITOR+i
+static xTaskStatusType smStatus[SM_MAX_TASKS];
+static unsigned int smSamples = 0, smFjErrors = 0, smTooMany = 0;
+static xSemaphoreHandle smLock = 0;
+
+
+static SMTask* SMFind(const char* name) {
+	unsigned int i;
+	SMTask* fr = 0;
+	for(i=0; i<SM_MAX_TASKS; ++i) {
+		if( smTask[i].used && 0==strncmp(smTask[i].rec.name,name,SM_NAME_LEN-1) ) return &smTask[i];
+		if( ! smTask[i].used && ! fr ) fr = &smTask[i];
+	}
+	if( fr ) {
+		memset(fr,0,sizeof(*fr));
+		fr->used = 1;
+		strncpy(fr->rec.name,name,SM_NAME_LEN-1);
+	}
+	return fr;
+}
+
+static unsigned short SMRecommended(unsigned int maxUsed) {
+	unsigned int words = maxUsed+maxUsed*SM_MARGIN_PCT/100+SM_MARGIN_WORDS;
+	words = (words+SM_ROUND_WORDS-1)/SM_ROUND_WORDS*SM_ROUND_WORDS;
+	if( words<configMINIMAL_STACK_SIZE ) words = configMINIMAL_STACK_SIZE;
+	return words>0xFFFF ? 0xFFFF : words; // the stack depth of xTaskCreate is an unsigned short
+}
+
+int StackMonitorSample(unsigned int when, void* privData) {
+	static const char* ownStr = __FUNCTION__;
+	unsigned long total;
+	unsigned int i, n, used;
+	SMTask* t;
+	if( ! smLock ) return 0;
+	xSemaphoreTake(smLock,portMAX_DELAY);
+		n = uxTaskGetSystemState(smStatus,SM_MAX_TASKS,&total);
+		if( n==0 ) {
+			xSemaphoreGive(smLock);
+			if( smTooMany++==0 ) UPLOG_ERR("%s %u tasks, more than %u",ownStr,(unsigned int)uxTaskGetNumberOfTasks(),SM_MAX_TASKS);
+			return 0;
+		}
+		for(i=0; i<SM_MAX_TASKS; ++i) smTask[i].running = 0;
+		for(i=0; i<n; ++i) {
+			if( !(t=SMFind((const char*)smStatus[i].pcTaskName)) ) continue; // slots full (StackMonitorReset)
+			t->running = 1;
+			t->minFree = smStatus[i].usStackHighWaterMark;
+			used = smStatus[i].usStackDepth>t->minFree ? smStatus[i].usStackDepth-t->minFree : 0;
+			if( t->minFree<SM_LOW_WORDS && ! t->low ) {
+				t->low = 1;
+				UPLOG_ERR("%s task '%s' has %u of %u stack words left",ownStr,t->rec.name,t->minFree,smStatus[i].usStackDepth);
+			}
+			if( used<=t->rec.maxUsed && smStatus[i].usStackDepth==t->rec.depth ) continue;
+			if( used>t->rec.maxUsed ) t->rec.maxUsed = used;
+			t->rec.depth = smStatus[i].usStackDepth;
+			if( FRAMJournalPut(FJ_KEY_STACK_MONITOR+(t-smTask),&t->rec,sizeof(t->rec)) ) ++smFjErrors;
+		}
+		++smSamples;
+	xSemaphoreGive(smLock);
+	return 0;
+}
+
+int StackMonitorInit() {
+	unsigned int i;
+	if( ! smLock && !(smLock=xSemaphoreCreateMutex()) ) return -1;
+	xSemaphoreTake(smLock,portMAX_DELAY);
+		memset(smTask,0,sizeof(smTask));
+		for(i=0; i<SM_MAX_TASKS; ++i) {
+			if( FRAMJournalGet(FJ_KEY_STACK_MONITOR+i,&smTask[i].rec,sizeof(smTask[i].rec))!=sizeof(smTask[i].rec) ) continue;
+			smTask[i].used = 1;
+			smTask[i].rec.name[SM_NAME_LEN-1] = 0;
+		}
+		smSamples = smFjErrors = 0;
+	xSemaphoreGive(smLock);
+	return 0;
+}
+
+void StackMonitorReset() {
+	unsigned int i;
+	int err;
+	if( ! smLock ) return;
+	xSemaphoreTake(smLock,portMAX_DELAY);
+		for(i=0; i<SM_MAX_TASKS; ++i) {
+			if( ! smTask[i].used ) continue;
+			smTask[i].used = 0;
+			err = FRAMJournalDelete(FJ_KEY_STACK_MONITOR+i);
+			if( err && err!=FJ_ERR_NOTFOUND ) ++smFjErrors;
+		}
+	xSemaphoreGive(smLock);
+	UPLOG_NOTICE("%s done",__FUNCTION__);
+}
+
+int StackMonitorGet(StackMonitorReport* rep) {
+	unsigned int i;
+	StackMonitorTask* r;
+	memset(rep,0,sizeof(*rep));
+	if( ! smLock ) return 0;
+	xSemaphoreTake(smLock,portMAX_DELAY);
+		rep->samples = smSamples;
+		rep->fjErrors = smFjErrors;
+		for(i=0; i<SM_MAX_TASKS; ++i) {
+			if( ! smTask[i].used ) continue;
+			r = &rep->task[rep->tasks++];
+			memcpy(r->name,smTask[i].rec.name,SM_NAME_LEN);
+			r->running = smTask[i].running;
+			r->depth = smTask[i].rec.depth;
+			r->maxUsed = smTask[i].rec.maxUsed;
+			r->minFree = r->running ? smTask[i].minFree : 0;
+			r->recommended = SMRecommended(r->maxUsed);
+			if( r->running && r->depth>r->recommended ) rep->reclaimBytes += (r->depth-r->recommended)*sizeof(portSTACK_TYPE);
+		}
+	xSemaphoreGive(smLock);
+	return rep->tasks;
+}
+
+void StackMonitorShowStatus() {
+	static StackMonitorReport rep;
+	unsigned int i;
+	StackMonitorGet(&rep);
+	UPLOG_INFO("%s samples=%u fjErrors=%u tasks=%u reclaimable=%uB",__FUNCTION__,rep.samples,rep.fjErrors,rep.tasks,rep.reclaimBytes);
+	for(i=0; i<rep.tasks; ++i)
+		UPLOG_INFO("%s task '%s'%s stack(words) depth=%u maxUsed=%u minFree=%u recommended=%u",__FUNCTION__,rep.task[i].name,
+					  rep.task[i].running ? "" : " (not running)",rep.task[i].depth,rep.task[i].maxUsed,rep.task[i].minFree,rep.task[i].recommended);
+}
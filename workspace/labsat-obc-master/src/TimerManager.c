@@ -1,4 +1,5 @@
 #include "TimerManager.h"
+#include "SliceMonitor.h"
 #include <freertos/semphr.h>
 #include <freertos/task.h>
 #include <string.h>
@@ -21,7 +22,7 @@ typedef struct LabsatTimer_ {
 	// pointer to other timers in ordered list
 	struct LabsatTimer_ *prev,*next;
 	// tiemr identifier
-	char id[8];
+	char id[16];
 } LabsatTimer;
 
 
@@ -85,8 +86,11 @@ void TimerManagerTask(void* params) {
 		// cannot accept insertions during the catchup loop
 		Time_getUnixEpoch( &currentTime );
    	while( ltFirst && ltFirst->when <= currentTime ) {
+			// let other tasks run between callbacks if this wakeup already took long
+			SLICE_YIELD();
 			lt = ltFirst;
 			ltFirst = lt->next;
+			SliceMonitorMark(lt->id);
 			int ret = lt->callback(currentTime,lt->privData);
 			if( ret<0 ) lt->count = 0; // forcing to stop repetitions
 			else {
@@ -103,6 +107,7 @@ void TimerManagerTask(void* params) {
 				xSemaphoreGive(ltMutex);
 			}
 		}
+		SliceMonitorMark("TimerManager");
 		vTaskDelayUntil( &ltLastWakeTime, tickInterval );
 	}
 	vTaskDelete(NULL);
@@ -152,7 +157,7 @@ void TimerManagerAdd(unsigned int when, int (*callback)(unsigned int_when, void*
 	lt->interval	= interval;
 	lt->count		= repetitionCount;
 	lt->privData	= privData;
-	if( name ) { strncpy(lt->id,name,7); lt->id[7] = 0; } else lt->id[0] = 0;
+	if( name ) { strncpy(lt->id,name,sizeof(lt->id)-1); lt->id[sizeof(lt->id)-1] = 0; } else lt->id[0] = 0;
 	// Safe critical section. Keep it as short as possible
 	xSemaphoreTake( ltMutex, (portTickType)portMAX_DELAY );
 		lt->next = toAdd;
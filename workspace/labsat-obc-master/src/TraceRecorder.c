@@ -0,0 +1,372 @@
+#include <stddef.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <hcc/api_fat.h>
+#include <at91/boards/ISIS_OBC_G20/board.h>
+#include "ObcGlobals.h"
+#include "TraceRecorder.h"
+#include "RunTimeStats.h"
+#include "LogManager.h"
+
+// Without the kernel hooks the recorder is left out, and its ring with it (stubs at the end)
+#if ( configUSE_TRACE_RECORDER == 1 )
+
+#define TRC_MASK (TRACE_RECORDS-1)
+#define TRC_MAX_TASKS RTS_MAX_TASKS // named at start and in a dump
+#define TRC_STOP_WAIT_MS 5000 // for the stream task to write the ring and close the file
+
+#if TRACE_RECORDS & TRC_MASK
+ #error TRACE_RECORDS must be a power of 2
+#endif
+
+// The kernel queue registry (queue.c): names of the queues added with vQueueAddToRegistry
+typedef struct {
+	signed char* pcQueueName;
+	xQueueHandle xHandle;
+} TRCQueueRegistryItem;
+extern TRCQueueRegistryItem xQueueRegistry[configQUEUE_REGISTRY_SIZE];
+
+volatile unsigned char ucTraceRecorderOn = 0, ucTraceRecorderTicks = 0;
+
+static TraceRecord trcRing[TRACE_RECORDS];
+static volatile unsigned int trcHead = 0; // records put in the ring since the start
+static volatile unsigned int trcTail = 0; // records written by the stream task
+static unsigned char trcMode = TRACE_SNAPSHOT, trcTask = 0, trcQueues = 0;
+static unsigned int trcEvents = 0, trcDropped = 0, trcPendingDrops = 0;
+static unsigned int trcBytesWritten = 0, trcWriteErrors = 0;
+static xTaskStatusType trcStatus[TRC_MAX_TASKS];
+static xTaskHandle trcStreamHdl = 0;
+static volatile char trcStreamStop = 0;
+static char trcStreamPath[F_MAXPATHNAME];
+
+
+/*- recording -------------------------------------------------------------------------------*/
+
+// Records are also put from interrupts, which the kernel critical sections do not mask
+static inline unsigned int TRCDisableInterrupts() {
+#if defined(__arm__) && !defined(__thumb__)
+	unsigned int cpsr, tmp;
+	__asm__ volatile("mrs %0, cpsr\n\torr %1, %0, #0xC0\n\tmsr cpsr_c, %1" : "=r"(cpsr), "=r"(tmp) : : "memory");
+	return cpsr;
+#else
+	return 0;
+#endif
+}
+
+static inline void TRCRestoreInterrupts(unsigned int cpsr) {
+#if defined(__arm__) && !defined(__thumb__)
+	__asm__ volatile("msr cpsr_c, %0" : : "r"(cpsr) : "memory");
+#else
+	(void)cpsr;
+#endif
+}
+
+// Take n consecutive records (interrupts disabled). Returns the index of the first or -1 if
+// a stream has no room (the records are dropped, the next ones are preceded by TRC_DROPPED).
+static inline int TRCReserve(unsigned int n, unsigned int time) {
+	unsigned int i;
+	TraceRecord* r;
+	if( trcMode==TRACE_STREAM ) {
+		if( trcHead-trcTail+n+(trcPendingDrops ? 1 : 0)>TRACE_RECORDS ) {
+			trcDropped += n;
+			trcPendingDrops += n;
+			return -1;
+		}
+		if( trcPendingDrops ) {
+			r = &trcRing[trcHead++ & TRC_MASK];
+			r->time = time;
+			r->event = TRC_DROPPED;
+			r->task = trcTask;
+			r->obj = trcPendingDrops>0xFFFF ? 0xFFFF : trcPendingDrops;
+			trcPendingDrops = 0;
+		}
+	}
+	i = trcHead;
+	trcHead += n;
+	++trcEvents;
+	return i;
+}
+
+static inline void TRCPut(unsigned char event, unsigned char task, unsigned short obj) {
+	unsigned int flags = TRCDisableInterrupts(), time = ulGetRunTimeCounterValue();
+	int i = TRCReserve(1,time);
+	if( i>=0 ) {
+		TraceRecord* r = &trcRing[i & TRC_MASK];
+		r->time = time;
+		r->event = event;
+		r->task = task;
+		r->obj = obj;
+	}
+	TRCRestoreInterrupts(flags);
+}
+
+// Fill a TRC_NAME record and the name records after it
+static void TRCFillName(TraceRecord* rec, unsigned int first, unsigned int mask, unsigned int time,
+								unsigned char kind, unsigned short number, const char* name) {
+	unsigned int i, j, k = 0;
+	unsigned char* d;
+	TraceRecord* r = &rec[first & mask];
+	r->time = time;
+	r->event = TRC_NAME;
+	r->task = kind;
+	r->obj = number;
+	for(i=1; i<=TRACE_NAME_RECORDS; ++i) {
+		d = (unsigned char*)&rec[(first+i) & mask];
+		for(j=0; j<sizeof(TraceRecord); ++j) {
+			if( j==offsetof(TraceRecord,event) ) d[j] = TRC_NAME_DATA;
+			else d[j] = k<TRACE_NAME_LEN && name && name[k] ? name[k++] : 0;
+		}
+	}
+}
+
+static void TRCPutName(unsigned char kind, unsigned short number, const char* name) {
+	unsigned int flags = TRCDisableInterrupts(), time = ulGetRunTimeCounterValue();
+	int i = TRCReserve(1+TRACE_NAME_RECORDS,time);
+	if( i>=0 ) TRCFillName(trcRing,i,TRC_MASK,time,kind,number,name);
+	TRCRestoreInterrupts(flags);
+}
+
+void vTraceRecord(unsigned char event, unsigned short obj) {
+	if( ucTraceRecorderOn ) TRCPut(event,trcTask,obj);
+}
+
+void vTraceTaskSwitchedIn(unsigned int taskNumber) {
+	trcTask = taskNumber;
+	if( ucTraceRecorderOn ) TRCPut(TRC_TASK_SWITCH,taskNumber,0);
+}
+
+void vTraceTaskCreate(unsigned int taskNumber, const char* name) {
+	if( ! ucTraceRecorderOn ) return;
+	TRCPutName(TRC_OBJ_TASK,taskNumber,name);
+	TRCPut(TRC_TASK_CREATE,trcTask,taskNumber);
+}
+
+// Queue numbers are given whether recording or not so that they stay unique
+unsigned char ucTraceQueueCreate(unsigned char type) {
+	unsigned char n = ++trcQueues;
+	if( ucTraceRecorderOn ) TRCPut(TRC_QUEUE_CREATE,trcTask,n | (type<<8));
+	return n;
+}
+
+
+/*- names -----------------------------------------------------------------------------------*/
+
+typedef void (*TRCNameFunc)(unsigned char kind, unsigned short number, const char* name, void* privData);
+
+// Number of the calling task (kernel TCB number, as the trace macros record)
+static unsigned int TRCSelf() {
+	unsigned int i, n;
+	unsigned long total;
+	xTaskHandle me = xTaskGetCurrentTaskHandle();
+	n = uxTaskGetSystemState(trcStatus,TRC_MAX_TASKS,&total);
+	for(i=0; i<n; ++i)
+		if( trcStatus[i].xHandle==me ) return trcStatus[i].xTaskNumber;
+	return 0;
+}
+
+// Live tasks and registered queues
+static void TRCForEachName(TRCNameFunc f, void* privData) {
+	unsigned int i, n;
+	unsigned long total;
+	n = uxTaskGetSystemState(trcStatus,TRC_MAX_TASKS,&total);
+	for(i=0; i<n; ++i)
+		f(TRC_OBJ_TASK,trcStatus[i].xTaskNumber,(const char*)trcStatus[i].pcTaskName,privData);
+	for(i=0; i<configQUEUE_REGISTRY_SIZE; ++i)
+		if( xQueueRegistry[i].pcQueueName )
+			f(TRC_OBJ_QUEUE,ucQueueGetQueueNumber(xQueueRegistry[i].xHandle) | (ucQueueGetQueueType(xQueueRegistry[i].xHandle)<<8),
+			  (const char*)xQueueRegistry[i].pcQueueName,privData);
+}
+
+static void TRCRingName(unsigned char kind, unsigned short number, const char* name, void* privData) {
+	TRCPutName(kind,number,name);
+}
+
+typedef struct {
+	F_FILE* f;
+	unsigned int records, errors;
+} TRCDumpCtx;
+
+static void TRCFileName(unsigned char kind, unsigned short number, const char* name, void* privData) {
+	TRCDumpCtx* c = (TRCDumpCtx*)privData;
+	TraceRecord rec[1+TRACE_NAME_RECORDS];
+	TRCFillName(rec,0,~0U,0,kind,number,name);
+	if( f_write(rec,sizeof(TraceRecord),1+TRACE_NAME_RECORDS,c->f)!=1+TRACE_NAME_RECORDS ) ++c->errors;
+	else c->records += 1+TRACE_NAME_RECORDS;
+}
+
+
+/*- stream ----------------------------------------------------------------------------------*/
+
+// Write the records put since the last call, at most up to the end of the ring per f_write
+static void TRCStreamWrite(F_FILE* f) {
+	unsigned int head = trcHead, tail = trcTail, idx, n;
+	while( tail!=head ) {
+		idx = tail & TRC_MASK;
+		n = head-tail;
+		if( n>TRACE_RECORDS-idx ) n = TRACE_RECORDS-idx;
+		if( f_write(&trcRing[idx],sizeof(TraceRecord),n,f)!=n ) ++trcWriteErrors;
+		else trcBytesWritten += n*sizeof(TraceRecord);
+		tail += n;
+		trcTail = tail; // the records can be reused
+	}
+}
+
+static void TRCStreamTask(void* param) {
+	static const char* ownStr = __FUNCTION__;
+	TraceRecorderFileHeader hdr;
+	F_FILE* f = 0;
+	int err;
+	if( (err=f_enterFS()) ) {
+		UPLOG_ERR("%s f_enterFS err=%d",ownStr,err);
+		goto endOfStream;
+	}
+	if( !(f=f_open(trcStreamPath,"w")) ) {
+		UPLOG_ERR("%s f_open %s err=%d",ownStr,trcStreamPath,f_getlasterror());
+		goto endOfStream;
+	}
+	memset(&hdr,0,sizeof(hdr));
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.counterHz = RTS_COUNTER_HZ;
+	if( f_write(&hdr,1,sizeof(hdr),f)!=sizeof(hdr) ) ++trcWriteErrors;
+	else trcBytesWritten += sizeof(hdr);
+	while( ! trcStreamStop ) {
+		vTaskDelay(pdMS_TO_TICKS(TRACE_STREAM_MS));
+		TRCStreamWrite(f);
+	}
+	endOfStream:
+	ucTraceRecorderOn = ucTraceRecorderTicks = 0;
+	if( f ) {
+		TRCStreamWrite(f);
+		f_close(f);
+	}
+	f_releaseFS();
+	trcStreamHdl = 0;
+	vTaskDelete(NULL);
+}
+
+
+/*- public ----------------------------------------------------------------------------------*/
+
+int TraceRecorderStart(unsigned char mode, unsigned char ticks, const char* path) {
+	static const char* ownStr = __FUNCTION__;
+	TraceRecorderStop();
+	if( mode==TRACE_STREAM && (! path || strlen(path)>=sizeof(trcStreamPath)) ) return -1;
+	trcHead = trcTail = 0;
+	trcEvents = trcDropped = trcPendingDrops = 0;
+	trcBytesWritten = trcWriteErrors = 0;
+	trcMode = mode;
+	// the switch hook only sets trcTask while recording: the caller runs until the next switch
+	trcTask = TRCSelf();
+	ucTraceRecorderOn = 1;
+	TRCForEachName(TRCRingName,0);
+	ucTraceRecorderTicks = ticks;
+	if( mode==TRACE_STREAM ) {
+		strcpy(trcStreamPath,path);
+		trcStreamStop = 0;
+		if( pdPASS!=xTaskCreate(TRCStreamTask,"TraceStream",basic_STACK_DEPTH,NULL,basic_TASK_PRIORITY,&trcStreamHdl) ) {
+			ucTraceRecorderOn = ucTraceRecorderTicks = 0;
+			trcStreamHdl = 0;
+			UPLOG_ERR("%s can not create the stream task",ownStr);
+			return -1;
+		}
+	}
+	UPLOG_INFO("%s mode=%s ticks=%u",ownStr,mode==TRACE_STREAM ? path : "snapshot",ticks);
+	return 0;
+}
+
+void TraceRecorderStop() {
+	unsigned int waited = 0;
+	ucTraceRecorderTicks = 0;
+	if( trcMode==TRACE_STREAM && trcStreamHdl ) {
+		trcStreamStop = 1;
+		while( trcStreamHdl && waited<TRC_STOP_WAIT_MS ) {
+			vTaskDelay(pdMS_TO_TICKS(10));
+			waited += 10;
+		}
+	}
+	ucTraceRecorderOn = 0;
+}
+
+int TraceRecorderDump(const char* path) {
+	static const char* ownStr = __FUNCTION__;
+	TraceRecorderFileHeader hdr;
+	TRCDumpCtx c;
+	unsigned int first, n, idx, len;
+	if( trcMode==TRACE_STREAM ) return -1;
+	TraceRecorderStop();
+	if( !(c.f=f_open(path,"w")) ) {
+		UPLOG_ERR("%s f_open %s err=%d",ownStr,path,f_getlasterror());
+		return -1;
+	}
+	c.records = c.errors = 0;
+	memset(&hdr,0,sizeof(hdr));
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.counterHz = RTS_COUNTER_HZ;
+	// rewritten with the counts at the end
+	if( f_write(&hdr,1,sizeof(hdr),c.f)!=sizeof(hdr) ) ++c.errors;
+	// the names put at the start may have been overwritten
+	TRCForEachName(TRCFileName,&c);
+	// the ring, oldest first
+	first = trcHead>TRACE_RECORDS ? trcHead-TRACE_RECORDS : 0;
+	for(n=trcHead-first; n>0; first += len, n -= len) {
+		idx = first & TRC_MASK;
+		len = n>TRACE_RECORDS-idx ? TRACE_RECORDS-idx : n;
+		if( f_write(&trcRing[idx],sizeof(TraceRecord),len,c.f)!=len ) ++c.errors;
+		else c.records += len;
+	}
+	hdr.records = c.records;
+	hdr.dropped = trcDropped;
+	if( f_seek(c.f,0,F_SEEK_SET) || f_write(&hdr,1,sizeof(hdr),c.f)!=sizeof(hdr) ) ++c.errors;
+	if( f_close(c.f) ) ++c.errors;
+	trcBytesWritten += sizeof(hdr)+c.records*sizeof(TraceRecord);
+	trcWriteErrors += c.errors;
+	UPLOG_INFO("%s %s records=%u errors=%u",ownStr,path,c.records,c.errors);
+	return c.errors ? -1 : (int)c.records;
+}
+
+void TraceRecorderGetStats(TraceRecorderStats* st) {
+	unsigned int flags = TRCDisableInterrupts();
+	st->on = ucTraceRecorderOn;
+	st->mode = trcMode;
+	st->ticks = ucTraceRecorderTicks;
+	st->events = trcEvents;
+	st->dropped = trcDropped;
+	st->buffered = trcMode==TRACE_STREAM ? trcHead-trcTail : (trcHead>TRACE_RECORDS ? TRACE_RECORDS : trcHead);
+	st->bytesWritten = trcBytesWritten;
+	st->writeErrors = trcWriteErrors;
+	TRCRestoreInterrupts(flags);
+}
+
+void TraceRecorderShowStatus() {
+	TraceRecorderStats st;
+	TraceRecorderGetStats(&st);
+	UPLOG_INFO("%s on=%u mode=%u ticks=%u events=%u dropped=%u buffered=%u bytesWritten=%u writeErrors=%u",
+				  __FUNCTION__,st.on,st.mode,st.ticks,st.events,st.dropped,st.buffered,st.bytesWritten,st.writeErrors);
+}
+
+#else
+
+int TraceRecorderStart(unsigned char mode, unsigned char ticks, const char* path) {
+	UPLOG_ERR("%s the kernel is built without configUSE_TRACE_RECORDER",__FUNCTION__);
+	return -1;
+}
+
+void TraceRecorderStop() {
+}
+
+int TraceRecorderDump(const char* path) {
+	return -1;
+}
+
+void TraceRecorderGetStats(TraceRecorderStats* st) {
+	memset(st,0,sizeof(*st));
+}
+
+void TraceRecorderShowStatus() {
+}
+
+#endif
@@ -0,0 +1,315 @@
+#include <string.h>
+#include <satellite-subsystems/isis_vu_e.h>
+#include "TrxvuManager.h"
+
+#ifdef TRXVU_HOST
+	// host benchmark build (trxvu-bench.c): no task and no CSP. The benchmark calls TrxvuFrameReady
+	// and TrxvuRxPass where the interrupt and the rx task would, and drives the time.
+	#include <stdio.h>
+	extern portTickType trxvuBenchTicks;
+	extern unsigned long trxvuBenchCounter; // us
+	int trxvuBenchQueue(const unsigned char* frame, unsigned int len);
+	#define trxvuTicks() trxvuBenchTicks
+	#define trxvuCounter() trxvuBenchCounter
+	#define TRXVU_COUNTER_HZ 1000000
+	#define TrxvuQueue trxvuBenchQueue
+	#define TVLOG_INFO(fmt,...) printf(fmt "\n",__VA_ARGS__)
+	#define TVLOG_NOTICE TVLOG_INFO
+#else
+	#include <freertos/task.h>
+	#include <freertos/semphr.h>
+	#include <at91/boards/ISIS_OBC_G20/board.h>
+	#include <at91/peripherals/pio/pio.h>
+	#include <at91/peripherals/pio/pio_it.h>
+	#include <csp/csp.h>
+	#include <csp/csp_id.h>
+	#include <csp/csp_iflist.h>
+	#include <csp/csp_interface.h>
+	#include "RunTimeStats.h"
+	#include "LogManager.h"
+	#define trxvuTicks() xTaskGetTickCount()
+	#define trxvuCounter() ulGetRunTimeCounterValue()
+	#define TRXVU_COUNTER_HZ RTS_COUNTER_HZ
+	#define TVLOG_INFO UPLOG_INFO
+	#define TVLOG_NOTICE UPLOG_NOTICE
+	// frame ready line of the receiver
+	static const Pin trxvuFrPin = {1 << 19, AT91C_BASE_PIOA, AT91C_ID_PIOA, PIO_INPUT, PIO_DEFAULT};
+	static xSemaphoreHandle trxvuWake = 0;
+	static xTaskHandle trxvuTaskHandle = 0;
+	static csp_iface_t trxvuIface;
+#endif
+
+// I2C bytes (written and read) of each receiver command, as the driver transfers them
+#define TRXVU_BYTES_COUNT (1+2)
+#define TRXVU_BYTES_COUNT_LENGTH(n) (1+2+2*(n))
+#define TRXVU_BYTES_FRAME(len) (1+6+(len))
+#define TRXVU_BYTES_REMOVE 1
+#define TRXVU_FULL_MAX (TRXVU_AX25_HDR+TRXVU_FRAME_MAX+2) // get_full_frame, with the AX.25 FCS
+
+static volatile char trxvuPolling = 0;
+static volatile char trxvuLineSeen = 0; // line rose and no frame has been delivered since
+static volatile unsigned long trxvuLineTime = 0; // run time counter when it rose
+static unsigned char trxvuRxBuf[TRXVU_FULL_MAX];
+// only the rx task updates these (interrupts and tx counters apart)
+static TrxvuManagerReport trxvuStat;
+static volatile unsigned int trxvuInterrupts = 0, trxvuTxFrames = 0, trxvuTxErrors = 0;
+static unsigned long long trxvuLatencySum = 0; // counts
+static unsigned int trxvuLatencyCount = 0, trxvuLatencyMax = 0;
+static portTickType trxvuStatStart = 0;
+
+
+char TrxvuFrameReady() {
+	++trxvuInterrupts;
+	if( ! trxvuLineSeen ) {
+		trxvuLineTime = trxvuCounter();
+		trxvuLineSeen = 1;
+	}
+	// polling mode keeps the interrupt only to measure the latency
+	return ! trxvuPolling;
+}
+
+#ifndef TRXVU_HOST
+
+static void TrxvuFrameReadyISR(const Pin* pin) {
+	portBASE_TYPE woken = pdFALSE;
+	if( PIO_Get(pin)!=1 ) return; // the line dropped
+	if( ! TrxvuFrameReady() ) return;
+	xSemaphoreGiveFromISR(trxvuWake,&woken);
+	if( woken==pdTRUE ) portYIELD_FROM_ISR();
+}
+
+// Queue a frame to CSP. Returns -1 if it was dropped.
+static int TrxvuQueue(const unsigned char* frame, unsigned int len) {
+	csp_packet_t* packet;
+	if( len>csp_buffer_data_size() || !(packet=csp_buffer_get(0)) ) return -1;
+	csp_id_setup_rx(packet);
+	memcpy(packet->frame_begin,frame,len);
+	packet->frame_length = len;
+	if( csp_id_strip(packet)<0 ) {
+		++trxvuIface.frame;
+		csp_buffer_free(packet);
+		return -1;
+	}
+	csp_qfifo_write(packet,&trxvuIface,NULL);
+	return 0;
+}
+
+#endif
+
+// Hand a frame received on the radio to CSP
+static void TrxvuDeliver(const unsigned char* frame, unsigned int len) {
+	unsigned long lat;
+	if( TrxvuQueue(frame,len)<0 ) { ++trxvuStat.dropped; return; }
+	if( trxvuLineSeen ) {
+		trxvuLineSeen = 0;
+		lat = trxvuCounter()-trxvuLineTime;
+		trxvuLatencySum += lat;
+		++trxvuLatencyCount;
+		if( lat>trxvuLatencyMax ) trxvuLatencyMax = lat;
+	}
+	++trxvuStat.frames;
+}
+
+// Interrupt mode: read the frames sized by their lengths. Returns the frames removed.
+static unsigned int TrxvuDrain() {
+	isis_vu_e__get_frame_count_length__from_t cl;
+	isis_vu_e__get_full_frame__from_t ff;
+	uint16_t len[TRXVU_RX_BURST];
+	unsigned int i, n, waiting = 0, removed = 0;
+	for(;;) {
+		cl.p_frame_length = len;
+		++trxvuStat.i2cCommands; trxvuStat.i2cBytes += TRXVU_BYTES_COUNT_LENGTH(TRXVU_RX_BURST);
+		if( driver_error_none!=isis_vu_e__get_frame_count_length_variable(TRXVU_INDEX,&cl,TRXVU_RX_BURST) ) {
+			++trxvuStat.i2cErrors;
+			break;
+		}
+		if( ! removed ) waiting = cl.frames_nb;
+		n = cl.frames_nb<TRXVU_RX_BURST ? cl.frames_nb : TRXVU_RX_BURST;
+		for(i=0; i<n; ++i) {
+			if( len[i]==0 || len[i]>TRXVU_FRAME_MAX ) {
+				++trxvuStat.dropped;
+			} else {
+				ff.data = trxvuRxBuf;
+				++trxvuStat.i2cCommands; trxvuStat.i2cBytes += TRXVU_BYTES_FRAME(TRXVU_AX25_HDR+len[i]);
+				if( driver_error_none!=isis_vu_e__get_full_frame_variable(TRXVU_INDEX,&ff,TRXVU_AX25_HDR+len[i]) ) {
+					++trxvuStat.i2cErrors;
+					return removed; // still the oldest frame, read again by the next drain
+				}
+				if( ff.length<TRXVU_AX25_HDR+len[i] ) ++trxvuStat.dropped;
+				else TrxvuDeliver(trxvuRxBuf+TRXVU_AX25_HDR,len[i]);
+			}
+			++trxvuStat.i2cCommands; trxvuStat.i2cBytes += TRXVU_BYTES_REMOVE;
+			if( driver_error_none!=isis_vu_e__remove_frame(TRXVU_INDEX) ) {
+				++trxvuStat.i2cErrors;
+				return removed;
+			}
+			++removed;
+		}
+		// the lengths of more frames were not asked for. The frames that came during the drain
+		// are left to the next one (the line is still high after the settle time): a receiver
+		// that fills faster than it is drained does not keep the task in one drain.
+		if( cl.frames_nb<=TRXVU_RX_BURST || removed>=waiting ) break;
+	}
+	return removed;
+}
+
+// Polling mode: the count/get_frame/remove loop of the isis_vu_e demos
+static unsigned int TrxvuPoll() {
+	isis_vu_e__get_frame__from_t fr;
+	uint16_t count = 0;
+	unsigned int removed = 0;
+	++trxvuStat.i2cCommands; trxvuStat.i2cBytes += TRXVU_BYTES_COUNT;
+	if( driver_error_none!=isis_vu_e__get_frame_count(TRXVU_INDEX,&count) ) {
+		++trxvuStat.i2cErrors;
+		return 0;
+	}
+	for(; count>0; --count) {
+		fr.data = trxvuRxBuf;
+		++trxvuStat.i2cCommands; trxvuStat.i2cBytes += TRXVU_BYTES_FRAME(TRXVU_FRAME_MAX);
+		if( driver_error_none!=isis_vu_e__get_frame_variable(TRXVU_INDEX,&fr,TRXVU_FRAME_MAX) ) {
+			++trxvuStat.i2cErrors;
+			break;
+		}
+		if( fr.length==0 || fr.length>TRXVU_FRAME_MAX ) ++trxvuStat.dropped;
+		else TrxvuDeliver(trxvuRxBuf,fr.length);
+		++trxvuStat.i2cCommands; trxvuStat.i2cBytes += TRXVU_BYTES_REMOVE;
+		if( driver_error_none!=isis_vu_e__remove_frame(TRXVU_INDEX) ) {
+			++trxvuStat.i2cErrors;
+			break;
+		}
+		++removed;
+	}
+	return removed;
+}
+
+unsigned int TrxvuRxPass(char polling, char woken) {
+	unsigned int n = polling ? TrxvuPoll() : TrxvuDrain();
+	if( polling!=trxvuPolling ) return n; // counters reset meanwhile
+	if( ! polling && ! woken ) ++trxvuStat.idleDrains;
+	++trxvuStat.drains;
+	if( n>trxvuStat.maxBurst ) trxvuStat.maxBurst = n;
+	return n;
+}
+
+static void TrxvuResetStats(char polling) {
+	memset(&trxvuStat,0,sizeof(trxvuStat));
+	trxvuStat.polling = polling;
+	trxvuInterrupts = trxvuTxFrames = trxvuTxErrors = 0;
+	trxvuLatencySum = 0;
+	trxvuLatencyCount = trxvuLatencyMax = 0;
+	trxvuLineSeen = 0;
+	trxvuStatStart = trxvuTicks();
+}
+
+#ifndef TRXVU_HOST
+
+static void TrxvuRxTask(void* args) {
+	char polling, woken;
+	UPLOG_NOTICE("%s starting",__FUNCTION__);
+	for(;;) {
+		polling = trxvuPolling;
+		if( polling ) {
+			vTaskDelay(TRXVU_RX_POLL_TICKS);
+			woken = 0;
+		} else {
+			woken = pdTRUE==xSemaphoreTake(trxvuWake,TRXVU_RX_IDLE_TICKS);
+		}
+		TrxvuRxPass(polling,woken);
+		if( ! polling ) {
+			// the line drops ~0.5ms after the last remove unless more frames came meanwhile,
+			// and then there is no new edge
+			vTaskDelay(TRXVU_FR_SETTLE_TICKS);
+			if( PIO_Get(&trxvuFrPin)==1 ) xSemaphoreGive(trxvuWake);
+		}
+	}
+}
+
+// Packets routed to the TRXVU interface
+static int TrxvuTx(csp_iface_t* iface, uint16_t via, csp_packet_t* packet, int from_me) {
+	uint8_t slots = 0;
+	csp_id_prepend(packet);
+	if( packet->frame_length>TRXVU_TX_MAX ||
+		 driver_error_none!=isis_vu_e__send_frame(TRXVU_INDEX,packet->frame_begin,packet->frame_length,&slots) || slots==255 ) {
+		++trxvuTxErrors;
+		return CSP_ERR_TX; // freed by the caller
+	}
+	++trxvuTxFrames;
+	csp_buffer_free(packet);
+	return CSP_ERR_NONE;
+}
+
+int TrxvuManagerInit() {
+	ISIS_VU_E_t vu;
+	driver_error_t err;
+	if( trxvuTaskHandle ) return 0;
+	vu.rxAddr = TRXVU_RX_ADDR;
+	vu.txAddr = TRXVU_TX_ADDR;
+	vu.maxReceiveBufferLength = TRXVU_FULL_MAX;
+	vu.maxSendBufferLength = TRXVU_TX_MAX;
+	err = ISIS_VU_E_Init(&vu,1);
+	if( err!=driver_error_none && err!=driver_error_reinit ) { UPLOG_ERR("%s driver init error %d",__FUNCTION__,err); return -1; }
+	vSemaphoreCreateBinary(trxvuWake);
+	if( ! trxvuWake ) { UPLOG_ERR("%s semaphore",__FUNCTION__); return -1; }
+	xSemaphoreTake(trxvuWake,0); // created given
+	TrxvuResetStats(trxvuPolling);
+
+	memset(&trxvuIface,0,sizeof(trxvuIface));
+	trxvuIface.name = "TRXVU";
+	trxvuIface.addr = TRXVU_CSP_ADDR;
+	trxvuIface.nexthop = TrxvuTx;
+	if( CSP_ERR_NONE!=csp_iflist_add(&trxvuIface) ) { UPLOG_ERR("%s csp interface",__FUNCTION__); return -1; }
+
+	if( pdPASS!=xTaskCreate(TrxvuRxTask,(signed char*)"TrxvuRxTask",TRXVU_STACK_SIZE,NULL,TRXVU_RX_PRIO,&trxvuTaskHandle) ) {
+		UPLOG_ERR("%s task",__FUNCTION__);
+		return -1;
+	}
+	// frames already waiting raised the line before the interrupt was enabled
+	PIO_Configure(&trxvuFrPin,1);
+	PIO_ConfigureIt(&trxvuFrPin,TrxvuFrameReadyISR);
+	PIO_EnableIt(&trxvuFrPin);
+	xSemaphoreGive(trxvuWake);
+	UPLOG_INFO("%s started",__FUNCTION__);
+	return 0;
+}
+
+#endif
+
+void TrxvuManagerSetPolling(char on) {
+	trxvuPolling = on!=0;
+	TrxvuResetStats(trxvuPolling);
+#ifndef TRXVU_HOST
+	if( ! trxvuPolling && trxvuWake ) xSemaphoreGive(trxvuWake);
+#endif
+	TVLOG_NOTICE("%s %s",__FUNCTION__,trxvuPolling ? "polling" : "frame-ready interrupt");
+}
+
+int TrxvuManagerGet(TrxvuManagerReport* rep) {
+	unsigned long long lat;
+	memcpy(rep,&trxvuStat,sizeof(*rep));
+	rep->interrupts = trxvuInterrupts;
+	rep->txFrames = trxvuTxFrames;
+	rep->txErrors = trxvuTxErrors;
+	rep->secs = (trxvuTicks()-trxvuStatStart)/configTICK_RATE_HZ;
+	if( rep->secs ) rep->framesPerSec = rep->frames/rep->secs;
+	if( rep->frames ) {
+		rep->commandsPerFrame100 = rep->i2cCommands*100/rep->frames;
+		rep->bytesPerFrame = rep->i2cBytes/rep->frames;
+	}
+	if( trxvuLatencyCount ) {
+		lat = trxvuLatencySum/trxvuLatencyCount;
+		rep->latencyUs = (unsigned int)(lat*1000000/TRXVU_COUNTER_HZ);
+		rep->maxLatencyUs = (unsigned int)((unsigned long long)trxvuLatencyMax*1000000/TRXVU_COUNTER_HZ);
+	}
+	return 0;
+}
+
+void TrxvuManagerShowStatus() {
+	TrxvuManagerReport rep;
+	TrxvuManagerGet(&rep);
+	TVLOG_INFO("%s mode=%s secs=%u frames=%u frames/s=%u i2c commands/frame=%u.%02u bytes/frame=%u latency avg=%uus max=%uus",
+				  __FUNCTION__,rep.polling ? "polling" : "interrupt",rep.secs,rep.frames,rep.framesPerSec,rep.commandsPerFrame100/100,
+				  rep.commandsPerFrame100%100,rep.bytesPerFrame,rep.latencyUs,rep.maxLatencyUs);
+	TVLOG_INFO("%s interrupts=%u drains=%u idleDrains=%u maxBurst=%u dropped=%u i2cErrors=%u i2cCommands=%u i2cBytes=%u tx=%u txErrors=%u",
+				  __FUNCTION__,rep.interrupts,rep.drains,rep.idleDrains,rep.maxBurst,rep.dropped,rep.i2cErrors,rep.i2cCommands,rep.i2cBytes,
+				  rep.txFrames,rep.txErrors);
+}
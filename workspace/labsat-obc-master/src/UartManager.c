@@ -13,7 +13,7 @@ void (*camUartRXCallback)(char* packetBuf, unsigned int len, char complete);
 int UartManagerInitEPS() {
 	return UartManagerInit(	EPS_UART_BUS,epsUartRXCallback,EPS_RX_RINGBUF_COUNT,EPS_BUF_SIZE,0,
 									EPS_UART_MODE,EPS_UART_RATE,EPS_UART_TIMEGUARD,EPS_UART_BUS_TYPE,
-									EPS_UART_DEFAULTTIMEOUT,"<rsp>","</rsp>\r\n");
+									EPS_UART_DEFAULTTIMEOUT,"<rsp>","</rsp>"); // trailing CR LF if any is skipped while looking for next <rsp>
 }
 int UartManagerInitCAM() {
 	return UartManagerInit(	CAM_UART_BUS,camUartRXCallback,CAM_RX_RINGBUF_COUNT,CAM_BUF_SIZE,0,
@@ -88,7 +88,6 @@ static void UartRxTask(void* param) {
 					}
 					// even if we found the initial sequence, we will not pass the initial and last sequences
 					// to the upper level, so we reuse its buffer space
-					rxCursor = uctx->rxBufRing[rxBufIdx];
 					rxBytes = 0;
 					q = needleLast = needle + ll;
 				}
@@ -101,11 +100,13 @@ static void UartRxTask(void* param) {
 				uctx->rxCallback(uctx->rxBufRing[rxBufIdx],rxBytes,0 /*incomplete*/ );
 				if( ++rxBufIdx==uctx->rxBufCount ) rxBufIdx = 0;
 			}
-			rxCursor = uctx->rxBufRing[rxBufIdx];
 			rxBytes = 0;
 		}
+		// next byte goes after the last one received (or at the start of a new frame buffer)
+		rxCursor = uctx->rxBufRing[rxBufIdx] + rxBytes;
 	}
 	vPortFree(uctx->rxBufRing);
+	vPortFree(uctx); // closeUart leaves the context to this task, it may still be in use here
 	vTaskDelete(NULL);
 }
 
@@ -125,9 +126,13 @@ int UartManagerInit(
 	const char *iniSeq,
 	const char *endSeq
 ) {
-	if( bus<0 or bus>UART_BUS_COUNT ) { UPLOG_ERR("%s nonvalid bus: %d",__FUNCTION__,bus); return -1; }
+	if( bus<0 || bus>=UART_BUS_COUNT ) { UPLOG_ERR("%s nonvalid bus: %d",__FUNCTION__,bus); return -1; }
 	if( uartData[bus] ) closeUart(bus);
 	uartContext *uctx = (uartContext*)pvPortMalloc(sizeof(uartContext));
+	if( uctx==0 ) { UPLOG_ERR("%s out of memory",__FUNCTION__); return -2; }
+	uctx->bus = bus;
+	uctx->iniSeq = iniSeq;
+	uctx->endSeq = endSeq;
 	uctx->go = 1;
 	uctx->passAlsoIncompleteBuf = passAlsoIncompleteBuf;
 	uctx->rxCallback = rxCallback;
@@ -138,7 +143,7 @@ int UartManagerInit(
 	UARTconfig uconf = { mode,baudrate,timeGuard,busType,defaultTimeout };
 	int res = UART_start(uctx->bus, uconf);
 	if( res!=0 ) {
-		UPLOG_ERR("%s error starting hal uart driver: %s",__FUNCTION__,res);
+		UPLOG_ERR("%s error starting hal uart driver: %d",__FUNCTION__,res);
 		vPortFree(uctx);
 		return res;
 	}
@@ -151,6 +156,7 @@ int UartManagerInit(
 				&(uctx->rxTaskHandle) ) ) 
 	{
 		UPLOG_ERR("%s: failed to create csp_uart_rx_task for uart bus: %d\n", __FUNCTION__,bus);
+		UART_stop(bus);
 		vPortFree(uctx);
 		return -3;
 	}
@@ -165,7 +171,6 @@ void closeUart(UARTbus bus) {  // bus0_uart=0, bus2_uart=1
 	uartContext *uctx = uartData[bus];
 	if( uctx==0 ) return;
 	uartData[bus]=0;
-	uctx->go = 0; // this signal the task to stop the loop
+	uctx->go = 0; // this signal the task to stop the loop, the task frees uctx
 	UART_stop(bus);
-	vPortFree( uctx );
 }
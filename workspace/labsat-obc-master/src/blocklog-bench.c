@@ -0,0 +1,270 @@
+// Power-loss harness of BlockLog.c on the development machine.
+// Build and run:  make blocklog-bench && ./blocklog-bench
+//
+// A run adds RUN_ENTRIES entries to a fresh log. The run is repeated cutting the power at each
+// FRAM write, file write and SD sync it makes in turn (a FRAM write is cut halfway, with a length
+// that changes from cut to cut). After each cut the log is started again from FRAM and the files:
+// every entry whose add returned 0 must read back with its data and time, at most the one being
+// added may be there too, and RUN_ENTRIES more entries are added and read back.
+//
+// The fake file system has three levels: what was written, what was pushed down by f_flush or
+// f_close (the SD cache and the mirror queue) and what SDManagerSync put on the card. Only the
+// card level survives a cut.
+
+// Only built by the blocklog-bench make target (Eclipse compiles every file in src/)
+#ifdef BLOCKLOG_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <hal/checksum.h>
+#include <hal/Storage/FRAM.h>
+#include <hal/Timing/Time.h>
+#include "BlockLog.h"
+#include "SDManager.h"
+
+#define RUN_ENTRIES 200
+#define ENTRY_SIZE 24 // 19 entries per block
+#define FRAM_BASE 0x100
+#define FILE_MAX 65536
+#define FILES 2 // log and index
+
+void BlockLogPowerLoss();
+
+typedef struct {
+	char name[F_MAXPATHNAME];
+	long len, pushedLen, cardLen;
+	unsigned char data[FILE_MAX], pushed[FILE_MAX], card[FILE_MAX];
+} FakeFile;
+
+typedef struct {
+	FN_FILE f;
+	FakeFile* file;
+	long pos;
+} FakeHandle;
+
+static FakeFile files[FILES];
+static unsigned char fram[FRAM_BASE+BLOCKLOG_FRAM_SIZE];
+static unsigned int benchClock = 1500000000;
+static unsigned int entryTime[2*RUN_ENTRIES+2];
+
+// power cut
+static jmp_buf powerLoss;
+static unsigned int events, cutAt; // cutAt 0: no cut
+static unsigned int framTorn;
+
+static int powerEvent() {
+	return cutAt && ++events==cutAt;
+}
+
+static void cut() {
+	longjmp(powerLoss,1);
+}
+
+// Only the card level is left
+static void reboot() {
+	int i;
+	BlockLogPowerLoss();
+	for(i=0; i<FILES; ++i) {
+		files[i].len = files[i].pushedLen = files[i].cardLen;
+		memcpy(files[i].data,files[i].card,files[i].cardLen);
+		memcpy(files[i].pushed,files[i].card,files[i].cardLen);
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// fakes of the hal, hcc and SDManager functions BlockLog.c uses
+
+void* pvPortMalloc(size_t size) { return malloc(size); }
+void vPortFree(void* p) { free(p); }
+
+int Time_getUnixEpoch(unsigned int* epochTime) { *epochTime = benchClock; return 0; }
+
+int FRAM_start(void) { return 0; }
+int FRAM_read(unsigned char* data, unsigned int address, unsigned int size) {
+	if( address+size>sizeof(fram) ) return -1;
+	memcpy(data,fram+address,size);
+	return 0;
+}
+int FRAM_write(const unsigned char* data, unsigned int address, unsigned int size) {
+	if( address+size>sizeof(fram) ) return -1;
+	if( powerEvent() ) {
+		memcpy(fram+address,data,cutAt%(size+1));
+		++framTorn;
+		cut();
+	}
+	memcpy(fram+address,data,size);
+	return 0;
+}
+
+void checksum_prepareLUTCRC16(unsigned short polynomial, unsigned short* LUT) {
+	unsigned int i, b, crc;
+	for(i=0; i<256; ++i) {
+		for(crc=i<<8, b=0; b<8; ++b) crc = crc & 0x8000 ? (crc<<1)^polynomial : crc<<1;
+		LUT[i] = (unsigned short)crc;
+	}
+}
+unsigned short checksum_calculateCRC16LUT(const unsigned char* data, unsigned int length, const unsigned short* LUT,
+														unsigned short start_remainder, Boolean endofdata) {
+	unsigned short crc = start_remainder;
+	while( length-- ) crc = (unsigned short)(crc<<8) ^ LUT[((crc>>8) ^ *data++) & 0xFF];
+	return crc;
+}
+
+static void push(FakeFile* k) {
+	memcpy(k->pushed,k->data,k->len);
+	k->pushedLen = k->len;
+}
+
+int SDManagerSync() {
+	int i;
+	if( powerEvent() ) cut();
+	for(i=0; i<FILES; ++i) {
+		memcpy(files[i].card,files[i].pushed,files[i].pushedLen);
+		files[i].cardLen = files[i].pushedLen;
+	}
+	return 0;
+}
+
+FN_FILE* fm_open(const char* filename, const char* mode) {
+	FakeHandle* h;
+	FakeFile* k = 0;
+	int i;
+	for(i=0; i<FILES && ! k; ++i)
+		if( ! strcmp(files[i].name,filename) ) k = &files[i];
+	if( ! k && mode[0]=='r' ) return 0;
+	for(i=0; i<FILES && ! k; ++i)
+		if( ! files[i].name[0] ) { k = &files[i]; strcpy(k->name,filename); }
+	if( ! k ) return 0;
+	if( mode[0]=='w' ) k->len = 0;
+	h = calloc(1,sizeof(FakeHandle));
+	h->file = k;
+	return &h->f;
+}
+int fm_flush(FN_FILE* f) { push(((FakeHandle*)f)->file); return 0; }
+int fm_close(FN_FILE* f) { push(((FakeHandle*)f)->file); free(f); return 0; }
+int fm_getlasterror(void) { return 0; }
+long fm_tell(FN_FILE* f) { return ((FakeHandle*)f)->pos; }
+
+int fm_seek(FN_FILE* f, long offset, long whence) {
+	FakeHandle* h = (FakeHandle*)f;
+	long pos = whence==F_SEEK_SET ? offset : whence==F_SEEK_END ? h->file->len+offset : h->pos+offset;
+	if( pos<0 || pos>FILE_MAX ) return F_ERR_NOTUSEABLE;
+	if( pos>h->file->len ) { memset(h->file->data+h->file->len,0,pos-h->file->len); h->file->len = pos; }
+	h->pos = pos;
+	return 0;
+}
+long fm_read(void* buf, long size, long size_st, FN_FILE* f) {
+	FakeHandle* h = (FakeHandle*)f;
+	long n = size*size_st;
+	if( h->pos+n>h->file->len ) n = h->file->len-h->pos;
+	memcpy(buf,h->file->data+h->pos,n);
+	h->pos += n;
+	return n/size;
+}
+long fm_write(const void* buf, long size, long size_st, FN_FILE* f) {
+	FakeHandle* h = (FakeHandle*)f;
+	long n = size*size_st;
+	if( powerEvent() ) cut();
+	if( h->pos+n>FILE_MAX ) return 0;
+	memcpy(h->file->data+h->pos,buf,n);
+	h->pos += n;
+	if( h->pos>h->file->len ) h->file->len = h->pos;
+	return size_st;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void pattern(unsigned char* d, unsigned int entryNumber) {
+	int i;
+	for(i=0; i<ENTRY_SIZE; ++i) d[i] = (unsigned char)(entryNumber*7+i);
+}
+
+// Add n entries, recording the time of each. Returns the entries added.
+static unsigned int addEntries(int logid, unsigned int n, unsigned int* acked) {
+	unsigned char d[ENTRY_SIZE];
+	BlockLogStats st;
+	unsigned int i;
+	for(i=0; i<n; ++i) {
+		BlockLog_getStats(logid,&st);
+		benchClock += i%5==4 ? 100 : 1+i%3; // deltas of 1 and 2 byte varints, so blocks of both entry count parities
+		entryTime[st.nextEntryNumber] = benchClock;
+		pattern(d,st.nextEntryNumber);
+		if( BlockLog_add(logid,d) ) break;
+		*acked = st.nextEntryNumber+1;
+	}
+	return i;
+}
+
+// Entries 0..n-1 read back. Returns the first wrong one, or n.
+static unsigned int readEntries(int logid, unsigned int n) {
+	unsigned char buf[sizeof(BlockLogEntry)+ENTRY_SIZE], d[ENTRY_SIZE];
+	BlockLogEntry* e = (BlockLogEntry*)buf;
+	unsigned int i;
+	for(i=0; i<n; ++i) {
+		pattern(d,i);
+		if( BlockLog_readOnce(logid,i,e) || e->entryNumber!=i || e->time!=entryTime[i] || memcmp(e->data,d,ENTRY_SIZE) ) break;
+	}
+	return i;
+}
+
+static BlockLogInit cfg = { ENTRY_SIZE, "A:/bl.log", FRAM_BASE };
+
+// One run cut at event c (0: not cut). Returns 1 if it was not cut, -1 if entries were lost.
+static int run(unsigned int c, unsigned int* lost) {
+	BlockLogStats st;
+	unsigned int acked = 0, bad;
+	int logid;
+	memset(files,0,sizeof(files));
+	memset(fram,0xA5,sizeof(fram)); // FRAM of an earlier log
+	BlockLogPowerLoss();
+	events = 0;
+	cutAt = 0;
+	if( BlockLog_start(&cfg,TRUE,&logid) ) return -1;
+	cutAt = c;
+	if( ! setjmp(powerLoss) ) {
+		addEntries(logid,RUN_ENTRIES,&acked);
+		cutAt = 0;
+		BlockLog_stop(logid);
+		return 1;
+	}
+	// restart after the cut
+	cutAt = 0;
+	reboot();
+	if( BlockLog_start(&cfg,FALSE,&logid) ) return -1;
+	BlockLog_getStats(logid,&st);
+	bad = readEntries(logid,acked);
+	if( st.nextEntryNumber<acked || st.nextEntryNumber>acked+1 || bad<acked ) {
+		*lost = acked-bad;
+		printf("cut %4u: %u entries acked, log restarts at %u, entry %u wrong\n",c,acked,st.nextEntryNumber,bad);
+		return -1;
+	}
+	// and it goes on
+	acked = st.nextEntryNumber;
+	if( addEntries(logid,RUN_ENTRIES,&acked)!=RUN_ENTRIES || (bad=readEntries(logid,acked))<acked ) {
+		*lost = acked-bad;
+		printf("cut %4u: after the restart entry %u of %u wrong\n",c,bad,acked);
+		return -1;
+	}
+	BlockLog_stop(logid);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	unsigned int c, cuts = 0, failed = 0, lost = 0, n;
+	int r;
+	for(c=1;; ++c) {
+		n = 0;
+		if( (r=run(c,&n))>0 ) break;
+		++cuts;
+		if( r<0 ) { ++failed; lost += n; }
+	}
+	printf("%u entries of %u bytes, %u power cuts (%u halfway through a FRAM write): %u restarts lost entries (%u in all) %s\n",
+			 RUN_ENTRIES,ENTRY_SIZE,cuts,framTorn,failed,lost,failed ? "FAILED" : "ok");
+	return failed!=0;
+}
+
+#endif
@@ -0,0 +1,111 @@
+// Host benchmark of Hamming_Compute256x/Hamming_Verify256x from hal/at91/src/utility/hamming.c.
+// Build and run on the development machine:  make hamming-bench && ./hamming-bench
+//
+// Checks the codes against the previous bit-by-bit version (OldCompute256 below) on random
+// blocks at every alignment, and that every single bit error is corrected and reported, then
+// compares the throughput over 2KB pages. Target numbers: TEST_HAMMING_BENCH in DevelTest.c.
+
+// Only built by the hamming-bench make target (Eclipse compiles every file in src/)
+#ifdef HAMMING_BENCH_HOST
+
+#include <at91/utility/hamming.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PAGE_SIZE 2048
+#define BENCH_PAGES 20000 // per measurement
+
+static unsigned char page[PAGE_SIZE+4], copy[PAGE_SIZE+4];
+
+// Compute256 as it was before the word-parallel version
+static unsigned char OldCountBits(unsigned char b) {
+	unsigned char n = 0;
+	while( b ) { n += b&1; b >>= 1; }
+	return n;
+}
+
+static void OldCompute256(const unsigned char *data, unsigned char *code) {
+	unsigned int i;
+	unsigned char columnSum = 0, evenLine = 0, oddLine = 0, evenColumn = 0, oddColumn = 0;
+	for(i=0; i<256; ++i) {
+		columnSum ^= data[i];
+		if( OldCountBits(data[i])&1 ) { evenLine ^= 255-i; oddLine ^= i; }
+	}
+	for(i=0; i<8; ++i) {
+		if( columnSum&1 ) { evenColumn ^= 7-i; oddColumn ^= i; }
+		columnSum >>= 1;
+	}
+	code[0] = code[1] = code[2] = 0;
+	for(i=0; i<4; ++i) {
+		code[0] = (code[0]<<2) | ((oddLine&0x80) ? 2 : 0) | ((evenLine&0x80) ? 1 : 0);
+		code[1] = (code[1]<<2) | ((oddLine&0x08) ? 2 : 0) | ((evenLine&0x08) ? 1 : 0);
+		code[2] = (code[2]<<2) | ((oddColumn&0x04) ? 2 : 0) | ((evenColumn&0x04) ? 1 : 0);
+		oddLine <<= 1; evenLine <<= 1; oddColumn <<= 1; evenColumn <<= 1;
+	}
+	code[0] = ~code[0]; code[1] = ~code[1]; code[2] = ~code[2];
+}
+
+static void OldCompute256x(const unsigned char *data, unsigned int size, unsigned char *code) {
+	for(; size>0; size -= 256, data += 256, code += 3) OldCompute256(data,code);
+}
+
+static int check() {
+	unsigned int n, i, a, bit;
+	int fails = 0;
+	unsigned char code[3*PAGE_SIZE/256], ref[3*PAGE_SIZE/256], r;
+	srand(1);
+	for(n=0; n<2000; ++n) for(a=0; a<4; ++a) {
+		// random, sparse and constant blocks
+		for(i=0; i<sizeof(page); ++i) page[i] = n%3==0 ? rand() : n%3==1 ? (rand()%50 ? 0 : rand()) : n;
+		Hamming_Compute256x(page+a,PAGE_SIZE,code);
+		OldCompute256x(page+a,PAGE_SIZE,ref);
+		if( memcmp(code,ref,sizeof(code)) ) { if( fails<10 ) printf("code n=%u align=%u FAILED\n",n,a); ++fails; }
+		if( Hamming_Verify256x(page+a,PAGE_SIZE,code)!=0 ) { printf("verify n=%u FAILED\n",n); ++fails; }
+	}
+	// every single bit error in a block, and in its code
+	memcpy(copy,page,sizeof(page));
+	Hamming_Compute256x(page,256,code);
+	for(bit=0; bit<256*8; ++bit) {
+		page[bit/8] ^= 1<<(bit%8);
+		r = Hamming_Verify256x(page,256,code);
+		if( r!=Hamming_ERROR_SINGLEBIT || memcmp(page,copy,256) ) { printf("bit %u not corrected\n",bit); ++fails; }
+		memcpy(page,copy,256);
+	}
+	for(bit=0; bit<24; ++bit) {
+		code[bit/8] ^= 1<<(bit%8);
+		r = Hamming_Verify256x(page,256,code);
+		if( r!=Hamming_ERROR_ECC ) { printf("code bit %u: %u\n",bit,r); ++fails; }
+		code[bit/8] ^= 1<<(bit%8);
+	}
+	page[3] ^= 0x11;
+	if( Hamming_Verify256x(page,256,code)!=Hamming_ERROR_MULTIPLEBITS ) { printf("double bit not detected\n"); ++fails; }
+	return fails;
+}
+
+typedef void (*ComputeFunc)(const unsigned char*, unsigned int, unsigned char*);
+
+static double bench(ComputeFunc f, unsigned char *code) {
+	unsigned int i;
+	clock_t t = clock();
+	for(i=0; i<BENCH_PAGES; ++i) f(page,PAGE_SIZE,code);
+	double s = (double)(clock()-t)/CLOCKS_PER_SEC;
+	return s>0 ? BENCH_PAGES*(double)PAGE_SIZE/s/1e6 : 0;
+}
+
+static void verify(const unsigned char *data, unsigned int size, unsigned char *code) {
+	Hamming_Verify256x((unsigned char*)data,size,code);
+}
+
+int main() {
+	static unsigned char code[3*PAGE_SIZE/256];
+	int fails = check();
+	printf("%s\n",fails ? "check FAILED" : "check ok");
+	printf("MB/s over %uB pages: old compute %.0f",PAGE_SIZE,bench(OldCompute256x,code));
+	printf(", new compute %.0f",bench(Hamming_Compute256x,code));
+	printf(", verify %.0f\n",bench(verify,code));
+	return fails!=0;
+}
+
+#endif
@@ -0,0 +1,210 @@
+// Host stress benchmark of pvPortMalloc/vPortFree from hal/freertos/src/portable/MemMang/standardMemMang.c.
+// Build and run on the development machine:  make heap-bench && ./heap-bench
+//
+// Replays an allocation pattern like the one of the application: log lines queued to the
+// log task and freed in bursts, escaped KISS frames freed at the next transmission, power
+// manager requests and reply strings, uxTaskGetSystemState arrays, long lived timers, and
+// now and then a task stack. Every block is filled and checked when freed. The same sequence
+// runs on the size-class heap and on the C library malloc: time per operation (mean, 99.9%,
+// worst) and heap footprint. Then a burst of small blocks checks the heapCLASS_MAX_BYTES bound.
+// Target numbers: TEST_HEAP_BENCH in DevelTest.c.
+
+// Only built by the heap-bench make target (Eclipse compiles every file in src/)
+#ifdef HEAP_BENCH_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// standardMemMang.c is compiled in here over a static arena, with the kernel calls it makes
+#define ARENA_SIZE (8*1024*1024)
+static char arena[ARENA_SIZE];
+#define heapSTART (arena)
+#define heapEND (arena+ARENA_SIZE)
+#define _sbrk bench_sbrk
+#include "standardMemMang.c"
+#undef _sbrk
+
+static void* currentTask = 0;
+void vTaskSuspendAll(void) {}
+signed portBASE_TYPE xTaskResumeAll(void) { return pdFALSE; }
+portBASE_TYPE xTaskGetSchedulerState(void) { return taskSCHEDULER_RUNNING; }
+xTaskHandle xTaskGetCurrentTaskHandle(void) { return currentTask; }
+void vApplicationMallocFailedHook(void) {}
+
+#define BENCH_OPS 2000000
+#define SLOTS 4096
+
+typedef struct { unsigned int slot, size; char alloc; } Op;
+static Op ops[BENCH_OPS];
+static unsigned int nops = 0;
+static void* ptr[SLOTS];
+static unsigned int size[SLOTS];
+static double opNs[BENCH_OPS];
+
+static unsigned int freeSlot[SLOTS], nFree = 0;
+
+// The live slots of each pool in allocation order
+static unsigned int fifo[8][SLOTS], fifoHead[8], fifoTail[8];
+
+static void PoolAlloc(int pool, unsigned int sz) {
+	unsigned int s = freeSlot[--nFree];
+	ops[nops++] = (Op){s,sz,1};
+	fifo[pool][fifoTail[pool]++ % SLOTS] = s;
+}
+
+static void PoolFree(int pool, int random) {
+	unsigned int n = fifoTail[pool]-fifoHead[pool], i, s;
+	if( ! n ) return;
+	i = random ? fifoHead[pool]+rand()%n : fifoHead[pool];
+	s = fifo[pool][i % SLOTS];
+	fifo[pool][i % SLOTS] = fifo[pool][fifoHead[pool] % SLOTS];
+	fifoHead[pool]++;
+	ops[nops++] = (Op){s,0,0};
+	freeSlot[nFree++] = s;
+}
+
+static unsigned int Live(int pool) { return fifoTail[pool]-fifoHead[pool]; }
+
+enum { LOG, KISS, POWER, STATE, TIMER, STACK };
+
+static void Generate() {
+	unsigned int i, burst;
+	srand(1);
+	for(i=0; i<SLOTS; ++i) freeSlot[nFree++] = SLOTS-1-i;
+	for(i=0; i<16; ++i) PoolAlloc(TIMER,32);
+	while( nops<BENCH_OPS-64 ) {
+		switch( rand()%16 ) {
+		case 0: case 1: case 2: case 3: case 4: case 5:
+			// log line (sizeof(logQueueItem)), the log task empties the queue now and then
+			PoolAlloc(LOG,4+192);
+			if( Live(LOG)>=32 || rand()%4==0 ) for(burst=rand()%8+1; burst-- && Live(LOG); ) PoolFree(LOG,0);
+			break;
+		case 6: case 7: case 8:
+			// escaped KISS frame, freed at the next transmission
+			PoolAlloc(KISS,(rand()%240+16)*2+12);
+			while( Live(KISS)>2 ) PoolFree(KISS,0);
+			break;
+		case 9: case 10:
+			// power manager request and reply string
+			PoolAlloc(POWER,40);
+			PoolAlloc(POWER,64+rand()%448);
+			while( Live(POWER)>4 ) PoolFree(POWER,0);
+			break;
+		case 11:
+			// task list for the status log
+			PoolAlloc(STATE,12*36);
+			PoolFree(STATE,0);
+			break;
+		case 12:
+			// timer replaced
+			PoolFree(TIMER,1);
+			PoolAlloc(TIMER,32);
+			break;
+		case 13:
+			// task created and deleted (TCB and stack)
+			if( rand()%512==0 ) {
+				PoolAlloc(STACK,100);
+				PoolAlloc(STACK,4096*(1+rand()%4));
+				while( Live(STACK)>4 ) PoolFree(STACK,0);
+			}
+			break;
+		default:
+			if( Live(LOG) ) PoolFree(LOG,0);
+			break;
+		}
+	}
+}
+
+static double Now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec*1e9+t.tv_nsec;
+}
+
+static int cmp(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return x<y ? -1 : x>y;
+}
+
+typedef void* (*AllocFunc)(size_t);
+typedef void (*FreeFunc)(void*);
+
+// Returns the number of corrupted or failed blocks
+static int Run(const char* name, AllocFunc af, FreeFunc ff) {
+	unsigned int i, j, s, fails = 0;
+	size_t bytes = 0, maxBytes = 0;
+	double t, sum = 0;
+	unsigned char* p;
+	memset(ptr,0,sizeof(ptr));
+	for(i=0; i<nops; ++i) {
+		s = ops[i].slot;
+		if( ops[i].alloc ) {
+			t = Now();
+			ptr[s] = af(ops[i].size);
+			opNs[i] = Now()-t;
+			if( ! ptr[s] ) { ++fails; continue; }
+			size[s] = ops[i].size;
+			memset(ptr[s],(unsigned char)s,size[s]);
+			bytes += size[s];
+			if( bytes>maxBytes ) maxBytes = bytes;
+		} else {
+			if( ! ptr[s] ) { opNs[i] = 0; continue; }
+			for(p=ptr[s], j=0; j<size[s]; ++j) if( p[j]!=(unsigned char)s ) { ++fails; break; }
+			bytes -= size[s];
+			t = Now();
+			ff(ptr[s]);
+			opNs[i] = Now()-t;
+			ptr[s] = 0;
+		}
+		sum += opNs[i];
+	}
+	for(s=0; s<SLOTS; ++s) if( ptr[s] ) { ff(ptr[s]); ptr[s] = 0; }
+	qsort(opNs,nops,sizeof(double),cmp);
+	printf("%-10s ns/op mean %5.1f  99.9%% %6.0f  worst %7.0f   peak requested %zuKB",
+			 name,sum/nops,opNs[nops*999/1000],opNs[nops-1],maxBytes/1024);
+	return fails;
+}
+
+// Small blocks for twice heapCLASS_MAX_BYTES: the classes stop there and newlib serves the rest
+static int Burst() {
+	static xHeapStatsType st;
+	static void* p[2*heapCLASS_MAX_BYTES/64];
+	unsigned int n = sizeof(p)/sizeof(p[0]), i, fails = 0;
+	for(i=0; i<n; ++i)
+		if( (p[i]=pvPortMalloc(56)) ) memset(p[i],(unsigned char)i,56);
+	vPortGetHeapStats(&st);
+	for(i=0; i<n; ++i) {
+		if( ! p[i] || ((unsigned char*)p[i])[55]!=(unsigned char)i ) ++fails;
+		vPortFree(p[i]);
+	}
+	printf("burst of %u 56 byte blocks: classes carved %zuKB (at most %uKB), %lu served by newlib\n",
+			 n,st.xClassBytes/1024,heapCLASS_MAX_BYTES/1024,st.ulClassOverflows);
+	return fails+(st.xClassBytes>heapCLASS_MAX_BYTES || ! st.ulClassOverflows);
+}
+
+int main() {
+	static xHeapStatsType st;
+	unsigned int i;
+	int fails;
+	Generate();
+	printf("%u operations\n",nops);
+	fails = Run("malloc",malloc,free);
+	printf("\n");
+	fails += Run("size class",pvPortMalloc,vPortFree);
+	vPortGetHeapStats(&st);
+	printf("   heap used %zuKB (classes %zuKB, large %zuKB in use)\n",
+			 (ARENA_SIZE-st.xHeapRemaining)/1024,st.xClassBytes/1024,st.xLargeBytes/1024);
+	printf("class    blocks  maxInUse    allocs\n");
+	for(i=0; i<heapNUM_CLASSES; ++i)
+		if( st.xClass[i].ulAllocs )
+			printf("%5zu %9lu %9lu %9lu\n",st.xClass[i].xBlockSize,st.xClass[i].ulBlocks,st.xClass[i].ulMaxInUse,st.xClass[i].ulAllocs);
+	printf("large allocs %lu, failures %lu, bad frees %lu, largest free block %zu, free %zu\n",
+			 st.ulLargeAllocs,st.ulFailures,st.ulBadFrees,st.xLargestFreeBlock,xPortGetFreeHeapSize());
+	fails += Burst();
+	printf("%s\n",fails ? "check FAILED" : "check ok");
+	return fails!=0;
+}
+
+#endif
@@ -0,0 +1,276 @@
+// Host benchmark of HstxsManager.c against a simulated HSTXS SPI slave.
+// Build and run on the development machine:  make hstxs-bench && ./hstxs-bench [fifo frames] [frames/s on air]
+//
+// The slave has a TX FIFO of a few frames and sends one frame on air every 1/rate secs: the next
+// one of the FIFO, or an idle frame when it is empty (an underrun while a stream runs). TX ready is
+// high while the FIFO has room. A sendframe takes the SPI bus for the 223 bytes at 10MHz, and the
+// frame enters the FIFO when the transfer ends; the slave checks that the frame was not changed
+// during the transfer and that the data arrive in order.
+//
+// Each source streams 1MB, once the way a caller would do it today (fill a frame, poll TX ready
+// every tick, sendframe blocking) and once through HstxsPump with the waits of its task. In the
+// streamer run every FAIL_EVERY-th sendframe fails FAIL_RUN times in a row (SPI error): the task
+// backs off and sends the frame again.
+// Time is simulated: the source, the SPI transfer and the waits advance it by their modeled cost.
+
+// Only built by the hstxs-bench make target (Eclipse compiles every file in src/)
+#ifdef HSTXS_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <satellite-subsystems/isis_hstxs_v2.h>
+#include <satellite-subsystems/isis_hstxs_v2_spi.h>
+#include "HstxsManager.h"
+
+#define FRAME_SIZE 223
+#define SPI_US (FRAME_SIZE*8/10+20) // 10MHz + DMA setup
+#define SENDFRAME_US 15 // queueing the transfer
+#define I2C_US 600 // idle frame counter read
+#define IRQ_US 30 // TX ready interrupt to the task running
+#define PUMP_US 5
+#define TICK_US 1000
+#define STREAM_BYTES (1024*1024)
+#define FAIL_EVERY 1000
+#define FAIL_RUN 3
+
+portTickType hstxsBenchTicks = 0; // ms
+static unsigned long long now = 0; // us
+
+typedef struct {
+	unsigned int depth, frameUs; // FIFO frames, time of a frame on air
+	unsigned int fifo;
+	unsigned long long nextSlot; // next frame goes on air
+	char spiBusy;
+	unsigned long long spiEnd;
+	const isis_hstxs_spi__sendframe__to_t* spiFrame;
+	unsigned char spiCopy[FRAME_SIZE];
+	unsigned char queue[64][HSTXS_FRAME_DATA]; // FIFO contents
+	unsigned int qHead;
+	unsigned int idle, dataOnAir, overflows, corrupt, outOfOrder;
+	unsigned int streamIdle; // idle frames between the first and the last data frame on air
+	unsigned long long expect; // stream offset of the next data on air
+	unsigned long long firstAir, lastAir;
+	char injectFails;
+	unsigned int sends, fails, failRun; // failRun: failures left of the current run
+} Slave;
+
+static Slave hs;
+
+static unsigned char pattern(unsigned long long off) { return (unsigned char)(off*7+(off>>8)); }
+
+static void slotOnAir() {
+	unsigned int i, n;
+	unsigned char* d;
+	if( hs.fifo==0 ) {
+		++hs.idle;
+		if( hs.dataOnAir && hs.expect<STREAM_BYTES ) ++hs.streamIdle;
+		return;
+	}
+	d = hs.queue[hs.qHead];
+	hs.qHead = (hs.qHead+1)%64;
+	--hs.fifo;
+	if( hs.dataOnAir++==0 ) hs.firstAir = now;
+	hs.lastAir = now;
+	n = STREAM_BYTES-hs.expect<HSTXS_FRAME_DATA ? (unsigned int)(STREAM_BYTES-hs.expect) : HSTXS_FRAME_DATA;
+	for(i=0; i<n; ++i) if( d[i]!=pattern(hs.expect+i) ) { ++hs.outOfOrder; break; }
+	hs.expect += n;
+}
+
+static void spiDone() {
+	hs.spiBusy = 0;
+	if( memcmp(hs.spiCopy,hs.spiFrame->raw,FRAME_SIZE) ) ++hs.corrupt; // buffer reused during the DMA
+	if( hs.fifo>=hs.depth ) { ++hs.overflows; return; }
+	memcpy(hs.queue[(hs.qHead+hs.fifo)%64],hs.spiCopy+6,HSTXS_FRAME_DATA);
+	++hs.fifo;
+}
+
+// Run the slave until t
+static void advanceTo(unsigned long long t) {
+	for(;;) {
+		if( hs.spiBusy && hs.spiEnd<=hs.nextSlot && hs.spiEnd<=t ) { now = hs.spiEnd; spiDone(); }
+		else if( hs.nextSlot<=t ) { now = hs.nextSlot; slotOnAir(); hs.nextSlot += hs.frameUs; }
+		else break;
+	}
+	now = t;
+	hstxsBenchTicks = (portTickType)(now/1000);
+}
+static void advance(unsigned long long us) { advanceTo(now+us); }
+static void nextTick() { advanceTo((now/TICK_US+1)*TICK_US); }
+
+
+////////////////////////////////////////////////////////////////////////////////
+// HSTXS drivers
+
+driver_error_t isis_hstxs_spi__gettxready(uint8_t* pin_value) {
+	*pin_value = hs.fifo<hs.depth;
+	return driver_error_none;
+}
+
+driver_error_t isis_hstxs_spi__sendframe(isis_hstxs_spi__sendframe__to_t* frame, Boolean blocking) {
+	if( hs.fifo>=hs.depth ) return driver_error_spi; // the driver checks TX ready first
+	if( hs.injectFails && (hs.failRun || ++hs.sends%FAIL_EVERY==0) ) {
+		hs.failRun = hs.failRun ? hs.failRun-1 : FAIL_RUN-1;
+		++hs.fails;
+		advance(SENDFRAME_US);
+		return driver_error_spi;
+	}
+	advance(SENDFRAME_US);
+	if( hs.spiBusy ) advanceTo(hs.spiEnd); // one transfer queued after the other
+	hs.spiBusy = 1;
+	hs.spiEnd = now+SPI_US;
+	hs.spiFrame = frame;
+	memcpy(hs.spiCopy,frame->raw,FRAME_SIZE);
+	if( blocking!=FALSE ) advanceTo(hs.spiEnd);
+	return driver_error_none;
+}
+
+driver_error_t isis_hstxs_v2__get_virtual_channel_counter_0(uint8_t index, uint32_t* count_out) {
+	advance(I2C_US);
+	*count_out = hs.idle;
+	return driver_error_none;
+}
+
+int hstxsBenchSpiIdle(void) { return ! hs.spiBusy; }
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Sources: modeled time to produce a frame
+
+typedef struct {
+	const char* name;
+	unsigned int frameUs; // per frame
+	unsigned int sectorUs; // each new 512 byte sector read from the card
+	unsigned int slowBytes, slowUs; // every slowBytes a slow read (FAT lookup, card busy)
+	unsigned long long off;
+} Source;
+
+static int sourceRead(unsigned char* data, unsigned int max, void* privData) {
+	Source* s = privData;
+	unsigned int i, n;
+	if( ! data ) return 0;
+	n = STREAM_BYTES-s->off<max ? (unsigned int)(STREAM_BYTES-s->off) : max;
+	if( n==0 ) return 0;
+	advance(s->frameUs);
+	if( s->sectorUs ) advance((unsigned long long)s->sectorUs*((s->off+n-1)/512-(s->off ? (s->off-1)/512 : -1ULL)));
+	if( s->slowBytes && (s->off+n)/s->slowBytes!=s->off/s->slowBytes ) advance(s->slowUs);
+	for(i=0; i<n; ++i) data[i] = pattern(s->off+i);
+	s->off += n;
+	return (int)n;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	unsigned int bytesPerSec, underruns, readyWaits, blockedMs;
+	unsigned int pumps; // HstxsPump calls
+	int ok;
+} Result;
+
+static void slaveInit(unsigned int depth, unsigned int rate) {
+	memset(&hs,0,sizeof(hs));
+	hs.depth = depth;
+	hs.frameUs = 1000000/rate;
+	now = 0;
+	hstxsBenchTicks = 0;
+	hs.nextSlot = hs.frameUs;
+}
+
+static void slaveResult(Result* r) {
+	unsigned long long us;
+	advance((unsigned long long)(hs.fifo+2)*hs.frameUs); // what is left in the FIFO
+	us = hs.lastAir-hs.firstAir;
+	r->bytesPerSec = us ? (unsigned int)((unsigned long long)(STREAM_BYTES-HSTXS_FRAME_DATA)*1000000/us) : 0;
+	r->underruns = hs.streamIdle;
+	r->ok = hs.expect==STREAM_BYTES && !hs.corrupt && !hs.outOfOrder && !hs.overflows;
+}
+
+// What a caller does without the streamer: the task stalls in each sendframe and TX ready poll
+static void runBlocking(Source src, unsigned int depth, unsigned int rate, Result* r) {
+	isis_hstxs_spi__sendframe__to_t f;
+	unsigned long long blocked = 0, t;
+	uint8_t ready;
+	int n;
+	memset(r,0,sizeof(*r));
+	slaveInit(depth,rate);
+	while( (n=sourceRead(f.fields.data,HSTXS_FRAME_DATA,&src))>0 ) {
+		memset(f.fields.data+n,0,HSTXS_FRAME_DATA-n);
+		memset(&f.fields.header,0,sizeof(f.fields.header));
+		t = now;
+		for(;;) {
+			isis_hstxs_spi__gettxready(&ready);
+			if( ready ) break;
+			++r->readyWaits;
+			nextTick();
+		}
+		isis_hstxs_spi__sendframe(&f,TRUE);
+		blocked += now-t;
+	}
+	r->blockedMs = (unsigned int)(blocked/1000);
+	slaveResult(r);
+}
+
+static void runStreamer(Source src, unsigned int depth, unsigned int rate, Result* r, HstxsManagerReport* rep) {
+	unsigned long long spin;
+	memset(r,0,sizeof(*r));
+	slaveInit(depth,rate);
+	hs.injectFails = 1;
+	HstxsManagerStart(sourceRead,&src);
+	for(;;) {
+		++r->pumps;
+		switch( HstxsPump() ) {
+			case HSTXS_WAIT_NONE: advance(PUMP_US); continue;
+			case HSTXS_WAIT_READY:
+				// the pin rises when the next frame goes on air
+				if( hs.fifo>=hs.depth ) advanceTo(hs.nextSlot+IRQ_US);
+				else advance(IRQ_US);
+				break;
+			case HSTXS_WAIT_SPI:
+				spin = now+HSTXS_SPI_SPIN_US;
+				if( hs.spiBusy && hs.spiEnd<=spin ) advanceTo(hs.spiEnd);
+				else { advanceTo(spin); if( hs.spiBusy ) nextTick(); }
+				break;
+			case HSTXS_WAIT_ERROR: // vTaskDelay
+				advanceTo((now/TICK_US+HstxsErrorBackoffMs()*1000/TICK_US)*TICK_US);
+				break;
+			case HSTXS_WAIT_START:
+				HstxsManagerGet(rep);
+				r->readyWaits = rep->readyWaits;
+				slaveResult(r);
+				if( rep->sendErrors!=hs.fails ) r->ok = 0;
+				return;
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	Source sources[] = {
+		{ "telemetry", 20, 0, 0, 0 }, // from RAM
+		{ "file", 30, 350, 32768, 4000 }, // SD card: a sector read every 512 bytes, a FAT lookup every cluster
+		{ "slowfile", 30, 350, 16384, 12000 }, // card busy erasing
+	};
+	unsigned int rates[] = { 1000, 2000, 3000 };
+	unsigned int depth = argc>1 ? (unsigned int)atoi(argv[1]) : 8;
+	unsigned int i, j;
+	int fail = 0;
+	Result b, s;
+	HstxsManagerReport rep;
+	if( argc>2 ) { rates[0] = (unsigned int)atoi(argv[2]); }
+	if( depth<1 || depth>64 || rates[0]<1 ) { fprintf(stderr,"usage: %s [fifo frames 1..64] [frames/s on air]\n",argv[0]); return 1; }
+	printf("HSTXS FIFO %u frames, SPI %uus/frame, %u bytes streamed\n",depth,SPI_US,STREAM_BYTES);
+	for(j=0; j<(argc>2 ? 1 : sizeof(rates)/sizeof(rates[0])); ++j) {
+		printf("%u frames/s on air (%u bytes/s max)\n",rates[j],rates[j]*HSTXS_FRAME_DATA);
+		for(i=0; i<sizeof(sources)/sizeof(sources[0]); ++i) {
+			runBlocking(sources[i],depth,rates[j],&b);
+			runStreamer(sources[i],depth,rates[j],&s,&rep);
+			printf("  %-9s blocking: %7u bytes/s underruns=%5u readyPolls=%5u stalled=%5ums %s | streamer: %7u bytes/s (reported %7u) underruns=%5u (reported %5u) readyWaits=%5u spiWaits=%5u sendErrors=%3u pumps=%6u maxGap=%2ums %s\n",
+					 sources[i].name,b.bytesPerSec,b.underruns,b.readyWaits,b.blockedMs,b.ok ? "ok" : "DATA BAD",
+					 s.bytesPerSec,rep.bytesPerSec,s.underruns,rep.underruns,rep.readyWaits,rep.spiWaits,rep.sendErrors,s.pumps,rep.maxGapMs,s.ok ? "ok" : "DATA BAD");
+			fail |= !b.ok || !s.ok;
+		}
+	}
+	return fail;
+}
+
+#endif
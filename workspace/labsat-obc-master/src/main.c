@@ -10,10 +10,12 @@
 #include <hal/boolean.h>
 #include <hal/Utility/util.h>
 #include <hal/version/version.h>
+#include <hal/Drivers/I2C.h>
 // cpu includes
 #include <at91/utility/trace.h>
 #include <at91/peripherals/cp15/cp15.h>
 #include <at91/utility/exithandler.h>
+#include <at91/peripherals/pio/pio_it.h>
 #include <at91/commons.h>
 // project includes
 #include "ObcGlobals.h"
@@ -22,6 +24,14 @@
 #include "LogManager.h"
 #include "CSPManager.h"
 #include "SDManager.h"
+#include "FRAMJournal.h"
+#include "NORStore.h"
+#include "RunTimeStats.h"
+#include "StackMonitor.h"
+#include "SliceMonitor.h"
+#include "IdleSleep.h"
+#include "TrxvuManager.h"
+#include "HstxsManager.h"
 #include "DevelTest.h"
 // Misc includes
 #include <stdlib.h>
@@ -73,12 +83,41 @@ void InitTask(void* args) {
 
 	LogManagerInit();
 
+	// persistent state, replayed from FRAM
+	FRAMJournalInit();
+	// mode, parameters and error log in NOR flash (sectors holding other data wait for NORStoreFormat)
+	NORStoreInit();
+
 	// Needs the scheduler to be already started
 	TimerManagerInit(0);
+	// periodic write back of the SD sector cache
+	TimerManagerAdd(0,SDManagerFlush,SD_FLUSH_INTERVAL,INFINITE_REPEAT,NULL,"SDManagerFlush");
+	// background compaction of the FRAM journal
+	TimerManagerAdd(0,FRAMJournalCompact,FRAMJOURNAL_COMPACT_INTERVAL,INFINITE_REPEAT,NULL,"FRAMJournalCompact");
+	// per task CPU load
+	RunTimeStatsInit();
+	TimerManagerAdd(0,RunTimeStatsSample,RTS_SAMPLE_INTERVAL,INFINITE_REPEAT,NULL,"RunTimeStatsSample");
+	// run slices over budget of the cooperative scheduler (kernel built with the hook)
+	if( SliceMonitorInit()==0 )
+		TimerManagerAdd(0,SliceMonitorCheck,SLICE_CHECK_INTERVAL,INFINITE_REPEAT,NULL,"SliceMonitorCheck");
+	// processor sleep when no task is ready
+	IdleSleepInit();
+	TimerManagerAdd(0,IdleSleepSample,IDLE_SAMPLE_INTERVAL,INFINITE_REPEAT,NULL,"IdleSleepSample");
+	// stack high-water marks, kept in the FRAM journal
+	StackMonitorInit();
+	TimerManagerAdd(0,StackMonitorSample,SM_SAMPLE_INTERVAL,INFINITE_REPEAT,NULL,"StackMonitorSample");
+
+	// I2C bus (EPS, TRXVU, HSTXS) and PIO line interrupts (TRXVU frame ready, HSTXS TX ready)
+	if( I2C_start(I2C_BUS_SPEED,I2C_TRANSFER_TIMEOUT) ) UPLOG_ERR("InitTask I2C_start failed");
+	PIO_InitializeInterrupts(AT91C_AIC_PRIOR_LOWEST+4);
 
 	PowerManagerInit();
 
 	CSPManagerInit(CSP_UART_BUS);
+	// uplink frames to CSP (after csp_init)
+	TrxvuManagerInit();
+	// S-band downlink streamer (-1 until its wiring is confirmed, HSTXS_ENABLED)
+	HstxsManagerInit();
 
 	// TaskManagerInit();
 
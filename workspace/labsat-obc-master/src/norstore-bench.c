@@ -0,0 +1,308 @@
+// Power-loss harness of NORStore.c on the development machine.
+// Build and run:  make norstore-bench && ./norstore-bench
+//
+// The simulated NOR flash only clears bits when programmed and is set back to 0xFF a sector at a
+// time. Programming a 16 bit word takes WORD_US and a sector erase ERASE_US (typical figures of
+// the bottom-boot NOR of the OBC: check them against its datasheet); reads are not timed.
+//
+// - Opening: sectors holding other data must be left as they are (NS_ERR_NOSTORE) until
+//   NORStoreFormat, erased sectors are taken without erasing them.
+// - Power losses: CUTS runs of random puts (some of an unchanged value) and error log entries,
+//   each cut at a random flash program or erase. A cut program leaves part of the data written, a
+//   cut erase leaves the sector part preprogrammed to 0 and part erased. After each cut the store
+//   is opened again: every key must read back its last acknowledged value or the one being
+//   written, and the error log must read back in order up to the last entry added.
+// - Update latency: UPDATES puts and log entries without cuts, timed by the simulated flash.
+
+// Only built by the norstore-bench make target (Eclipse compiles every file in src/)
+#ifdef NORSTORE_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <freertos/FreeRTOS.h>
+#include <hal/checksum.h>
+#include <hal/Timing/Time.h>
+#include "NORStore.h"
+
+#define SECTOR 8192 // NORFLASH_SMALL_SECTOR_SIZE
+#define FLASH_SIZE (8*SECTOR) // SA0..SA7, the small sectors
+#define STORE_FIRST (4*SECTOR) // MODE_STORAGE_SECTOR (SA4): the store takes SA4..SA7
+#define WORD_US 6
+#define ERASE_US 500000
+#define KEYS 16
+#define MAX_LEN 48 // longest value put
+#define LOG_CODE 0x0100
+#define CUTS 2000
+#define CUT_SPAN 3000 // a run is cut within this many flash operations
+#define UPDATES 100000
+
+struct NorFlash;
+unsigned char norBenchFlash[FLASH_SIZE];
+portTickType norBenchTicks = 0;
+static unsigned long long benchUs = 0;
+static unsigned int benchClock = 1500000000;
+static unsigned int rnd = 12345;
+
+// power cut
+static jmp_buf powerLoss;
+static unsigned int events, cutAt; // cutAt 0: no cut
+static unsigned int erases;
+
+typedef struct {
+	unsigned int len; // 0: never acknowledged
+	unsigned char data[MAX_LEN];
+} Value;
+
+static Value acked[KEYS], pending;
+static int pendingKey; // -1: no put running
+static unsigned int logAcked, logPending; // log entry numbers, 0: none
+
+static unsigned int random32() {
+	rnd ^= rnd<<13; rnd ^= rnd>>17; rnd ^= rnd<<5;
+	return rnd;
+}
+
+static void spend(unsigned long long us) {
+	benchUs += us;
+	norBenchTicks = (portTickType)(benchUs/1000/portTICK_RATE_MS);
+}
+
+static int powerEvent() {
+	return cutAt && ++events==cutAt;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// fakes of the hal functions NORStore.c uses
+
+int NORflash_start(void) { return 0; }
+
+unsigned char NORFLASH_WriteData(struct NorFlash* norFlash, unsigned int address, unsigned char* buffer, unsigned int size) {
+	unsigned int i;
+	if( address+size>FLASH_SIZE ) return 1;
+	if( powerEvent() ) {
+		size = random32()%(size+1);
+		for(i=0; i<size; ++i) norBenchFlash[address+i] &= buffer[i];
+		if( address+size<FLASH_SIZE ) norBenchFlash[address+size] &= buffer[size] | random32(); // the byte being written
+		longjmp(powerLoss,1);
+	}
+	for(i=0; i<size; ++i) norBenchFlash[address+i] &= buffer[i];
+	spend((size+1)/2*WORD_US);
+	return 0;
+}
+
+unsigned char NORFLASH_EraseSector(struct NorFlash* norFlash, unsigned int sectorAddr) {
+	unsigned int n;
+	if( sectorAddr%SECTOR || sectorAddr>=FLASH_SIZE ) return 1;
+	if( powerEvent() ) {
+		n = random32()%SECTOR;
+		if( random32() & 1 ) memset(norBenchFlash+sectorAddr,0,n); // preprogramming
+		else memset(norBenchFlash+sectorAddr,0xFF,n);
+		longjmp(powerLoss,1);
+	}
+	++erases;
+	memset(norBenchFlash+sectorAddr,0xFF,SECTOR);
+	spend(ERASE_US);
+	return 0;
+}
+
+int Time_getUnixEpoch(unsigned int* epochTime) { *epochTime = benchClock; return 0; }
+
+void checksum_prepareLUTCRC16(unsigned short polynomial, unsigned short* LUT) {
+	unsigned int i, b, crc;
+	for(i=0; i<256; ++i) {
+		for(crc=i<<8, b=0; b<8; ++b) crc = crc & 0x8000 ? (crc<<1)^polynomial : crc<<1;
+		LUT[i] = (unsigned short)crc;
+	}
+}
+unsigned short checksum_calculateCRC16LUT(const unsigned char* data, unsigned int length, const unsigned short* LUT,
+														unsigned short start_remainder, Boolean endofdata) {
+	unsigned short crc = start_remainder;
+	while( length-- ) crc = (unsigned short)(crc<<8) ^ LUT[((crc>>8) ^ *data++) & 0xFF];
+	return crc;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned short keyOf(int k) {
+	return k ? NS_KEY_PARAM_BASE+k : NS_KEY_MODE;
+}
+
+// Put a random value (the last one again one time in 8) on a random key
+static int putOne() {
+	int k = random32()%KEYS, err;
+	unsigned int i;
+	if( acked[k].len && random32()%8==0 ) {
+		pending = acked[k];
+	} else {
+		pending.len = 1+random32()%MAX_LEN;
+		for(i=0; i<pending.len; ++i) pending.data[i] = (unsigned char)random32();
+	}
+	pendingKey = k;
+	if( (err=NORStorePut(keyOf(k),pending.data,pending.len)) ) return err;
+	acked[k] = pending;
+	pendingKey = -1;
+	return 0;
+}
+
+static int logOne() {
+	unsigned char d[8];
+	int err;
+	logPending = logAcked+1;
+	memset(d,0,sizeof(d));
+	memcpy(d,&logPending,4);
+	++benchClock;
+	if( (err=NORStoreLogAdd(LOG_CODE,d,4+random32()%5)) ) return err;
+	logAcked = logPending;
+	logPending = 0;
+	return 0;
+}
+
+static int update() {
+	return random32()%7==0 ? logOne() : putOne();
+}
+
+typedef struct {
+	unsigned int n, last;
+	char bad;
+} LogCheck;
+
+static int logEntry(unsigned short code, unsigned int time, const void* data, unsigned int len, void* priv) {
+	LogCheck* c = (LogCheck*)priv;
+	unsigned int no;
+	memcpy(&no,data,4);
+	if( code!=LOG_CODE || len<4 || no<=c->last ) c->bad = 1;
+	c->last = no;
+	++c->n;
+	return 0;
+}
+
+// Values and log against what was acknowledged. Returns 0 if they match.
+static int check(unsigned int cut) {
+	unsigned char v[MAX_LEN];
+	LogCheck lc;
+	int k, len;
+	for(k=0; k<KEYS; ++k) {
+		len = NORStoreGet(keyOf(k),v,sizeof(v));
+		if( k==pendingKey && len==(int)pending.len && ! memcmp(v,pending.data,len) ) {
+			acked[k] = pending;
+		} else if( acked[k].len ? len!=(int)acked[k].len || memcmp(v,acked[k].data,len) : len!=NS_ERR_NOTFOUND ) {
+			printf("cut %u: key 0x%04X reads %d bytes, %u acknowledged\n",cut,keyOf(k),len,acked[k].len);
+			return -1;
+		}
+	}
+	pendingKey = -1;
+	memset(&lc,0,sizeof(lc));
+	NORStoreLogRead(logEntry,&lc);
+	if( logPending && lc.last==logPending ) logAcked = logPending;
+	logPending = 0;
+	if( lc.bad || lc.last!=logAcked ) {
+		printf("cut %u: error log of %u entries ends at %u, %u acknowledged%s\n",cut,lc.n,lc.last,logAcked,lc.bad ? ", out of order" : "");
+		return -1;
+	}
+	return 0;
+}
+
+static void fresh() {
+	memset(acked,0,sizeof(acked));
+	pendingKey = -1;
+	logAcked = logPending = 0;
+	cutAt = 0;
+}
+
+// Sectors with other data are left alone until NORStoreFormat
+static int opening() {
+	static unsigned char before[FLASH_SIZE];
+	unsigned char v[4];
+	int fail = 0, i;
+	memset(norBenchFlash,0xFF,FLASH_SIZE);
+	for(i=STORE_FIRST+2*SECTOR; i<FLASH_SIZE; ++i) norBenchFlash[i] = (unsigned char)(i*7); // error log sectors
+	memcpy(before,norBenchFlash,FLASH_SIZE);
+	erases = 0;
+	fresh();
+	fail |= NORStoreInit()!=NS_ERR_NOSTORE || erases || memcmp(before+STORE_FIRST+2*SECTOR,norBenchFlash+STORE_FIRST+2*SECTOR,2*SECTOR);
+	fail |= NORStoreLogAdd(LOG_CODE,v,4)!=NS_ERR_NOSTORE || putOne() || check(0); // values: erased sectors taken
+	for(i=STORE_FIRST; i<FLASH_SIZE; ++i) norBenchFlash[i] = (unsigned char)(i*7);
+	memcpy(before,norBenchFlash,FLASH_SIZE);
+	fresh();
+	fail |= NORStoreInit()!=NS_ERR_NOSTORE || NORStorePut(NS_KEY_MODE,v,4)!=NS_ERR_NOSTORE || NORStoreGet(NS_KEY_MODE,v,4)!=NS_ERR_NOSTORE;
+	fail |= NORStoreFormat(0)!=NS_ERR_SIZE || erases || memcmp(before,norBenchFlash,FLASH_SIZE);
+	fail |= NORStoreFormat(NORSTORE_FORMAT_CONFIRM) || erases!=4 || putOne() || logOne() || check(0);
+	fail |= NORStoreInit() || check(0);
+	printf("sectors with other data left alone until NORStoreFormat, erased ones taken: %s\n",fail ? "FAILED" : "ok");
+	return fail;
+}
+
+static int powerLosses() {
+	static unsigned int ops = 0, errors = 0; // kept across the longjmp
+	NORStoreStats st;
+	unsigned int c, puts = 0, switches = 0;
+	int failed = 0;
+	memset(norBenchFlash,0xFF,FLASH_SIZE);
+	fresh();
+	erases = 0;
+	if( NORStoreInit() ) return 1;
+	for(c=1; c<=CUTS && ! failed; ++c) {
+		events = 0;
+		cutAt = 1+random32()%CUT_SPAN;
+		if( ! setjmp(powerLoss) ) {
+			for(;;) {
+				if( update() ) ++errors;
+				++ops;
+			}
+		}
+		cutAt = 0;
+		NORStoreGetStats(&st);
+		puts += st.puts;
+		switches += st.sectorSwitches;
+		if( NORStoreInit() || check(c) ) failed = 1;
+	}
+	failed |= errors!=0;
+	printf("%u power losses in %u updates (%u puts): %u erases, %u sector switches, %u errors  %s\n",
+			 c-1,ops,puts,erases,switches,errors,failed ? "FAILED" : "ok");
+	return failed;
+}
+
+static int latency() {
+	NORStoreStats st;
+	unsigned long long t, sum[2] = {0,0}, fast[2] = {0,0}, max[2] = {0,0};
+	unsigned int n[2] = {0,0}, slow[2] = {0,0}, i, e0;
+	int log, fail = 0;
+	memset(norBenchFlash,0xFF,FLASH_SIZE);
+	fresh();
+	fail |= NORStoreInit()!=0;
+	e0 = erases;
+	for(i=0; i<UPDATES && ! fail; ++i) {
+		log = random32()%7==0;
+		t = benchUs;
+		fail |= log ? logOne() : putOne();
+		t = benchUs-t;
+		sum[log] += t; ++n[log];
+		if( t>max[log] ) max[log] = t;
+		if( t>=ERASE_US ) ++slow[log];
+		else fast[log] += t;
+	}
+	fail |= check(0);
+	NORStoreGetStats(&st);
+	printf("%u puts (%u unchanged): avg %.3fms max %.1fms, %u (%.2f%%) took a sector erase, avg %.3fms without\n",
+			 n[0],st.unchanged,sum[0]/1000.0/n[0],max[0]/1000.0,slow[0],100.0*slow[0]/n[0],fast[0]/1000.0/(n[0]-slow[0]));
+	printf("%u error log entries: avg %.3fms max %.1fms, %u took a sector erase, avg %.3fms without\n",
+			 n[1],sum[1]/1000.0/n[1],max[1]/1000.0,slow[1],fast[1]/1000.0/(n[1]-slow[1]));
+	printf("%u erases, %u KB programmed, live values %u bytes  %s\n",
+			 erases-e0,st.bytesWritten/1024,st.liveBytes,fail ? "FAILED" : "ok");
+	return fail;
+}
+
+int main(int argc, char** argv) {
+	int fail = 0;
+	printf("word program %uus, sector erase %ums\n",WORD_US,ERASE_US/1000);
+	fail |= opening();
+	fail |= powerLosses();
+	fail |= latency();
+	return fail;
+}
+
+#endif
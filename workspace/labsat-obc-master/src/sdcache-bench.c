@@ -0,0 +1,206 @@
+// Host benchmark of SDCache.c against a file-backed fake SD card.
+// Build and run on the development machine:  make sdcache-bench && ./sdcache-bench [card file]
+//
+// Each workload replays the sector accesses hcc makes for a typical use, once straight to
+// the fake card and once through the cache. The fake card counts commands and models their
+// time (fixed command overhead + per sector transfer), and after each cached run the card
+// contents are compared with the uncached run.
+
+// Only built by the sdcache-bench make target (Eclipse compiles every file in src/)
+#ifdef SDCACHE_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "SDCache.h"
+
+#define CARD_SECTORS 8192 // 4MB fake card
+#define CMD_READ_US 300 // modeled SD command overhead (incl. busy time for writes)
+#define CMD_WRITE_US 1500
+#define SECTOR_US 50 // modeled transfer time per sector at 25MHz 4 bit bus (incl. CRC, gaps)
+
+unsigned int sdcacheBenchTicks = 0; // ms, drives SDCache dirty ageing
+
+typedef struct {
+	int fd;
+	unsigned long readCmds, writeCmds, sectors;
+	unsigned long long us;
+} FakeCard;
+
+static FakeCard card;
+static F_DRIVER cardDrv;
+
+static void cardTime(unsigned long us) {
+	card.us += us;
+	sdcacheBenchTicks = (unsigned int)(card.us/1000);
+}
+
+static int cardRead(F_DRIVER* d, void* data, unsigned long sector, int cnt) {
+	if( sector+cnt>CARD_SECTORS ) return 1;
+	if( pread(card.fd,data,cnt*SDCACHE_SECTOR_SIZE,sector*SDCACHE_SECTOR_SIZE)!=cnt*SDCACHE_SECTOR_SIZE ) return 1;
+	++card.readCmds; card.sectors += cnt;
+	cardTime(CMD_READ_US+cnt*SECTOR_US);
+	return 0;
+}
+static int cardWrite(F_DRIVER* d, void* data, unsigned long sector, int cnt) {
+	if( sector+cnt>CARD_SECTORS ) return 1;
+	if( pwrite(card.fd,data,cnt*SDCACHE_SECTOR_SIZE,sector*SDCACHE_SECTOR_SIZE)!=cnt*SDCACHE_SECTOR_SIZE ) return 1;
+	++card.writeCmds; card.sectors += cnt;
+	cardTime(CMD_WRITE_US+cnt*SECTOR_US);
+	return 0;
+}
+static int cardReadSector(F_DRIVER* d, void* data, unsigned long sector) { return cardRead(d,data,sector,1); }
+static int cardWriteSector(F_DRIVER* d, void* data, unsigned long sector) { return cardWrite(d,data,sector,1); }
+static int cardGetPhy(F_DRIVER* d, F_PHY* phy) {
+	memset(phy,0,sizeof(*phy));
+	phy->number_of_sectors = CARD_SECTORS;
+	phy->bytes_per_sector = SDCACHE_SECTOR_SIZE;
+	phy->media_descriptor = F_MEDIADESC_REMOVABLE;
+	return 0;
+}
+static long cardGetStatus(F_DRIVER* d) { return 0; }
+static void cardRelease(F_DRIVER* d) { }
+
+static F_DRIVER* cardInit(unsigned long param) {
+	memset(&cardDrv,0,sizeof(cardDrv));
+	cardDrv.readsector = cardReadSector;
+	cardDrv.writesector = cardWriteSector;
+	cardDrv.readmultiplesector = cardRead;
+	cardDrv.writemultiplesector = cardWrite;
+	cardDrv.getphy = cardGetPhy;
+	cardDrv.getstatus = cardGetStatus;
+	cardDrv.release = cardRelease;
+	return &cardDrv;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Workloads: sector access patterns of hcc
+
+#define FAT_SECTOR 32
+#define DIR_SECTOR 96
+#define DATA_SECTOR 128
+
+// Append 64 byte records with f_write+f_flush (syslog, telemetry): every record rewrites
+// the partial data sector and the directory entry, and the FAT when a cluster is added.
+static int wlAppend(F_DRIVER* d) {
+	unsigned char buf[SDCACHE_SECTOR_SIZE], fat[SDCACHE_SECTOR_SIZE];
+	unsigned int rec, pos;
+	int err = 0;
+	memset(buf,0,sizeof(buf));
+	for(rec=0; rec<4000 && !err; ++rec) {
+		pos = rec*64;
+		snprintf((char*)buf+pos%SDCACHE_SECTOR_SIZE,64,"record %u",rec);
+		err |= d->writesector(d,buf,DATA_SECTOR+pos/SDCACHE_SECTOR_SIZE);
+		if( (pos+64)%SDCACHE_SECTOR_SIZE==0 ) memset(buf,0,sizeof(buf));
+		if( pos%(8*SDCACHE_SECTOR_SIZE)==0 ) {
+			err |= d->readsector(d,fat,FAT_SECTOR); // read-modify-write of the FAT
+			memcpy(fat+(rec/8)%SDCACHE_SECTOR_SIZE,&rec,1);
+			err |= d->writesector(d,fat,FAT_SECTOR);
+		}
+		buf[SDCACHE_SECTOR_SIZE-1] = (unsigned char)rec;
+		err |= d->writesector(d,buf,DIR_SECTOR); // file size in directory entry
+		buf[SDCACHE_SECTOR_SIZE-1] = 0;
+	}
+	return err;
+}
+
+// Read a 512KB file sector by sector (BTP downlink of a stored file)
+static int wlSequential(F_DRIVER* d) {
+	unsigned char buf[SDCACHE_SECTOR_SIZE];
+	unsigned long s;
+	int err = 0;
+	for(s=0; s<1024 && !err; ++s) err |= d->readsector(d,buf,2048+s);
+	return err;
+}
+
+// Write a few sectors (left dirty), then read a file sequentially: the read-ahead has to evict
+// the dirty sectors, and the sectors read must still be the ones of the card (zero here)
+static int wlEvict(F_DRIVER* d) {
+	unsigned char buf[SDCACHE_SECTOR_SIZE];
+	unsigned long s;
+	unsigned int i;
+	int err = 0;
+	memset(buf,0xEE,sizeof(buf));
+	for(s=0; s<20 && !err; ++s) err |= d->writesector(d,buf,s);
+	for(s=1000; s<1100 && !err; ++s) {
+		err |= d->readsector(d,buf,s);
+		for(i=0; i<sizeof(buf) && !buf[i]; ++i);
+		if( i<sizeof(buf) ) { fprintf(stderr,"evict: sector %lu read back wrong\n",s); err = 1; }
+	}
+	return err;
+}
+
+// Open/stat/close files repeatedly: FAT and directory sectors read over and over
+static int wlMetadata(F_DRIVER* d) {
+	unsigned char buf[SDCACHE_SECTOR_SIZE];
+	unsigned int i;
+	int err = 0;
+	srand(1);
+	for(i=0; i<5000 && !err; ++i) {
+		err |= d->readsector(d,buf,DIR_SECTOR+rand()%8);
+		err |= d->readsector(d,buf,FAT_SECTOR+rand()%4);
+		if( i%10==0 ) err |= d->writesector(d,buf,DIR_SECTOR+rand()%8);
+	}
+	return err;
+}
+
+
+static int run(const char* name, int (*wl)(F_DRIVER*), const char* cardFile) {
+	FakeCard direct;
+	F_DRIVER* d;
+	F_PHY phy;
+	SDCacheStats st;
+	char ref[256];
+	int err, ok;
+
+	// reference run straight to the card
+	snprintf(ref,sizeof(ref),"%s.ref",cardFile);
+	memset(&card,0,sizeof(card));
+	card.fd = open(ref,O_RDWR|O_CREAT|O_TRUNC,0644);
+	if( card.fd<0 || ftruncate(card.fd,(off_t)CARD_SECTORS*SDCACHE_SECTOR_SIZE) ) { perror(ref); return 1; }
+	err = wl(cardInit(0));
+	direct = card;
+
+	// cached run
+	memset(&card,0,sizeof(card));
+	card.fd = open(cardFile,O_RDWR|O_CREAT|O_TRUNC,0644);
+	if( card.fd<0 || ftruncate(card.fd,(off_t)CARD_SECTORS*SDCACHE_SECTOR_SIZE) ) { perror(cardFile); return 1; }
+	sdcacheBenchTicks = 0;
+	d = SDCacheInitFunc(0);
+	d->getphy(d,&phy);
+	err |= wl(d);
+	err |= SDCacheFlush();
+	SDCacheGetStats(0,&st,0);
+	d->release(d);
+
+	// compare card contents
+	{
+		static unsigned char a[CARD_SECTORS*SDCACHE_SECTOR_SIZE], b[CARD_SECTORS*SDCACHE_SECTOR_SIZE];
+		ok = pread(direct.fd,a,sizeof(a),0)==sizeof(a) && pread(card.fd,b,sizeof(b),0)==sizeof(b) && !memcmp(a,b,sizeof(a));
+	}
+	close(direct.fd); close(card.fd); unlink(ref);
+
+	printf("%-10s direct: cmds=%5lu (r%lu w%lu) sectors=%6lu time=%7.1fms | cached: cmds=%5lu (r%lu w%lu) sectors=%6lu time=%7.1fms hitRate=%3u%% readAheads=%u flushes=%u | speedup x%.1f %s%s\n",
+			 name,direct.readCmds+direct.writeCmds,direct.readCmds,direct.writeCmds,direct.sectors,direct.us/1000.0,
+			 card.readCmds+card.writeCmds,card.readCmds,card.writeCmds,card.sectors,card.us/1000.0,
+			 st.hits+st.misses ? 100*st.hits/(st.hits+st.misses) : 0,st.readAheads,st.flushes,
+			 card.us ? (double)direct.us/card.us : 0.0,ok ? "contents ok" : "CONTENTS DIFFER",err ? " (driver errors)" : "");
+	return !ok || err;
+}
+
+int main(int argc, char** argv) {
+	const char* cardFile = argc>1 ? argv[1] : "/tmp/sdcache-bench.img";
+	int fail = 0;
+	SDCacheLowerInit = cardInit;
+	fail |= run("append",wlAppend,cardFile);
+	fail |= run("sequential",wlSequential,cardFile);
+	fail |= run("metadata",wlMetadata,cardFile);
+	fail |= run("evict",wlEvict,cardFile);
+	unlink(cardFile);
+	return fail;
+}
+
+#endif
@@ -0,0 +1,178 @@
+// Host test of SDMirror.c against two fake SD cards in RAM.
+// Build and run on the development machine:  make sdmirror-bench && ./sdmirror-bench
+//
+// Each scenario writes through the mirror, runs the card tasks (SDMirrorPump) until they have
+// nothing left to do, and checks that both cards hold the data written, that reads through the
+// mirror return it and that every card is back in sync. A card task that still has work after
+// SETTLE_PASSES passes is reported as spinning.
+
+// Only built by the sdmirror-bench make target (Eclipse compiles every file in src/)
+#ifdef SDMIRROR_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <hcc/api_mdriver_atmel_mcipdc.h>
+#include "SDMirror.h"
+
+#define CARD_SECTORS 8192 // 4MB fake cards: 4 regions of 2048 sectors
+#define SETTLE_PASSES 100000
+
+portTickType sdmirrorBenchTicks = 0; // ms, drives the probes of failed cards
+
+typedef struct {
+	F_DRIVER drv;
+	unsigned char data[CARD_SECTORS*SDMIRROR_SECTOR_SIZE];
+	char failed; // every command fails
+	char missing; // removed
+	char changed; // reports F_ST_CHANGED once
+	unsigned long writeCmds, sectorsWritten;
+} FakeCard;
+
+static FakeCard card[SDMIRROR_CARDS];
+static unsigned char ref[CARD_SECTORS*SDMIRROR_SECTOR_SIZE]; // what was written
+
+static int cardRead(F_DRIVER* d, void* data, unsigned long sector, int cnt) {
+	FakeCard* k = d->user_ptr;
+	if( k->failed || k->missing || sector+cnt>CARD_SECTORS ) return MMC_ERR_NOTPLUGGED;
+	memcpy(data,k->data+sector*SDMIRROR_SECTOR_SIZE,cnt*SDMIRROR_SECTOR_SIZE);
+	return 0;
+}
+static int cardWrite(F_DRIVER* d, void* data, unsigned long sector, int cnt) {
+	FakeCard* k = d->user_ptr;
+	if( k->failed || k->missing || sector+cnt>CARD_SECTORS ) return MMC_ERR_NOTPLUGGED;
+	memcpy(k->data+sector*SDMIRROR_SECTOR_SIZE,data,cnt*SDMIRROR_SECTOR_SIZE);
+	++k->writeCmds; k->sectorsWritten += cnt;
+	return 0;
+}
+static int cardReadSector(F_DRIVER* d, void* data, unsigned long sector) { return cardRead(d,data,sector,1); }
+static int cardWriteSector(F_DRIVER* d, void* data, unsigned long sector) { return cardWrite(d,data,sector,1); }
+static int cardGetPhy(F_DRIVER* d, F_PHY* phy) {
+	memset(phy,0,sizeof(*phy));
+	phy->number_of_sectors = CARD_SECTORS;
+	phy->bytes_per_sector = SDMIRROR_SECTOR_SIZE;
+	phy->media_descriptor = F_MEDIADESC_REMOVABLE;
+	return 0;
+}
+static long cardGetStatus(F_DRIVER* d) {
+	FakeCard* k = d->user_ptr;
+	long st = k->missing ? F_ST_MISSING : 0;
+	if( k->changed && ! k->missing ) { st |= F_ST_CHANGED; k->changed = 0; }
+	return st;
+}
+static void cardRelease(F_DRIVER* d) { }
+
+static F_DRIVER* cardInit(unsigned long c) {
+	FakeCard* k = &card[c];
+	if( k->missing ) return 0;
+	memset(&k->drv,0,sizeof(k->drv));
+	k->drv.user_ptr = k;
+	k->drv.readsector = cardReadSector;
+	k->drv.writesector = cardWriteSector;
+	k->drv.readmultiplesector = cardRead;
+	k->drv.writemultiplesector = cardWrite;
+	k->drv.getphy = cardGetPhy;
+	k->drv.getstatus = cardGetStatus;
+	k->drv.release = cardRelease;
+	return &k->drv;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Run both card tasks until they wait for work with both cards in sync. Returns the passes, or -1
+// if a task keeps running (or a card does not come back).
+static int settle() {
+	int c, passes, idle;
+	portTickType wait, minWait;
+	for(passes=0; passes<SETTLE_PASSES; ++passes) {
+		idle = 0;
+		minWait = portMAX_DELAY;
+		for(c=0; c<SDMIRROR_CARDS; ++c) {
+			if( (wait=SDMirrorPump(c)) ) ++idle;
+			if( wait && wait<minWait ) minWait = wait;
+		}
+		if( idle<SDMIRROR_CARDS ) continue;
+		if( minWait==portMAX_DELAY ) return passes; // both cards ok, nothing queued
+		sdmirrorBenchTicks += minWait; // a card is out: wait for its probe
+	}
+	return -1;
+}
+
+// Write runs of sectors with a pattern of the pass, through the mirror, a few at a time
+static int writeSectors(F_DRIVER* d, unsigned long first, unsigned int n, unsigned char pass) {
+	unsigned char buf[4*SDMIRROR_SECTOR_SIZE];
+	unsigned int i, j, cnt;
+	int err = 0;
+	for(i=0; i<n && !err; i+=cnt) {
+		cnt = n-i<4 ? n-i : 4;
+		for(j=0; j<cnt*SDMIRROR_SECTOR_SIZE; ++j) buf[j] = (unsigned char)(pass*31+first+i+j);
+		err = d->writemultiplesector(d,buf,first+i,cnt);
+		memcpy(ref+(first+i)*SDMIRROR_SECTOR_SIZE,buf,cnt*SDMIRROR_SECTOR_SIZE);
+		// the card tasks take a write each (no scheduler here: the queue must not get full)
+		SDMirrorPump(0);
+		SDMirrorPump(1);
+	}
+	return err;
+}
+
+static int check(const char* name, F_DRIVER* d, int passes, int err) {
+	static unsigned char buf[CARD_SECTORS*SDMIRROR_SECTOR_SIZE];
+	SDMirrorStats st;
+	int ok, c;
+	SDMirrorGetStats(&st,0);
+	ok = passes>=0 && !err && 0==d->readmultiplesector(d,buf,0,CARD_SECTORS) && !memcmp(buf,ref,sizeof(ref));
+	for(c=0; c<SDMIRROR_CARDS; ++c)
+		ok &= st.card[c].state==SDMIRROR_CARD_OK && st.card[c].dirtyRegions==0 && !memcmp(card[c].data,ref,sizeof(ref));
+	printf("%-14s settled in %6d passes, card0: state=%u dirtyRegions=%u sectorsWritten=%6lu, card1: state=%u dirtyRegions=%u sectorsWritten=%6lu failures=%u %s\n",
+			 name,passes,st.card[0].state,st.card[0].dirtyRegions,card[0].sectorsWritten,
+			 st.card[1].state,st.card[1].dirtyRegions,card[1].sectorsWritten,st.card[1].failures,
+			 ok ? "ok" : passes<0 ? "SPINNING" : "CONTENTS DIFFER");
+	return !ok;
+}
+
+int main(int argc, char** argv) {
+	F_DRIVER* d;
+	int fail = 0, err, i;
+	SDMirrorLowerInit = cardInit;
+	if( !(d=SDMirrorInitFunc(0)) ) { fprintf(stderr,"mount failed\n"); return 1; }
+
+	// both cards up
+	err = writeSectors(d,0,3000,1);
+	fail |= check("mirrored",d,settle(),err);
+
+	// card 1 fails and misses writes in one region, then is replaced: the probe finds it changed
+	// and marks it all dirty while the missed region is still counted
+	card[1].failed = 1;
+	err = writeSectors(d,100,50,2);
+	SDMirrorPump(0); SDMirrorPump(1); // card 1 out of service
+	card[1].failed = 0;
+	card[1].changed = 1;
+	err |= writeSectors(d,5000,200,3);
+	fail |= check("fail+changed",d,settle(),err);
+
+	// full resync asked again while one is running
+	SDMirrorResync(1);
+	for(i=0; i<10; ++i) SDMirrorPump(1);
+	SDMirrorResync(1);
+	err = writeSectors(d,7000,100,4);
+	fail |= check("resync twice",d,settle(),err);
+
+	// card 0 removed while writing, back unchanged: only the missed regions are copied
+	card[0].missing = 1;
+	err = writeSectors(d,2100,300,5);
+	SDMirrorPump(0); SDMirrorPump(1);
+	card[0].missing = 0;
+	fail |= check("remove+back",d,settle(),err);
+
+	// the TimerManager flush only wakes the card tasks: it returns at once with the write queued
+	memset(ref+10*SDMIRROR_SECTOR_SIZE,0x77,SDMIRROR_SECTOR_SIZE);
+	err = d->writesector(d,ref+10*SDMIRROR_SECTOR_SIZE,10);
+	if( SDMirrorFlush(0)!=-1 ) { printf("flush(0) did not return with the write queued\n"); fail = 1; }
+	fail |= check("flush(0)",d,settle(),err);
+
+	d->release(d);
+	return fail;
+}
+
+#endif
@@ -0,0 +1,204 @@
+// Host tool: converts a TraceRecorder file (snapshot dump or stream) into Chrome trace JSON.
+// Build and run on the development machine:
+//   make trace2json && ./trace2json trace.bin > trace.json
+// then open trace.json in chrome://tracing or ui.perfetto.dev.
+//
+// One track per task: "run" slices between task switches, and "wait"/"delay" slices from the
+// moment a task blocked on a queue (or delayed) until it ran again, named after the queue.
+// Queue sends/receives/failures are instant events on the task doing them; the ...FromISR
+// calls and the ticks go on an "ISR" track (tid 0: task numbers start at 1).
+
+// Only built by the trace2json make target (Eclipse compiles every file in src/)
+#ifdef TRACE2JSON_HOST
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "TraceRecorder.h"
+
+#define MAX_OBJS 256
+#define ISR_TID 0
+
+typedef struct {
+	char name[TRACE_NAME_LEN+1];
+	int seen;
+	double runStart; // <0: not running
+	double waitStart; // <0: not waiting
+	int waitEvent; // TRC_BLOCKING_ON_SEND/RECEIVE or TRC_TASK_DELAY pending until switched out
+	unsigned short waitObj;
+} Task;
+
+static Task tasks[MAX_OBJS];
+static char queueNames[MAX_OBJS][TRACE_NAME_LEN+1];
+static int first = 1;
+
+static const char* QueueName(unsigned short obj) {
+	static const char* const types[] = {"queue","mutex","counting sem","binary sem","recursive mutex"};
+	static char buf[64];
+	unsigned int n = obj & 0xFF, t = obj>>8;
+	if( queueNames[n][0] ) return queueNames[n];
+	snprintf(buf,sizeof(buf),"%s %u",t<5 ? types[t] : "queue",n);
+	return buf;
+}
+
+// Names come from the target: keep only printable characters, no JSON escapes needed
+static void CopyName(char* d, const unsigned char* s, unsigned int len) {
+	unsigned int i;
+	for(i=0; i<len && s[i]; ++i) d[i] = s[i]>=' ' && s[i]<0x7F && s[i]!='"' && s[i]!='\\' ? s[i] : '?';
+	d[i] = 0;
+}
+
+static void Event(const char* fmt, ...) __attribute__((format(printf,1,2)));
+static void Event(const char* fmt, ...) {
+	va_list ap;
+	printf(first ? "\n" : ",\n");
+	first = 0;
+	va_start(ap,fmt);
+	vprintf(fmt,ap);
+	va_end(ap);
+}
+
+static const char* TaskName(unsigned int t) {
+	static char buf[32];
+	if( tasks[t].name[0] ) return tasks[t].name;
+	snprintf(buf,sizeof(buf),"task %u",t);
+	return buf;
+}
+
+static void Slice(unsigned int tid, const char* cat, const char* name, double start, double end) {
+	Event("{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"cat\":\"%s\",\"name\":\"%s\",\"ts\":%.3f,\"dur\":%.3f}",
+			tid,cat,name,start,end-start);
+}
+
+static void Instant(unsigned int tid, const char* name, const char* obj, double ts) {
+	Event("{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"name\":\"%s\",\"args\":{\"obj\":\"%s\"},\"ts\":%.3f}",
+			tid,name,obj,ts);
+}
+
+static void SwitchTo(unsigned int t, double ts, unsigned int* running) {
+	Task* r = &tasks[*running];
+	char name[96];
+	if( *running && r->runStart>=0 ) {
+		Slice(*running,"run",TaskName(*running),r->runStart,ts);
+		r->runStart = -1;
+		// blocked or delayed before being switched out
+		if( r->waitEvent ) r->waitStart = ts;
+	}
+	r = &tasks[t];
+	if( r->waitStart>=0 ) {
+		if( r->waitEvent==TRC_TASK_DELAY ) Slice(t,"wait","delay",r->waitStart,ts);
+		else {
+			snprintf(name,sizeof(name),"%s %s",r->waitEvent==TRC_BLOCKING_ON_SEND ? "send" : "receive",QueueName(r->waitObj));
+			Slice(t,"wait",name,r->waitStart,ts);
+		}
+	}
+	r->waitStart = -1;
+	r->waitEvent = 0;
+	r->seen = 1;
+	r->runStart = ts;
+	*running = t;
+}
+
+int main(int argc, char** argv) {
+	static const char* const queueEvents[TRC_EVENTS] = {
+		[TRC_QUEUE_CREATE] = "create", [TRC_QUEUE_SEND] = "send", [TRC_QUEUE_SEND_FAILED] = "send failed",
+		[TRC_QUEUE_RECEIVE] = "receive", [TRC_QUEUE_RECEIVE_FAILED] = "receive failed", [TRC_QUEUE_PEEK] = "peek",
+		[TRC_QUEUE_SEND_FROM_ISR] = "send from ISR", [TRC_QUEUE_RECEIVE_FROM_ISR] = "receive from ISR",
+	};
+	TraceRecorderFileHeader hdr;
+	TraceRecord rec;
+	FILE* f;
+	unsigned char nameBuf[TRACE_NAME_RECORDS*7];
+	unsigned int n = 0, i, j, k, last = 0, running = 0, records = 0, nameData = 0, nameKind = 0, nameNum = 0;
+	unsigned long long ticks = 0;
+	double ts = 0, end = 0;
+	char buf[64];
+	if( argc!=2 ) {
+		fprintf(stderr,"usage: %s trace-file > trace.json\n",argv[0]);
+		return 2;
+	}
+	if( !(f=fopen(argv[1],"rb")) || fread(&hdr,sizeof(hdr),1,f)!=1 || hdr.magic!=TRACE_MAGIC || hdr.version!=TRACE_VERSION || ! hdr.counterHz ) {
+		fprintf(stderr,"%s: not a trace file\n",argv[1]);
+		return 1;
+	}
+	for(i=0; i<MAX_OBJS; ++i) tasks[i].runStart = tasks[i].waitStart = -1;
+	printf("{\"traceEvents\":[");
+	Event("{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"OBC\"}}");
+	Event("{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"ISR\"}}",ISR_TID);
+	while( (! hdr.records || n<hdr.records) && fread(&rec,sizeof(rec),1,f)==1 ) {
+		++n;
+		// names: the time stamps of the names written by a dump are not in sequence
+		if( rec.event==TRC_NAME_DATA ) {
+			if( nameData ) {
+				const unsigned char* d = (const unsigned char*)&rec;
+				k = (TRACE_NAME_RECORDS-nameData)*7;
+				for(j=0; j<sizeof(rec); ++j) if( j!=offsetof(TraceRecord,event) ) nameBuf[k++] = d[j];
+				if( --nameData==0 ) {
+					if( nameKind==TRC_OBJ_TASK ) CopyName(tasks[nameNum & 0xFF].name,nameBuf,TRACE_NAME_LEN);
+					else CopyName(queueNames[nameNum & 0xFF],nameBuf,TRACE_NAME_LEN);
+				}
+			}
+			continue; // else the end of a name overwritten in the ring
+		}
+		nameData = 0;
+		if( rec.event==TRC_NAME ) {
+			nameData = TRACE_NAME_RECORDS;
+			nameKind = rec.task;
+			nameNum = rec.obj;
+			continue;
+		}
+		if( rec.event==0 || rec.event>=TRC_EVENTS ) {
+			fprintf(stderr,"record %u: bad event %u\n",n,rec.event);
+			continue;
+		}
+		// extend the 32 bit counter
+		if( records++ ) ticks += (unsigned int)(rec.time-last);
+		last = rec.time;
+		ts = ticks*1e6/hdr.counterHz;
+		switch( rec.event ) {
+		case TRC_TASK_SWITCH:
+			SwitchTo(rec.task,ts,&running);
+			break;
+		case TRC_TASK_CREATE:
+			Instant(rec.task,"create",TaskName(rec.obj & 0xFF),ts);
+			break;
+		case TRC_TASK_DELETE:
+			Instant(rec.task,"delete",TaskName(rec.obj & 0xFF),ts);
+			break;
+		case TRC_TASK_DELAY:
+		case TRC_BLOCKING_ON_SEND:
+		case TRC_BLOCKING_ON_RECEIVE:
+			tasks[rec.task].waitEvent = rec.event;
+			tasks[rec.task].waitObj = rec.obj;
+			break;
+		case TRC_QUEUE_SEND_FROM_ISR:
+		case TRC_QUEUE_RECEIVE_FROM_ISR:
+			Instant(ISR_TID,queueEvents[rec.event],QueueName(rec.obj),ts);
+			break;
+		case TRC_TICK:
+			snprintf(buf,sizeof(buf),"%u",rec.obj);
+			Instant(ISR_TID,"tick",buf,ts);
+			break;
+		case TRC_DROPPED:
+			Event("{\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%u,\"name\":\"dropped %u records\",\"ts\":%.3f}",ISR_TID,rec.obj,ts);
+			break;
+		default:
+			Instant(rec.task,queueEvents[rec.event],QueueName(rec.obj),ts);
+			break;
+		}
+		end = ts;
+	}
+	// the running task until the last record
+	if( running && tasks[running].runStart>=0 ) Slice(running,"run",TaskName(running),tasks[running].runStart,end);
+	for(i=1; i<MAX_OBJS; ++i)
+		if( tasks[i].seen || tasks[i].name[0] )
+			Event("{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",i,TaskName(i));
+	printf("\n]}\n");
+	fclose(f);
+	fprintf(stderr,"%u records, %.3f s, %u dropped\n",records,end/1e6,hdr.dropped);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,243 @@
+// Host benchmark of TrxvuManager.c against a simulated ISIS VU-E receiver.
+// Build and run on the development machine:  make trxvu-bench && ./trxvu-bench [data bytes]
+//
+// Uplink frames arrive at a fixed rate into the 40 frame receive buffer of the receiver (lost when
+// it is full). The frame-ready line is high while the buffer holds frames and drops FR_DROP_US after
+// the last remove_frame; its rising edge calls TrxvuFrameReady as the interrupt would. Each receiver
+// command takes the I2C bus for its bytes at I2C_BUS_SPEED plus the command turnaround, and the
+// frames that arrive meanwhile are not in its reply.
+//
+// Every rate runs SIM_SECS with the frame-ready interrupt and with the polling loop: the rx task
+// waits as TrxvuRxTask does (semaphore with TRXVU_RX_IDLE_TICKS timeout and TRXVU_FR_SETTLE_TICKS,
+// or TRXVU_RX_POLL_TICKS) and calls TrxvuRxPass. Frames/s, I2C commands and bytes per frame and the
+// latency are the counters of TrxvuManager.c; the receiver checks the commands and bytes it saw.
+// Time is simulated.
+
+// Only built by the trxvu-bench make target (Eclipse compiles every file in src/)
+#ifdef TRXVU_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <satellite-subsystems/isis_vu_e.h>
+#include "TrxvuManager.h"
+
+#define RX_FRAMES 40 // receive buffer of the receiver
+#define BYTE_US (9*1000000/I2C_BUS_SPEED) // 8 bits and the ack
+#define CMD_US 300 // driver and receiver turnaround of a write+read command
+#define FR_DROP_US 500
+#define IRQ_US 30 // frame-ready interrupt to the rx task running
+#define SIM_SECS 60
+
+portTickType trxvuBenchTicks = 0; // ms
+unsigned long trxvuBenchCounter = 0; // us
+static unsigned long long now = 0; // us
+
+typedef struct {
+	unsigned int rate, size; // frames/s, frame contents
+	unsigned int seq[RX_FRAMES]; // frames in the buffer
+	unsigned long long arrived[RX_FRAMES];
+	unsigned int head, count;
+	unsigned int made, lost, removed;
+	unsigned long long nextArrival;
+	char line, dropping, wake; // wake: the rx task semaphore
+	unsigned long long dropAt;
+	unsigned int cmds, bytes; // seen by the receiver
+	unsigned long long busUs, waitSum, waitMax; // waitSum, waitMax: time in the buffer
+	unsigned int delivered, expect, bad; // bad: repeated, out of order or wrong contents
+} Receiver;
+
+static Receiver vu;
+
+static void setNow(unsigned long long t) {
+	now = t;
+	trxvuBenchTicks = (portTickType)(now/1000);
+	trxvuBenchCounter = (unsigned long)now;
+}
+
+static void arrive() {
+	unsigned int i;
+	++vu.made;
+	if( vu.count>=RX_FRAMES ) { ++vu.lost; return; }
+	i = (vu.head+vu.count)%RX_FRAMES;
+	vu.seq[i] = vu.made;
+	vu.arrived[i] = now;
+	++vu.count;
+	vu.dropping = 0;
+	if( vu.line ) return; // still high: no edge
+	vu.line = 1;
+	if( TrxvuFrameReady() ) vu.wake = 1;
+}
+
+// Run the receiver until t, or until the rx task is woken if untilWake
+static void advanceTo(unsigned long long t, char untilWake) {
+	for(;;) {
+		if( untilWake && vu.wake ) break;
+		if( vu.dropping && vu.dropAt<=vu.nextArrival && vu.dropAt<=t ) {
+			setNow(vu.dropAt);
+			vu.dropping = 0;
+			vu.line = 0;
+		} else if( vu.nextArrival<=t ) {
+			setNow(vu.nextArrival);
+			arrive();
+			vu.nextArrival += 1000000/vu.rate;
+		} else {
+			setNow(t);
+			break;
+		}
+	}
+}
+static void advance(unsigned long long us) { advanceTo(now+us,0); }
+
+// vTaskDelay(ticks): to the end of the current tick and ticks-1 more
+static void delayTicks(unsigned int ticks) { advanceTo((now/1000+ticks)*1000,0); }
+
+// A receiver command: write the command byte, read reply bytes
+static void command(unsigned int reply) {
+	unsigned int us = CMD_US+(2+1+reply)*BYTE_US; // two address bytes
+	++vu.cmds;
+	vu.bytes += 1+reply;
+	vu.busUs += us;
+	advance(us);
+}
+
+// Frame contents: CSP header sized bytes with the sequence, then a pattern of it
+static void frameData(unsigned int seq, unsigned char* data) {
+	unsigned int i;
+	memset(data,0,6);
+	data[2] = seq>>24; data[3] = seq>>16; data[4] = seq>>8; data[5] = seq;
+	for(i=6; i<vu.size; ++i) data[i] = (unsigned char)(seq+i);
+}
+
+int trxvuBenchQueue(const unsigned char* frame, unsigned int len) {
+	unsigned char ref[TRXVU_FRAME_MAX];
+	unsigned int seq = (frame[2]<<24)|(frame[3]<<16)|(frame[4]<<8)|frame[5];
+	frameData(seq,ref);
+	if( seq<vu.expect || len!=vu.size || memcmp(frame,ref,len) ) ++vu.bad; // a gap is a frame lost in the buffer
+	vu.expect = seq+1;
+	++vu.delivered;
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// VU-E receiver commands
+
+driver_error_t isis_vu_e__get_frame_count(uint8_t index, uint16_t* frame_count_out) {
+	*frame_count_out = vu.count;
+	command(2);
+	return driver_error_none;
+}
+
+driver_error_t isis_vu_e__get_frame_count_length_variable(uint8_t index, isis_vu_e__get_frame_count_length__from_t* response, size_t p_frame_length_length) {
+	unsigned int i;
+	response->frames_nb = vu.count;
+	for(i=0; i<p_frame_length_length; ++i) response->p_frame_length[i] = i<vu.count ? vu.size : 0;
+	command(2+2*p_frame_length_length);
+	return driver_error_none;
+}
+
+driver_error_t isis_vu_e__get_frame_variable(uint8_t index, isis_vu_e__get_frame__from_t* response, size_t data_length) {
+	unsigned char data[TRXVU_FRAME_MAX];
+	response->length = vu.count ? vu.size : 0;
+	response->doppler = response->rssi = 0;
+	if( vu.count ) {
+		frameData(vu.seq[vu.head],data);
+		memcpy(response->data,data,vu.size<data_length ? vu.size : data_length);
+	}
+	command(6+data_length);
+	return driver_error_none;
+}
+
+driver_error_t isis_vu_e__get_full_frame_variable(uint8_t index, isis_vu_e__get_full_frame__from_t* response, size_t data_length) {
+	unsigned char full[TRXVU_AX25_HDR+TRXVU_FRAME_MAX];
+	unsigned int len = TRXVU_AX25_HDR+vu.size;
+	response->length = vu.count ? len+2 : 0; // with the FCS
+	response->doppler = response->rssi = 0;
+	if( vu.count ) {
+		memset(full,'A',TRXVU_AX25_HDR);
+		frameData(vu.seq[vu.head],full+TRXVU_AX25_HDR);
+		memcpy(response->data,full,len<data_length ? len : data_length);
+	}
+	command(6+data_length);
+	return driver_error_none;
+}
+
+driver_error_t isis_vu_e__remove_frame(uint8_t index) {
+	unsigned long long w;
+	command(0);
+	if( ! vu.count ) return driver_error_none;
+	w = now-vu.arrived[vu.head];
+	vu.waitSum += w;
+	if( w>vu.waitMax ) vu.waitMax = w;
+	vu.head = (vu.head+1)%RX_FRAMES;
+	--vu.count;
+	++vu.removed;
+	if( ! vu.count ) {
+		vu.dropping = 1;
+		vu.dropAt = now+FR_DROP_US;
+	}
+	return driver_error_none;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int run(unsigned int rate, unsigned int size, char polling) {
+	TrxvuManagerReport rep;
+	unsigned long long start, end;
+	char woken;
+	memset(&vu,0,sizeof(vu));
+	vu.rate = rate;
+	vu.size = size;
+	vu.expect = 1;
+	vu.nextArrival = now+1000000/rate;
+	TrxvuManagerSetPolling(polling);
+	start = now;
+	end = now+SIM_SECS*1000000ULL;
+	while( now<end ) {
+		// the waits of TrxvuRxTask
+		if( polling ) {
+			delayTicks(TRXVU_RX_POLL_TICKS);
+			woken = 0;
+		} else {
+			advanceTo((now/1000+TRXVU_RX_IDLE_TICKS)*1000,1);
+			woken = vu.wake;
+			vu.wake = 0;
+			if( woken ) advance(IRQ_US);
+		}
+		TrxvuRxPass(polling,woken);
+		if( ! polling ) {
+			delayTicks(TRXVU_FR_SETTLE_TICKS);
+			if( vu.line ) vu.wake = 1;
+		}
+	}
+	TrxvuManagerGet(&rep);
+	printf("%-9s %4u/s  delivered %5.1f/s lost %5u  i2c/frame %u.%02u cmds %4u bytes  latency avg %6.2fms max %7.2fms  bus %4.1f%%  drains %5u idle %2u maxBurst %2u",
+			 polling ? "polling" : "interrupt",rate,(double)rep.frames/SIM_SECS,vu.lost,rep.commandsPerFrame100/100,rep.commandsPerFrame100%100,
+			 rep.bytesPerFrame,rep.latencyUs/1000.0,rep.maxLatencyUs/1000.0,100.0*vu.busUs/(now-start),rep.drains,rep.idleDrains,rep.maxBurst);
+	// the counters of TrxvuManager.c against what the receiver saw
+	if( vu.bad || rep.dropped || rep.i2cErrors || vu.delivered!=vu.removed || rep.frames!=vu.removed ||
+		 rep.i2cCommands!=vu.cmds || rep.i2cBytes!=vu.bytes ) {
+		printf("  WRONG (bad=%u dropped=%u delivered=%u removed=%u cmds=%u/%u bytes=%u/%u)\n",
+				 vu.bad,rep.dropped,vu.delivered,vu.removed,rep.i2cCommands,vu.cmds,rep.i2cBytes,vu.bytes);
+		return 1;
+	}
+	printf("  ok\n");
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	static const unsigned int rates[] = { 1, 5, 20, 50, 100, 150 };
+	unsigned int size = argc>1 ? atoi(argv[1]) : 70, i;
+	int fail = 0;
+	if( size<6 || size>TRXVU_FRAME_MAX ) { fprintf(stderr,"data bytes 6..%u\n",TRXVU_FRAME_MAX); return 1; }
+	printf("%u byte frames, I2C %u Hz, %u secs each\n",size,I2C_BUS_SPEED,SIM_SECS);
+	for(i=0; i<sizeof(rates)/sizeof(rates[0]); ++i) {
+		fail |= run(rates[i],size,0);
+		fail |= run(rates[i],size,1);
+	}
+	return fail;
+}
+
+#endif